@@ -0,0 +1,248 @@
+#include "Benchmark.h"
+#include "CameraPath.h"
+
+#include <nlohmann/json.hpp>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+bool Benchmark::run(Renderer& renderer, const char* cameraPath, uint32_t frames)
+{
+    CameraPath path;
+    if (!path.load(cameraPath))
+        return false;
+
+    m_cameraPath = cameraPath;
+    m_deviceName = renderer.m_gfxDevice.m_props.deviceName;
+    m_samples.assign(frames, Sample());
+
+    // restart from tick 0 and step once per frame on the render thread, independently of frame times
+    Simulation& simulation = renderer.m_simulation;
+    simulation.stop();
+    simulation.setCameraPath(path);
+    simulation.setLockstep(true);
+    simulation.init(renderer.m_camera, renderer.m_sunDirection, renderer.m_animations);
+
+    uint64_t firstFrame = renderer.m_frameIndex;
+
+    printf("Benchmark: %d frames along %s (%.2f sec of simulated time, path is %.2f sec)\n", int(frames), cameraPath, frames * Simulation::TICK_SECONDS, path.getDuration());
+
+    // GPU results of a frame are read back when its frame slot is reused, so keep rendering until the last sampled frame is read
+    for (uint32_t frame = 0; frame < frames + FRAMES_COUNT; ++frame)
+    {
+        if (!renderer.m_gfxDevice.m_headless && shouldQuit(renderer.m_gfxDevice))
+        {
+            printf("Benchmark: window closed after %d frames\n", int(frame));
+            return false;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        renderer.draw();
+
+        double cpuTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        if (frame < frames)
+        {
+            m_samples[frame].cpuTime = cpuTime;
+            m_samples[frame].recordTime = renderer.m_recordCpuTime;
+        }
+
+        const GpuFrameStats& gpu = renderer.m_gpuStats;
+        if (gpu.valid && gpu.frameIndex >= firstFrame && gpu.frameIndex < firstFrame + frames)
+            m_samples[gpu.frameIndex - firstFrame].gpu = gpu;
+    }
+
+    m_passes.clear();
+    for (const GpuProfiler::Timing& timing : renderer.m_profiler.getTimings())
+        m_passes.push_back(timing.name);
+
+    return true;
+}
+
+Benchmark::Summary Benchmark::summarize(std::vector<double> values)
+{
+    Summary summary = {};
+    if (values.empty())
+        return summary;
+
+    std::sort(values.begin(), values.end());
+
+    // nearest rank: the smallest value that at least p of the samples don't exceed
+    auto percentile = [&](double p) { return values[std::max(size_t(ceil(p * double(values.size()))), size_t(1)) - 1]; };
+
+    double total = 0;
+    for (double value : values)
+        total += value;
+
+    summary.avg = total / double(values.size());
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    summary.max = values.back();
+
+    return summary;
+}
+
+static std::vector<double> collect(const std::vector<Benchmark::Sample>& samples, double (*get)(const Benchmark::Sample&))
+{
+    std::vector<double> values;
+    values.reserve(samples.size());
+
+    for (const Benchmark::Sample& sample : samples)
+        values.push_back(get(sample));
+
+    return values;
+}
+
+// GPU columns skip frames whose queries never completed, instead of counting them as 0
+static std::vector<double> collectGpu(const std::vector<Benchmark::Sample>& samples, double (*get)(const GpuFrameStats&, const char*), const char* pass = nullptr)
+{
+    std::vector<double> values;
+    values.reserve(samples.size());
+
+    for (const Benchmark::Sample& sample : samples)
+        if (sample.gpu.valid)
+            values.push_back(get(sample.gpu, pass));
+
+    return values;
+}
+
+static double getCpuTime(const Benchmark::Sample& sample) { return sample.cpuTime; }
+static double getRecordTime(const Benchmark::Sample& sample) { return sample.recordTime; }
+static double getGpuTime(const GpuFrameStats& gpu, const char*) { return gpu.frameTime; }
+static double getTriangles(const GpuFrameStats& gpu, const char*) { return double(gpu.triangles); }
+
+// passes that didn't run in a frame count as 0
+static double getPassTime(const GpuFrameStats& gpu, const char* pass)
+{
+    double time = 0;
+    for (const GpuProfiler::Result& result : gpu.passTimes)
+        if (strcmp(result.name, pass) == 0)
+            time += result.time;
+
+    return time;
+}
+
+void Benchmark::print() const
+{
+    auto line = [](const char* name, const Summary& s) { printf("  %-16s avg %8.3f  p50 %8.3f  p95 %8.3f  p99 %8.3f  max %8.3f\n", name, s.avg, s.p50, s.p95, s.p99, s.max); };
+
+    printf("Benchmark results on %s, %d frames (ms):\n", m_deviceName.c_str(), int(m_samples.size()));
+
+    line("cpu", summarize(collect(m_samples, getCpuTime)));
+    line("record", summarize(collect(m_samples, getRecordTime)));
+    line("gpu", summarize(collectGpu(m_samples, getGpuTime)));
+
+    for (const std::string& pass : m_passes)
+        line(pass.c_str(), summarize(collectGpu(m_samples, getPassTime, pass.c_str())));
+
+    Summary triangles = summarize(collectGpu(m_samples, getTriangles));
+    printf("  triangles        avg %.2fM  p50 %.2fM  max %.2fM\n", triangles.avg * 1e-6, triangles.p50 * 1e-6, triangles.max * 1e-6);
+}
+
+bool Benchmark::writeCsv(const char* path) const
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        printf("Error: can't write benchmark results to %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "frame,cpu_ms,record_ms,gpu_valid,gpu_ms");
+    for (const std::string& pass : m_passes)
+        fprintf(file, ",%s_ms", pass.c_str());
+    fprintf(file, ",triangles");
+    for (uint32_t pass = 0; pass < RENDER_PASS_COUNT; ++pass)
+        fprintf(file, ",%s_task,%s_mesh,%s_triangles,%s_fragments", RENDER_PASS_NAMES[pass], RENDER_PASS_NAMES[pass], RENDER_PASS_NAMES[pass], RENDER_PASS_NAMES[pass]);
+    fprintf(file, "\n");
+
+    for (size_t frame = 0; frame < m_samples.size(); ++frame)
+    {
+        const Sample& sample = m_samples[frame];
+
+        fprintf(file, "%d,%.4f,%.4f,%d,%.4f", int(frame), sample.cpuTime, sample.recordTime, sample.gpu.valid ? 1 : 0, sample.gpu.frameTime);
+        for (const std::string& pass : m_passes)
+            fprintf(file, ",%.4f", getPassTime(sample.gpu, pass.c_str()));
+        fprintf(file, ",%llu", (unsigned long long)sample.gpu.triangles);
+        for (const PipelineStats& stats : sample.gpu.passStats)
+            fprintf(file, ",%llu,%llu,%llu,%llu", (unsigned long long)stats.taskInvocations, (unsigned long long)stats.meshInvocations, (unsigned long long)stats.clippingInvocations, (unsigned long long)stats.fragmentInvocations);
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+
+    printf("Benchmark: wrote %d frames to %s\n", int(m_samples.size()), path);
+    return true;
+}
+
+static nlohmann::json toJson(const Benchmark::Summary& summary)
+{
+    return { { "avg", summary.avg }, { "p50", summary.p50 }, { "p95", summary.p95 }, { "p99", summary.p99 }, { "max", summary.max } };
+}
+
+bool Benchmark::writeJson(const char* path) const
+{
+    nlohmann::json summary;
+    summary["cpu_ms"] = toJson(summarize(collect(m_samples, getCpuTime)));
+    summary["record_ms"] = toJson(summarize(collect(m_samples, getRecordTime)));
+    summary["gpu_ms"] = toJson(summarize(collectGpu(m_samples, getGpuTime)));
+    summary["triangles"] = toJson(summarize(collectGpu(m_samples, getTriangles)));
+
+    for (const std::string& pass : m_passes)
+        summary["passes_ms"][pass] = toJson(summarize(collectGpu(m_samples, getPassTime, pass.c_str())));
+
+    nlohmann::json frames = nlohmann::json::array();
+    for (const Sample& sample : m_samples)
+    {
+        nlohmann::json frame;
+        frame["cpu_ms"] = sample.cpuTime;
+        frame["record_ms"] = sample.recordTime;
+
+        if (sample.gpu.valid)
+        {
+            frame["gpu_ms"] = sample.gpu.frameTime;
+            std::vector<double> passTimes;
+            for (const std::string& pass : m_passes)
+                passTimes.push_back(getPassTime(sample.gpu, pass.c_str()));
+
+            frame["passes_ms"] = passTimes;
+            frame["triangles"] = sample.gpu.triangles;
+
+            for (uint32_t pass = 0; pass < RENDER_PASS_COUNT; ++pass)
+            {
+                const PipelineStats& stats = sample.gpu.passStats[pass];
+                if (stats.valid)
+                    frame["pipeline"][RENDER_PASS_NAMES[pass]] = { { "task", stats.taskInvocations }, { "mesh", stats.meshInvocations }, { "triangles", stats.clippingInvocations }, { "clipped", stats.clippingPrimitives }, { "fragments", stats.fragmentInvocations } };
+            }
+        }
+
+        frames.push_back(std::move(frame));
+    }
+
+    nlohmann::json document;
+    document["device"] = m_deviceName;
+    document["cameraPath"] = m_cameraPath;
+    document["tickSeconds"] = Simulation::TICK_SECONDS;
+    document["passes"] = m_passes;
+    document["summary"] = summary;
+    document["frames"] = frames;
+
+    std::ofstream file(path);
+    if (!file)
+    {
+        printf("Error: can't write benchmark results to %s\n", path);
+        return false;
+    }
+
+    file << document.dump(2) << "\n";
+
+    printf("Benchmark: wrote %d frames to %s\n", int(m_samples.size()), path);
+    return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Renderer.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Renders a fixed number of frames along a recorded camera path and collects per-frame timings
+ * The simulation runs in lockstep with rendering, so frame N of every run shows the same view
+ * and results of different builds can be compared frame by frame
+ */
+class Benchmark
+{
+public:
+    struct Sample
+    {
+        double cpuTime; // milliseconds spent in Renderer::draw
+        double recordTime; // milliseconds of cpuTime spent recording the frame graph
+        GpuFrameStats gpu; // invalid when the frame's queries didn't complete
+    };
+
+    /**
+     * Distribution of one value over all frames of a run
+     */
+    struct Summary
+    {
+        double avg;
+        double p50;
+        double p95;
+        double p99;
+        double max;
+    };
+
+    /**
+     * Plays the camera path with the renderer and records one sample per frame
+     * Stops the renderer's simulation thread and restarts the simulation from tick 0
+     *
+     * @param renderer Initialized renderer; stays usable afterwards, but its simulation keeps following the path
+     * @param cameraPath Path to the camera path JSON file
+     * @param frames Number of frames to sample
+     * @return False if the camera path can't be loaded or the window was closed during the run
+     */
+    bool run(Renderer& renderer, const char* cameraPath, uint32_t frames);
+
+    /**
+     * Prints the summary of the last run
+     */
+    void print() const;
+
+    /**
+     * Writes one row per frame with CPU time, GPU frame and pass times, and per render pass pipeline statistics
+     *
+     * @param path Output file path
+     * @return False if the file can't be written
+     */
+    bool writeCsv(const char* path) const;
+
+    /**
+     * Writes the summary of every column followed by the per-frame samples
+     *
+     * @param path Output file path
+     * @return False if the file can't be written
+     */
+    bool writeJson(const char* path) const;
+
+    /**
+     * Computes average and nearest-rank percentiles
+     */
+    static Summary summarize(std::vector<double> values);
+
+private:
+    std::string m_cameraPath;
+    std::string m_deviceName;
+    std::vector<std::string> m_passes; // every pass the profiler timed during the run
+    std::vector<Sample> m_samples;
+};
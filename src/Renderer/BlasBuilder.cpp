@@ -0,0 +1,335 @@
+#include "BlasBuilder.h"
+#include "GfxDevice.h"
+#include "../Utils/Profile.hpp"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+// required by spec for acceleration structures, could be smaller for scratch but it's a small waste
+static const size_t ACCELERATION_ALIGNMENT = 256;
+// batches are sized to fill this much scratch, unless a single BLAS needs more
+static const size_t DEFAULT_SCRATCH_SIZE = 32 * 1024 * 1024;
+
+static size_t alignAcceleration(size_t size)
+{
+    return (size + ACCELERATION_ALIGNMENT - 1) & ~(ACCELERATION_ALIGNMENT - 1);
+}
+
+static VkDeviceAddress getAccelerationAddress(VkDevice device, VkAccelerationStructureKHR blas)
+{
+    VkAccelerationStructureDeviceAddressInfoKHR info = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
+    info.accelerationStructure = blas;
+
+    return vkGetAccelerationStructureDeviceAddressKHR(device, &info);
+}
+
+void BlasBuilder::init(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, const std::vector<Mesh>& meshes, const std::vector<BlasLod>& lods, const Buffer& vb, const Buffer& ib)
+{
+    PROFILE_ZONE();
+
+    m_memoryProperties = memoryProperties;
+
+    size_t count = lods.size();
+
+    m_geometries.assign(count, {});
+    m_buildInfos.assign(count, {});
+    m_buildRanges.assign(count, {});
+    m_offsets.assign(count, 0);
+    m_sizes.assign(count, 0);
+    m_scratchOffsets.assign(count, 0);
+
+    m_blas.assign(count, nullptr);
+    m_addresses.assign(count, 0);
+    m_compactedSizes.assign(count, 0);
+
+    std::vector<size_t> scratchSizes(count);
+
+    size_t totalSize = 0;
+    size_t totalPrimitiveCount = 0;
+    size_t maxScratchSize = 0;
+
+    VkDeviceAddress vbAddress = getBufferAddress(vb, device);
+    VkDeviceAddress ibAddress = getBufferAddress(ib, device);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Mesh& mesh = meshes[lods[i].meshIndex];
+        const MeshLod& lod = mesh.lods[lods[i].lodIndex];
+        assert(lods[i].lodIndex < mesh.lodCount);
+
+        VkAccelerationStructureGeometryKHR& geometry = m_geometries[i];
+        VkAccelerationStructureBuildGeometryInfoKHR& buildInfo = m_buildInfos[i];
+
+        m_buildRanges[i].primitiveCount = lod.indexCount / 3;
+
+        static_assert(offsetof(Vertex, vz) == offsetof(Vertex, vx) + sizeof(uint16_t) * 2, "Vertex layout mismatch");
+
+        geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+        geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+        geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+        geometry.geometry.triangles.vertexFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+        geometry.geometry.triangles.vertexData.deviceAddress = vbAddress + mesh.vertexOffset * sizeof(Vertex);
+        geometry.geometry.triangles.vertexStride = sizeof(Vertex);
+        geometry.geometry.triangles.maxVertex = mesh.vertexCount - 1;
+        geometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
+        geometry.geometry.triangles.indexData.deviceAddress = ibAddress + lod.indexOffset * sizeof(uint32_t);
+
+        buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+        buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+        buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        buildInfo.geometryCount = 1;
+        buildInfo.pGeometries = &geometry;
+
+        VkAccelerationStructureBuildSizesInfoKHR sizeInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+        vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &m_buildRanges[i].primitiveCount, &sizeInfo);
+
+        m_sizes[i] = sizeInfo.accelerationStructureSize;
+        scratchSizes[i] = sizeInfo.buildScratchSize;
+
+        totalSize = alignAcceleration(totalSize + sizeInfo.accelerationStructureSize);
+        totalPrimitiveCount += m_buildRanges[i].primitiveCount;
+        maxScratchSize = std::max(maxScratchSize, size_t(sizeInfo.buildScratchSize));
+    }
+
+    m_batches.clear();
+    m_nextBatch = 0;
+    m_compactedBatches = 0;
+    m_frames = 0;
+
+    if (count == 0)
+        return;
+
+    createBuffer(m_scratch, device, memoryProperties, std::max(DEFAULT_SCRATCH_SIZE, maxScratchSize), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // consecutive BLASes whose scratch memory fits at once
+    for (uint32_t begin = 0; begin < count;)
+    {
+        Batch batch;
+        batch.begin = begin;
+
+        size_t scratchOffset = 0;
+        uint32_t end = begin;
+
+        while (end < count && scratchOffset + scratchSizes[end] <= m_scratch.size)
+        {
+            m_scratchOffsets[end] = scratchOffset;
+            m_offsets[end] = batch.size;
+
+            scratchOffset = alignAcceleration(scratchOffset + scratchSizes[end]);
+            batch.size = alignAcceleration(batch.size + m_sizes[end]);
+            end++;
+        }
+        assert(end > begin); // guaranteed as m_scratch.size >= maxScratchSize
+
+        batch.end = end;
+        m_batches.push_back(batch);
+
+        begin = end;
+    }
+
+    m_queryPool = createQueryPool(device, uint32_t(count), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR);
+    m_startTime = std::chrono::high_resolution_clock::now();
+
+    printf("BLAS accelerationStructureSize: %.2f MB in %u batches, scratchSize: %.2f MB (max %.2f MB), %.3fM triangles\n", double(totalSize) / 1e6, uint32_t(m_batches.size()), double(m_scratch.size) / 1e6, double(maxScratchSize) / 1e6, double(totalPrimitiveCount) / 1e6);
+}
+
+void BlasBuilder::destroy(VkDevice device)
+{
+    for (VkAccelerationStructureKHR blas : m_blas)
+        if (blas)
+            vkDestroyAccelerationStructureKHR(device, blas, nullptr);
+
+    for (const Batch& batch : m_batches)
+        if (batch.buffer.buffer)
+            destroyBuffer(batch.buffer, device);
+
+    for (const Retired& retired : m_retired)
+    {
+        for (VkAccelerationStructureKHR blas : retired.blas)
+            vkDestroyAccelerationStructureKHR(device, blas, nullptr);
+
+        destroyBuffer(retired.buffer, device);
+    }
+
+    if (m_scratch.buffer)
+        destroyBuffer(m_scratch, device);
+
+    if (m_queryPool)
+        vkDestroyQueryPool(device, m_queryPool, nullptr);
+
+    m_blas.clear();
+    m_addresses.clear();
+    m_batches.clear();
+    m_retired.clear();
+    m_scratch = {};
+    m_queryPool = nullptr;
+}
+
+bool BlasBuilder::update(VkDevice device, VkCommandBuffer commandBuffer, uint64_t completedValue, uint64_t submitValue, std::vector<uint32_t>& changed)
+{
+    // uncompacted BLASes are only referenced by TLASes of frames that completed
+    for (size_t i = 0; i < m_retired.size();)
+    {
+        if (m_retired[i].value > completedValue)
+        {
+            ++i;
+            continue;
+        }
+
+        for (VkAccelerationStructureKHR blas : m_retired[i].blas)
+            vkDestroyAccelerationStructureKHR(device, blas, nullptr);
+
+        destroyBuffer(m_retired[i].buffer, device);
+
+        m_retired[i] = std::move(m_retired.back());
+        m_retired.pop_back();
+    }
+
+    if (m_compactedBatches == m_batches.size())
+        return false;
+
+    PROFILE_ZONE();
+
+    // earlier frames built the BLASes compacted below, with the same scratch memory
+    stageBarrier(commandBuffer, VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR);
+
+    for (Batch& batch : m_batches)
+    {
+        if (batch.state != Batch_Building || batch.value > completedValue)
+            continue;
+
+        recordCompaction(device, commandBuffer, batch, submitValue);
+
+        batch.state = Batch_Compacted;
+        m_compactedBatches++;
+
+        for (uint32_t i = batch.begin; i < batch.end; ++i)
+            changed.push_back(i);
+    }
+
+    bool built = false;
+
+    for (uint32_t i = 0; i < MAX_BUILDS_PER_FRAME && m_nextBatch < m_batches.size(); ++i)
+    {
+        Batch& batch = m_batches[m_nextBatch++];
+
+        if (i)
+            stageBarrier(commandBuffer, VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR);
+
+        recordBuild(device, commandBuffer, batch);
+
+        batch.state = Batch_Building;
+        batch.value = submitValue;
+        built = true;
+
+        for (uint32_t j = batch.begin; j < batch.end; ++j)
+            changed.push_back(j);
+    }
+
+    // TLAS builds and ray queries later in the frame read the new BLASes
+    stageBarrier(commandBuffer, VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+
+    m_frames++;
+
+    if (m_compactedBatches == m_batches.size())
+    {
+        // every build completed before its batch was compacted, so the GPU is done with scratch memory and queries
+        destroyBuffer(m_scratch, device);
+        vkDestroyQueryPool(device, m_queryPool, nullptr);
+        m_scratch = {};
+        m_queryPool = nullptr;
+
+        size_t compactedSize = 0;
+        for (const Batch& batch : m_batches)
+            compactedSize += batch.buffer.size;
+
+        double time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_startTime).count();
+
+        printf("BLAS compacted accelerationStructureSize: %.2f MB, built and compacted over %u frames in %.1f ms\n", double(compactedSize) / 1e6, m_frames, time);
+    }
+
+    return built;
+}
+
+void BlasBuilder::recordBuild(VkDevice device, VkCommandBuffer commandBuffer, Batch& batch)
+{
+    createBuffer(batch.buffer, device, m_memoryProperties, batch.size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkDeviceAddress scratchAddress = getBufferAddress(m_scratch, device);
+
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangePtrs(batch.end - batch.begin);
+
+    for (uint32_t i = batch.begin; i < batch.end; ++i)
+    {
+        VkAccelerationStructureCreateInfoKHR accelerationInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+        accelerationInfo.buffer = batch.buffer.buffer;
+        accelerationInfo.offset = m_offsets[i];
+        accelerationInfo.size = m_sizes[i];
+        accelerationInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+
+        VK_CHECK(vkCreateAccelerationStructureKHR(device, &accelerationInfo, nullptr, &m_blas[i]));
+
+        m_buildInfos[i].dstAccelerationStructure = m_blas[i];
+        m_buildInfos[i].scratchData.deviceAddress = scratchAddress + m_scratchOffsets[i];
+        buildRangePtrs[i - batch.begin] = &m_buildRanges[i];
+
+        m_addresses[i] = getAccelerationAddress(device, m_blas[i]);
+    }
+
+    uint32_t count = batch.end - batch.begin;
+
+    vkCmdBuildAccelerationStructuresKHR(commandBuffer, count, &m_buildInfos[batch.begin], buildRangePtrs.data());
+
+    // compacted sizes are written once the builds are done
+    stageBarrier(commandBuffer, VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR);
+
+    vkCmdResetQueryPool(commandBuffer, m_queryPool, batch.begin, count);
+    vkCmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, count, &m_blas[batch.begin], VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, m_queryPool, batch.begin);
+}
+
+void BlasBuilder::recordCompaction(VkDevice device, VkCommandBuffer commandBuffer, Batch& batch, uint64_t submitValue)
+{
+    uint32_t count = batch.end - batch.begin;
+
+    // the timeline passed the submit that wrote them, so results are available without waiting
+    VK_CHECK(vkGetQueryPoolResults(device, m_queryPool, batch.begin, count, count * sizeof(VkDeviceSize), &m_compactedSizes[batch.begin], sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT));
+
+    // TLASes of frames before this one may still reference the uncompacted BLASes
+    Retired retired = { submitValue, batch.buffer, std::vector<VkAccelerationStructureKHR>(m_blas.begin() + batch.begin, m_blas.begin() + batch.end) };
+    m_retired.push_back(std::move(retired));
+
+    size_t compactedSize = 0;
+    for (uint32_t i = batch.begin; i < batch.end; ++i)
+    {
+        m_offsets[i] = compactedSize;
+        compactedSize = alignAcceleration(compactedSize + m_compactedSizes[i]);
+    }
+
+    createBuffer(batch.buffer, device, m_memoryProperties, compactedSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    for (uint32_t i = batch.begin; i < batch.end; ++i)
+    {
+        VkAccelerationStructureCreateInfoKHR accelerationInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+        accelerationInfo.buffer = batch.buffer.buffer;
+        accelerationInfo.offset = m_offsets[i];
+        accelerationInfo.size = m_compactedSizes[i];
+        accelerationInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+
+        VkAccelerationStructureKHR compacted = nullptr;
+        VK_CHECK(vkCreateAccelerationStructureKHR(device, &accelerationInfo, nullptr, &compacted));
+
+        VkCopyAccelerationStructureInfoKHR copyInfo = { VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
+        copyInfo.src = m_blas[i];
+        copyInfo.dst = compacted;
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+
+        vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+
+        m_blas[i] = compacted;
+        m_addresses[i] = getAccelerationAddress(device, compacted);
+    }
+}
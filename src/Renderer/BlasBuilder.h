@@ -0,0 +1,110 @@
+#pragma once
+
+#include "GfxTypes.h"
+#include "niagara/resources.h"
+#include "niagara/scenert.h"
+
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+/**
+ * Builds and compacts BLASes over several frames instead of blocking on load
+ * BLASes are split into batches whose builds fit the scratch buffer. Every frame records the build of the next batch
+ * and compacted size queries into the frame prologue; BLASes are usable right after, through a barrier in the same
+ * command buffer. Once a later frame finds the timeline past a batch's build, its query results are available without
+ * waiting, and the frame records copies into compacted BLASes and switches to them. Uncompacted BLASes are destroyed
+ * once the frames that may still trace them have completed. Nothing waits on the GPU, so frames render with partial or
+ * no ray tracing geometry until every batch is done
+ */
+class BlasBuilder
+{
+public:
+    // batches whose builds are recorded per frame; every batch fills the scratch buffer at most
+    static const uint32_t MAX_BUILDS_PER_FRAME = 1;
+
+    /**
+     * Computes build sizes and splits BLASes into batches; nothing is recorded yet
+     *
+     * @param lods Geometry of every BLAS, in the order of getAddresses
+     * @param vb Vertex buffer; it and ib have to stay alive until isCompacted
+     */
+    void init(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, const std::vector<Mesh>& meshes, const std::vector<BlasLod>& lods, const Buffer& vb, const Buffer& ib);
+
+    /**
+     * Destroys every BLAS and the buffers behind them; the GPU must be done with them
+     */
+    void destroy(VkDevice device);
+
+    /**
+     * Records the next batch's build and copies into compacted BLASes of batches whose build completed
+     * BLASes are ready for TLAS builds recorded after this into the same command buffer
+     *
+     * @param commandBuffer Frame prologue command buffer
+     * @param completedValue Timeline value the GPU has reached
+     * @param submitValue Timeline value the frame's submit signals
+     * @param changed Receives BLASes whose address changed, because they were built or compacted
+     * @return True if a BLAS was built, so instances referencing it become active
+     */
+    bool update(VkDevice device, VkCommandBuffer commandBuffer, uint64_t completedValue, uint64_t submitValue, std::vector<uint32_t>& changed);
+
+    // addresses are 0 until the BLAS is built
+    const std::vector<VkDeviceAddress>& getAddresses() const { return m_addresses; }
+    // 0 until the BLAS is compacted
+    const std::vector<VkDeviceSize>& getCompactedSizes() const { return m_compactedSizes; }
+
+    uint32_t getCount() const { return uint32_t(m_addresses.size()); }
+    // every BLAS is compacted; uncompacted ones may still wait for frames in flight
+    bool isCompacted() const { return m_compactedBatches == m_batches.size(); }
+
+private:
+    enum BatchState
+    {
+        Batch_Pending,
+        Batch_Building, // recorded; compacted sizes are available once the timeline reaches value
+        Batch_Compacted,
+    };
+
+    struct Batch
+    {
+        uint32_t begin, end; // BLASes of the batch
+        BatchState state = Batch_Pending;
+        uint64_t value = 0;
+        size_t size = 0; // bytes before compaction
+        Buffer buffer = {}; // uncompacted BLASes, then compacted BLASes
+    };
+
+    struct Retired
+    {
+        uint64_t value;
+        Buffer buffer;
+        std::vector<VkAccelerationStructureKHR> blas;
+    };
+
+    void recordBuild(VkDevice device, VkCommandBuffer commandBuffer, Batch& batch);
+    void recordCompaction(VkDevice device, VkCommandBuffer commandBuffer, Batch& batch, uint64_t submitValue);
+
+    VkPhysicalDeviceMemoryProperties m_memoryProperties = {};
+
+    std::vector<VkAccelerationStructureGeometryKHR> m_geometries;
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> m_buildInfos;
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> m_buildRanges;
+    std::vector<size_t> m_offsets; // within the batch buffer; uncompacted, then compacted
+    std::vector<size_t> m_sizes;
+    std::vector<size_t> m_scratchOffsets;
+
+    std::vector<VkAccelerationStructureKHR> m_blas;
+    std::vector<VkDeviceAddress> m_addresses;
+    std::vector<VkDeviceSize> m_compactedSizes;
+
+    std::vector<Batch> m_batches;
+    size_t m_nextBatch = 0;
+    size_t m_compactedBatches = 0;
+    std::vector<Retired> m_retired;
+
+    Buffer m_scratch = {};
+    VkQueryPool m_queryPool = nullptr;
+
+    std::chrono::high_resolution_clock::time_point m_startTime;
+    uint32_t m_frames = 0; // frames that recorded work
+};
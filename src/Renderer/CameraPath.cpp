@@ -0,0 +1,122 @@
+#include "CameraPath.h"
+#include "Camera.h"
+
+#include <nlohmann/json.hpp>
+
+#include <glm/trigonometric.hpp>
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>
+
+bool CameraPath::load(const char* path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        printf("Error: camera path %s not found\n", path);
+        return false;
+    }
+
+    nlohmann::json document = nlohmann::json::parse(file, nullptr, /* allow_exceptions= */ false);
+    if (document.is_discarded() || !document.contains("keyframes") || !document["keyframes"].is_array())
+    {
+        printf("Error: camera path %s is not a valid JSON file with a keyframes array\n", path);
+        return false;
+    }
+
+    std::vector<Keyframe> keyframes;
+
+    // get<float> throws on anything but numbers, so every value is checked upfront
+    auto isNumbers = [](const nlohmann::json& value, size_t count)
+    {
+        if (!value.is_array() || value.size() != count)
+            return false;
+
+        for (const nlohmann::json& element : value)
+            if (!element.is_number())
+                return false;
+
+        return true;
+    };
+
+    for (const nlohmann::json& entry : document["keyframes"])
+    {
+        if (!entry.is_object() || !entry.contains("time") || !entry["time"].is_number() ||
+            !isNumbers(entry.value("position", nlohmann::json()), 3) || !isNumbers(entry.value("orientation", nlohmann::json()), 4))
+        {
+            printf("Error: camera path %s has a keyframe without numeric time, position[3] or orientation[4]\n", path);
+            return false;
+        }
+
+        const nlohmann::json& position = entry["position"];
+        const nlohmann::json& orientation = entry["orientation"];
+
+        Keyframe keyframe = {};
+        keyframe.time = entry["time"].get<float>();
+        keyframe.position = vec3(position[0].get<float>(), position[1].get<float>(), position[2].get<float>());
+        keyframe.orientation = normalize(quat(orientation[3].get<float>(), orientation[0].get<float>(), orientation[1].get<float>(), orientation[2].get<float>()));
+
+        if (!keyframes.empty() && keyframe.time <= keyframes.back().time)
+        {
+            printf("Error: camera path %s keyframe times must increase\n", path);
+            return false;
+        }
+
+        keyframes.push_back(keyframe);
+    }
+
+    if (keyframes.size() < 2)
+    {
+        printf("Error: camera path %s needs at least two keyframes\n", path);
+        return false;
+    }
+
+    if ((document.contains("fovY") && !document["fovY"].is_number()) || (document.contains("loop") && !document["loop"].is_boolean()))
+    {
+        printf("Error: camera path %s fovY must be a number and loop a boolean\n", path);
+        return false;
+    }
+
+    m_keyframes = std::move(keyframes);
+    m_fovY = glm::radians(document.value("fovY", 0.f));
+    m_loop = document.value("loop", false);
+
+    printf("Loaded camera path %s: %d keyframes, %.2f sec\n", path, int(m_keyframes.size()), getDuration());
+    return true;
+}
+
+void CameraPath::apply(Camera& camera, double time) const
+{
+    assert(m_keyframes.size() >= 2);
+
+    float duration = getDuration();
+    float t = m_keyframes.front().time + (m_loop ? float(fmod(time, double(duration))) : std::min(float(time), duration));
+
+    // segment i spans keyframes i and i+1
+    size_t count = m_keyframes.size();
+    size_t i = 0;
+    while (i + 2 < count && m_keyframes[i + 1].time <= t)
+        i++;
+
+    const Keyframe& k1 = m_keyframes[i];
+    const Keyframe& k2 = m_keyframes[i + 1];
+    const Keyframe& k0 = m_keyframes[i > 0 ? i - 1 : i];
+    const Keyframe& k3 = m_keyframes[i + 2 < count ? i + 2 : i + 1];
+
+    float s = std::clamp((t - k1.time) / (k2.time - k1.time), 0.f, 1.f);
+    float s2 = s * s;
+    float s3 = s2 * s;
+
+    // uniform Catmull-Rom; end segments reuse the end points as outer control points
+    vec3 position = 0.5f * ((2.f * k1.position) + (k2.position - k0.position) * s + (2.f * k0.position - 5.f * k1.position + 4.f * k2.position - k3.position) * s2 + (3.f * k1.position - k0.position - 3.f * k2.position + k3.position) * s3);
+
+    camera.setPosition(position);
+    camera.setOrientation(glm::slerp(k1.orientation, k2.orientation, s));
+
+    if (m_fovY > 0.f)
+        camera.setFovY(m_fovY);
+}
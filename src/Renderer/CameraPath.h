@@ -0,0 +1,54 @@
+#pragma once
+
+#include "niagara/math.h"
+
+#include <vector>
+
+class Camera;
+
+/**
+ * Recorded camera flight used to make runs reproducible
+ * Positions follow a Catmull-Rom spline through the keyframes and orientations are slerped,
+ * so the path only depends on simulated time
+ *
+ * File format:
+ * { "fovY": 70, "loop": false, "keyframes": [ { "time": 0, "position": [x, y, z], "orientation": [x, y, z, w] }, ... ] }
+ */
+class CameraPath
+{
+public:
+    struct Keyframe
+    {
+        float time; // seconds; the path starts at the first keyframe, which doesn't have to be at 0
+        vec3 position;
+        quat orientation;
+    };
+
+    /**
+     * Loads keyframes from a JSON file
+     *
+     * @param path Path to the JSON file
+     * @return False if the file is missing, malformed or has fewer than two keyframes
+     */
+    bool load(const char* path);
+
+    bool empty() const { return m_keyframes.empty(); }
+
+    /**
+     * Returns the time between the first and last keyframes in seconds
+     */
+    float getDuration() const { return m_keyframes.empty() ? 0.f : m_keyframes.back().time - m_keyframes.front().time; }
+
+    /**
+     * Places the camera on the path
+     *
+     * @param camera Camera to move; its field of view is overridden when the path specifies one
+     * @param time Seconds since the first keyframe; clamped to the path, or wrapped when it loops
+     */
+    void apply(Camera& camera, double time) const;
+
+private:
+    std::vector<Keyframe> m_keyframes;
+    float m_fovY = 0.f; // radians, 0 keeps the camera's field of view
+    bool m_loop = false;
+};
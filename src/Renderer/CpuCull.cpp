@@ -0,0 +1,665 @@
+#include "CpuCull.h"
+
+#include "../Utils/parallel.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CPU_CULL_SSE 1
+#include <immintrin.h>
+
+#if defined(__GNUC__)
+#define CPU_CULL_AVX2 1
+#define CPU_CULL_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__AVX2__)
+#define CPU_CULL_AVX2 1
+#define CPU_CULL_TARGET_AVX2
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define CPU_CULL_NEON 1
+#include <arm_neon.h>
+#endif
+
+// src/CMakeLists.txt builds this file with -ffp-contract=off: fused multiply-adds round differently, and compilers
+// are free to fuse the scalar kernel (GCC does by default on AArch64) but not the SSE, AVX2 or NEON intrinsics
+
+// kernels process draws in batches of up to 8, so arrays are padded to a multiple of it
+static const uint32_t BATCH_SIZE = 8;
+// draws per job at least, so posting jobs stays cheap compared to culling
+static const uint32_t JOB_SIZE = 16384;
+
+namespace
+{
+
+struct CullArrays
+{
+    const float* centerX;
+    const float* centerY;
+    const float* centerZ;
+    const float* radius;
+    const float* scale;
+    const uint32_t* postPass;
+    const float* lodErrors[8];
+};
+
+struct CullParams
+{
+    float view[4][3]; // columns of the upper 3 rows of CullData::view
+    float frustum[4];
+    float znear, zfar;
+    float lodTarget;
+    bool cullingEnabled;
+    bool lodEnabled;
+    uint32_t postPass;
+};
+
+typedef uint32_t (*KernelFunction)(const CullArrays& a, const CullParams& p, uint32_t begin, uint32_t end, uint8_t* lods);
+
+uint32_t popcount8(uint32_t mask)
+{
+    static const uint8_t counts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    return counts[mask & 15] + counts[(mask >> 4) & 15];
+}
+
+// reference kernel; every step matches drawcull.comp, which --bench-cull checks, and the SIMD kernels match this one
+uint32_t cullScalar(const CullArrays& a, const CullParams& p, uint32_t begin, uint32_t end, uint8_t* lods)
+{
+    uint32_t visibleCount = 0;
+
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        float x = a.centerX[i], y = a.centerY[i], z = a.centerZ[i];
+        float radius = a.radius[i];
+
+        float vx = p.view[0][0] * x + p.view[1][0] * y + p.view[2][0] * z + p.view[3][0];
+        float vy = p.view[0][1] * x + p.view[1][1] * y + p.view[2][1] * z + p.view[3][1];
+        float vz = p.view[0][2] * x + p.view[1][2] * y + p.view[2][2] * z + p.view[3][2];
+
+        bool visible = true;
+        visible = visible && vz * p.frustum[1] - fabsf(vx) * p.frustum[0] > -radius;
+        visible = visible && vz * p.frustum[3] - fabsf(vy) * p.frustum[2] > -radius;
+        visible = visible && vz + radius > p.znear && vz - radius < p.zfar;
+
+        visible = visible || !p.cullingEnabled;
+        visible = visible && a.postPass[i] == p.postPass;
+
+        uint32_t lodIndex = 0;
+
+        if (p.lodEnabled)
+        {
+            float distance = std::max(sqrtf(vx * vx + vy * vy + vz * vz) - radius, 0.f);
+            float threshold = distance * p.lodTarget / a.scale[i];
+
+            for (uint32_t lod = 1; lod < 8; ++lod)
+                if (a.lodErrors[lod][i] < threshold)
+                    lodIndex = lod;
+        }
+
+        lods[i] = visible ? uint8_t(lodIndex) : CPU_CULL_INVISIBLE;
+        visibleCount += visible;
+    }
+
+    return visibleCount;
+}
+
+#if CPU_CULL_SSE
+uint32_t cullSSE(const CullArrays& a, const CullParams& p, uint32_t begin, uint32_t end, uint8_t* lods)
+{
+    __m128 view[4][3];
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 3; ++r)
+            view[c][r] = _mm_set1_ps(p.view[c][r]);
+
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(int(0x80000000)));
+    const __m128 allVisible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    const __m128i pass = _mm_set1_epi32(int(p.postPass));
+    const __m128i invisible = _mm_set1_epi32(CPU_CULL_INVISIBLE);
+
+    uint32_t visibleCount = 0;
+
+    for (uint32_t i = begin; i < end; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(a.centerX + i);
+        __m128 y = _mm_loadu_ps(a.centerY + i);
+        __m128 z = _mm_loadu_ps(a.centerZ + i);
+        __m128 radius = _mm_loadu_ps(a.radius + i);
+        __m128 negRadius = _mm_xor_ps(radius, signMask);
+
+        __m128 vx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(view[0][0], x), _mm_mul_ps(view[1][0], y)), _mm_mul_ps(view[2][0], z)), view[3][0]);
+        __m128 vy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(view[0][1], x), _mm_mul_ps(view[1][1], y)), _mm_mul_ps(view[2][1], z)), view[3][1]);
+        __m128 vz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(view[0][2], x), _mm_mul_ps(view[1][2], y)), _mm_mul_ps(view[2][2], z)), view[3][2]);
+
+        __m128 visible = _mm_cmpgt_ps(_mm_sub_ps(_mm_mul_ps(vz, _mm_set1_ps(p.frustum[1])), _mm_mul_ps(_mm_and_ps(vx, absMask), _mm_set1_ps(p.frustum[0]))), negRadius);
+        visible = _mm_and_ps(visible, _mm_cmpgt_ps(_mm_sub_ps(_mm_mul_ps(vz, _mm_set1_ps(p.frustum[3])), _mm_mul_ps(_mm_and_ps(vy, absMask), _mm_set1_ps(p.frustum[2]))), negRadius));
+        visible = _mm_and_ps(visible, _mm_cmpgt_ps(_mm_add_ps(vz, radius), _mm_set1_ps(p.znear)));
+        visible = _mm_and_ps(visible, _mm_cmplt_ps(_mm_sub_ps(vz, radius), _mm_set1_ps(p.zfar)));
+
+        if (!p.cullingEnabled)
+            visible = allVisible;
+
+        visible = _mm_and_ps(visible, _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a.postPass + i)), pass)));
+
+        __m128i lodIndex = _mm_setzero_si128();
+
+        if (p.lodEnabled)
+        {
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+            __m128 distance = _mm_max_ps(_mm_sub_ps(length, radius), _mm_setzero_ps());
+            __m128 threshold = _mm_div_ps(_mm_mul_ps(distance, _mm_set1_ps(p.lodTarget)), _mm_loadu_ps(a.scale + i));
+
+            for (int lod = 1; lod < 8; ++lod)
+            {
+                __m128i select = _mm_castps_si128(_mm_cmplt_ps(_mm_loadu_ps(a.lodErrors[lod] + i), threshold));
+                lodIndex = _mm_or_si128(_mm_and_si128(select, _mm_set1_epi32(lod)), _mm_andnot_si128(select, lodIndex));
+            }
+        }
+
+        __m128i visibleMask = _mm_castps_si128(visible);
+        __m128i result = _mm_or_si128(_mm_and_si128(visibleMask, lodIndex), _mm_andnot_si128(visibleMask, invisible));
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(result, result), _mm_setzero_si128());
+
+        int packed = _mm_cvtsi128_si32(bytes);
+        memcpy(lods + i, &packed, 4);
+
+        visibleCount += popcount8(_mm_movemask_ps(visible));
+    }
+
+    return visibleCount;
+}
+#endif
+
+#if CPU_CULL_AVX2
+CPU_CULL_TARGET_AVX2 uint32_t cullAVX2(const CullArrays& a, const CullParams& p, uint32_t begin, uint32_t end, uint8_t* lods)
+{
+    __m256 view[4][3];
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 3; ++r)
+            view[c][r] = _mm256_set1_ps(p.view[c][r]);
+
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(int(0x80000000)));
+    const __m256 allVisible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    const __m256i pass = _mm256_set1_epi32(int(p.postPass));
+    const __m256i invisible = _mm256_set1_epi32(CPU_CULL_INVISIBLE);
+
+    uint32_t visibleCount = 0;
+
+    for (uint32_t i = begin; i < end; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(a.centerX + i);
+        __m256 y = _mm256_loadu_ps(a.centerY + i);
+        __m256 z = _mm256_loadu_ps(a.centerZ + i);
+        __m256 radius = _mm256_loadu_ps(a.radius + i);
+        __m256 negRadius = _mm256_xor_ps(radius, signMask);
+
+        __m256 vx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(view[0][0], x), _mm256_mul_ps(view[1][0], y)), _mm256_mul_ps(view[2][0], z)), view[3][0]);
+        __m256 vy = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(view[0][1], x), _mm256_mul_ps(view[1][1], y)), _mm256_mul_ps(view[2][1], z)), view[3][1]);
+        __m256 vz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(view[0][2], x), _mm256_mul_ps(view[1][2], y)), _mm256_mul_ps(view[2][2], z)), view[3][2]);
+
+        __m256 visible = _mm256_cmp_ps(_mm256_sub_ps(_mm256_mul_ps(vz, _mm256_set1_ps(p.frustum[1])), _mm256_mul_ps(_mm256_and_ps(vx, absMask), _mm256_set1_ps(p.frustum[0]))), negRadius, _CMP_GT_OQ);
+        visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_sub_ps(_mm256_mul_ps(vz, _mm256_set1_ps(p.frustum[3])), _mm256_mul_ps(_mm256_and_ps(vy, absMask), _mm256_set1_ps(p.frustum[2]))), negRadius, _CMP_GT_OQ));
+        visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_add_ps(vz, radius), _mm256_set1_ps(p.znear), _CMP_GT_OQ));
+        visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_sub_ps(vz, radius), _mm256_set1_ps(p.zfar), _CMP_LT_OQ));
+
+        if (!p.cullingEnabled)
+            visible = allVisible;
+
+        visible = _mm256_and_ps(visible, _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a.postPass + i)), pass)));
+
+        __m256i lodIndex = _mm256_setzero_si256();
+
+        if (p.lodEnabled)
+        {
+            __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz)));
+            __m256 distance = _mm256_max_ps(_mm256_sub_ps(length, radius), _mm256_setzero_ps());
+            __m256 threshold = _mm256_div_ps(_mm256_mul_ps(distance, _mm256_set1_ps(p.lodTarget)), _mm256_loadu_ps(a.scale + i));
+
+            for (int lod = 1; lod < 8; ++lod)
+            {
+                __m256 select = _mm256_cmp_ps(_mm256_loadu_ps(a.lodErrors[lod] + i), threshold, _CMP_LT_OQ);
+                lodIndex = _mm256_blendv_epi8(lodIndex, _mm256_set1_epi32(lod), _mm256_castps_si256(select));
+            }
+        }
+
+        __m256i result = _mm256_blendv_epi8(invisible, lodIndex, _mm256_castps_si256(visible));
+
+        // packs work within 128-bit lanes, so the halves are packed separately
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(lods + i), _mm_packus_epi16(words, _mm_setzero_si128()));
+
+        visibleCount += popcount8(_mm256_movemask_ps(visible));
+    }
+
+    return visibleCount;
+}
+#endif
+
+#if CPU_CULL_NEON
+uint32_t cullNEON(const CullArrays& a, const CullParams& p, uint32_t begin, uint32_t end, uint8_t* lods)
+{
+    float32x4_t view[4][3];
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 3; ++r)
+            view[c][r] = vdupq_n_f32(p.view[c][r]);
+
+    const uint32x4_t allVisible = vdupq_n_u32(~0u);
+    const uint32x4_t pass = vdupq_n_u32(p.postPass);
+    const uint32x4_t invisible = vdupq_n_u32(CPU_CULL_INVISIBLE);
+
+    uint32_t visibleCount = 0;
+
+    for (uint32_t i = begin; i < end; i += 4)
+    {
+        float32x4_t x = vld1q_f32(a.centerX + i);
+        float32x4_t y = vld1q_f32(a.centerY + i);
+        float32x4_t z = vld1q_f32(a.centerZ + i);
+        float32x4_t radius = vld1q_f32(a.radius + i);
+        float32x4_t negRadius = vnegq_f32(radius);
+
+        // separate multiplies and adds; vmlaq_f32 may fuse and round differently than the other kernels
+        float32x4_t vx = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(view[0][0], x), vmulq_f32(view[1][0], y)), vmulq_f32(view[2][0], z)), view[3][0]);
+        float32x4_t vy = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(view[0][1], x), vmulq_f32(view[1][1], y)), vmulq_f32(view[2][1], z)), view[3][1]);
+        float32x4_t vz = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(view[0][2], x), vmulq_f32(view[1][2], y)), vmulq_f32(view[2][2], z)), view[3][2]);
+
+        uint32x4_t visible = vcgtq_f32(vsubq_f32(vmulq_f32(vz, vdupq_n_f32(p.frustum[1])), vmulq_f32(vabsq_f32(vx), vdupq_n_f32(p.frustum[0]))), negRadius);
+        visible = vandq_u32(visible, vcgtq_f32(vsubq_f32(vmulq_f32(vz, vdupq_n_f32(p.frustum[3])), vmulq_f32(vabsq_f32(vy), vdupq_n_f32(p.frustum[2]))), negRadius));
+        visible = vandq_u32(visible, vcgtq_f32(vaddq_f32(vz, radius), vdupq_n_f32(p.znear)));
+        visible = vandq_u32(visible, vcltq_f32(vsubq_f32(vz, radius), vdupq_n_f32(p.zfar)));
+
+        if (!p.cullingEnabled)
+            visible = allVisible;
+
+        visible = vandq_u32(visible, vceqq_u32(vld1q_u32(a.postPass + i), pass));
+
+        uint32x4_t lodIndex = vdupq_n_u32(0);
+
+        if (p.lodEnabled)
+        {
+            float32x4_t length = vsqrtq_f32(vaddq_f32(vaddq_f32(vmulq_f32(vx, vx), vmulq_f32(vy, vy)), vmulq_f32(vz, vz)));
+            float32x4_t distance = vmaxq_f32(vsubq_f32(length, radius), vdupq_n_f32(0));
+            float32x4_t threshold = vdivq_f32(vmulq_f32(distance, vdupq_n_f32(p.lodTarget)), vld1q_f32(a.scale + i));
+
+            for (uint32_t lod = 1; lod < 8; ++lod)
+                lodIndex = vbslq_u32(vcltq_f32(vld1q_f32(a.lodErrors[lod] + i), threshold), vdupq_n_u32(lod), lodIndex);
+        }
+
+        uint32x4_t result = vbslq_u32(visible, lodIndex, invisible);
+
+        uint16x4_t words = vmovn_u32(result);
+        uint8x8_t bytes = vmovn_u16(vcombine_u16(words, words));
+        vst1_lane_u32(reinterpret_cast<uint32_t*>(lods + i), vreinterpret_u32_u8(bytes), 0);
+
+        visibleCount += vaddvq_u32(vshrq_n_u32(visible, 31));
+    }
+
+    return visibleCount;
+}
+#endif
+
+KernelFunction getKernelFunction(CpuCuller::Kernel kernel)
+{
+    switch (kernel)
+    {
+#if CPU_CULL_SSE
+    case CpuCuller::Kernel_SSE:
+        return cullSSE;
+#endif
+#if CPU_CULL_AVX2
+    case CpuCuller::Kernel_AVX2:
+        return cullAVX2;
+#endif
+#if CPU_CULL_NEON
+    case CpuCuller::Kernel_NEON:
+        return cullNEON;
+#endif
+    default:
+        return cullScalar;
+    }
+}
+
+} // namespace
+
+bool CpuCuller::isSupported(Kernel kernel)
+{
+    switch (kernel)
+    {
+    case Kernel_Scalar:
+        return true;
+#if CPU_CULL_SSE
+    case Kernel_SSE:
+        return true; // part of x86-64
+#endif
+#if CPU_CULL_AVX2
+    case Kernel_AVX2:
+#if defined(__GNUC__)
+        return __builtin_cpu_supports("avx2");
+#else
+        return true; // only compiled when the build targets AVX2
+#endif
+#endif
+#if CPU_CULL_NEON
+    case Kernel_NEON:
+        return true; // part of AArch64
+#endif
+    default:
+        return false;
+    }
+}
+
+CpuCuller::Kernel CpuCuller::getBestKernel()
+{
+    static const Kernel preferred[] = { Kernel_AVX2, Kernel_NEON, Kernel_SSE };
+
+    for (Kernel kernel : preferred)
+        if (isSupported(kernel))
+            return kernel;
+
+    return Kernel_Scalar;
+}
+
+const char* CpuCuller::getKernelName(Kernel kernel)
+{
+    static const char* names[Kernel_Count] = { "scalar", "sse", "avx2", "neon" };
+    return kernel < Kernel_Count ? names[kernel] : "unknown";
+}
+
+vec4 getDrawSphere(const MeshDraw& draw, const Mesh& mesh)
+{
+    // same operations as drawcull.comp: rotateQuat(mesh.center, orientation) * scale + position
+    vec3 axis = vec3(draw.orientation.x, draw.orientation.y, draw.orientation.z);
+    vec3 rotated = mesh.center + 2.0f * glm::cross(axis, glm::cross(axis, mesh.center) + draw.orientation.w * mesh.center);
+    vec3 center = rotated * draw.scale + draw.position;
+
+    return vec4(center, mesh.radius * draw.scale);
+}
+
+void CpuCuller::setDraw(uint32_t index, const MeshDraw& draw, const Mesh& mesh)
+{
+    vec4 sphere = getDrawSphere(draw, mesh);
+
+    m_centerX[index] = sphere.x;
+    m_centerY[index] = sphere.y;
+    m_centerZ[index] = sphere.z;
+    m_radius[index] = sphere.w;
+    m_scale[index] = draw.scale;
+    m_postPass[index] = draw.postPass;
+
+    for (uint32_t lod = 0; lod < COUNTOF(m_lodErrors); ++lod)
+        m_lodErrors[lod][index] = lod < mesh.lodCount ? mesh.lods[lod].error : INFINITY;
+}
+
+void CpuCuller::setDraws(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes)
+{
+    m_drawCount = uint32_t(draws.size());
+    size_t paddedCount = (draws.size() + BATCH_SIZE - 1) / BATCH_SIZE * BATCH_SIZE;
+
+    // padding is culled as a draw of a pass that never runs
+    m_centerX.assign(paddedCount, 0.f);
+    m_centerY.assign(paddedCount, 0.f);
+    m_centerZ.assign(paddedCount, 0.f);
+    m_radius.assign(paddedCount, 0.f);
+    m_scale.assign(paddedCount, 1.f);
+    m_postPass.assign(paddedCount, ~0u);
+
+    for (std::vector<float>& errors : m_lodErrors)
+        errors.assign(paddedCount, INFINITY);
+
+    m_lods.assign(paddedCount, CPU_CULL_INVISIBLE);
+
+    for (size_t i = 0; i < draws.size(); ++i)
+        setDraw(uint32_t(i), draws[i], meshes[draws[i].meshIndex]);
+}
+
+void CpuCuller::updateDraws(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes, const std::vector<uint32_t>& drawIndices)
+{
+    assert(draws.size() == m_drawCount);
+
+    for (uint32_t drawIndex : drawIndices)
+        setDraw(drawIndex, draws[drawIndex], meshes[draws[drawIndex].meshIndex]);
+}
+
+uint32_t CpuCuller::cull(const CullData& cullData, tmc::ex_cpu* executor, Kernel kernel)
+{
+    if (kernel >= Kernel_Count || !isSupported(kernel))
+        kernel = getBestKernel();
+
+    CullArrays arrays = {};
+    arrays.centerX = m_centerX.data();
+    arrays.centerY = m_centerY.data();
+    arrays.centerZ = m_centerZ.data();
+    arrays.radius = m_radius.data();
+    arrays.scale = m_scale.data();
+    arrays.postPass = m_postPass.data();
+    for (uint32_t lod = 0; lod < COUNTOF(m_lodErrors); ++lod)
+        arrays.lodErrors[lod] = m_lodErrors[lod].data();
+
+    CullParams params = {};
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 3; ++r)
+            params.view[c][r] = cullData.view[c][r];
+    for (int i = 0; i < 4; ++i)
+        params.frustum[i] = cullData.frustum[i];
+    params.znear = cullData.znear;
+    params.zfar = cullData.zfar;
+    params.lodTarget = cullData.lodTarget;
+    params.cullingEnabled = cullData.cullingEnabled != 0;
+    params.lodEnabled = cullData.lodEnabled != 0;
+    params.postPass = cullData.postPass;
+
+    KernelFunction function = getKernelFunction(kernel);
+
+    // ranges are multiples of the batch size, so kernels never see a partial batch
+    uint32_t paddedCount = uint32_t(m_lods.size());
+    size_t workers = executor ? executor->thread_count() : 1;
+    uint32_t jobCount = uint32_t(std::max(std::min(workers, size_t((paddedCount + JOB_SIZE - 1) / JOB_SIZE)), size_t(1)));
+    uint32_t jobSize = ((paddedCount + jobCount - 1) / jobCount + BATCH_SIZE - 1) / BATCH_SIZE * BATCH_SIZE;
+
+    std::vector<uint32_t> visibleCounts(jobCount);
+
+    runJobs(executor, jobCount, [&](uint32_t job)
+    {
+        uint32_t begin = std::min(job * jobSize, paddedCount);
+        uint32_t end = std::min(begin + jobSize, paddedCount);
+
+        visibleCounts[job] = function(arrays, params, begin, end, m_lods.data());
+    });
+
+    uint32_t visibleCount = 0;
+    for (uint32_t count : visibleCounts)
+        visibleCount += count;
+
+    return visibleCount;
+}
+
+// drawcull.comp transcribed for one draw of the early pass, with none of the culler's preprocessing: no bounding sphere
+// precomputation, structure-of-arrays conversion, LOD padding or view matrix extraction
+static uint8_t cullDrawShader(const MeshDraw& drawData, const Mesh& mesh, const CullData& cullData)
+{
+    if (drawData.postPass != cullData.postPass)
+        return CPU_CULL_INVISIBLE;
+
+    vec3 axis = vec3(drawData.orientation.x, drawData.orientation.y, drawData.orientation.z);
+    vec3 center = (mesh.center + 2.0f * glm::cross(axis, glm::cross(axis, mesh.center) + drawData.orientation.w * mesh.center)) * drawData.scale + drawData.position;
+    // cullData.view * vec4(center, 1), summed column by column
+    center = vec3(cullData.view[0] * center.x + cullData.view[1] * center.y + cullData.view[2] * center.z + cullData.view[3]);
+    float radius = mesh.radius * drawData.scale;
+
+    bool visible = true;
+    visible = visible && center.z * cullData.frustum[1] - fabsf(center.x) * cullData.frustum[0] > -radius;
+    visible = visible && center.z * cullData.frustum[3] - fabsf(center.y) * cullData.frustum[2] > -radius;
+    visible = visible && center.z + radius > cullData.znear && center.z - radius < cullData.zfar;
+
+    visible = visible || cullData.cullingEnabled == 0;
+
+    if (!visible)
+        return CPU_CULL_INVISIBLE;
+
+    uint32_t lodIndex = 0;
+
+    if (cullData.lodEnabled == 1)
+    {
+        float distance = std::max(glm::length(center) - radius, 0.f);
+        float threshold = distance * cullData.lodTarget / drawData.scale;
+
+        for (uint32_t i = 1; i < mesh.lodCount; ++i)
+            if (mesh.lods[i].error < threshold)
+                lodIndex = i;
+    }
+
+    return uint8_t(lodIndex);
+}
+
+// meshes and draws spread around the camera; a tenth of the draws belongs to the post pass
+static void generateScene(uint32_t drawCount, std::vector<MeshDraw>& draws, std::vector<Mesh>& meshes)
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+    meshes.resize(256);
+
+    for (Mesh& mesh : meshes)
+    {
+        mesh = {};
+        mesh.center = vec3(unit(rng), unit(rng), unit(rng)) * 2.f - 1.f;
+        mesh.radius = 0.5f + unit(rng) * 4.f;
+        mesh.lodCount = 1 + uint32_t(unit(rng) * 8) % 8;
+
+        // errors grow with every LOD like simplification errors do
+        float error = 0;
+        for (uint32_t lod = 0; lod < mesh.lodCount; ++lod)
+        {
+            mesh.lods[lod].error = error;
+            error = (error + 1e-3f) * (1.5f + unit(rng)) * mesh.radius;
+        }
+    }
+
+    draws.resize(drawCount);
+
+    for (MeshDraw& draw : draws)
+    {
+        draw = {};
+        draw.position = vec3(unit(rng) * 600.f - 300.f, unit(rng) * 200.f - 100.f, unit(rng) * 500.f - 100.f);
+        draw.scale = 0.5f + unit(rng) * 1.5f;
+        draw.orientation = glm::normalize(quat(unit(rng) * 2.f - 1.f, unit(rng) * 2.f - 1.f, unit(rng) * 2.f - 1.f, unit(rng) * 2.f - 1.f));
+        draw.meshIndex = uint32_t(unit(rng) * float(meshes.size())) % uint32_t(meshes.size());
+        draw.postPass = unit(rng) < 0.1f ? 1 : 0;
+    }
+}
+
+// same setup as Renderer::beginFrame for a 70 degree 2560x1440 view
+static CullData getBenchmarkCullData(uint32_t postPass)
+{
+    float aspectRatio = 2560.f / 1440.f;
+    float fovY = 70.f * 3.14159265f / 180.f;
+
+    CullData cullData = {};
+    cullData.view = mat4(1.f);
+    cullData.view[3] = vec4(1.5f, -2.f, 10.f, 1.f);
+    cullData.P00 = 1.0f / (tanf(fovY * 0.5f) * aspectRatio);
+    cullData.P11 = 1.0f / tanf(fovY * 0.5f);
+    cullData.znear = 0.1f;
+    cullData.zfar = 200.f;
+    cullData.frustum[0] = -1.0f / cullData.P00;
+    cullData.frustum[1] = 1.0f / cullData.P00;
+    cullData.frustum[2] = -1.0f / cullData.P11;
+    cullData.frustum[3] = 1.0f / cullData.P11;
+    cullData.lodTarget = 0.75f * 4.0f / 1440.f;
+    cullData.cullingEnabled = 1;
+    cullData.lodEnabled = 1;
+    cullData.postPass = postPass;
+
+    return cullData;
+}
+
+bool benchmarkCpuCull(uint32_t drawCount, tmc::ex_cpu& executor, int iterations)
+{
+    std::vector<uint32_t> drawCounts;
+    if (drawCount)
+        drawCounts.push_back(drawCount);
+    else
+        drawCounts = { 100000, 1000000 };
+
+    iterations = std::max(iterations, 1);
+    bool matched = true;
+
+    for (uint32_t count : drawCounts)
+    {
+        std::vector<MeshDraw> draws;
+        std::vector<Mesh> meshes;
+        generateScene(count, draws, meshes);
+
+        CpuCuller culler;
+        culler.setDraws(draws, meshes);
+
+        // the scalar kernel's results are the reference for every pass
+        std::vector<uint8_t> reference[2];
+        uint32_t referenceVisible[2] = {};
+        for (uint32_t pass = 0; pass < 2; ++pass)
+        {
+            referenceVisible[pass] = culler.cull(getBenchmarkCullData(pass), nullptr, CpuCuller::Kernel_Scalar);
+            reference[pass].assign(culler.getLods(), culler.getLods() + count);
+
+            // the scalar kernel in turn has to match the shader
+            CullData passData = getBenchmarkCullData(pass);
+
+            size_t mismatches = 0;
+            for (uint32_t i = 0; i < count; ++i)
+                mismatches += reference[pass][i] != cullDrawShader(draws[i], meshes[draws[i].meshIndex], passData);
+
+            if (mismatches)
+            {
+                printf("Error: scalar kernel disagrees with drawcull.comp on %d draws of pass %d\n", int(mismatches), int(pass));
+                matched = false;
+            }
+        }
+
+        printf("CPU cull: %d draws, %d visible in the main pass, %d in the post pass\n", int(count), int(referenceVisible[0]), int(referenceVisible[1]));
+
+        CullData cullData = getBenchmarkCullData(0);
+
+        for (int kernel = 0; kernel < CpuCuller::Kernel_Count; ++kernel)
+        {
+            if (!CpuCuller::isSupported(CpuCuller::Kernel(kernel)))
+                continue;
+
+            for (tmc::ex_cpu* pool : { (tmc::ex_cpu*)nullptr, &executor })
+            {
+                for (uint32_t pass = 0; pass < 2; ++pass)
+                {
+                    uint32_t visible = culler.cull(getBenchmarkCullData(pass), pool, CpuCuller::Kernel(kernel));
+
+                    size_t mismatches = 0;
+                    for (uint32_t i = 0; i < count; ++i)
+                        mismatches += culler.getLods()[i] != reference[pass][i];
+
+                    if (mismatches || visible != referenceVisible[pass])
+                    {
+                        printf("Error: %s kernel disagrees with the scalar kernel on %d draws of pass %d\n", CpuCuller::getKernelName(CpuCuller::Kernel(kernel)), int(mismatches), int(pass));
+                        matched = false;
+                    }
+                }
+
+                auto start = std::chrono::high_resolution_clock::now();
+
+                for (int i = 0; i < iterations; ++i)
+                    culler.cull(cullData, pool, CpuCuller::Kernel(kernel));
+
+                double time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+                int threads = pool ? int(pool->thread_count()) : 1;
+
+                printf("  %-6s %2d threads %8.3f ms %10.1fM draws/s\n", CpuCuller::getKernelName(CpuCuller::Kernel(kernel)), threads, time, double(count) / time * 1e-3);
+            }
+        }
+    }
+
+    return matched;
+}
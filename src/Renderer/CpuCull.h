@@ -0,0 +1,98 @@
+#pragma once
+
+#include "GfxTypes.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace tmc { class ex_cpu; }
+
+// LOD index of draws that are culled or belong to another pass
+static const uint8_t CPU_CULL_INVISIBLE = 0xff;
+
+/**
+ * Returns the world space bounding sphere of a draw as center and radius, computed in the same order as drawcull.comp
+ */
+vec4 getDrawSphere(const MeshDraw& draw, const Mesh& mesh);
+
+/**
+ * CPU version of the draw culling and LOD selection in drawcull.comp
+ * Draws are converted once into structure-of-arrays form, then culled in batches of 4 or 8 with SSE, AVX2 or NEON kernels,
+ * split across the executor's workers. Mirrors the early pass with every draw visible last frame: occlusion culling
+ * needs the depth pyramid and stays on the GPU. Operations are done in the same order as in the shader and the file is
+ * built without floating point contraction, so every kernel produces the same visible set and LOD indices. The GPU may
+ * fuse multiply-adds and differ at the very boundary of a test; nothing compares against it directly
+ */
+class CpuCuller
+{
+public:
+    enum Kernel
+    {
+        Kernel_Scalar,
+        Kernel_SSE,
+        Kernel_AVX2,
+        Kernel_NEON,
+
+        Kernel_Count
+    };
+
+    /**
+     * Converts draws into batches; must be called again when draws are added or change meshes
+     *
+     * @param draws Draws to cull, indexed like the GPU draw buffer
+     * @param meshes Meshes the draws refer to
+     */
+    void setDraws(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes);
+
+    /**
+     * Refreshes transforms of moved draws, e.g. Renderer::m_animatedDraws
+     */
+    void updateDraws(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes, const std::vector<uint32_t>& drawIndices);
+
+    /**
+     * Culls every draw against the frustum and selects LODs like drawcull.comp does for draws of cullData.postPass
+     * Results are stored in the culler, so only one cull may run at a time
+     *
+     * @param cullData Same values as passed to drawcull.comp; drawCount and the occlusion settings are ignored
+     * @param executor Splits the draws across its workers; nullptr culls on the calling thread
+     * @param kernel Instruction set to use; falls back to the best supported one
+     * @return Number of visible draws
+     */
+    uint32_t cull(const CullData& cullData, tmc::ex_cpu* executor = nullptr, Kernel kernel = Kernel_Count);
+
+    /**
+     * Returns the LOD index of every draw after the last cull, or CPU_CULL_INVISIBLE
+     */
+    const uint8_t* getLods() const { return m_lods.data(); }
+
+    uint32_t getDrawCount() const { return m_drawCount; }
+
+    static bool isSupported(Kernel kernel);
+    static Kernel getBestKernel();
+    static const char* getKernelName(Kernel kernel);
+
+private:
+    void setDraw(uint32_t index, const MeshDraw& draw, const Mesh& mesh);
+
+    uint32_t m_drawCount = 0;
+
+    // per draw, padded to a multiple of the widest batch; padding never matches a pass
+    std::vector<float> m_centerX, m_centerY, m_centerZ; // world space bounding sphere
+    std::vector<float> m_radius;
+    std::vector<float> m_scale;
+    std::vector<uint32_t> m_postPass;
+    std::vector<float> m_lodErrors[8]; // infinity past the mesh's LOD count
+
+    std::vector<uint8_t> m_lods;
+};
+
+/**
+ * Culls synthetic scenes with every supported kernel, single threaded and across the executor, and prints draws per second
+ * The scalar kernel is compared against a per draw transcription of drawcull.comp, every other kernel against the scalar one
+ *
+ * @param drawCount Draws in the scene; 0 runs 100k and 1M draws
+ * @param executor Workers for the multithreaded runs
+ * @param iterations Culls per measurement
+ * @return False if the scalar kernel disagreed with the transcription, or another kernel with the scalar kernel
+ */
+bool benchmarkCpuCull(uint32_t drawCount, tmc::ex_cpu& executor, int iterations);
@@ -0,0 +1,932 @@
+#include "DrawBvh.h"
+#include "CpuCull.h"
+
+#include "../Utils/parallel.hpp"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+static const uint32_t BIN_COUNT = 16;
+static const uint32_t MAX_LEAF_SIZE = 8;
+// SAH cost of visiting a node, relative to testing one draw
+static const float TRAVERSAL_COST = 1.0f;
+// below this depth nodes are split at the median, which bounds the depth of any tree by MAX_SAH_DEPTH + 32
+static const uint32_t MAX_SAH_DEPTH = 40;
+static const uint32_t STACK_SIZE = MAX_SAH_DEPTH + 34;
+// draws per build task at least, and rays per raycast job
+static const uint32_t BUILD_TASK_SIZE = 4096;
+static const uint32_t RAYCAST_JOB_SIZE = 1024;
+
+enum Containment
+{
+    Containment_Outside,
+    Containment_Intersect,
+    Containment_Inside,
+};
+
+static float getHalfArea(vec3 min, vec3 max)
+{
+    vec3 extent = max - min;
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+static Containment testBox(const vec4 planes[6], vec3 min, vec3 max)
+{
+    vec3 center = (min + max) * 0.5f;
+    vec3 extent = (max - min) * 0.5f;
+
+    bool inside = true;
+
+    for (int i = 0; i < 6; ++i)
+    {
+        const vec4& plane = planes[i];
+
+        float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+        float radius = fabsf(plane.x) * extent.x + fabsf(plane.y) * extent.y + fabsf(plane.z) * extent.z;
+
+        if (distance + radius < 0)
+            return Containment_Outside;
+
+        inside = inside && distance - radius >= 0;
+    }
+
+    return inside ? Containment_Inside : Containment_Intersect;
+}
+
+static bool testSphere(const vec4 planes[6], const vec4& sphere)
+{
+    for (int i = 0; i < 6; ++i)
+        if (planes[i].x * sphere.x + planes[i].y * sphere.y + planes[i].z * sphere.z + planes[i].w < -sphere.w)
+            return false;
+
+    return true;
+}
+
+// squared distance from the point to the box, 0 inside
+static float getBoxDistance2(vec3 min, vec3 max, vec3 point)
+{
+    float dx = std::max(std::max(min.x - point.x, point.x - max.x), 0.f);
+    float dy = std::max(std::max(min.y - point.y, point.y - max.y), 0.f);
+    float dz = std::max(std::max(min.z - point.z, point.z - max.z), 0.f);
+
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// distance along the ray to the box, or INFINITY on a miss; fminf/fmaxf drop the NaNs of axis parallel rays
+static float intersectBox(vec3 min, vec3 max, const DrawBvh::Ray& ray, vec3 invDirection, float maxDistance)
+{
+    float tx0 = (min.x - ray.origin.x) * invDirection.x, tx1 = (max.x - ray.origin.x) * invDirection.x;
+    float ty0 = (min.y - ray.origin.y) * invDirection.y, ty1 = (max.y - ray.origin.y) * invDirection.y;
+    float tz0 = (min.z - ray.origin.z) * invDirection.z, tz1 = (max.z - ray.origin.z) * invDirection.z;
+
+    float tmin = fmaxf(fmaxf(fmaxf(fminf(tx0, tx1), fminf(ty0, ty1)), fminf(tz0, tz1)), 0.f);
+    float tmax = fminf(fminf(fminf(fmaxf(tx0, tx1), fmaxf(ty0, ty1)), fmaxf(tz0, tz1)), maxDistance);
+
+    return tmin <= tmax ? tmin : INFINITY;
+}
+
+static float intersectSphere(const vec4& sphere, const DrawBvh::Ray& ray)
+{
+    vec3 offset = vec3(sphere.x, sphere.y, sphere.z) - ray.origin;
+
+    float along = offset.x * ray.direction.x + offset.y * ray.direction.y + offset.z * ray.direction.z;
+    float distance2 = offset.x * offset.x + offset.y * offset.y + offset.z * offset.z - along * along;
+    float radius2 = sphere.w * sphere.w;
+
+    if (distance2 > radius2)
+        return INFINITY;
+
+    float half = sqrtf(radius2 - distance2);
+
+    return along + half < 0 ? INFINITY : std::max(along - half, 0.f);
+}
+
+// visits leaves of every node that passes the box test, depth first
+template <typename BoxTest, typename LeafVisit>
+static void traverse(const std::vector<DrawBvh::Node>& nodes, const BoxTest& boxTest, const LeafVisit& leafVisit)
+{
+    if (nodes.empty())
+        return;
+
+    uint32_t stack[STACK_SIZE];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = 0;
+
+    while (stackSize)
+    {
+        const DrawBvh::Node& node = nodes[stack[--stackSize]];
+
+        if (!boxTest(node.min, node.max))
+            continue;
+
+        if (node.count)
+        {
+            leafVisit(node.leftFirst, node.count);
+        }
+        else
+        {
+            assert(stackSize + 2 <= STACK_SIZE);
+            stack[stackSize++] = node.leftFirst + 1;
+            stack[stackSize++] = node.leftFirst;
+        }
+    }
+}
+
+void DrawBvh::build(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes, tmc::ex_cpu* executor)
+{
+    uint32_t drawCount = uint32_t(draws.size());
+
+    m_drawIndices.resize(drawCount);
+    m_drawSlots.resize(drawCount);
+    m_spheres.resize(drawCount);
+
+    for (uint32_t i = 0; i < drawCount; ++i)
+    {
+        m_drawIndices[i] = i;
+        m_spheres[i] = getDrawSphere(draws[i], meshes[draws[i].meshIndex]);
+    }
+
+    m_nodes.clear();
+
+    if (drawCount == 0)
+        return;
+
+    // a subtree of N draws needs at most 2N-1 nodes, so subtrees get disjoint node ranges up front and build independently
+    m_nodes.assign(2 * drawCount - 1, Node());
+
+    size_t workers = executor ? executor->thread_count() : 1;
+
+    if (executor && workers > 1 && drawCount > BUILD_TASK_SIZE)
+    {
+        // top levels are split on the calling thread until there's a few subtrees per worker
+        uint32_t taskSize = std::max(drawCount / uint32_t(workers * 4), BUILD_TASK_SIZE);
+
+        std::vector<BuildTask> tasks;
+        buildNode(0, 0, drawCount, 1, 0, taskSize, &tasks);
+
+        uint32_t jobCount = uint32_t(std::min(workers, tasks.size()));
+
+        runJobs(executor, jobCount, [&](uint32_t job)
+        {
+            for (size_t i = job; i < tasks.size(); i += jobCount)
+                buildNode(tasks[i].node, tasks[i].begin, tasks[i].end, tasks[i].freeNode, tasks[i].depth, 0, nullptr);
+        });
+    }
+    else
+    {
+        buildNode(0, 0, drawCount, 1, 0, 0, nullptr);
+    }
+
+    compact();
+
+    for (uint32_t i = 0; i < drawCount; ++i)
+        m_drawSlots[m_drawIndices[i]] = i;
+}
+
+void DrawBvh::buildNode(uint32_t nodeIndex, uint32_t begin, uint32_t end, uint32_t freeNode, uint32_t depth, uint32_t taskSize, std::vector<BuildTask>* tasks)
+{
+    uint32_t count = end - begin;
+
+    if (tasks && count <= taskSize)
+    {
+        tasks->push_back({ nodeIndex, begin, end, freeNode, depth });
+        return;
+    }
+
+    vec3 boundsMin = vec3(INFINITY), boundsMax = vec3(-INFINITY);
+    vec3 centerMin = vec3(INFINITY), centerMax = vec3(-INFINITY);
+
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        vec3 center = vec3(m_spheres[i].x, m_spheres[i].y, m_spheres[i].z);
+        float radius = m_spheres[i].w;
+
+        boundsMin = glm::min(boundsMin, center - radius);
+        boundsMax = glm::max(boundsMax, center + radius);
+        centerMin = glm::min(centerMin, center);
+        centerMax = glm::max(centerMax, center);
+    }
+
+    Node& node = m_nodes[nodeIndex];
+    node.min = boundsMin;
+    node.max = boundsMax;
+    node.leftFirst = begin;
+    node.count = count;
+
+    if (count <= 2)
+        return;
+
+    vec3 centerExtent = centerMax - centerMin;
+    int axis = centerExtent.x >= centerExtent.y && centerExtent.x >= centerExtent.z ? 0 : centerExtent.y >= centerExtent.z ? 1 : 2;
+
+    uint32_t mid = begin + count / 2;
+
+    if (centerExtent[axis] <= 0)
+    {
+        // coincident centers can't be separated
+        if (count <= MAX_LEAF_SIZE)
+            return;
+    }
+    else if (depth >= MAX_SAH_DEPTH)
+    {
+        std::vector<uint32_t> order(count);
+        for (uint32_t i = 0; i < count; ++i)
+            order[i] = begin + i;
+
+        std::nth_element(order.begin(), order.begin() + count / 2, order.end(), [&](uint32_t lhs, uint32_t rhs) { return m_spheres[lhs][axis] < m_spheres[rhs][axis]; });
+
+        std::vector<vec4> spheres(count);
+        std::vector<uint32_t> drawIndices(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            spheres[i] = m_spheres[order[i]];
+            drawIndices[i] = m_drawIndices[order[i]];
+        }
+
+        std::copy(spheres.begin(), spheres.end(), m_spheres.begin() + begin);
+        std::copy(drawIndices.begin(), drawIndices.end(), m_drawIndices.begin() + begin);
+    }
+    else
+    {
+        struct Bin
+        {
+            vec3 min = vec3(INFINITY);
+            vec3 max = vec3(-INFINITY);
+            uint32_t count = 0;
+        };
+
+        Bin bins[BIN_COUNT];
+        float binScale = float(BIN_COUNT) / centerExtent[axis];
+
+        auto getBin = [&](const vec4& sphere) { return std::min(uint32_t((sphere[axis] - centerMin[axis]) * binScale), BIN_COUNT - 1); };
+
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const vec4& sphere = m_spheres[i];
+            vec3 center = vec3(sphere.x, sphere.y, sphere.z);
+
+            Bin& bin = bins[getBin(sphere)];
+            bin.min = glm::min(bin.min, center - sphere.w);
+            bin.max = glm::max(bin.max, center + sphere.w);
+            bin.count++;
+        }
+
+        // sweep from both sides; split i puts bins 0..i on the left
+        float leftCost[BIN_COUNT - 1];
+        Bin left, right;
+
+        for (uint32_t i = 0; i < BIN_COUNT - 1; ++i)
+        {
+            left.min = glm::min(left.min, bins[i].min);
+            left.max = glm::max(left.max, bins[i].max);
+            left.count += bins[i].count;
+            leftCost[i] = left.count ? getHalfArea(left.min, left.max) * float(left.count) : 0.f;
+        }
+
+        uint32_t bestSplit = 0;
+        float bestCost = INFINITY;
+
+        for (uint32_t i = BIN_COUNT - 1; i > 0; --i)
+        {
+            right.min = glm::min(right.min, bins[i].min);
+            right.max = glm::max(right.max, bins[i].max);
+            right.count += bins[i].count;
+
+            float cost = leftCost[i - 1] + (right.count ? getHalfArea(right.min, right.max) * float(right.count) : 0.f);
+
+            if (right.count && right.count < count && cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = i - 1;
+            }
+        }
+
+        float area = getHalfArea(boundsMin, boundsMax);
+
+        if (count <= MAX_LEAF_SIZE && area * float(count) <= area * TRAVERSAL_COST + bestCost)
+            return;
+
+        // partition draws and their spheres together
+        uint32_t i = begin, j = end;
+
+        while (i < j)
+        {
+            if (getBin(m_spheres[i]) <= bestSplit)
+            {
+                ++i;
+            }
+            else
+            {
+                --j;
+                std::swap(m_spheres[i], m_spheres[j]);
+                std::swap(m_drawIndices[i], m_drawIndices[j]);
+            }
+        }
+
+        mid = i;
+    }
+
+    uint32_t leftCount = mid - begin;
+
+    node.leftFirst = freeNode;
+    node.count = 0;
+
+    buildNode(freeNode, begin, mid, freeNode + 2, depth + 1, taskSize, tasks);
+    buildNode(freeNode + 1, mid, end, freeNode + 2 + (2 * leftCount - 2), depth + 1, taskSize, tasks);
+}
+
+void DrawBvh::compact()
+{
+    std::vector<Node> nodes;
+    nodes.reserve(m_nodes.size());
+    nodes.push_back(m_nodes[0]);
+
+    // breadth first renumbering keeps siblings together and drops nodes reserved for subtrees that needed fewer
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (nodes[i].count)
+            continue;
+
+        uint32_t left = nodes[i].leftFirst;
+        nodes[i].leftFirst = uint32_t(nodes.size());
+
+        nodes.push_back(m_nodes[left]);
+        nodes.push_back(m_nodes[left + 1]);
+    }
+
+    m_nodes.swap(nodes);
+}
+
+void DrawBvh::refit(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes, const std::vector<uint32_t>& drawIndices)
+{
+    assert(draws.size() == m_drawIndices.size());
+
+    for (uint32_t drawIndex : drawIndices)
+        m_spheres[m_drawSlots[drawIndex]] = getDrawSphere(draws[drawIndex], meshes[draws[drawIndex].meshIndex]);
+
+    // children are stored after their parents, so a reverse pass sees both children first
+    for (size_t i = m_nodes.size(); i-- > 0;)
+    {
+        Node& node = m_nodes[i];
+
+        if (node.count)
+        {
+            node.min = vec3(INFINITY);
+            node.max = vec3(-INFINITY);
+
+            for (uint32_t j = node.leftFirst; j < node.leftFirst + node.count; ++j)
+            {
+                vec3 center = vec3(m_spheres[j].x, m_spheres[j].y, m_spheres[j].z);
+
+                node.min = glm::min(node.min, center - m_spheres[j].w);
+                node.max = glm::max(node.max, center + m_spheres[j].w);
+            }
+        }
+        else
+        {
+            const Node& left = m_nodes[node.leftFirst];
+            const Node& right = m_nodes[node.leftFirst + 1];
+
+            node.min = glm::min(left.min, right.min);
+            node.max = glm::max(left.max, right.max);
+        }
+    }
+}
+
+void DrawBvh::getRange(uint32_t nodeIndex, uint32_t& begin, uint32_t& end) const
+{
+    uint32_t first = nodeIndex, last = nodeIndex;
+
+    while (m_nodes[first].count == 0)
+        first = m_nodes[first].leftFirst;
+
+    while (m_nodes[last].count == 0)
+        last = m_nodes[last].leftFirst + 1;
+
+    begin = m_nodes[first].leftFirst;
+    end = m_nodes[last].leftFirst + m_nodes[last].count;
+}
+
+void DrawBvh::queryFrustumNode(uint32_t nodeIndex, const vec4 planes[6], std::vector<uint32_t>& drawIndices) const
+{
+    uint32_t stack[STACK_SIZE];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = nodeIndex;
+
+    while (stackSize)
+    {
+        uint32_t index = stack[--stackSize];
+        const Node& node = m_nodes[index];
+
+        Containment containment = testBox(planes, node.min, node.max);
+
+        if (containment == Containment_Outside)
+            continue;
+
+        if (containment == Containment_Inside)
+        {
+            uint32_t begin, end;
+            getRange(index, begin, end);
+
+            drawIndices.insert(drawIndices.end(), m_drawIndices.begin() + begin, m_drawIndices.begin() + end);
+        }
+        else if (node.count)
+        {
+            for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+                if (testSphere(planes, m_spheres[i]))
+                    drawIndices.push_back(m_drawIndices[i]);
+        }
+        else
+        {
+            assert(stackSize + 2 <= STACK_SIZE);
+            stack[stackSize++] = node.leftFirst + 1;
+            stack[stackSize++] = node.leftFirst;
+        }
+    }
+}
+
+void DrawBvh::queryFrustum(const vec4 planes[6], std::vector<uint32_t>& drawIndices, tmc::ex_cpu* executor) const
+{
+    if (m_nodes.empty())
+        return;
+
+    size_t workers = executor ? executor->thread_count() : 1;
+
+    if (workers <= 1)
+    {
+        queryFrustumNode(0, planes, drawIndices);
+        return;
+    }
+
+    // expand intersecting nodes breadth first until there's a few subtrees per worker
+    std::vector<uint32_t> subtrees = { 0 }, next;
+
+    while (subtrees.size() < workers * 4)
+    {
+        next.clear();
+
+        for (uint32_t index : subtrees)
+        {
+            const Node& node = m_nodes[index];
+            Containment containment = node.count ? Containment_Inside : testBox(planes, node.min, node.max);
+
+            if (containment == Containment_Intersect)
+            {
+                next.push_back(node.leftFirst);
+                next.push_back(node.leftFirst + 1);
+            }
+            else if (containment == Containment_Inside)
+            {
+                next.push_back(index);
+            }
+        }
+
+        if (next.size() == subtrees.size())
+            break;
+
+        subtrees.swap(next);
+    }
+
+    uint32_t jobCount = uint32_t(std::min(workers, subtrees.size()));
+    std::vector<std::vector<uint32_t>> results(jobCount);
+
+    runJobs(executor, jobCount, [&](uint32_t job)
+    {
+        for (size_t i = job; i < subtrees.size(); i += jobCount)
+            queryFrustumNode(subtrees[i], planes, results[job]);
+    });
+
+    for (const std::vector<uint32_t>& result : results)
+        drawIndices.insert(drawIndices.end(), result.begin(), result.end());
+}
+
+void DrawBvh::querySphere(vec3 center, float radius, std::vector<uint32_t>& drawIndices) const
+{
+    traverse(m_nodes, [&](vec3 min, vec3 max) { return getBoxDistance2(min, max, center) <= radius * radius; },
+        [&](uint32_t first, uint32_t count)
+        {
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                const vec4& sphere = m_spheres[i];
+
+                float dx = sphere.x - center.x, dy = sphere.y - center.y, dz = sphere.z - center.z;
+                float distance = radius + sphere.w;
+
+                if (dx * dx + dy * dy + dz * dz <= distance * distance)
+                    drawIndices.push_back(m_drawIndices[i]);
+            }
+        });
+}
+
+void DrawBvh::queryBox(vec3 min, vec3 max, std::vector<uint32_t>& drawIndices) const
+{
+    traverse(m_nodes,
+        [&](vec3 nodeMin, vec3 nodeMax)
+        {
+            return nodeMin.x <= max.x && nodeMax.x >= min.x && nodeMin.y <= max.y && nodeMax.y >= min.y && nodeMin.z <= max.z && nodeMax.z >= min.z;
+        },
+        [&](uint32_t first, uint32_t count)
+        {
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                const vec4& sphere = m_spheres[i];
+
+                if (getBoxDistance2(min, max, vec3(sphere.x, sphere.y, sphere.z)) <= sphere.w * sphere.w)
+                    drawIndices.push_back(m_drawIndices[i]);
+            }
+        });
+}
+
+bool DrawBvh::raycast(const Ray& ray, RayHit& hit) const
+{
+    hit.drawIndex = ~0u;
+    hit.distance = ray.maxDistance;
+
+    if (m_nodes.empty())
+        return false;
+
+    vec3 invDirection = 1.0f / ray.direction;
+
+    struct Entry
+    {
+        uint32_t node;
+        float distance;
+    };
+
+    Entry stack[STACK_SIZE];
+    uint32_t stackSize = 0;
+
+    float rootDistance = intersectBox(m_nodes[0].min, m_nodes[0].max, ray, invDirection, hit.distance);
+    if (rootDistance != INFINITY)
+        stack[stackSize++] = { 0, rootDistance };
+
+    while (stackSize)
+    {
+        Entry entry = stack[--stackSize];
+
+        // a closer hit was found after the node was pushed
+        if (entry.distance > hit.distance)
+            continue;
+
+        const Node& node = m_nodes[entry.node];
+
+        if (node.count)
+        {
+            for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+            {
+                float distance = intersectSphere(m_spheres[i], ray);
+
+                if (distance < hit.distance || (distance == hit.distance && hit.drawIndex == ~0u))
+                {
+                    hit.drawIndex = m_drawIndices[i];
+                    hit.distance = distance;
+                }
+            }
+        }
+        else
+        {
+            Entry left = { node.leftFirst, intersectBox(m_nodes[node.leftFirst].min, m_nodes[node.leftFirst].max, ray, invDirection, hit.distance) };
+            Entry right = { node.leftFirst + 1, intersectBox(m_nodes[node.leftFirst + 1].min, m_nodes[node.leftFirst + 1].max, ray, invDirection, hit.distance) };
+
+            // the closer child is popped first
+            if (left.distance < right.distance)
+                std::swap(left, right);
+
+            assert(stackSize + 2 <= STACK_SIZE);
+
+            if (left.distance != INFINITY)
+                stack[stackSize++] = left;
+            if (right.distance != INFINITY)
+                stack[stackSize++] = right;
+        }
+    }
+
+    return hit.drawIndex != ~0u;
+}
+
+void DrawBvh::raycast(const std::vector<Ray>& rays, std::vector<RayHit>& hits, tmc::ex_cpu* executor) const
+{
+    hits.resize(rays.size());
+
+    size_t workers = executor ? executor->thread_count() : 1;
+    uint32_t chunkCount = uint32_t((rays.size() + RAYCAST_JOB_SIZE - 1) / RAYCAST_JOB_SIZE);
+    uint32_t jobCount = uint32_t(std::min(workers, size_t(chunkCount)));
+
+    runJobs(executor, jobCount, [&](uint32_t job)
+    {
+        for (uint32_t chunk = job; chunk < chunkCount; chunk += jobCount)
+            for (size_t i = chunk * size_t(RAYCAST_JOB_SIZE); i < std::min(rays.size(), (chunk + 1) * size_t(RAYCAST_JOB_SIZE)); ++i)
+                raycast(rays[i], hits[i]);
+    });
+}
+
+void DrawBvh::getFrustumPlanes(const CullData& cullData, vec4 planes[6])
+{
+    // view space has +Z forward; side planes pass through the eye
+    float nx = 1.0f / sqrtf(cullData.P00 * cullData.P00 + 1.0f);
+    float ny = 1.0f / sqrtf(cullData.P11 * cullData.P11 + 1.0f);
+
+    vec4 viewPlanes[6] = {
+        vec4(cullData.P00 * nx, 0, nx, 0),
+        vec4(-cullData.P00 * nx, 0, nx, 0),
+        vec4(0, cullData.P11 * ny, ny, 0),
+        vec4(0, -cullData.P11 * ny, ny, 0),
+        vec4(0, 0, 1, -cullData.znear),
+        vec4(0, 0, -1, cullData.zfar),
+    };
+
+    // a world space point p is inside when dot(viewPlane, view * p) >= 0, so the world plane is transpose(view) * viewPlane
+    for (int i = 0; i < 6; ++i)
+        planes[i] = vec4(glm::dot(cullData.view[0], viewPlanes[i]), glm::dot(cullData.view[1], viewPlanes[i]), glm::dot(cullData.view[2], viewPlanes[i]), glm::dot(cullData.view[3], viewPlanes[i]));
+}
+
+// draws spread over a level, with a few stacked on top of each other like instanced props
+static void generateBvhScene(std::mt19937& rng, uint32_t drawCount, std::vector<MeshDraw>& draws, std::vector<Mesh>& meshes)
+{
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+    meshes.resize(64);
+
+    for (Mesh& mesh : meshes)
+    {
+        mesh = {};
+        mesh.center = vec3(unit(rng), unit(rng), unit(rng)) * 2.f - 1.f;
+        mesh.radius = 0.25f + unit(rng) * unit(rng) * 8.f;
+    }
+
+    draws.resize(drawCount);
+
+    for (uint32_t i = 0; i < drawCount; ++i)
+    {
+        MeshDraw& draw = draws[i];
+
+        draw = {};
+        draw.position = vec3(unit(rng) * 600.f - 300.f, unit(rng) * 60.f - 10.f, unit(rng) * 600.f - 300.f);
+        draw.scale = 0.5f + unit(rng) * 1.5f;
+        draw.orientation = glm::normalize(quat(unit(rng) * 2.f - 1.f, unit(rng) * 2.f - 1.f, unit(rng) * 2.f - 1.f, unit(rng) * 2.f - 1.f));
+        draw.meshIndex = uint32_t(unit(rng) * float(meshes.size())) % uint32_t(meshes.size());
+
+        // coincident centers take the path that can't split them
+        if (i % 50 == 49)
+            draw.position = draws[i - 1].position;
+    }
+}
+
+// a 70 degree camera anywhere in the level, looking in a random direction
+static CullData getRandomCullData(std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+    float yaw = unit(rng) * 6.2831853f;
+    float pitch = unit(rng) * 1.2f - 0.6f;
+
+    vec3 eye = vec3(unit(rng) * 700.f - 350.f, unit(rng) * 40.f, unit(rng) * 700.f - 350.f);
+    vec3 forward = vec3(cosf(pitch) * sinf(yaw), sinf(pitch), cosf(pitch) * cosf(yaw));
+    vec3 right = vec3(cosf(yaw), 0.f, -sinf(yaw));
+    vec3 up = glm::cross(forward, right);
+
+    CullData cullData = {};
+    cullData.view = mat4(1.f);
+
+    vec3 axes[3] = { right, up, forward };
+    for (int r = 0; r < 3; ++r)
+    {
+        cullData.view[0][r] = axes[r].x;
+        cullData.view[1][r] = axes[r].y;
+        cullData.view[2][r] = axes[r].z;
+        cullData.view[3][r] = -(axes[r].x * eye.x + axes[r].y * eye.y + axes[r].z * eye.z);
+    }
+
+    float fovY = 70.f * 3.14159265f / 180.f;
+    cullData.P00 = 1.0f / (tanf(fovY * 0.5f) * (16.f / 9.f));
+    cullData.P11 = 1.0f / tanf(fovY * 0.5f);
+    cullData.znear = 0.1f;
+    cullData.zfar = 50.f + unit(rng) * 400.f;
+
+    return cullData;
+}
+
+// checks random queries of every kind against brute force over the draws' current bounding spheres
+static size_t checkDrawBvh(std::mt19937& rng, const DrawBvh& bvh, const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes, tmc::ex_cpu* executor)
+{
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+    uint32_t drawCount = uint32_t(draws.size());
+
+    std::vector<vec4> spheres(drawCount);
+    for (uint32_t i = 0; i < drawCount; ++i)
+        spheres[i] = getDrawSphere(draws[i], meshes[draws[i].meshIndex]);
+
+    size_t mismatches = 0;
+    std::vector<uint32_t> result, expected;
+
+    // results are sets, so duplicates count as mismatches as well
+    auto compare = [&](const char* query)
+    {
+        std::sort(result.begin(), result.end());
+
+        if (result != expected)
+        {
+            if (mismatches == 0)
+                printf("Error: %s query returned %d draws, brute force %d\n", query, int(result.size()), int(expected.size()));
+
+            mismatches++;
+        }
+    };
+
+    for (int i = 0; i < 16; ++i)
+    {
+        vec4 planes[6];
+        DrawBvh::getFrustumPlanes(getRandomCullData(rng), planes);
+
+        result.clear();
+        bvh.queryFrustum(planes, result, executor);
+
+        expected.clear();
+        for (uint32_t j = 0; j < drawCount; ++j)
+            if (testSphere(planes, spheres[j]))
+                expected.push_back(j);
+
+        compare("frustum");
+    }
+
+    for (int i = 0; i < 16; ++i)
+    {
+        vec3 center = vec3(unit(rng) * 700.f - 350.f, unit(rng) * 60.f - 10.f, unit(rng) * 700.f - 350.f);
+        float radius = unit(rng) * unit(rng) * 100.f;
+
+        result.clear();
+        bvh.querySphere(center, radius, result);
+
+        expected.clear();
+        for (uint32_t j = 0; j < drawCount; ++j)
+        {
+            float dx = spheres[j].x - center.x, dy = spheres[j].y - center.y, dz = spheres[j].z - center.z;
+            float distance = radius + spheres[j].w;
+
+            if (dx * dx + dy * dy + dz * dz <= distance * distance)
+                expected.push_back(j);
+        }
+
+        compare("sphere");
+    }
+
+    for (int i = 0; i < 16; ++i)
+    {
+        vec3 corner = vec3(unit(rng) * 700.f - 350.f, unit(rng) * 60.f - 10.f, unit(rng) * 700.f - 350.f);
+        vec3 min = corner, max = corner + vec3(unit(rng), unit(rng), unit(rng)) * 120.f;
+
+        result.clear();
+        bvh.queryBox(min, max, result);
+
+        expected.clear();
+        for (uint32_t j = 0; j < drawCount; ++j)
+            if (getBoxDistance2(min, max, vec3(spheres[j].x, spheres[j].y, spheres[j].z)) <= spheres[j].w * spheres[j].w)
+                expected.push_back(j);
+
+        compare("box");
+    }
+
+    std::vector<DrawBvh::Ray> rays(1000);
+
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        vec3 direction = vec3(unit(rng), unit(rng), unit(rng)) * 2.f - 1.f;
+
+        // axis parallel rays divide by zero in the box tests
+        if (i % 10 == 0)
+        {
+            direction = vec3(0.f);
+            direction[int(i / 10 % 3)] = i / 30 % 2 ? 1.f : -1.f;
+        }
+
+        float length = sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+
+        rays[i].origin = vec3(unit(rng) * 700.f - 350.f, unit(rng) * 60.f - 10.f, unit(rng) * 700.f - 350.f);
+        rays[i].direction = length > 0 ? direction * (1.f / length) : vec3(0.f, 1.f, 0.f);
+        rays[i].maxDistance = i % 2 ? 1000.f : 50.f;
+    }
+
+    std::vector<DrawBvh::RayHit> hits;
+    bvh.raycast(rays, hits, executor);
+
+    size_t rayMismatches = 0;
+
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        float closest = rays[i].maxDistance;
+        bool hit = false;
+
+        for (uint32_t j = 0; j < drawCount; ++j)
+        {
+            float distance = intersectSphere(spheres[j], rays[i]);
+
+            if (distance <= closest)
+            {
+                closest = distance;
+                hit = true;
+            }
+        }
+
+        // draws at the same distance are equally correct answers
+        bool matched = hits[i].drawIndex == ~0u ? !hit : hit && hits[i].distance == closest && hits[i].drawIndex < drawCount && intersectSphere(spheres[hits[i].drawIndex], rays[i]) == closest;
+
+        rayMismatches += !matched;
+    }
+
+    if (rayMismatches)
+        printf("Error: %d of %d rays hit a different draw than brute force\n", int(rayMismatches), int(rays.size()));
+
+    return mismatches + rayMismatches;
+}
+
+bool benchmarkDrawBvh(uint32_t drawCount, tmc::ex_cpu& executor, int iterations)
+{
+    std::vector<uint32_t> drawCounts;
+    if (drawCount)
+        drawCounts.push_back(drawCount);
+    else
+        drawCounts = { 0, 1, 7, 1000, 100000 };
+
+    iterations = std::max(iterations, 1);
+    bool matched = true;
+
+    for (uint32_t count : drawCounts)
+    {
+        for (tmc::ex_cpu* pool : { (tmc::ex_cpu*)nullptr, &executor })
+        {
+            std::mt19937 rng(42);
+            std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+            std::vector<MeshDraw> draws;
+            std::vector<Mesh> meshes;
+            generateBvhScene(rng, count, draws, meshes);
+
+            DrawBvh bvh;
+
+            auto start = std::chrono::high_resolution_clock::now();
+            bvh.build(draws, meshes, pool);
+            double buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+            size_t mismatches = checkDrawBvh(rng, bvh, draws, meshes, pool);
+
+            // refits have to keep every query exact however loose the bounds get, including after moves across the level
+            double refitTime = 0;
+            std::vector<uint32_t> moved;
+
+            for (int round = 0; round < 4; ++round)
+            {
+                moved.clear();
+
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    if (unit(rng) >= 0.3f)
+                        continue;
+
+                    float distance = round == 3 ? 300.f : 20.f;
+                    draws[i].position = draws[i].position + (vec3(unit(rng), unit(rng), unit(rng)) * 2.f - 1.f) * distance;
+                    moved.push_back(i);
+                }
+
+                start = std::chrono::high_resolution_clock::now();
+                bvh.refit(draws, meshes, moved);
+                refitTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / 4;
+
+                mismatches += checkDrawBvh(rng, bvh, draws, meshes, pool);
+            }
+
+            if (mismatches)
+            {
+                printf("Error: %d draw BVH queries disagree with brute force for %d draws\n", int(mismatches), int(count));
+                matched = false;
+            }
+
+            vec4 planes[6];
+            DrawBvh::getFrustumPlanes(getRandomCullData(rng), planes);
+
+            std::vector<uint32_t> visible;
+
+            start = std::chrono::high_resolution_clock::now();
+
+            for (int i = 0; i < iterations; ++i)
+            {
+                visible.clear();
+                bvh.queryFrustum(planes, visible, pool);
+            }
+
+            double queryTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+            int threads = pool ? int(pool->thread_count()) : 1;
+
+            printf("Draw BVH: %7d draws %2d threads, %6d nodes, build %8.3f ms, refit %8.3f ms, frustum query %8.3f ms\n",
+                int(count), threads, int(bvh.getNodes().size()), buildTime, refitTime, queryTime);
+        }
+    }
+
+    return matched;
+}
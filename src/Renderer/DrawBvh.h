@@ -0,0 +1,125 @@
+#pragma once
+
+#include "GfxTypes.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace tmc { class ex_cpu; }
+
+/**
+ * Bounding volume hierarchy over the world space bounding spheres of draws, see getDrawSphere
+ * Built with binned SAH; every subtree covers a contiguous range of draws, and siblings are stored next to each other,
+ * so a node visit loads both children from one cache line. Moving draws only needs a refit, which keeps the topology;
+ * rebuild when draws moved far enough to degrade queries
+ */
+class DrawBvh
+{
+public:
+    struct Node
+    {
+        vec3 min;
+        uint32_t leftFirst; // index of the left child, right child follows it; first draw for leaves
+        vec3 max;
+        uint32_t count; // draws in a leaf, 0 for inner nodes
+    };
+
+    struct Ray
+    {
+        vec3 origin;
+        vec3 direction; // normalized
+        float maxDistance;
+    };
+
+    struct RayHit
+    {
+        uint32_t drawIndex; // ~0u on a miss
+        float distance; // along the ray to the draw's bounding sphere, 0 when the origin is inside it
+    };
+
+    /**
+     * Builds the hierarchy from scratch
+     *
+     * @param draws Draws to index, the same indices are returned by queries
+     * @param meshes Meshes the draws refer to
+     * @param executor Builds independent subtrees on its workers; nullptr builds on the calling thread
+     */
+    void build(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes, tmc::ex_cpu* executor = nullptr);
+
+    /**
+     * Updates bounds of moved draws, e.g. Renderer::m_animatedDraws, and refits every node bottom-up
+     */
+    void refit(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes, const std::vector<uint32_t>& drawIndices);
+
+    /**
+     * Appends draws whose bounding spheres intersect the frustum; fully visible subtrees are appended without tests
+     * Order of the results is unspecified
+     *
+     * @param planes World space planes with normals pointing inside, see getFrustumPlanes
+     * @param executor Traverses separate subtrees on its workers; nullptr traverses on the calling thread
+     */
+    void queryFrustum(const vec4 planes[6], std::vector<uint32_t>& drawIndices, tmc::ex_cpu* executor = nullptr) const;
+
+    /**
+     * Appends draws whose bounding spheres intersect the sphere
+     */
+    void querySphere(vec3 center, float radius, std::vector<uint32_t>& drawIndices) const;
+
+    /**
+     * Appends draws whose bounding spheres intersect the box
+     */
+    void queryBox(vec3 min, vec3 max, std::vector<uint32_t>& drawIndices) const;
+
+    /**
+     * Finds the closest draw whose bounding sphere the ray hits; meshes aren't tested, so refine picking with
+     * triangles of the returned draw if needed
+     *
+     * @return False on a miss
+     */
+    bool raycast(const Ray& ray, RayHit& hit) const;
+
+    /**
+     * Casts every ray, split across the executor's workers
+     */
+    void raycast(const std::vector<Ray>& rays, std::vector<RayHit>& hits, tmc::ex_cpu* executor = nullptr) const;
+
+    const std::vector<Node>& getNodes() const { return m_nodes; }
+
+    uint32_t getDrawCount() const { return uint32_t(m_drawIndices.size()); }
+
+    /**
+     * Computes world space planes of the view frustum described by cullData: left, right, bottom, top, near, far
+     */
+    static void getFrustumPlanes(const CullData& cullData, vec4 planes[6]);
+
+private:
+    struct BuildTask
+    {
+        uint32_t node;
+        uint32_t begin, end;
+        uint32_t freeNode; // first node the subtree may use below its root
+        uint32_t depth;
+    };
+
+    void buildNode(uint32_t node, uint32_t begin, uint32_t end, uint32_t freeNode, uint32_t depth, uint32_t taskSize, std::vector<BuildTask>* tasks);
+    void compact();
+
+    void getRange(uint32_t node, uint32_t& begin, uint32_t& end) const;
+    void queryFrustumNode(uint32_t node, const vec4 planes[6], std::vector<uint32_t>& drawIndices) const;
+
+    std::vector<Node> m_nodes; // root first, children always after their parent
+    std::vector<uint32_t> m_drawIndices; // draws in leaf order
+    std::vector<uint32_t> m_drawSlots; // position of every draw in m_drawIndices
+    std::vector<vec4> m_spheres; // bounding spheres in leaf order
+};
+
+/**
+ * Builds hierarchies over synthetic scenes, single threaded and across the executor, and prints build, refit and query times
+ * Every query is compared against brute force over all draws, again after each of several rounds of moving draws and refitting
+ *
+ * @param drawCount Draws in the scene; 0 runs a few sizes from none to 100k draws
+ * @param executor Workers for the multithreaded builds and queries
+ * @param iterations Queries per measurement
+ * @return False if a query disagreed with brute force
+ */
+bool benchmarkDrawBvh(uint32_t drawCount, tmc::ex_cpu& executor, int iterations);
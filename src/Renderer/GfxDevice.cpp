@@ -19,15 +19,19 @@ VkSemaphore createSemaphore(VkDevice device)
 	return semaphore;
 }
 
-VkFence createFence(VkDevice device)
+VkSemaphore createTimelineSemaphore(VkDevice device)
 {
-	VkFenceCreateInfo createInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
-	createInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	VkSemaphoreTypeCreateInfo typeInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
 
-	VkFence fence = 0;
-	VK_CHECK(vkCreateFence(device, &createInfo, 0, &fence));
+	VkSemaphoreCreateInfo createInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	createInfo.pNext = &typeInfo;
+
+	VkSemaphore semaphore = 0;
+	VK_CHECK(vkCreateSemaphore(device, &createInfo, 0, &semaphore));
 
-	return fence;
+	return semaphore;
 }
 
 VkCommandPool createCommandPool(VkDevice device, uint32_t familyIndex)
@@ -42,7 +46,7 @@ VkCommandPool createCommandPool(VkDevice device, uint32_t familyIndex)
 	return commandPool;
 }
 
-VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount, VkQueryType queryType)
+VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount, VkQueryType queryType, VkQueryPipelineStatisticFlags pipelineStatistics)
 {
 	VkQueryPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
 	createInfo.queryType = queryType;
@@ -50,7 +54,8 @@ VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount, VkQueryType qu
 
 	if (queryType == VK_QUERY_TYPE_PIPELINE_STATISTICS)
 	{
-		createInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT;
+		assert(pipelineStatistics);
+		createInfo.pipelineStatistics = pipelineStatistics;
 	}
 
 	VkQueryPool queryPool = 0;
@@ -60,34 +65,72 @@ VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount, VkQueryType qu
 }
 
 
-GfxDevice initDevice()
+static void createOffscreenImages(GfxDevice& result, uint32_t width, uint32_t height)
+{
+	// stands in for a swapchain with one image per frame in flight, so an image is reused only after its frame retired
+	result.m_offscreenImages.resize(FRAMES_COUNT);
+
+	result.m_swapchain = {};
+	result.m_swapchain.width = width;
+	result.m_swapchain.height = height;
+	result.m_swapchain.imageCount = FRAMES_COUNT;
+
+	for (Image& image : result.m_offscreenImages)
+	{
+		createImage(image, result.m_device, result.m_memoryProperties, width, height, 1, result.m_swapchainFormat, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+		result.m_swapchain.images.push_back(image.image);
+	}
+}
+
+void destroyOffscreenImages(GfxDevice& gfxDevice)
+{
+	for (Image& image : gfxDevice.m_offscreenImages)
+		destroyImage(image, gfxDevice.m_device);
+
+	gfxDevice.m_offscreenImages.clear();
+	gfxDevice.m_swapchain.images.clear();
+}
+
+GfxDevice initDevice(uint32_t headlessWidth, uint32_t headlessHeight)
 {
     GfxDevice result;
-    // Initialize SDL
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_JOYSTICK | SDL_INIT_GAMEPAD) < 0) {
-        printf("SDL could not initialize. SDL Error: %s\n", SDL_GetError());
-        std::exit(1);
+    result.m_headless = headlessWidth > 0 && headlessHeight > 0;
+
+    if (result.m_headless)
+    {
+        printf("Running headless at %dx%d\n", int(headlessWidth), int(headlessHeight));
+    }
+    else
+    {
+        // Initialize SDL
+        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_JOYSTICK | SDL_INIT_GAMEPAD) < 0) {
+            printf("SDL could not initialize. SDL Error: %s\n", SDL_GetError());
+            std::exit(1);
+        }
     }
 
 	VK_CHECK(volkInitialize());
 
-	printf("Creating SDL window\n");
-    // TODO:
-    // Add version to window title.
-    result.m_window = SDL_CreateWindow(
-        "Game",
-        // size
-        1024,
-        768,
-        SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
-
-    if (!result.m_window) {
-        printf("Failed to create window. SDL Error: %s\n", SDL_GetError());
-        std::exit(1);
+    if (!result.m_headless)
+    {
+        printf("Creating SDL window\n");
+        // TODO:
+        // Add version to window title.
+        result.m_window = SDL_CreateWindow(
+            "Game",
+            // size
+            1024,
+            768,
+            SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+
+        if (!result.m_window) {
+            printf("Failed to create window. SDL Error: %s\n", SDL_GetError());
+            std::exit(1);
+        }
     }
 
 	printf("Creating instance\n");
-	result.m_instance = createInstance();
+	result.m_instance = createInstance(result.m_headless);
 	assert(result.m_instance);
 
 	printf("Volk load instance\n");
@@ -100,7 +143,7 @@ GfxDevice initDevice()
 	VK_CHECK(vkEnumeratePhysicalDevices(result.m_instance, &physicalDeviceCount, physicalDevices));
 
 	printf("Selecting physical device\n");
-	result.m_physicalDevice = pickPhysicalDevice(physicalDevices, physicalDeviceCount);
+	result.m_physicalDevice = pickPhysicalDevice(physicalDevices, physicalDeviceCount, result.m_headless);
 	assert(result.m_physicalDevice);
 
 	uint32_t extensionCount = 0;
@@ -121,17 +164,37 @@ GfxDevice initDevice()
     assert(meshShadingSupported);
     assert(raytracingSupported);
 
+	VkPhysicalDeviceMeshShaderFeaturesEXT meshFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+	VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	features.pNext = &meshFeatures;
+	vkGetPhysicalDeviceFeatures2(result.m_physicalDevice, &features);
+
+	result.m_meshShaderQueries = meshFeatures.meshShaderQueries;
+
 	vkGetPhysicalDeviceProperties(result.m_physicalDevice, &result.m_props);
 	assert(result.m_props.limits.timestampComputeAndGraphics);
 
 	result.m_familyIndex = getGraphicsFamilyIndex(result.m_physicalDevice);
 	assert(result.m_familyIndex != VK_QUEUE_FAMILY_IGNORED);
 
-	result.m_device = createDevice(result.m_instance, result.m_physicalDevice, result.m_familyIndex, meshShadingSupported, raytracingSupported);
+	result.m_device = createDevice(result.m_instance, result.m_physicalDevice, result.m_familyIndex, meshShadingSupported, raytracingSupported, result.m_headless, result.m_meshShaderQueries);
 	assert(result.m_device);
 
 	volkLoadDevice(result.m_device);
 
+	result.m_depthFormat = VK_FORMAT_D32_SFLOAT;
+
+	vkGetPhysicalDeviceMemoryProperties(result.m_physicalDevice, &result.m_memoryProperties);
+
+	if (result.m_headless)
+	{
+		// the final pass writes the output as a storage image, which every implementation supports for RGBA8
+		result.m_swapchainFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+		createOffscreenImages(result, headlessWidth, headlessHeight);
+		return result;
+	}
+
 	result.m_surface = createSurface(result.m_instance, result.m_window);
 	assert(result.m_surface);
 
@@ -140,9 +203,6 @@ GfxDevice initDevice()
 	assert(presentSupported);
 
 	result.m_swapchainFormat = getSwapchainFormat(result.m_physicalDevice, result.m_surface);
-	result.m_depthFormat = VK_FORMAT_D32_SFLOAT;
-
-	vkGetPhysicalDeviceMemoryProperties(result.m_physicalDevice, &result.m_memoryProperties);
 
 	createSwapchain(result.m_swapchain, result.m_physicalDevice, result.m_device, result.m_surface, result.m_familyIndex, result.m_window, result.m_swapchainFormat);
 
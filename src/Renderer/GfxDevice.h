@@ -2,6 +2,7 @@
 
 #include "niagara/common.h"
 #include "niagara/swapchain.h"
+#include "niagara/resources.h"
 
 struct SDL_Window;
 struct Program;
@@ -9,22 +10,27 @@ struct PushConstants;
 struct DescriptorInfo;
 
 struct GfxDevice {
-    SDL_Window * m_window;
+    SDL_Window * m_window = nullptr;
     VkPhysicalDevice m_physicalDevice;
 	VkInstance m_instance;
     VkPipelineRenderingCreateInfo m_gbufferInfo = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
     VkPhysicalDeviceMemoryProperties m_memoryProperties;
     uint32_t m_familyIndex;
     VkDevice m_device;
-    VkSurfaceKHR m_surface;
+    VkSurfaceKHR m_surface = 0;
     Swapchain m_swapchain;
 	VkFormat m_swapchainFormat;
 	VkFormat m_depthFormat = VK_FORMAT_D32_SFLOAT;
 	VkPhysicalDeviceProperties m_props = {};
 	VkDebugReportCallbackEXT m_debugCallback;
+	bool m_meshShaderQueries = false; // pipeline statistics can count task and mesh shader invocations
 
 	std::vector<VkImageView> m_swapchainImageViews;
 
+	// headless devices have no window, surface or swapchain; m_swapchain describes offscreen images instead
+	bool m_headless = false;
+	std::vector<Image> m_offscreenImages;
+
 };
 
 /**
@@ -35,11 +41,11 @@ struct GfxDevice {
 VkSemaphore createSemaphore(VkDevice device);
 
 /**
- * Creates a Vulkan fence for CPU-GPU synchronization.
- * @param device The Vulkan device to create the fence on
- * @return The created fence handle with signaled state
+ * Creates a timeline semaphore that counts completed GPU work.
+ * @param device The Vulkan device to create the semaphore on
+ * @return The created semaphore handle with value 0
  */
-VkFence createFence(VkDevice device);
+VkSemaphore createTimelineSemaphore(VkDevice device);
 
 /**
  * Creates a command pool for allocating command buffers.
@@ -54,9 +60,10 @@ VkCommandPool createCommandPool(VkDevice device, uint32_t familyIndex);
  * @param device The Vulkan device to create the query pool on
  * @param queryCount Number of queries in the pool
  * @param queryType Type of query (timestamp or pipeline statistics)
+ * @param pipelineStatistics Statistics counted by pipeline statistics queries; results are returned in bit order
  * @return The created query pool handle
  */
-VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount, VkQueryType queryType);
+VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount, VkQueryType queryType, VkQueryPipelineStatisticFlags pipelineStatistics = 0);
 
 /**
  * Destroys the SDL window used for rendering.
@@ -67,9 +74,18 @@ void destroyGfxWindow(SDL_Window * window);
 /**
  * Initializes the graphics device and Vulkan context.
  * Creates window, instance, physical device, logical device, and swapchain.
+ * With a headless size, no window or swapchain is created and frames render into offscreen images.
+ * @param headlessWidth Offscreen image width; 0 creates a window
+ * @param headlessHeight Offscreen image height; 0 creates a window
  * @return Initialized GfxDevice structure
  */
-GfxDevice initDevice();
+GfxDevice initDevice(uint32_t headlessWidth = 0, uint32_t headlessHeight = 0);
+
+/**
+ * Destroys the offscreen images that stand in for the swapchain of a headless device.
+ * @param gfxDevice Headless device the images were created for
+ */
+void destroyOffscreenImages(GfxDevice& gfxDevice);
 
 /**
  * Checks if application should quit by polling SDL events.
@@ -44,6 +44,7 @@ struct alignas(16) CullData
 	int occlusionEnabled;
 	int clusterOcclusionEnabled;
 	int clusterBackfaceEnabled;
+	int cpuOcclusionEnabled;           // skip draws marked in the CPU occlusion mask, see OcclusionBuffer
 
 	uint32_t postPass;
 };
@@ -55,6 +56,31 @@ struct alignas(16) Globals
 	float screenWidth, screenHeight;
 };
 
+struct CullStats
+{
+	// draw culling; draws of the pass that reached the tests
+	uint32_t drawsTested;
+	uint32_t drawsHistoryCulled;   // early pass: not visible last frame, left to the late pass
+	uint32_t drawsFrustumCulled;
+	uint32_t drawsOcclusionCulled;
+	uint32_t drawsAlreadyDrawn;    // late pass: still visible, but rendered by the early pass
+	uint32_t drawsEmitted;
+	uint32_t drawsDropped;         // emitted, but dropped because task commands overflowed
+	uint32_t drawMeshlets;         // meshlets in the selected LODs of emitted draws
+	uint32_t drawTriangles;        // triangles in the selected LODs of emitted draws
+	uint32_t drawLods[8];          // emitted draws per selected LOD
+
+	// meshlet culling in task shader; meshlets of emitted draws
+	uint32_t meshletsTested;
+	uint32_t meshletsHistoryCulled;
+	uint32_t meshletsBackfaceCulled;
+	uint32_t meshletsFrustumCulled;
+	uint32_t meshletsOcclusionCulled;
+	uint32_t meshletsAlreadyDrawn;
+	uint32_t meshletsEmitted;
+	uint32_t meshletTriangles;     // triangles in emitted meshlets
+};
+
 struct alignas(16) ShadowData
 {
 	vec3 sunDirection;
@@ -78,6 +104,13 @@ struct alignas(16) ShadeData
 	vec2 imageSize;
 };
 
+struct alignas(16) PyramidData
+{
+	vec2 imageSize;
+	uint32_t levelCount;
+	uint32_t groupCount;
+};
+
 struct alignas(16) TextData
 {
 	int offsetX, offsetY;
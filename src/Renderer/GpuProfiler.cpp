@@ -0,0 +1,177 @@
+#include "GpuProfiler.h"
+#include "GfxDevice.h"
+
+#include <nlohmann/json.hpp>
+
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+
+// query 0 and 1 bracket the frame, scope i uses queries 2 + 2i and 3 + 2i
+static const uint32_t QUERY_COUNT = 2 + 2 * GpuProfiler::MAX_SCOPES;
+
+void GpuProfiler::init(VkDevice device, float timestampPeriod)
+{
+    m_timestampPeriod = double(timestampPeriod) * 1e-6;
+
+    for (Frame& frame : m_frames)
+    {
+        frame.pool = createQueryPool(device, QUERY_COUNT, VK_QUERY_TYPE_TIMESTAMP);
+        assert(frame.pool);
+    }
+}
+
+void GpuProfiler::destroy(VkDevice device)
+{
+    for (Frame& frame : m_frames)
+    {
+        vkDestroyQueryPool(device, frame.pool, 0);
+        frame.pool = 0;
+    }
+
+    m_current = nullptr;
+}
+
+void GpuProfiler::beginFrame(VkDevice device, uint32_t slot, uint64_t frameIndex, VkCommandBuffer commandBuffer)
+{
+    assert(slot < FRAMES_COUNT);
+    Frame& frame = m_frames[slot];
+
+    if (frame.frameIndex != ~0ull)
+        readback(device, frame);
+
+    frame.frameIndex = frameIndex;
+    frame.scopeCount = 0;
+    m_current = &frame;
+
+    vkCmdResetQueryPool(commandBuffer, frame.pool, 0, QUERY_COUNT);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, frame.pool, 0);
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer commandBuffer)
+{
+    assert(m_current);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_current->pool, 1);
+}
+
+uint32_t GpuProfiler::beginScope(VkCommandBuffer commandBuffer, const char* name)
+{
+    assert(m_current);
+
+    uint32_t scope = m_current->scopeCount.fetch_add(1, std::memory_order_relaxed);
+    if (scope >= MAX_SCOPES)
+        return ~0u;
+
+    m_current->names[scope] = name;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_current->pool, 2 + 2 * scope);
+
+    return scope;
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+    assert(m_current);
+
+    if (scope >= MAX_SCOPES)
+        return;
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_current->pool, 3 + 2 * scope);
+}
+
+void GpuProfiler::readback(VkDevice device, Frame& frame)
+{
+    uint32_t scopeCount = std::min(frame.scopeCount.load(std::memory_order_relaxed), MAX_SCOPES);
+    uint32_t queryCount = 2 + 2 * scopeCount;
+
+    // value and availability pairs; the frame has completed, so unavailable queries were never written
+    uint64_t results[QUERY_COUNT][2] = {};
+    VK_CHECK_QUERY(vkGetQueryPoolResults(device, frame.pool, 0, queryCount, queryCount * sizeof(results[0]), results, sizeof(results[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT));
+
+    auto elapsed = [&](uint32_t begin) { return results[begin][1] && results[begin + 1][1] ? double(results[begin + 1][0] - results[begin][0]) * m_timestampPeriod : -1.0; };
+
+    m_resultFrameIndex = frame.frameIndex;
+    m_frameTime = std::max(elapsed(0), 0.0);
+    m_frameTimeAvg = m_frameTimeAvg * 0.95 + m_frameTime * 0.05;
+
+    m_frameResults.clear();
+
+    for (uint32_t scope = 0; scope < scopeCount; ++scope)
+    {
+        double time = elapsed(2 + 2 * scope);
+        if (time < 0)
+            continue;
+
+        m_frameResults.push_back({ frame.names[scope], time });
+    }
+
+    // scopes with the same name, e.g. a pass recorded twice, count as one entry per frame
+    for (size_t i = 0; i < m_frameResults.size(); ++i)
+    {
+        const char* name = m_frameResults[i].name;
+
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; ++j)
+            seen = strcmp(m_frameResults[j].name, name) == 0;
+
+        if (seen)
+            continue;
+
+        double time = 0;
+        for (size_t j = i; j < m_frameResults.size(); ++j)
+            if (strcmp(m_frameResults[j].name, name) == 0)
+                time += m_frameResults[j].time;
+
+        auto timing = std::find_if(m_timings.begin(), m_timings.end(), [&](const Timing& t) { return t.name == name; });
+
+        if (timing == m_timings.end())
+        {
+            m_timings.push_back({ name, time, time, time, time, 1 });
+        }
+        else
+        {
+            timing->last = time;
+            timing->avg = timing->avg * 0.95 + time * 0.05;
+            timing->min = std::min(timing->min, time);
+            timing->max = std::max(timing->max, time);
+            timing->frames++;
+        }
+    }
+
+    if (!m_dumpPath.empty() && ++m_framesSinceDump >= m_dumpInterval)
+    {
+        writeJson(m_dumpPath.c_str());
+        m_framesSinceDump = 0;
+    }
+}
+
+void GpuProfiler::setDump(const char* path, uint32_t intervalFrames)
+{
+    m_dumpPath = path ? path : "";
+    m_dumpInterval = std::max(intervalFrames, 1u);
+    m_framesSinceDump = 0;
+}
+
+bool GpuProfiler::writeJson(const char* path) const
+{
+    nlohmann::json passes = nlohmann::json::array();
+
+    for (const Timing& timing : m_timings)
+        passes.push_back({ { "name", timing.name }, { "last_ms", timing.last }, { "avg_ms", timing.avg }, { "min_ms", timing.min }, { "max_ms", timing.max }, { "frames", timing.frames } });
+
+    nlohmann::json document;
+    document["frame"] = m_resultFrameIndex;
+    document["frame_ms"] = m_frameTime;
+    document["frame_avg_ms"] = m_frameTimeAvg;
+    document["passes"] = passes;
+
+    std::ofstream file(path);
+    if (!file)
+    {
+        printf("Error: can't write GPU profile to %s\n", path);
+        return false;
+    }
+
+    file << document.dump(2) << "\n";
+    return true;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "niagara/common.h"
+#include "GfxTypes.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Measures GPU time of named scopes with timestamp queries
+ * Every frame slot owns a query pool; scopes take the next free pair of queries when they are recorded,
+ * so passes don't need fixed query indices. Results are read back without waiting when the slot is reused,
+ * FRAMES_COUNT frames later, and folded into rolling per-name averages
+ */
+class GpuProfiler
+{
+public:
+    // scopes recorded per frame at most; scopes past the limit aren't timed
+    static const uint32_t MAX_SCOPES = 63;
+
+    /**
+     * Time of one scope in a completed frame
+     */
+    struct Result
+    {
+        const char* name;
+        double time; // milliseconds
+    };
+
+    /**
+     * Rolling statistics of all scopes with the same name
+     */
+    struct Timing
+    {
+        std::string name;
+        double last; // milliseconds, in the latest frame that recorded the scope
+        double avg; // exponential moving average
+        double min;
+        double max;
+        uint64_t frames; // frames that recorded the scope
+    };
+
+    /**
+     * Creates the per-slot query pools
+     *
+     * @param device Logical device
+     * @param timestampPeriod Nanoseconds per timestamp tick, from VkPhysicalDeviceLimits
+     */
+    void init(VkDevice device, float timestampPeriod);
+
+    void destroy(VkDevice device);
+
+    /**
+     * Reads back the results of the frame that last used the slot and starts a new frame in it
+     * Must be called once the slot's previous frame has completed, before any scope of the new frame is recorded
+     *
+     * @param device Logical device
+     * @param slot Frame slot of the new frame
+     * @param frameIndex Index of the new frame
+     * @param commandBuffer First command buffer of the frame; receives the pool reset and the frame start timestamp
+     */
+    void beginFrame(VkDevice device, uint32_t slot, uint64_t frameIndex, VkCommandBuffer commandBuffer);
+
+    /**
+     * Writes the frame end timestamp; must be recorded after every scope of the frame
+     */
+    void endFrame(VkCommandBuffer commandBuffer);
+
+    /**
+     * Starts a scope; may be called from several recording threads at once
+     *
+     * @param commandBuffer Command buffer to write the start timestamp into
+     * @param name Scope name; has to stay valid until the frame is read back, e.g. a string literal
+     * @return Scope handle for endScope
+     */
+    uint32_t beginScope(VkCommandBuffer commandBuffer, const char* name);
+
+    /**
+     * Ends a scope; may be recorded into a different command buffer of the same frame than beginScope
+     */
+    void endScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+    /**
+     * Returns rolling statistics per scope name, in order of first appearance
+     */
+    const std::vector<Timing>& getTimings() const { return m_timings; }
+
+    /**
+     * Returns the scopes of the latest frame that was read back, in recording order
+     */
+    const std::vector<Result>& getFrameResults() const { return m_frameResults; }
+
+    /**
+     * Index of the latest frame that was read back, or ~0ull if there is none yet
+     */
+    uint64_t getFrameIndex() const { return m_resultFrameIndex; }
+
+    /**
+     * Returns the GPU time of the latest frame that was read back, in milliseconds; 0 if it wasn't available
+     */
+    double getFrameTime() const { return m_frameTime; }
+
+    double getFrameTimeAvg() const { return m_frameTimeAvg; }
+
+    /**
+     * Rewrites a JSON file with the timing table every intervalFrames read back frames
+     *
+     * @param path Output file path, nullptr disables the dump
+     * @param intervalFrames Frames between dumps
+     */
+    void setDump(const char* path, uint32_t intervalFrames);
+
+    /**
+     * Writes the frame time and the timing table as JSON
+     *
+     * @param path Output file path
+     * @return False if the file can't be written
+     */
+    bool writeJson(const char* path) const;
+
+private:
+    struct Frame
+    {
+        VkQueryPool pool = 0;
+        uint64_t frameIndex = ~0ull;
+        std::atomic<uint32_t> scopeCount = 0;
+        const char* names[MAX_SCOPES] = {};
+    };
+
+    void readback(VkDevice device, Frame& frame);
+
+    Frame m_frames[FRAMES_COUNT];
+    Frame* m_current = nullptr;
+    double m_timestampPeriod = 0; // milliseconds per tick
+
+    std::vector<Timing> m_timings;
+    std::vector<Result> m_frameResults;
+    uint64_t m_resultFrameIndex = ~0ull;
+    double m_frameTime = 0;
+    double m_frameTimeAvg = 0;
+
+    std::string m_dumpPath;
+    uint32_t m_dumpInterval = 0;
+    uint32_t m_framesSinceDump = 0;
+};
+
+/**
+ * Times the enclosing block on the GPU
+ */
+class GpuScope
+{
+public:
+    GpuScope(GpuProfiler& profiler, VkCommandBuffer commandBuffer, const char* name)
+        : m_profiler(profiler)
+        , m_commandBuffer(commandBuffer)
+        , m_scope(profiler.beginScope(commandBuffer, name))
+    {
+    }
+
+    ~GpuScope()
+    {
+        m_profiler.endScope(m_commandBuffer, m_scope);
+    }
+
+    GpuScope(const GpuScope&) = delete;
+    GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+    GpuProfiler& m_profiler;
+    VkCommandBuffer m_commandBuffer;
+    uint32_t m_scope;
+};
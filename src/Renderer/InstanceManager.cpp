@@ -0,0 +1,527 @@
+#include "InstanceManager.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <random>
+
+// smallest meshlet visibility capacity in words, 128k meshlets
+static const uint32_t MIN_MESHLET_WORD_CAPACITY = 4096;
+
+// grows by half at least, so a steady stream of spawns reallocates GPU buffers a logarithmic number of times
+static uint32_t growCapacity(uint32_t capacity, uint32_t needed, uint32_t minimum)
+{
+    if (needed <= capacity)
+        return capacity;
+
+    return std::max(std::max(needed, capacity + capacity / 2), minimum);
+}
+
+static void appendRange(std::vector<InstanceManager::Range>& ranges, uint32_t begin, uint32_t count)
+{
+    if (!ranges.empty() && ranges.back().begin + ranges.back().count == begin)
+        ranges.back().count += count;
+    else
+        ranges.push_back({ begin, count });
+}
+
+void InstanceManager::init(const std::vector<Mesh>& meshes, std::vector<MeshDraw> draws)
+{
+    m_meshMeshletWords.resize(meshes.size());
+
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        // draws keep their visibility bits when they switch LODs, so they need room for the LOD with most meshlets
+        uint32_t meshletCount = 0;
+        for (uint32_t lod = 0; lod < meshes[i].lodCount; ++lod)
+            meshletCount = std::max(meshletCount, meshes[i].lods[lod].meshletCount);
+
+        m_meshMeshletWords[i] = (meshletCount + 31) / 32;
+    }
+
+    m_draws = std::move(draws);
+    m_slotFlags.assign(m_draws.size(), 0);
+    m_occluderSlots.assign(m_draws.size(), 0);
+    m_occluders.clear();
+    m_freeSlots.clear();
+    m_freeMeshletWords.clear();
+    m_freeMeshletSizes.clear();
+    m_markedSlots.clear();
+    m_changedDraws.clear();
+    m_spawnedDraws.clear();
+    m_spawnedMeshletWords.clear();
+    m_despawnCount = 0;
+
+    m_meshletWordCount = 0;
+    m_postPasses = 0;
+
+    for (MeshDraw& draw : m_draws)
+    {
+        assert(draw.meshIndex < meshes.size());
+
+        draw.meshletVisibilityOffset = m_meshletWordCount * 32;
+        m_meshletWordCount += m_meshMeshletWords[draw.meshIndex];
+        m_postPasses |= 1 << draw.postPass;
+    }
+
+    m_drawCapacity = growCapacity(0, uint32_t(m_draws.size()), MIN_DRAW_CAPACITY);
+    m_meshletWordCapacity = growCapacity(0, m_meshletWordCount, MIN_MESHLET_WORD_CAPACITY);
+
+    m_draws.reserve(m_drawCapacity);
+    m_slotFlags.reserve(m_drawCapacity);
+    m_occluderSlots.reserve(m_drawCapacity);
+}
+
+void InstanceManager::reserve(uint32_t drawCount, uint32_t meshletVisibilityWords)
+{
+    m_drawCapacity = std::max(m_drawCapacity, drawCount);
+    m_meshletWordCapacity = std::max(m_meshletWordCapacity, meshletVisibilityWords);
+
+    m_draws.reserve(m_drawCapacity);
+    m_slotFlags.reserve(m_drawCapacity);
+    m_occluderSlots.reserve(m_drawCapacity);
+}
+
+uint32_t InstanceManager::spawn(const MeshDraw& draw)
+{
+    assert(draw.meshIndex < m_meshMeshletWords.size());
+    assert(draw.postPass != FREE_SLOT);
+
+    uint32_t drawIndex;
+
+    if (!m_freeSlots.empty())
+    {
+        drawIndex = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+    else
+    {
+        drawIndex = uint32_t(m_draws.size());
+
+        if (drawIndex == m_drawCapacity)
+            reserve(growCapacity(m_drawCapacity, drawIndex + 1, MIN_DRAW_CAPACITY), 0);
+
+        m_draws.emplace_back();
+        m_slotFlags.push_back(0);
+        m_occluderSlots.push_back(0);
+    }
+
+    MeshDraw& slot = m_draws[drawIndex];
+    slot = draw;
+    slot.meshletVisibilityOffset = allocateMeshletWords(m_meshMeshletWords[draw.meshIndex]) * 32;
+
+    m_postPasses |= 1 << draw.postPass;
+
+    markSlot(drawIndex, Slot_Changed | Slot_Spawned);
+
+    return drawIndex;
+}
+
+void InstanceManager::despawn(uint32_t drawIndex)
+{
+    assert(isAlive(drawIndex));
+
+    MeshDraw& draw = m_draws[drawIndex];
+
+    // visibility is cleared when the range is allocated again, so it can be reused right away
+    if (uint32_t wordCount = m_meshMeshletWords[draw.meshIndex])
+        freeMeshletWords(draw.meshletVisibilityOffset / 32, wordCount);
+
+    setOccluder(drawIndex, false);
+
+    draw.postPass = FREE_SLOT;
+    m_freeSlots.push_back(drawIndex);
+
+    markSlot(drawIndex, Slot_Changed | Slot_Despawned);
+}
+
+void InstanceManager::setTransform(uint32_t drawIndex, vec3 position, float scale, quat orientation)
+{
+    assert(isAlive(drawIndex));
+
+    MeshDraw& draw = m_draws[drawIndex];
+    draw.position = position;
+    draw.scale = scale;
+    draw.orientation = orientation;
+
+    markSlot(drawIndex, Slot_Changed);
+}
+
+void InstanceManager::setOccluder(uint32_t drawIndex, bool occluder)
+{
+    assert(isAlive(drawIndex));
+
+    if (m_occluderSlots[drawIndex] == uint8_t(occluder))
+        return;
+
+    m_occluderSlots[drawIndex] = occluder;
+
+    // occluders are few, so a linear search beats keeping positions per slot
+    if (occluder)
+        m_occluders.push_back(drawIndex);
+    else
+        m_occluders.erase(std::find(m_occluders.begin(), m_occluders.end(), drawIndex));
+}
+
+void InstanceManager::flush()
+{
+    m_changedDraws.clear();
+    m_spawnedDraws.clear();
+    m_spawnedMeshletWords.clear();
+    m_despawnCount = 0;
+
+    std::sort(m_markedSlots.begin(), m_markedSlots.end());
+
+    for (uint32_t drawIndex : m_markedSlots)
+    {
+        uint8_t flags = m_slotFlags[drawIndex];
+        m_slotFlags[drawIndex] = 0;
+
+        if (flags & Slot_Changed)
+        {
+            if (!m_changedDraws.empty() && m_changedDraws.back().begin + m_changedDraws.back().count + MAX_RANGE_GAP >= drawIndex)
+                m_changedDraws.back().count = drawIndex + 1 - m_changedDraws.back().begin;
+            else
+                m_changedDraws.push_back({ drawIndex, 1 });
+        }
+
+        if (flags & Slot_Despawned)
+            m_despawnCount++;
+
+        if (flags & Slot_Spawned)
+        {
+            appendRange(m_spawnedDraws, drawIndex, 1);
+
+            // a draw despawned again before the flush doesn't own its range anymore, and whoever does clears it
+            const MeshDraw& draw = m_draws[drawIndex];
+            if (draw.postPass != FREE_SLOT && m_meshMeshletWords[draw.meshIndex])
+                m_spawnedMeshletWords.push_back({ draw.meshletVisibilityOffset / 32, m_meshMeshletWords[draw.meshIndex] });
+        }
+    }
+
+    m_markedSlots.clear();
+
+    // ranges are usually allocated in spawn order, so most of them merge; words in between may belong to live draws
+    coalesceRanges(m_spawnedMeshletWords, 0);
+}
+
+void InstanceManager::coalesceRanges(std::vector<Range>& ranges, uint32_t maxGap)
+{
+    std::sort(ranges.begin(), ranges.end(), [](const Range& lhs, const Range& rhs) { return lhs.begin < rhs.begin; });
+
+    size_t merged = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        Range range = ranges[i];
+
+        if (merged && ranges[merged - 1].begin + ranges[merged - 1].count + maxGap >= range.begin)
+        {
+            Range& last = ranges[merged - 1];
+            last.count = std::max(last.begin + last.count, range.begin + range.count) - last.begin;
+        }
+        else
+        {
+            ranges[merged++] = range;
+        }
+    }
+
+    ranges.resize(merged);
+}
+
+uint32_t InstanceManager::allocateMeshletWords(uint32_t wordCount)
+{
+    if (wordCount == 0)
+        return 0;
+
+    // exact fits first, then the smallest larger range, lowest address first among equal sizes
+    auto it = m_freeMeshletSizes.lower_bound(std::make_pair(wordCount, 0u));
+
+    if (it != m_freeMeshletSizes.end())
+    {
+        uint32_t rangeSize = it->first;
+        uint32_t first = it->second;
+
+        m_freeMeshletSizes.erase(it);
+        m_freeMeshletWords.erase(first);
+
+        // the tail can't have a free neighbour: the next range was allocated, or it would have been merged
+        if (rangeSize > wordCount)
+        {
+            m_freeMeshletWords[first + wordCount] = rangeSize - wordCount;
+            m_freeMeshletSizes.insert(std::make_pair(rangeSize - wordCount, first + wordCount));
+        }
+
+        return first;
+    }
+
+    uint32_t first = m_meshletWordCount;
+    m_meshletWordCount += wordCount;
+    m_meshletWordCapacity = growCapacity(m_meshletWordCapacity, m_meshletWordCount, MIN_MESHLET_WORD_CAPACITY);
+
+    return first;
+}
+
+void InstanceManager::freeMeshletWords(uint32_t first, uint32_t wordCount)
+{
+    auto next = m_freeMeshletWords.lower_bound(first);
+
+    if (next != m_freeMeshletWords.begin())
+    {
+        auto prev = std::prev(next);
+
+        if (prev->first + prev->second == first)
+        {
+            first = prev->first;
+            wordCount += prev->second;
+
+            m_freeMeshletSizes.erase(std::make_pair(prev->second, prev->first));
+            m_freeMeshletWords.erase(prev);
+        }
+    }
+
+    if (next != m_freeMeshletWords.end() && first + wordCount == next->first)
+    {
+        wordCount += next->second;
+
+        m_freeMeshletSizes.erase(std::make_pair(next->second, next->first));
+        m_freeMeshletWords.erase(next);
+    }
+
+    // a range at the end is handed back, so that the next allocation past all free ranges starts right after live ones
+    if (first + wordCount == m_meshletWordCount)
+    {
+        m_meshletWordCount = first;
+        return;
+    }
+
+    m_freeMeshletWords[first] = wordCount;
+    m_freeMeshletSizes.insert(std::make_pair(wordCount, first));
+}
+
+void InstanceManager::markSlot(uint32_t drawIndex, uint8_t flags)
+{
+    if (m_slotFlags[drawIndex] == 0)
+        m_markedSlots.push_back(drawIndex);
+
+    m_slotFlags[drawIndex] |= flags;
+}
+
+bool benchmarkInstances(uint32_t drawCount, uint32_t spawnsPerFrame, int iterations)
+{
+    drawCount = drawCount ? drawCount : 100000;
+    spawnsPerFrame = std::min(spawnsPerFrame ? spawnsPerFrame : 5000, drawCount);
+    iterations = std::max(iterations, 1);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+    // meshes only need meshlet counts; they vary a lot so that freed visibility ranges rarely fit exactly
+    std::vector<Mesh> meshes(64);
+    std::vector<uint32_t> meshWords(meshes.size());
+
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        Mesh& mesh = meshes[i];
+
+        mesh = {};
+        mesh.lodCount = 1 + uint32_t(unit(rng) * 3.f) % 3;
+
+        for (uint32_t lod = 0; lod < mesh.lodCount; ++lod)
+        {
+            mesh.lods[lod].meshletCount = 1 + uint32_t(unit(rng) * unit(rng) * 2000.f) / (lod + 1);
+            meshWords[i] = std::max(meshWords[i], (mesh.lods[lod].meshletCount + 31) / 32);
+        }
+    }
+
+    std::vector<uint32_t> meshOrder(meshes.size());
+    for (uint32_t i = 0; i < meshOrder.size(); ++i)
+        meshOrder[i] = i;
+
+    std::sort(meshOrder.begin(), meshOrder.end(), [&](uint32_t lhs, uint32_t rhs) { return meshWords[lhs] < meshWords[rhs]; });
+
+    // phase 0 picks any mesh, 1 the smaller half and 2 the larger half
+    auto makeDraw = [&](int phase)
+    {
+        uint32_t half = uint32_t(meshOrder.size() / 2);
+        uint32_t pick = uint32_t(unit(rng) * float(phase ? half : 2 * half)) % (phase ? half : 2 * half);
+
+        MeshDraw draw = {};
+        draw.position = vec3(unit(rng) * 600.f - 300.f, unit(rng) * 200.f - 100.f, unit(rng) * 500.f - 100.f);
+        draw.scale = 0.5f + unit(rng) * 1.5f;
+        draw.orientation = quat(1.f, 0.f, 0.f, 0.f);
+        draw.meshIndex = meshOrder[phase == 2 ? half + pick : pick];
+        draw.postPass = unit(rng) < 0.1f ? 1 : 0;
+        return draw;
+    };
+
+    std::vector<MeshDraw> draws(drawCount);
+    for (MeshDraw& draw : draws)
+        draw = makeDraw(0);
+
+    InstanceManager instances;
+    instances.init(meshes, draws);
+
+    std::vector<uint32_t> live(drawCount);
+    for (uint32_t i = 0; i < drawCount; ++i)
+        live[i] = i;
+
+    // every 8th spawn is marked as an occluder, so despawns have to drop marks and recycled slots must not inherit them
+    std::vector<uint8_t> occluders(drawCount);
+    uint32_t spawnCount = 0;
+
+    uint32_t initialDrawCapacity = instances.getDrawCapacity();
+    uint32_t initialMeshletCapacity = instances.getMeshletVisibilityCapacity();
+
+    // spawns switch between small and large meshes after as many spawns as there are draws, so draws mostly take the place
+    // of differently sized ones; the first small and large phases may grow capacities, later ones have to fit
+    int phaseFrames = std::max(int(drawCount / spawnsPerFrame), 1);
+    int warmupFrames = 2 * phaseFrames;
+
+    bool valid = true;
+    int reallocations = 0, lateReallocations = 0;
+    size_t changedRanges = 0, changedDraws = 0, meshletRanges = 0;
+    double time = 0;
+
+    for (int frame = 0; frame < iterations; ++frame)
+    {
+        uint32_t drawCapacity = instances.getDrawCapacity();
+        uint32_t meshletCapacity = instances.getMeshletVisibilityCapacity();
+
+        // victims are picked before the timer starts, the manager's work is what's measured
+        std::vector<uint32_t> despawned(spawnsPerFrame);
+        for (uint32_t& drawIndex : despawned)
+        {
+            size_t victim = size_t(unit(rng) * float(live.size())) % live.size();
+            drawIndex = live[victim];
+            live[victim] = live.back();
+            live.pop_back();
+        }
+
+        std::vector<MeshDraw> spawned(spawnsPerFrame);
+        for (MeshDraw& draw : spawned)
+            draw = makeDraw(1 + frame / phaseFrames % 2);
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (uint32_t drawIndex : despawned)
+            instances.despawn(drawIndex);
+
+        for (const MeshDraw& draw : spawned)
+        {
+            uint32_t drawIndex = instances.spawn(draw);
+            live.push_back(drawIndex);
+
+            if (drawIndex >= occluders.size())
+                occluders.resize(drawIndex + 1);
+
+            occluders[drawIndex] = spawnCount++ % 8 == 0;
+
+            if (occluders[drawIndex])
+                instances.setOccluder(drawIndex, true);
+        }
+
+        for (uint32_t i = 0; i < spawnsPerFrame; ++i)
+        {
+            const MeshDraw& draw = instances.getDraws()[live[i]];
+            instances.setTransform(live[i], draw.position + vec3(0.f, 0.1f, 0.f), draw.scale, draw.orientation);
+        }
+
+        instances.flush();
+
+        time += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        bool reallocated = drawCapacity != instances.getDrawCapacity() || meshletCapacity != instances.getMeshletVisibilityCapacity();
+        reallocations += reallocated;
+        lateReallocations += reallocated && frame >= warmupFrames;
+        changedRanges += instances.getChangedDraws().size();
+        for (const InstanceManager::Range& range : instances.getChangedDraws())
+            changedDraws += range.count;
+        meshletRanges += instances.getSpawnedMeshletWords().size();
+
+        uint32_t spawnedCount = 0;
+        for (const InstanceManager::Range& range : instances.getSpawnedDraws())
+            spawnedCount += range.count;
+
+        if (spawnedCount != spawnsPerFrame)
+        {
+            printf("Error: frame %d reported %d spawned draws, expected %d\n", frame, int(spawnedCount), int(spawnsPerFrame));
+            valid = false;
+        }
+    }
+
+    // every live draw owns its slot and words; a shared word would mix up meshlet visibility of two draws
+    std::vector<uint8_t> slotUsed(instances.getDrawCount());
+    std::vector<uint8_t> wordUsed(instances.getMeshletVisibilityCapacity());
+    size_t conflicts = 0, liveWords = 0;
+
+    size_t occluderConflicts = 0, liveOccluders = 0;
+
+    for (uint32_t drawIndex : live)
+    {
+        if (!instances.isAlive(drawIndex) || slotUsed[drawIndex]++)
+            conflicts++;
+
+        occluderConflicts += instances.isOccluder(drawIndex) != bool(occluders[drawIndex]);
+        liveOccluders += occluders[drawIndex];
+
+        const MeshDraw& draw = instances.getDraws()[drawIndex];
+        const Mesh& mesh = meshes[draw.meshIndex];
+
+        uint32_t meshletCount = 0;
+        for (uint32_t lod = 0; lod < mesh.lodCount; ++lod)
+            meshletCount = std::max(meshletCount, mesh.lods[lod].meshletCount);
+
+        for (uint32_t word = draw.meshletVisibilityOffset / 32; word < (draw.meshletVisibilityOffset + meshletCount + 31) / 32; ++word)
+            if (word >= wordUsed.size() || wordUsed[word]++)
+                conflicts++;
+
+        liveWords += (meshletCount + 31) / 32;
+    }
+
+    if (conflicts || instances.getLiveDrawCount() != live.size())
+    {
+        printf("Error: %d slot or meshlet visibility conflicts, %d live draws, expected %d\n", int(conflicts), int(instances.getLiveDrawCount()), int(live.size()));
+        valid = false;
+    }
+
+    if (occluderConflicts || instances.getOccluders().size() != liveOccluders)
+    {
+        printf("Error: %d live draws have the wrong occluder mark, %d occluders listed, expected %d\n", int(occluderConflicts), int(instances.getOccluders().size()), int(liveOccluders));
+        valid = false;
+    }
+
+    // without merging, ranges freed by small draws can't be reused by large ones, and every switch to large meshes grows
+    if (lateReallocations)
+    {
+        printf("Error: capacities grew %d times after the first %d frames, freed ranges aren't reused\n", lateReallocations, warmupFrames);
+        valid = false;
+    }
+
+    uint32_t fragmentedWords = instances.getMeshletVisibilityWordCount();
+
+    // once every draw is gone, all freed ranges have to merge back into nothing
+    for (uint32_t drawIndex : live)
+        instances.despawn(drawIndex);
+
+    instances.flush();
+
+    if (instances.getMeshletVisibilityWordCount() != 0 || !instances.getOccluders().empty())
+    {
+        printf("Error: %d meshlet visibility words and %d occluders remain after despawning every draw\n", int(instances.getMeshletVisibilityWordCount()), int(instances.getOccluders().size()));
+        valid = false;
+    }
+
+    printf("Instances: %d draws, %d spawns, despawns and moves per frame\n", int(drawCount), int(spawnsPerFrame));
+    printf("  %8.3f ms per frame %10.1f ns per spawn, despawn and move\n", time / iterations, time / iterations / spawnsPerFrame * 1e6);
+    printf("  %8.1f changed draw ranges, %.1f meshlet visibility ranges to clear per frame\n", double(changedRanges) / iterations, double(meshletRanges) / iterations);
+    printf("  %8.1f KB of draws uploaded per frame, %.1f KB for the whole array\n", double(changedDraws) / iterations * sizeof(MeshDraw) / 1024, double(instances.getDrawCount()) * sizeof(MeshDraw) / 1024);
+    printf("  draw capacity %d -> %d, meshlet visibility words %d -> %d, %d reallocations in %d frames\n",
+        int(initialDrawCapacity), int(instances.getDrawCapacity()), int(initialMeshletCapacity), int(instances.getMeshletVisibilityCapacity()), reallocations, iterations);
+    printf("  %d meshlet visibility words live, %d up to the last range, spawns switch mesh sizes every %d frames\n",
+        int(liveWords), int(fragmentedWords), phaseFrames);
+
+    return valid;
+}
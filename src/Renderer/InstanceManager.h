@@ -0,0 +1,157 @@
+#pragma once
+
+#include "GfxTypes.h"
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <vector>
+
+/**
+ * Owns the draws of the scene and lets them be spawned, despawned and moved at runtime
+ * Draws live in slots that are recycled through a free list, so a draw index stays valid until the draw is despawned
+ * and GPU buffers indexed by draw never move entries. Every draw also owns a range of meshlet visibility bits, allocated
+ * in whole 32-bit words so a range can be cleared with vkCmdFillBuffer; freed ranges are merged with free neighbours and
+ * recycled best fit, which draws of the same mesh always find exactly, splitting the smallest larger range otherwise, so
+ * draws of differently sized meshes can take each other's place. Capacities grow geometrically and the renderer
+ * reallocates GPU buffers only when a capacity changes, so spawning and despawning at a steady rate never reallocates
+ * Not thread safe; changes are made on the render thread between frames
+ */
+class InstanceManager
+{
+public:
+    // postPass of free slots; drawcull.comp only culls draws of the pass being rendered, so free slots are never drawn
+    static const uint32_t FREE_SLOT = ~0u;
+    // smallest draw capacity, so the first spawns after loading a small scene don't reallocate
+    static const uint32_t MIN_DRAW_CAPACITY = 1024;
+    // changed draws at most this many slots apart are uploaded as one range; rewriting a few unchanged draws is cheaper
+    // than another copy region or update command
+    static const uint32_t MAX_RANGE_GAP = 8;
+
+    struct Range
+    {
+        uint32_t begin;
+        uint32_t count;
+    };
+
+    /**
+     * Replaces all draws; meshlet visibility offsets of the draws are reassigned
+     *
+     * @param meshes Meshes the draws refer to; only meshlet counts are used, so they must outlive the manager
+     */
+    void init(const std::vector<Mesh>& meshes, std::vector<MeshDraw> draws);
+
+    /**
+     * Grows capacities so that many draws and meshlet visibility words fit without reallocating GPU buffers
+     */
+    void reserve(uint32_t drawCount, uint32_t meshletVisibilityWords);
+
+    /**
+     * Adds a draw; meshletVisibilityOffset is assigned here
+     *
+     * @return Index of the draw until it is despawned
+     */
+    uint32_t spawn(const MeshDraw& draw);
+
+    /**
+     * Removes a draw; its slot and meshlet visibility range are reused by later spawns
+     */
+    void despawn(uint32_t drawIndex);
+
+    /**
+     * Moves a draw; the transform is uploaded with the next frame
+     */
+    void setTransform(uint32_t drawIndex, vec3 position, float scale, quat orientation);
+
+    bool isAlive(uint32_t drawIndex) const { return drawIndex < m_draws.size() && m_draws[drawIndex].postPass != FREE_SLOT; }
+
+    /**
+     * Marks a draw as an occluder, rasterized by CPU occlusion culling; despawning the draw clears the mark
+     */
+    void setOccluder(uint32_t drawIndex, bool occluder);
+
+    bool isOccluder(uint32_t drawIndex) const { return drawIndex < m_occluderSlots.size() && m_occluderSlots[drawIndex]; }
+
+    // live draws marked as occluders, in no particular order
+    const std::vector<uint32_t>& getOccluders() const { return m_occluders; }
+
+    /**
+     * Gathers changes made since the last flush into sorted, coalesced ranges and starts tracking changes anew
+     * Called by the renderer once per frame, before the ranges are uploaded
+     */
+    void flush();
+
+    /**
+     * Sorts ranges and merges the ones that overlap or are at most maxGap slots apart
+     */
+    static void coalesceRanges(std::vector<Range>& ranges, uint32_t maxGap);
+
+    // draws whose MeshDraw changed before the last flush, including despawned ones; ranges may include unchanged draws
+    // in gaps of up to MAX_RANGE_GAP
+    const std::vector<Range>& getChangedDraws() const { return m_changedDraws; }
+    // draws spawned before the last flush, whose draw visibility has to be cleared
+    const std::vector<Range>& getSpawnedDraws() const { return m_spawnedDraws; }
+    // meshlet visibility words of draws spawned before the last flush, which have to be cleared
+    const std::vector<Range>& getSpawnedMeshletWords() const { return m_spawnedMeshletWords; }
+    // slots despawned before the last flush, including ones spawned into again
+    uint32_t getDespawnCount() const { return m_despawnCount; }
+
+    // every slot up to the highest one in use, including free slots
+    const std::vector<MeshDraw>& getDraws() const { return m_draws; }
+
+    uint32_t getDrawCount() const { return uint32_t(m_draws.size()); }
+    uint32_t getLiveDrawCount() const { return uint32_t(m_draws.size() - m_freeSlots.size()); }
+    uint32_t getDrawCapacity() const { return m_drawCapacity; }
+    uint32_t getMeshletVisibilityCapacity() const { return m_meshletWordCapacity; }
+    // meshlet visibility words up to the end of the last allocated range, including free ranges in between
+    uint32_t getMeshletVisibilityWordCount() const { return m_meshletWordCount; }
+
+    // bit mask of every postPass a draw has been spawned with
+    uint32_t getPostPasses() const { return m_postPasses; }
+
+private:
+    enum SlotFlags
+    {
+        Slot_Changed = 1 << 0,
+        Slot_Spawned = 1 << 1,
+        Slot_Despawned = 1 << 2,
+    };
+
+    uint32_t allocateMeshletWords(uint32_t wordCount);
+    void freeMeshletWords(uint32_t first, uint32_t wordCount);
+    void markSlot(uint32_t drawIndex, uint8_t flags);
+
+    std::vector<uint32_t> m_meshMeshletWords; // meshlet visibility words a draw of every mesh needs
+
+    std::vector<MeshDraw> m_draws;
+    std::vector<uint8_t> m_slotFlags;
+    std::vector<uint8_t> m_occluderSlots;
+    std::vector<uint32_t> m_occluders;
+    std::vector<uint32_t> m_freeSlots;
+    std::map<uint32_t, uint32_t> m_freeMeshletWords; // sizes of free ranges by first word; adjacent ranges are always merged
+    std::set<std::pair<uint32_t, uint32_t>> m_freeMeshletSizes; // the same ranges as size and first word, for best fit
+
+    uint32_t m_drawCapacity = 0;
+    uint32_t m_meshletWordCount = 0; // words up to the end of the last allocated range; free ranges never reach it
+    uint32_t m_meshletWordCapacity = 0;
+    uint32_t m_postPasses = 0;
+
+    std::vector<uint32_t> m_markedSlots; // slots with flags, in the order they were first marked
+    std::vector<Range> m_changedDraws;
+    std::vector<Range> m_spawnedDraws;
+    std::vector<Range> m_spawnedMeshletWords;
+    uint32_t m_despawnCount = 0;
+};
+
+/**
+ * Spawns and despawns draws at random every frame and prints timings, capacities and how often they grew
+ * Spawns alternate between the smaller and the larger half of the meshes, so freed meshlet visibility ranges have to be
+ * merged to be reused. Checks that live draws never share a slot or meshlet visibility words, that capacities stop
+ * growing once both halves have been spawned for a while, that occluder marks follow the draws they were set on, and that
+ * no words or occluders remain once every draw is despawned
+ *
+ * @param drawCount Draws in the scene; 0 uses 100k
+ * @param spawnsPerFrame Draws spawned and despawned every frame; 0 uses 5000
+ * @return False if a check failed
+ */
+bool benchmarkInstances(uint32_t drawCount, uint32_t spawnsPerFrame, int iterations);
@@ -0,0 +1,852 @@
+#include "OcclusionBuffer.h"
+#include "CpuCull.h"
+
+#include "../Utils/parallel.hpp"
+
+#include <meshoptimizer.h>
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define OCCLUSION_SSE 1
+#include <emmintrin.h>
+#endif
+
+static const int32_t SUBPIXEL_BITS = 4;
+static const int32_t SUBPIXEL_SCALE = 1 << SUBPIXEL_BITS;
+// occluders are clipped to [-GUARD_BAND, GUARD_BAND] in NDC, which keeps edge functions of MAX_SIZE buffers within 30 bits
+static const float GUARD_BAND = 2.0f;
+// occluders per triangle setup job and draws per test job, at least
+static const uint32_t OCCLUDER_JOB_SIZE = 16;
+static const uint32_t DRAW_JOB_SIZE = 4096;
+
+namespace
+{
+
+// x and y are scaled by P00 and P11, so the guard band planes are w = +-x / GUARD_BAND and w = +-y / GUARD_BAND
+struct ClipVertex
+{
+    float x, y, w;
+};
+
+float getPlaneDistance(const ClipVertex& v, int plane, float znear)
+{
+    switch (plane)
+    {
+    case 0:
+        return v.w - znear;
+    case 1:
+        return GUARD_BAND * v.w - v.x;
+    case 2:
+        return GUARD_BAND * v.w + v.x;
+    case 3:
+        return GUARD_BAND * v.w - v.y;
+    default:
+        return GUARD_BAND * v.w + v.y;
+    }
+}
+
+} // namespace
+
+void buildOccluderMesh(const Geometry& geometry, const Mesh& mesh, OccluderMesh& occluder)
+{
+    const MeshLod& lod = mesh.lods[mesh.lodCount - 1];
+
+    occluder.positions.resize(mesh.vertexCount);
+
+    for (uint32_t i = 0; i < mesh.vertexCount; ++i)
+    {
+        const Vertex& v = geometry.vertices[mesh.vertexOffset + i];
+        occluder.positions[i] = vec3(meshopt_dequantizeHalf(v.vx), meshopt_dequantizeHalf(v.vy), meshopt_dequantizeHalf(v.vz));
+    }
+
+    // LOD indices are relative to the mesh's first vertex
+    occluder.indices.assign(geometry.indices.begin() + lod.indexOffset, geometry.indices.begin() + lod.indexOffset + lod.indexCount);
+}
+
+void OcclusionBuffer::init(uint32_t width, uint32_t height)
+{
+    m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    m_width = m_tilesX * TILE_SIZE;
+    m_height = m_tilesY * TILE_SIZE;
+
+    assert(m_width <= MAX_SIZE && m_height <= MAX_SIZE);
+
+    m_depth.assign(m_width * m_height, 0.f);
+    m_tileDepth.assign(m_tilesX * m_tilesY, 0.f);
+}
+
+void OcclusionBuffer::setupTriangles(const MeshDraw& draw, const OccluderMesh& mesh, std::vector<Triangle>& triangles) const
+{
+    const CullData& cullData = m_cullData;
+    const mat4& view = cullData.view;
+
+    std::vector<ClipVertex> vertices(mesh.positions.size());
+
+    vec3 axis = vec3(draw.orientation.x, draw.orientation.y, draw.orientation.z);
+
+    for (size_t i = 0; i < mesh.positions.size(); ++i)
+    {
+        vec3 position = mesh.positions[i];
+        vec3 world = (position + 2.0f * glm::cross(axis, glm::cross(axis, position) + draw.orientation.w * position)) * draw.scale + draw.position;
+
+        float x = view[0][0] * world.x + view[1][0] * world.y + view[2][0] * world.z + view[3][0];
+        float y = view[0][1] * world.x + view[1][1] * world.y + view[2][1] * world.z + view[3][1];
+        float z = view[0][2] * world.x + view[1][2] * world.y + view[2][2] * world.z + view[3][2];
+
+        vertices[i] = { x * cullData.P00, y * cullData.P11, z };
+    }
+
+    float width = float(m_width), height = float(m_height);
+
+    auto emit = [&](const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2)
+    {
+        const ClipVertex* v[3] = { &v0, &v1, &v2 };
+
+        Triangle triangle;
+        float depth[3];
+
+        for (int i = 0; i < 3; ++i)
+        {
+            float invW = 1.0f / v[i]->w;
+
+            triangle.x[i] = int32_t(lrintf((v[i]->x * invW * 0.5f + 0.5f) * width * SUBPIXEL_SCALE));
+            triangle.y[i] = int32_t(lrintf((v[i]->y * invW * -0.5f + 0.5f) * height * SUBPIXEL_SCALE));
+            depth[i] = cullData.znear * invW;
+        }
+
+        int64_t area = int64_t(triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) - int64_t(triangle.y[1] - triangle.y[0]) * (triangle.x[2] - triangle.x[0]);
+
+        if (area == 0)
+            return;
+
+        // occluders are rasterized from both sides, so just make every triangle counter clockwise
+        if (area < 0)
+        {
+            std::swap(triangle.x[1], triangle.x[2]);
+            std::swap(triangle.y[1], triangle.y[2]);
+            std::swap(depth[1], depth[2]);
+        }
+
+        // only pixels fully inside the triangle are written
+        triangle.minX = std::max((std::min(std::min(triangle.x[0], triangle.x[1]), triangle.x[2]) + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS, 0);
+        triangle.minY = std::max((std::min(std::min(triangle.y[0], triangle.y[1]), triangle.y[2]) + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS, 0);
+        triangle.maxX = std::min((std::max(std::max(triangle.x[0], triangle.x[1]), triangle.x[2]) >> SUBPIXEL_BITS) - 1, int32_t(m_width) - 1);
+        triangle.maxY = std::min((std::max(std::max(triangle.y[0], triangle.y[1]), triangle.y[2]) >> SUBPIXEL_BITS) - 1, int32_t(m_height) - 1);
+
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+            return;
+
+        // znear / z is linear in screen space; the plane is lowered by its largest change within half a pixel
+        float px0 = float(triangle.x[0]) / SUBPIXEL_SCALE, py0 = float(triangle.y[0]) / SUBPIXEL_SCALE;
+        float x1 = float(triangle.x[1]) / SUBPIXEL_SCALE - px0, y1 = float(triangle.y[1]) / SUBPIXEL_SCALE - py0;
+        float x2 = float(triangle.x[2]) / SUBPIXEL_SCALE - px0, y2 = float(triangle.y[2]) / SUBPIXEL_SCALE - py0;
+        float dz1 = depth[1] - depth[0], dz2 = depth[2] - depth[0];
+        float det = x1 * y2 - x2 * y1;
+
+        triangle.a = (dz1 * y2 - dz2 * y1) / det;
+        triangle.b = (dz2 * x1 - dz1 * x2) / det;
+        triangle.c = depth[0] - triangle.a * px0 - triangle.b * py0 - 0.5f * (fabsf(triangle.a) + fabsf(triangle.b));
+
+        triangles.push_back(triangle);
+    };
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        ClipVertex polygon[2][8];
+        int count = 3;
+
+        polygon[0][0] = vertices[mesh.indices[i + 0]];
+        polygon[0][1] = vertices[mesh.indices[i + 1]];
+        polygon[0][2] = vertices[mesh.indices[i + 2]];
+
+        // Sutherland-Hodgman against the near plane and the guard band; each plane adds at most one vertex
+        int current = 0;
+
+        for (int plane = 0; plane < 5 && count >= 3; ++plane)
+        {
+            float distances[8];
+            bool inside = true;
+
+            for (int j = 0; j < count; ++j)
+            {
+                distances[j] = getPlaneDistance(polygon[current][j], plane, cullData.znear);
+                inside = inside && distances[j] >= 0;
+            }
+
+            if (inside)
+                continue;
+
+            int clippedCount = 0;
+
+            for (int j = 0; j < count; ++j)
+            {
+                int k = (j + 1) % count;
+                const ClipVertex& a = polygon[current][j];
+                const ClipVertex& b = polygon[current][k];
+
+                if (distances[j] >= 0)
+                    polygon[1 - current][clippedCount++] = a;
+
+                if ((distances[j] >= 0) != (distances[k] >= 0))
+                {
+                    float t = distances[j] / (distances[j] - distances[k]);
+                    polygon[1 - current][clippedCount++] = { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.w + (b.w - a.w) * t };
+                }
+            }
+
+            current = 1 - current;
+            count = clippedCount;
+        }
+
+        for (int j = 1; j + 1 < count; ++j)
+            emit(polygon[current][0], polygon[current][j], polygon[current][j + 1]);
+    }
+}
+
+void OcclusionBuffer::rasterizeReference(const Triangle& triangle, uint32_t rowBegin, uint32_t rowEnd)
+{
+    int32_t minY = std::max(triangle.minY, int32_t(rowBegin));
+    int32_t maxY = std::min(triangle.maxY, int32_t(rowEnd) - 1);
+
+    for (int32_t y = minY; y <= maxY; ++y)
+    {
+        for (int32_t x = triangle.minX; x <= triangle.maxX; ++x)
+        {
+            int64_t px = x * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+            int64_t py = y * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+
+            bool covered = true;
+
+            for (int edge = 0; edge < 3; ++edge)
+            {
+                int next = (edge + 1) % 3;
+                int64_t dx = triangle.x[next] - triangle.x[edge];
+                int64_t dy = triangle.y[next] - triangle.y[edge];
+                int64_t value = dx * (py - triangle.y[edge]) - dy * (px - triangle.x[edge]);
+
+                // the pixel center has to be inside by half a pixel in both axes, so all 4 corners are
+                covered = covered && value >= (std::abs(dx) + std::abs(dy)) * (SUBPIXEL_SCALE / 2);
+            }
+
+            if (covered)
+            {
+                float depth = (triangle.a * (float(x) + 0.5f) + triangle.b * (float(y) + 0.5f)) + triangle.c;
+                float& pixel = m_depth[y * m_width + x];
+
+                pixel = std::max(pixel, depth);
+            }
+        }
+    }
+}
+
+void OcclusionBuffer::rasterizeSIMD(const Triangle& triangle, uint32_t rowBegin, uint32_t rowEnd)
+{
+#if OCCLUSION_SSE
+    int32_t minY = std::max(triangle.minY, int32_t(rowBegin));
+    int32_t maxY = std::min(triangle.maxY, int32_t(rowEnd) - 1);
+
+    // rows start at a multiple of 4 pixels; the buffer is a whole number of tiles wide, so groups never cross its edge
+    int32_t startX = triangle.minX & ~3;
+
+    __m128i offsets[3], steps[3], thresholds[3];
+    int64_t dx[3], dy[3];
+
+    for (int edge = 0; edge < 3; ++edge)
+    {
+        int next = (edge + 1) % 3;
+        dx[edge] = triangle.x[next] - triangle.x[edge];
+        dy[edge] = triangle.y[next] - triangle.y[edge];
+
+        int32_t step = int32_t(-dy[edge] * SUBPIXEL_SCALE);
+
+        offsets[edge] = _mm_set_epi32(step * 3, step * 2, step, 0);
+        steps[edge] = _mm_set1_epi32(step * 4);
+        thresholds[edge] = _mm_set1_epi32(int32_t((std::abs(dx[edge]) + std::abs(dy[edge])) * (SUBPIXEL_SCALE / 2) - 1));
+    }
+
+    const __m128 a = _mm_set1_ps(triangle.a);
+    const __m128 c = _mm_set1_ps(triangle.c);
+    const __m128 pixelOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+
+    int64_t px = startX * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+
+    for (int32_t y = minY; y <= maxY; ++y)
+    {
+        int64_t py = y * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+
+        // edge functions fit in 32 bits anywhere on screen thanks to the guard band
+        __m128i values[3];
+        for (int edge = 0; edge < 3; ++edge)
+            values[edge] = _mm_add_epi32(_mm_set1_epi32(int32_t(dx[edge] * (py - triangle.y[edge]) - dy[edge] * (px - triangle.x[edge]))), offsets[edge]);
+
+        __m128 rowDepth = _mm_mul_ps(_mm_set1_ps(triangle.b), _mm_set1_ps(float(y) + 0.5f));
+        float* row = &m_depth[y * m_width];
+
+        for (int32_t x = startX; x <= triangle.maxX; x += 4)
+        {
+            __m128i covered = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(values[0], thresholds[0]), _mm_cmpgt_epi32(values[1], thresholds[1])), _mm_cmpgt_epi32(values[2], thresholds[2]));
+
+            if (_mm_movemask_epi8(covered))
+            {
+                __m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_add_ps(_mm_set1_ps(float(x)), pixelOffsets)), rowDepth), c);
+                __m128 pixels = _mm_loadu_ps(row + x);
+                __m128 mask = _mm_castsi128_ps(covered);
+
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, _mm_max_ps(pixels, depth)), _mm_andnot_ps(mask, pixels)));
+            }
+
+            for (int edge = 0; edge < 3; ++edge)
+                values[edge] = _mm_add_epi32(values[edge], steps[edge]);
+        }
+    }
+#else
+    rasterizeReference(triangle, rowBegin, rowEnd);
+#endif
+}
+
+void OcclusionBuffer::updateTiles(uint32_t rowBegin, uint32_t rowEnd)
+{
+    for (uint32_t ty = rowBegin / TILE_SIZE; ty < rowEnd / TILE_SIZE; ++ty)
+    {
+        for (uint32_t tx = 0; tx < m_tilesX; ++tx)
+        {
+            float depth = INFINITY;
+
+            for (uint32_t y = ty * TILE_SIZE; y < (ty + 1) * TILE_SIZE; ++y)
+                for (uint32_t x = tx * TILE_SIZE; x < (tx + 1) * TILE_SIZE; ++x)
+                    depth = std::min(depth, m_depth[y * m_width + x]);
+
+            m_tileDepth[ty * m_tilesX + tx] = depth;
+        }
+    }
+}
+
+void OcclusionBuffer::render(const CullData& cullData, const std::vector<MeshDraw>& draws, const std::vector<uint32_t>& occluders, const std::vector<OccluderMesh>& occluderMeshes, tmc::ex_cpu* executor, Rasterizer rasterizer)
+{
+    assert(m_width && m_height);
+
+    m_cullData = cullData;
+
+    size_t workers = executor ? executor->thread_count() : 1;
+
+    uint32_t setupJobs = uint32_t(std::max(std::min(workers, (occluders.size() + OCCLUDER_JOB_SIZE - 1) / OCCLUDER_JOB_SIZE), size_t(1)));
+    std::vector<std::vector<Triangle>> triangles(setupJobs);
+
+    runJobs(executor, setupJobs, [&](uint32_t job)
+    {
+        for (size_t i = job; i < occluders.size(); i += setupJobs)
+        {
+            const MeshDraw& draw = draws[occluders[i]];
+            setupTriangles(draw, occluderMeshes[draw.meshIndex], triangles[job]);
+        }
+    });
+
+    m_triangles.clear();
+    for (const std::vector<Triangle>& jobTriangles : triangles)
+        m_triangles.insert(m_triangles.end(), jobTriangles.begin(), jobTriangles.end());
+
+    // every job owns whole rows of tiles; the result doesn't depend on the order triangles are rasterized in
+    uint32_t rasterJobs = uint32_t(std::min(workers, size_t(m_tilesY)));
+
+    runJobs(executor, rasterJobs, [&](uint32_t job)
+    {
+        uint32_t rowBegin = m_tilesY * job / rasterJobs * TILE_SIZE;
+        uint32_t rowEnd = m_tilesY * (job + 1) / rasterJobs * TILE_SIZE;
+
+        std::fill(m_depth.begin() + rowBegin * m_width, m_depth.begin() + rowEnd * m_width, 0.f);
+
+        for (const Triangle& triangle : m_triangles)
+        {
+            if (triangle.maxY < int32_t(rowBegin) || triangle.minY >= int32_t(rowEnd))
+                continue;
+
+            if (rasterizer == Rasterizer_SIMD)
+                rasterizeSIMD(triangle, rowBegin, rowEnd);
+            else
+                rasterizeReference(triangle, rowBegin, rowEnd);
+        }
+
+        updateTiles(rowBegin, rowEnd);
+    });
+}
+
+bool OcclusionBuffer::getScreenRect(const vec4& sphere, ScreenRect& rect) const
+{
+    const CullData& cullData = m_cullData;
+    const mat4& view = cullData.view;
+
+    vec3 c;
+    c.x = view[0][0] * sphere.x + view[1][0] * sphere.y + view[2][0] * sphere.z + view[3][0];
+    c.y = view[0][1] * sphere.x + view[1][1] * sphere.y + view[2][1] * sphere.z + view[3][1];
+    c.z = view[0][2] * sphere.x + view[1][2] * sphere.y + view[2][2] * sphere.z + view[3][2];
+
+    float r = sphere.w;
+
+    // same bounds as projectSphere in shaders/math.h
+    if (c.z < r + cullData.znear)
+        return false;
+
+    vec3 cr = c * r;
+    float czr2 = c.z * c.z - r * r;
+
+    float vx = sqrtf(c.x * c.x + czr2);
+    float minx = (vx * c.x - cr.z) / (vx * c.z + cr.x);
+    float maxx = (vx * c.x + cr.z) / (vx * c.z - cr.x);
+
+    float vy = sqrtf(c.y * c.y + czr2);
+    float miny = (vy * c.y - cr.z) / (vy * c.z + cr.y);
+    float maxy = (vy * c.y + cr.z) / (vy * c.z - cr.y);
+
+    float x0 = (minx * cullData.P00 * 0.5f + 0.5f) * float(m_width);
+    float x1 = (maxx * cullData.P00 * 0.5f + 0.5f) * float(m_width);
+    float y0 = (maxy * cullData.P11 * -0.5f + 0.5f) * float(m_height);
+    float y1 = (miny * cullData.P11 * -0.5f + 0.5f) * float(m_height);
+
+    // off screen draws are left to frustum culling
+    if (!(x0 < float(m_width) && x1 > 0 && y0 < float(m_height) && y1 > 0))
+        return false;
+
+    rect.minX = int32_t(std::max(floorf(x0), 0.f));
+    rect.minY = int32_t(std::max(floorf(y0), 0.f));
+    rect.maxX = int32_t(std::min(ceilf(x1), float(m_width))) - 1;
+    rect.maxY = int32_t(std::min(ceilf(y1), float(m_height))) - 1;
+    rect.depth = cullData.znear / (c.z - r);
+
+    return true;
+}
+
+bool OcclusionBuffer::isOccluded(const vec4& sphere) const
+{
+    ScreenRect rect;
+    if (!getScreenRect(sphere, rect))
+        return false;
+
+    for (int32_t ty = rect.minY / int32_t(TILE_SIZE); ty <= rect.maxY / int32_t(TILE_SIZE); ++ty)
+    {
+        for (int32_t tx = rect.minX / int32_t(TILE_SIZE); tx <= rect.maxX / int32_t(TILE_SIZE); ++tx)
+        {
+            // every pixel of the tile is closer than the sphere
+            if (m_tileDepth[ty * m_tilesX + tx] > rect.depth)
+                continue;
+
+            int32_t minX = std::max(rect.minX, tx * int32_t(TILE_SIZE)), maxX = std::min(rect.maxX, (tx + 1) * int32_t(TILE_SIZE) - 1);
+            int32_t minY = std::max(rect.minY, ty * int32_t(TILE_SIZE)), maxY = std::min(rect.maxY, (ty + 1) * int32_t(TILE_SIZE) - 1);
+
+            for (int32_t y = minY; y <= maxY; ++y)
+                for (int32_t x = minX; x <= maxX; ++x)
+                    if (m_depth[y * m_width + x] <= rect.depth)
+                        return false;
+        }
+    }
+
+    return true;
+}
+
+bool OcclusionBuffer::isOccludedReference(const vec4& sphere) const
+{
+    ScreenRect rect;
+    if (!getScreenRect(sphere, rect))
+        return false;
+
+    for (int32_t y = rect.minY; y <= rect.maxY; ++y)
+        for (int32_t x = rect.minX; x <= rect.maxX; ++x)
+            if (m_depth[y * m_width + x] <= rect.depth)
+                return false;
+
+    return true;
+}
+
+void OcclusionBuffer::filterDraws(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes, const std::vector<uint32_t>& drawIndices, std::vector<uint32_t>& visibleDraws, tmc::ex_cpu* executor) const
+{
+    size_t workers = executor ? executor->thread_count() : 1;
+    uint32_t jobCount = uint32_t(std::max(std::min(workers, (drawIndices.size() + DRAW_JOB_SIZE - 1) / DRAW_JOB_SIZE), size_t(1)));
+
+    std::vector<std::vector<uint32_t>> results(jobCount);
+
+    // contiguous ranges keep the results in input order
+    runJobs(executor, jobCount, [&](uint32_t job)
+    {
+        size_t begin = drawIndices.size() * job / jobCount;
+        size_t end = drawIndices.size() * (job + 1) / jobCount;
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            const MeshDraw& draw = draws[drawIndices[i]];
+
+            if (!isOccluded(getDrawSphere(draw, meshes[draw.meshIndex])))
+                results[job].push_back(drawIndices[i]);
+        }
+    });
+
+    for (const std::vector<uint32_t>& result : results)
+        visibleDraws.insert(visibleDraws.end(), result.begin(), result.end());
+}
+
+// walls of 8x4x0.5 units in front of the camera, and small draws scattered behind and between them
+static void generateOcclusionScene(uint32_t drawCount, std::vector<MeshDraw>& draws, std::vector<Mesh>& meshes, std::vector<OccluderMesh>& occluderMeshes, std::vector<uint32_t>& occluders, std::vector<uint32_t>& testDraws)
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+    OccluderMesh wall;
+    for (int i = 0; i < 8; ++i)
+        wall.positions.push_back(vec3(i & 1 ? 4.f : -4.f, i & 2 ? 2.f : -2.f, i & 4 ? 0.25f : -0.25f));
+
+    static const uint32_t boxIndices[] = { 0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5 };
+    wall.indices.assign(boxIndices, boxIndices + COUNTOF(boxIndices));
+
+    occluderMeshes.assign(2, OccluderMesh());
+    occluderMeshes[0] = wall;
+
+    meshes.assign(2, Mesh());
+    meshes[0].radius = sqrtf(4.f * 4.f + 2.f * 2.f + 0.25f * 0.25f);
+    meshes[0].lodCount = 1;
+    meshes[1].radius = 1.f;
+    meshes[1].lodCount = 1;
+
+    draws.clear();
+    occluders.clear();
+    testDraws.clear();
+
+    for (int i = 0; i < 48; ++i)
+    {
+        float angle = (unit(rng) - 0.5f) * 1.2f;
+
+        MeshDraw draw = {};
+        draw.position = vec3(unit(rng) * 80.f - 40.f, unit(rng) * 4.f - 2.f, 15.f + unit(rng) * 45.f);
+        draw.scale = 1.f + unit(rng) * 2.f;
+        draw.orientation = quat(cosf(angle * 0.5f), 0.f, sinf(angle * 0.5f), 0.f);
+        draw.meshIndex = 0;
+
+        occluders.push_back(uint32_t(draws.size()));
+        draws.push_back(draw);
+    }
+
+    for (uint32_t i = 0; i < drawCount; ++i)
+    {
+        MeshDraw draw = {};
+        draw.position = vec3(unit(rng) * 200.f - 100.f, unit(rng) * 10.f - 5.f, 5.f + unit(rng) * 195.f);
+        draw.scale = 0.5f + unit(rng) * 1.5f;
+        draw.orientation = quat(1.f, 0.f, 0.f, 0.f);
+        draw.meshIndex = 1;
+
+        testDraws.push_back(uint32_t(draws.size()));
+        draws.push_back(draw);
+    }
+}
+
+// independent of setupTriangles and both rasterizers: casts a ray through every pixel corner and intersects it with the
+// occluders' triangles in view space, in double precision, so clipping needs no special cases. A pixel is covered when
+// all 4 corner rays hit the same triangle in front of the near plane, at the farthest of the 4 depths. The rasterizers
+// snap vertices to 1/16 pixels, so coverage within 1/8 pixels of an edge is ambiguous; every pixel gets a range of
+// depths the rasterizers may produce: lower only counts certain coverage, upper also ambiguous coverage. Triangles that
+// cross the near plane or the guard band are split into several by clipping, and pixels on the new edges aren't covered
+// by any of them, so those only raise upper
+static void rasterizeOccludersByRays(const CullData& cullData, const std::vector<MeshDraw>& draws, const std::vector<uint32_t>& occluders, const std::vector<OccluderMesh>& occluderMeshes, uint32_t width, uint32_t height, std::vector<float>& lower, std::vector<float>& upper)
+{
+    const double edgeMargin = 1.0 / 8.0;
+
+    enum Corner
+    {
+        Corner_Outside,
+        Corner_Ambiguous,
+        Corner_Inside,
+    };
+
+    lower.assign(width * height, 0.f);
+    upper.assign(width * height, 0.f);
+
+    uint32_t cornersX = width + 1, cornersY = height + 1;
+    std::vector<uint8_t> cornerStates(cornersX * cornersY);
+    std::vector<double> cornerDepths(cornersX * cornersY);
+
+    // ray direction through a corner, at view space z = 1
+    auto getRay = [&](uint32_t x, uint32_t y)
+    {
+        return glm::dvec3((2.0 * x / width - 1.0) / cullData.P00, (1.0 - 2.0 * y / height) / cullData.P11, 1.0);
+    };
+
+    for (uint32_t drawIndex : occluders)
+    {
+        const MeshDraw& draw = draws[drawIndex];
+        const OccluderMesh& mesh = occluderMeshes[draw.meshIndex];
+
+        double qx = draw.orientation.x, qy = draw.orientation.y, qz = draw.orientation.z, qw = draw.orientation.w;
+        double rotation[3][3] = {
+            { 1 - 2 * (qy * qy + qz * qz), 2 * (qx * qy - qw * qz), 2 * (qx * qz + qw * qy) },
+            { 2 * (qx * qy + qw * qz), 1 - 2 * (qx * qx + qz * qz), 2 * (qy * qz - qw * qx) },
+            { 2 * (qx * qz - qw * qy), 2 * (qy * qz + qw * qx), 1 - 2 * (qx * qx + qy * qy) },
+        };
+
+        std::vector<glm::dvec3> vertices(mesh.positions.size());
+
+        for (size_t i = 0; i < mesh.positions.size(); ++i)
+        {
+            double local[3] = { mesh.positions[i].x, mesh.positions[i].y, mesh.positions[i].z };
+            double world[4] = { draw.position.x, draw.position.y, draw.position.z, 1.0 };
+
+            for (int row = 0; row < 3; ++row)
+                for (int column = 0; column < 3; ++column)
+                    world[row] += rotation[row][column] * local[column] * draw.scale;
+
+            double view[3] = {};
+            for (int row = 0; row < 3; ++row)
+                for (int column = 0; column < 4; ++column)
+                    view[row] += double(cullData.view[column][row]) * world[column];
+
+            vertices[i] = glm::dvec3(view[0], view[1], view[2]);
+        }
+
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            glm::dvec3 v[3] = { vertices[mesh.indices[i + 0]], vertices[mesh.indices[i + 1]], vertices[mesh.indices[i + 2]] };
+
+            // a ray is inside when it is a positive combination of the vertices; every edge plane through the camera
+            // then has the ray on the same side as the opposite vertex
+            double volume = glm::dot(glm::cross(v[0], v[1]), v[2]);
+            if (volume == 0)
+                continue;
+
+            glm::dvec3 edges[3];
+            double edgeScales[3];
+
+            for (int edge = 0; edge < 3; ++edge)
+            {
+                edges[edge] = glm::cross(v[edge], v[(edge + 1) % 3]) * (volume > 0 ? 1.0 : -1.0);
+
+                // the edge function is affine in pixels; this converts it to a distance in pixels
+                edgeScales[edge] = 1.0 / glm::length(glm::dvec2(edges[edge].x * 2 / (width * cullData.P00), edges[edge].y * 2 / (height * cullData.P11)));
+            }
+
+            glm::dvec3 normal = glm::cross(v[1] - v[0], v[2] - v[0]);
+            double offset = glm::dot(normal, v[0]);
+
+            bool clipped = false;
+            for (const glm::dvec3& vertex : v)
+                clipped = clipped || vertex.z < cullData.znear || fabs(vertex.x * cullData.P00) > GUARD_BAND * vertex.z || fabs(vertex.y * cullData.P11) > GUARD_BAND * vertex.z;
+
+            for (uint32_t y = 0; y < cornersY; ++y)
+            {
+                for (uint32_t x = 0; x < cornersX; ++x)
+                {
+                    glm::dvec3 ray = getRay(x, y);
+
+                    double distance = INFINITY;
+                    for (int edge = 0; edge < 3; ++edge)
+                        distance = std::min(distance, glm::dot(edges[edge], ray) * edgeScales[edge]);
+
+                    // view space z of the hit, the ray's z is 1
+                    double z = offset / glm::dot(normal, ray);
+                    double nearDistance = (z - cullData.znear) / cullData.znear;
+
+                    uint8_t state = Corner_Inside;
+                    if (distance < -edgeMargin || !(nearDistance > -1e-3))
+                        state = Corner_Outside;
+                    else if (distance < edgeMargin || nearDistance < 1e-3)
+                        state = Corner_Ambiguous;
+
+                    cornerStates[y * cornersX + x] = state;
+                    cornerDepths[y * cornersX + x] = state == Corner_Outside ? 0.0 : cullData.znear / z;
+                }
+            }
+
+            for (uint32_t y = 0; y < height; ++y)
+            {
+                for (uint32_t x = 0; x < width; ++x)
+                {
+                    uint32_t corners[4] = { y * cornersX + x, y * cornersX + x + 1, (y + 1) * cornersX + x, (y + 1) * cornersX + x + 1 };
+
+                    uint8_t state = Corner_Inside;
+                    double minDepth = INFINITY, maxDepth = 0;
+
+                    for (uint32_t corner : corners)
+                    {
+                        state = std::min(state, cornerStates[corner]);
+                        minDepth = std::min(minDepth, cornerDepths[corner]);
+                        maxDepth = std::max(maxDepth, cornerDepths[corner]);
+                    }
+
+                    if (state == Corner_Outside)
+                        continue;
+
+                    // snapping tilts the depth plane a little, by less than a quarter of its change across the pixel
+                    double margin = (maxDepth - minDepth) * 0.25 + minDepth * 1e-4;
+
+                    upper[y * width + x] = std::max(upper[y * width + x], float(minDepth + margin));
+
+                    if (state == Corner_Inside && !clipped)
+                        lower[y * width + x] = std::max(lower[y * width + x], float(std::max(minDepth - margin, 0.0)));
+                }
+            }
+        }
+    }
+}
+
+// compares the buffer against rasterizeOccludersByRays
+static bool checkOcclusionBuffer(const OcclusionBuffer& buffer, const char* name, const CullData& cullData, const std::vector<MeshDraw>& draws, const std::vector<uint32_t>& occluders, const std::vector<OccluderMesh>& occluderMeshes)
+{
+    uint32_t width = buffer.getWidth(), height = buffer.getHeight();
+
+    std::vector<float> lower, upper;
+    rasterizeOccludersByRays(cullData, draws, occluders, occluderMeshes, width, height, lower, upper);
+
+    const std::vector<float>& depth = buffer.getDepth();
+
+    size_t covered = 0, mismatches = 0, firstMismatch = 0;
+
+    for (size_t i = 0; i < depth.size(); ++i)
+    {
+        covered += depth[i] > 0;
+
+        if (depth[i] < lower[i] || depth[i] > upper[i])
+        {
+            firstMismatch = mismatches ? firstMismatch : i;
+            mismatches++;
+        }
+    }
+
+    printf("  %-9s ray check: %d of %d pixels covered\n", name, int(covered), int(depth.size()));
+
+    if (mismatches)
+    {
+        printf("Error: %d pixels differ from ray casting, e.g. pixel %d,%d is %g instead of %g..%g\n", int(mismatches), int(firstMismatch % width), int(firstMismatch / width), depth[firstMismatch], lower[firstMismatch], upper[firstMismatch]);
+        return false;
+    }
+
+    return true;
+}
+
+bool benchmarkOcclusion(uint32_t drawCount, tmc::ex_cpu& executor, int iterations)
+{
+    if (!drawCount)
+        drawCount = 100000;
+
+    iterations = std::max(iterations, 1);
+
+    std::vector<MeshDraw> draws;
+    std::vector<Mesh> meshes;
+    std::vector<OccluderMesh> occluderMeshes;
+    std::vector<uint32_t> occluders, testDraws;
+    generateOcclusionScene(drawCount, draws, meshes, occluderMeshes, occluders, testDraws);
+
+    // same camera setup as Renderer::beginFrame for a 70 degree 16:9 view
+    float fovY = 70.f * 3.14159265f / 180.f;
+
+    CullData cullData = {};
+    cullData.view = mat4(1.f);
+    cullData.P00 = 1.0f / (tanf(fovY * 0.5f) * (16.f / 9.f));
+    cullData.P11 = 1.0f / tanf(fovY * 0.5f);
+    cullData.znear = 0.1f;
+    cullData.zfar = 200.f;
+
+    bool matched = true;
+
+    std::vector<float> referenceDepth;
+    std::vector<uint32_t> referenceVisible;
+
+    printf("Occlusion: %d occluders, %d draws, %dx%d buffer\n", int(occluders.size()), int(testDraws.size()), 256, 144);
+
+    for (int rasterizer = 0; rasterizer < 2; ++rasterizer)
+    {
+        for (tmc::ex_cpu* pool : { (tmc::ex_cpu*)nullptr, &executor })
+        {
+            OcclusionBuffer buffer;
+            buffer.init(256, 144);
+
+            auto start = std::chrono::high_resolution_clock::now();
+
+            for (int i = 0; i < iterations; ++i)
+                buffer.render(cullData, draws, occluders, occluderMeshes, pool, OcclusionBuffer::Rasterizer(rasterizer));
+
+            auto middle = std::chrono::high_resolution_clock::now();
+
+            std::vector<uint32_t> visible;
+            for (int i = 0; i < iterations; ++i)
+            {
+                visible.clear();
+                buffer.filterDraws(draws, meshes, testDraws, visible, pool);
+            }
+
+            auto end = std::chrono::high_resolution_clock::now();
+
+            double renderTime = std::chrono::duration<double, std::milli>(middle - start).count() / iterations;
+            double testTime = std::chrono::duration<double, std::milli>(end - middle).count() / iterations;
+            int threads = pool ? int(pool->thread_count()) : 1;
+
+            printf("  %-9s %2d threads: render %7.3f ms (%d triangles), test %7.3f ms, %d of %d draws occluded\n", rasterizer == OcclusionBuffer::Rasterizer_SIMD ? "simd" : "reference", threads, renderTime, int(buffer.getTriangleCount()), testTime, int(testDraws.size() - visible.size()), int(testDraws.size()));
+
+            if (referenceDepth.empty())
+            {
+                referenceDepth = buffer.getDepth();
+                referenceVisible = visible;
+
+                // tiles only skip work, so the per pixel test has to agree on every draw
+                size_t mismatches = 0;
+                for (uint32_t drawIndex : testDraws)
+                {
+                    vec4 sphere = getDrawSphere(draws[drawIndex], meshes[draws[drawIndex].meshIndex]);
+                    mismatches += buffer.isOccluded(sphere) != buffer.isOccludedReference(sphere);
+                }
+
+                if (mismatches)
+                {
+                    printf("Error: tile and per pixel tests disagree on %d draws\n", int(mismatches));
+                    matched = false;
+                }
+            }
+            else
+            {
+                size_t mismatches = 0;
+                for (size_t i = 0; i < referenceDepth.size(); ++i)
+                    mismatches += buffer.getDepth()[i] != referenceDepth[i];
+
+                if (mismatches || visible != referenceVisible)
+                {
+                    printf("Error: %d pixels and %s visible draws differ from the single threaded reference rasterizer\n", int(mismatches), visible == referenceVisible ? "no" : "the");
+                    matched = false;
+                }
+            }
+        }
+    }
+
+    // the second camera stands right in front of a wall, looking past it, with a near plane far enough out that the wall
+    // crosses it on screen; walls also cross the guard band
+    vec3 eye = draws[occluders[0]].position - vec3(0.f, 0.f, 1.5f);
+    vec3 forward = vec3(0.8f, 0.f, 0.6f), up = vec3(0.f, 1.f, 0.f), right = glm::cross(up, forward);
+
+    CullData insideData = cullData;
+    insideData.view = mat4(1.f);
+    insideData.znear = 2.f;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        insideData.view[i][0] = right[i];
+        insideData.view[i][1] = up[i];
+        insideData.view[i][2] = forward[i];
+    }
+
+    insideData.view[3][0] = -glm::dot(right, eye);
+    insideData.view[3][1] = -glm::dot(up, eye);
+    insideData.view[3][2] = -glm::dot(forward, eye);
+
+    for (const CullData& viewData : { cullData, insideData })
+    {
+        for (int rasterizer = 0; rasterizer < 2; ++rasterizer)
+        {
+            OcclusionBuffer buffer;
+            buffer.init(256, 144);
+            buffer.render(viewData, draws, occluders, occluderMeshes, &executor, OcclusionBuffer::Rasterizer(rasterizer));
+
+            matched &= checkOcclusionBuffer(buffer, rasterizer == OcclusionBuffer::Rasterizer_SIMD ? "simd" : "reference", viewData, draws, occluders, occluderMeshes);
+        }
+    }
+
+    return matched;
+}
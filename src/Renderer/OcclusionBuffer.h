@@ -0,0 +1,123 @@
+#pragma once
+
+#include "GfxTypes.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace tmc { class ex_cpu; }
+
+/**
+ * Occluder geometry in mesh space, usually the coarsest LOD of a mesh
+ */
+struct OccluderMesh
+{
+    std::vector<vec3> positions;
+    std::vector<uint32_t> indices;
+};
+
+/**
+ * Fills the occluder with the coarsest LOD of the mesh
+ */
+void buildOccluderMesh(const Geometry& geometry, const Mesh& mesh, OccluderMesh& occluder);
+
+/**
+ * Low resolution depth buffer for coarse occlusion culling on the CPU, before anything is submitted to the GPU
+ * Occluders are clipped to the near plane and a guard band, then rasterized conservatively: a pixel is only written when
+ * the triangle covers all of it, with the triangle's farthest depth within the pixel. Depth is stored like the depth
+ * pyramid, znear / z, so 0 is infinitely far and larger values are closer. 8x8 tiles keep their farthest depth, so most
+ * tests only touch the tiles a draw's bounding sphere projects to. Draws that intersect the near plane or are entirely
+ * off screen are never reported as occluded
+ */
+class OcclusionBuffer
+{
+public:
+    enum Rasterizer
+    {
+        Rasterizer_Reference, // one pixel at a time, evaluating every edge function from scratch
+        Rasterizer_SIMD, // 4 pixels at a time with incremental edge functions; SSE2 only, the reference elsewhere
+    };
+
+    static const uint32_t TILE_SIZE = 8;
+    static const uint32_t MAX_SIZE = 512;
+
+    /**
+     * Allocates the buffer; sizes are rounded up to whole tiles
+     */
+    void init(uint32_t width, uint32_t height);
+
+    /**
+     * Clears the buffer and rasterizes the occluders as seen by the camera described by cullData
+     *
+     * @param draws Draws of the scene
+     * @param occluders Indices of draws to rasterize
+     * @param occluderMeshes Occluder geometry, indexed by MeshDraw::meshIndex
+     * @param executor Splits triangle setup and the buffer's rows across its workers; nullptr runs on the calling thread
+     */
+    void render(const CullData& cullData, const std::vector<MeshDraw>& draws, const std::vector<uint32_t>& occluders, const std::vector<OccluderMesh>& occluderMeshes, tmc::ex_cpu* executor = nullptr, Rasterizer rasterizer = Rasterizer_SIMD);
+
+    /**
+     * Tests a world space bounding sphere against the buffer, using tiles to skip covered areas
+     */
+    bool isOccluded(const vec4& sphere) const;
+
+    /**
+     * Same as isOccluded, but tests every pixel; used to validate the tile hierarchy
+     */
+    bool isOccludedReference(const vec4& sphere) const;
+
+    /**
+     * Appends draws that aren't occluded, in the order of drawIndices
+     *
+     * @param drawIndices Draws to test, e.g. the result of a frustum query
+     */
+    void filterDraws(const std::vector<MeshDraw>& draws, const std::vector<Mesh>& meshes, const std::vector<uint32_t>& drawIndices, std::vector<uint32_t>& visibleDraws, tmc::ex_cpu* executor = nullptr) const;
+
+    const std::vector<float>& getDepth() const { return m_depth; }
+    uint32_t getWidth() const { return m_width; }
+    uint32_t getHeight() const { return m_height; }
+
+    // triangles rasterized by the last render, after clipping
+    uint32_t getTriangleCount() const { return uint32_t(m_triangles.size()); }
+
+private:
+    struct Triangle
+    {
+        int32_t x[3], y[3]; // screen position in 1/16 pixels, counter clockwise on screen
+        int32_t minX, minY, maxX, maxY; // pixels the triangle may cover, inclusive
+        float a, b, c; // depth at pixel center (x, y) is a * x + b * y + c, lowered to the farthest depth within the pixel
+    };
+
+    struct ScreenRect
+    {
+        int32_t minX, minY, maxX, maxY;
+        float depth;
+    };
+
+    void setupTriangles(const MeshDraw& draw, const OccluderMesh& mesh, std::vector<Triangle>& triangles) const;
+    void rasterizeReference(const Triangle& triangle, uint32_t rowBegin, uint32_t rowEnd);
+    void rasterizeSIMD(const Triangle& triangle, uint32_t rowBegin, uint32_t rowEnd);
+    void updateTiles(uint32_t rowBegin, uint32_t rowEnd);
+
+    bool getScreenRect(const vec4& sphere, ScreenRect& rect) const;
+
+    uint32_t m_width = 0, m_height = 0;
+    uint32_t m_tilesX = 0, m_tilesY = 0;
+
+    CullData m_cullData = {};
+
+    std::vector<float> m_depth; // row major, znear / z
+    std::vector<float> m_tileDepth; // farthest depth of every tile
+    std::vector<Triangle> m_triangles;
+};
+
+/**
+ * Rasterizes synthetic occluders with both rasterizers, single threaded and across the executor, tests draws against
+ * them and prints timings and the culled share
+ * Checks that both rasterizers produce identical buffers, that tile and per pixel tests agree, and that the buffers match
+ * ray casting the occluders, also from a camera in front of an occluder that crosses the near plane
+ *
+ * @param drawCount Draws to test; 0 tests 100k
+ * @return False if a check failed
+ */
+bool benchmarkOcclusion(uint32_t drawCount, tmc::ex_cpu& executor, int iterations);
@@ -0,0 +1,291 @@
+#include "PipelineVariantCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+bool PipelineVariantKey::operator==(const PipelineVariantKey& other) const
+{
+    if (program != other.program || graphics != other.graphics || constantCount != other.constantCount)
+        return false;
+
+    if (memcmp(constants, other.constants, constantCount * sizeof(int)) != 0)
+        return false;
+
+    if (!graphics)
+        return true;
+
+    return colorAttachmentCount == other.colorAttachmentCount &&
+           memcmp(colorAttachmentFormats, other.colorAttachmentFormats, colorAttachmentCount * sizeof(VkFormat)) == 0 &&
+           depthAttachmentFormat == other.depthAttachmentFormat &&
+           stencilAttachmentFormat == other.stencilAttachmentFormat &&
+           viewMask == other.viewMask;
+}
+
+size_t PipelineVariantKeyHash::operator()(const PipelineVariantKey& key) const
+{
+    // FNV-1a over the fields that participate in equality
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](uint64_t value) { hash = (hash ^ value) * 1099511628211ull; };
+
+    mix(uint64_t(uintptr_t(key.program)));
+    mix(key.graphics);
+    mix(key.constantCount);
+
+    for (uint32_t i = 0; i < key.constantCount; ++i)
+        mix(uint32_t(key.constants[i]));
+
+    if (key.graphics)
+    {
+        mix(key.colorAttachmentCount);
+        for (uint32_t i = 0; i < key.colorAttachmentCount; ++i)
+            mix(key.colorAttachmentFormats[i]);
+        mix(key.depthAttachmentFormat);
+        mix(key.stencilAttachmentFormat);
+        mix(key.viewMask);
+    }
+
+    return size_t(hash);
+}
+
+static void fillConstants(PipelineVariantKey& key, Constants constants)
+{
+    assert(constants.size() <= COUNTOF(key.constants));
+
+    key.constantCount = uint32_t(constants.size());
+    for (size_t i = 0; i < constants.size(); ++i)
+        key.constants[i] = constants.begin()[i];
+}
+
+static void fillRenderingInfo(PipelineVariantKey& key, const VkPipelineRenderingCreateInfo& renderingInfo)
+{
+    assert(renderingInfo.colorAttachmentCount <= COUNTOF(key.colorAttachmentFormats));
+
+    key.graphics = true;
+    key.colorAttachmentCount = renderingInfo.colorAttachmentCount;
+    for (uint32_t i = 0; i < renderingInfo.colorAttachmentCount; ++i)
+        key.colorAttachmentFormats[i] = renderingInfo.pColorAttachmentFormats[i];
+    key.depthAttachmentFormat = renderingInfo.depthAttachmentFormat;
+    key.stencilAttachmentFormat = renderingInfo.stencilAttachmentFormat;
+    key.viewMask = renderingInfo.viewMask;
+}
+
+void PipelineVariantCache::init(VkDevice device, VkPipelineCache pipelineCache)
+{
+    m_device = device;
+    m_pipelineCache = pipelineCache;
+}
+
+void PipelineVariantCache::registerProgram(const char* name, const Program& program)
+{
+    for (auto& entry : m_programs)
+        if (entry.first == name)
+        {
+            entry.second = &program;
+            return;
+        }
+
+    m_programs.push_back(std::make_pair(std::string(name), &program));
+}
+
+VkPipeline PipelineVariantCache::get(const Program& program, Constants constants)
+{
+    PipelineVariantKey key = {};
+    key.program = &program;
+    fillConstants(key, constants);
+
+    return getOrCreate(key);
+}
+
+VkPipeline PipelineVariantCache::get(const Program& program, const VkPipelineRenderingCreateInfo& renderingInfo, Constants constants)
+{
+    PipelineVariantKey key = {};
+    key.program = &program;
+    fillRenderingInfo(key, renderingInfo);
+    fillConstants(key, constants);
+
+    return getOrCreate(key);
+}
+
+VkPipeline PipelineVariantCache::getOrCreate(const PipelineVariantKey& key)
+{
+    // compiling under the lock stalls other recording threads, but misses are rare once the variant list is prewarmed
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_variants.find(key);
+    if (it != m_variants.end())
+        return it->second;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    VkPipeline pipeline = compile(key);
+
+    // the constants are chosen by the C++ side and reloads can't change the declared ones, so a mismatch is a code bug
+    if (!pipeline)
+    {
+        const char* name = getProgramName(key.program);
+        fprintf(stderr, "Error: %s pipeline variant failed to compile\n", name ? name : "unregistered");
+        std::exit(1);
+    }
+
+    // compiling in the middle of a frame is a hitch; printing it makes missing prewarm entries easy to spot, but variants
+    // recompiled after a shader reload were already reported
+    if (m_reported.insert(key).second)
+    {
+        const char* name = getProgramName(key.program);
+        printf("Compiled %s pipeline variant on demand in %.2f ms\n", name ? name : "unregistered", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+
+    m_variants[key] = pipeline;
+    return pipeline;
+}
+
+const char* PipelineVariantCache::getProgramName(const Program* program) const
+{
+    for (auto& entry : m_programs)
+        if (entry.second == program)
+            return entry.first.c_str();
+
+    return nullptr;
+}
+
+VkPipeline PipelineVariantCache::compile(const PipelineVariantKey& key) const
+{
+    assert(m_device);
+
+    if (!key.graphics)
+        return createComputePipeline(m_device, m_pipelineCache, *key.program, key.constants, key.constantCount);
+
+    VkPipelineRenderingCreateInfo renderingInfo = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+    renderingInfo.viewMask = key.viewMask;
+    renderingInfo.colorAttachmentCount = key.colorAttachmentCount;
+    renderingInfo.pColorAttachmentFormats = key.colorAttachmentFormats;
+    renderingInfo.depthAttachmentFormat = key.depthAttachmentFormat;
+    renderingInfo.stencilAttachmentFormat = key.stencilAttachmentFormat;
+
+    return createGraphicsPipeline(m_device, m_pipelineCache, renderingInfo, *key.program, key.constants, key.constantCount);
+}
+
+void PipelineVariantCache::invalidate(const Program& program, std::vector<VkPipeline>& retired)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto it = m_variants.begin(); it != m_variants.end();)
+    {
+        if (it->first.program == &program)
+        {
+            retired.push_back(it->second);
+            it = m_variants.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+bool PipelineVariantCache::prewarm(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t compiled = 0;
+
+    char type[16], name[128];
+    while (fscanf(file, "%15s %127s", type, name) == 2)
+    {
+        PipelineVariantKey key = {};
+        bool valid = true;
+
+        if (strcmp(type, "graphics") == 0)
+        {
+            key.graphics = true;
+
+            valid &= fscanf(file, "%u", &key.colorAttachmentCount) == 1 && key.colorAttachmentCount <= COUNTOF(key.colorAttachmentFormats);
+            for (uint32_t i = 0; valid && i < key.colorAttachmentCount; ++i)
+                valid &= fscanf(file, "%d", reinterpret_cast<int*>(&key.colorAttachmentFormats[i])) == 1;
+
+            valid = valid && fscanf(file, "%d %d %u", reinterpret_cast<int*>(&key.depthAttachmentFormat), reinterpret_cast<int*>(&key.stencilAttachmentFormat), &key.viewMask) == 3;
+        }
+        else
+            valid &= strcmp(type, "compute") == 0;
+
+        valid = valid && fscanf(file, "%u", &key.constantCount) == 1 && key.constantCount <= COUNTOF(key.constants);
+        for (uint32_t i = 0; valid && i < key.constantCount; ++i)
+            valid &= fscanf(file, "%d", &key.constants[i]) == 1;
+
+        if (!valid)
+        {
+            fprintf(stderr, "Warning: %s is malformed, stopping prewarm\n", path);
+            break;
+        }
+
+        for (auto& entry : m_programs)
+            if (entry.first == name)
+                key.program = entry.second;
+
+        // programs may have been renamed or removed since the list was written
+        if (!key.program || m_variants.count(key))
+            continue;
+
+        VkPipeline pipeline = compile(key);
+        if (!pipeline)
+        {
+            fprintf(stderr, "Warning: %s doesn't match the current shaders, stopping prewarm\n", path);
+            break;
+        }
+
+        m_variants[key] = pipeline;
+        compiled++;
+    }
+
+    fclose(file);
+
+    printf("Prewarmed %d pipeline variants in %.2f ms\n", int(compiled), std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    return true;
+}
+
+bool PipelineVariantCache::save(const char* path) const
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    for (auto& variant : m_variants)
+    {
+        const PipelineVariantKey& key = variant.first;
+
+        const char* name = getProgramName(key.program);
+        if (!name)
+            continue;
+
+        if (key.graphics)
+        {
+            fprintf(file, "graphics %s %u", name, key.colorAttachmentCount);
+            for (uint32_t i = 0; i < key.colorAttachmentCount; ++i)
+                fprintf(file, " %d", int(key.colorAttachmentFormats[i]));
+            fprintf(file, " %d %d %u", int(key.depthAttachmentFormat), int(key.stencilAttachmentFormat), key.viewMask);
+        }
+        else
+            fprintf(file, "compute %s", name);
+
+        fprintf(file, " %u", key.constantCount);
+        for (uint32_t i = 0; i < key.constantCount; ++i)
+            fprintf(file, " %d", key.constants[i]);
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+    return true;
+}
+
+void PipelineVariantCache::destroy()
+{
+    for (auto& variant : m_variants)
+        vkDestroyPipeline(m_device, variant.second, 0);
+
+    m_variants.clear();
+    m_reported.clear();
+}
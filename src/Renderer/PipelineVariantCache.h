@@ -0,0 +1,125 @@
+#pragma once
+
+#include "niagara/common.h"
+#include "niagara/shaders.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Identifies a pipeline variant: program, attachment formats (graphics only) and specialization constants
+ */
+struct PipelineVariantKey
+{
+    const Program* program;
+
+    bool graphics;
+    uint32_t colorAttachmentCount;
+    VkFormat colorAttachmentFormats[8];
+    VkFormat depthAttachmentFormat;
+    VkFormat stencilAttachmentFormat;
+    uint32_t viewMask;
+
+    uint32_t constantCount;
+    int constants[8];
+
+    bool operator==(const PipelineVariantKey& other) const;
+};
+
+struct PipelineVariantKeyHash
+{
+    size_t operator()(const PipelineVariantKey& key) const;
+};
+
+/**
+ * Compiles pipeline variants on first use and keeps them for the lifetime of their program
+ * Variants used in a session can be saved and compiled upfront on the next run
+ * get may be called from several recording threads at once
+ */
+class PipelineVariantCache
+{
+public:
+    /**
+     * Sets the device and pipeline cache used to compile variants
+     *
+     * @param device The Vulkan device
+     * @param pipelineCache Optional driver pipeline cache
+     */
+    void init(VkDevice device, VkPipelineCache pipelineCache);
+
+    /**
+     * Names a program so that its variants can be saved and prewarmed
+     * The program is identified by address, so it must outlive the cache
+     *
+     * @param name Stable name used in the variant list
+     * @param program Program owned by the caller
+     */
+    void registerProgram(const char* name, const Program& program);
+
+    /**
+     * Returns a compute pipeline variant, compiling it if needed
+     *
+     * @param program Registered or caller-owned program
+     * @param constants Specialization constants, in constant_id order
+     * @return Pipeline owned by the cache; exits if the constants don't match the program
+     */
+    VkPipeline get(const Program& program, Constants constants = {});
+
+    /**
+     * Returns a graphics pipeline variant, compiling it if needed
+     *
+     * @param program Registered or caller-owned program
+     * @param renderingInfo Attachment formats used with dynamic rendering
+     * @param constants Specialization constants, in constant_id order
+     * @return Pipeline owned by the cache; exits if the constants don't match the program
+     */
+    VkPipeline get(const Program& program, const VkPipelineRenderingCreateInfo& renderingInfo, Constants constants = {});
+
+    /**
+     * Removes all variants of a program, e.g. when it's recreated after a shader reload
+     *
+     * @param program Program whose variants are dropped
+     * @param retired Receives the pipelines; the caller destroys them once they are no longer in use
+     */
+    void invalidate(const Program& program, std::vector<VkPipeline>& retired);
+
+    /**
+     * Compiles variants listed in a file written by save
+     * Stops at the first entry that no longer matches its program's shaders
+     *
+     * @param path Variant list path
+     * @return True if the list was found
+     */
+    bool prewarm(const char* path);
+
+    /**
+     * Writes all variants of registered programs to a file
+     *
+     * @param path Variant list path
+     * @return True if the list was written
+     */
+    bool save(const char* path) const;
+
+    /**
+     * Destroys all pipelines; requires the device to be idle
+     */
+    void destroy();
+
+    size_t size() const { return m_variants.size(); }
+
+private:
+    VkPipeline getOrCreate(const PipelineVariantKey& key);
+    VkPipeline compile(const PipelineVariantKey& key) const;
+    const char* getProgramName(const Program* program) const;
+
+    VkDevice m_device = 0;
+    VkPipelineCache m_pipelineCache = 0;
+
+    std::mutex m_mutex;
+    std::unordered_map<PipelineVariantKey, VkPipeline, PipelineVariantKeyHash> m_variants;
+    std::unordered_set<PipelineVariantKey, PipelineVariantKeyHash> m_reported; // variants compiled on demand so far
+    std::vector<std::pair<std::string, const Program*>> m_programs;
+};
@@ -0,0 +1,426 @@
+#include "RenderGraph.h"
+#include "niagara/resources.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+void RenderGraph::reset()
+{
+    m_passes.clear();
+
+    for (Resource& resource : m_resources)
+        resource.output = false;
+}
+
+RenderGraphResource RenderGraph::findResource(const char* name)
+{
+    for (size_t i = 0; i < m_resources.size(); ++i)
+        if (m_resources[i].name == name)
+            return RenderGraphResource(i);
+
+    Resource resource = {};
+    resource.name = name;
+    resource.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    m_resources.push_back(resource);
+    return RenderGraphResource(m_resources.size() - 1);
+}
+
+RenderGraphResource RenderGraph::importBuffer(const char* name, VkBuffer buffer, bool persistent)
+{
+    RenderGraphResource index = findResource(name);
+    Resource& resource = m_resources[index];
+
+    // a recreated buffer has no pending accesses
+    if (resource.buffer != buffer)
+    {
+        resource.writeStage = resource.readStage = 0;
+        resource.writeAccess = resource.readAccess = 0;
+    }
+
+    resource.isImage = false;
+    resource.buffer = buffer;
+    resource.persistent = persistent;
+
+    return index;
+}
+
+RenderGraphResource RenderGraph::importImage(const char* name, VkImage image, VkImageAspectFlags aspectMask, bool persistent, const RenderGraphState* initialState)
+{
+    RenderGraphResource index = findResource(name);
+    Resource& resource = m_resources[index];
+
+    if (initialState)
+    {
+        resource.writeStage = initialState->stage;
+        resource.writeAccess = initialState->access;
+        resource.readStage = 0;
+        resource.readAccess = 0;
+        resource.layout = initialState->layout;
+    }
+    else if (resource.image != image)
+    {
+        // images are recreated on resize; their contents are undefined until the first write
+        resource.writeStage = resource.readStage = 0;
+        resource.writeAccess = resource.readAccess = 0;
+        resource.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+
+    resource.isImage = true;
+    resource.image = image;
+    resource.aspectMask = aspectMask;
+    resource.persistent = persistent;
+
+    return index;
+}
+
+void RenderGraph::markOutput(RenderGraphResource resource)
+{
+    assert(resource < m_resources.size());
+    m_resources[resource].output = true;
+}
+
+uint32_t RenderGraph::addPass(const char* name, PassCallback callback)
+{
+    Pass pass = {};
+    pass.name = name;
+    pass.callback = std::move(callback);
+
+    m_passes.push_back(std::move(pass));
+    return uint32_t(m_passes.size() - 1);
+}
+
+void RenderGraph::setSideEffects(uint32_t pass)
+{
+    assert(pass < m_passes.size());
+    m_passes[pass].sideEffects = true;
+}
+
+void RenderGraph::read(uint32_t pass, RenderGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout)
+{
+    addUsage(pass, { resource, { stage, access, layout }, /* write= */ false, /* discard= */ false });
+}
+
+void RenderGraph::write(uint32_t pass, RenderGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout, bool discard)
+{
+    addUsage(pass, { resource, { stage, access, layout }, /* write= */ true, discard });
+}
+
+void RenderGraph::addUsage(uint32_t pass, const Usage& usage)
+{
+    assert(pass < m_passes.size());
+    assert(usage.resource < m_resources.size());
+
+    // all accesses of a resource within a pass are covered by a single barrier
+    for (Usage& existing : m_passes[pass].usages)
+        if (existing.resource == usage.resource)
+        {
+            assert(!m_resources[usage.resource].isImage || existing.state.layout == usage.state.layout);
+
+            existing.state.stage |= usage.state.stage;
+            existing.state.access |= usage.state.access;
+            existing.discard = existing.discard && usage.discard && existing.write && usage.write;
+            existing.write |= usage.write;
+            return;
+        }
+
+    m_passes[pass].usages.push_back(usage);
+}
+
+void RenderGraph::cullPasses()
+{
+    std::vector<bool> needed(m_resources.size());
+
+    for (size_t i = 0; i < m_resources.size(); ++i)
+        needed[i] = m_resources[i].persistent || m_resources[i].output;
+
+    // walk backwards: a pass is needed if a later needed pass (or the outside world) reads what it writes
+    for (size_t i = m_passes.size(); i-- > 0;)
+    {
+        Pass& pass = m_passes[i];
+
+        bool keep = pass.sideEffects;
+        for (const Usage& usage : pass.usages)
+            keep |= usage.write && needed[usage.resource];
+
+        pass.culled = !keep;
+
+        if (!keep)
+            continue;
+
+        // a discarding write starts a new version, so earlier writers only matter if somebody else reads them
+        for (const Usage& usage : pass.usages)
+            if (usage.discard)
+                needed[usage.resource] = m_resources[usage.resource].persistent;
+
+        for (const Usage& usage : pass.usages)
+            if (!usage.discard)
+                needed[usage.resource] = true;
+    }
+}
+
+void RenderGraph::computeBarriers(Pass& pass)
+{
+    for (const Usage& usage : pass.usages)
+    {
+        Resource& resource = m_resources[usage.resource];
+
+        bool transition = resource.isImage && usage.state.layout != resource.layout;
+        VkImageLayout oldLayout = usage.discard ? VK_IMAGE_LAYOUT_UNDEFINED : resource.layout;
+
+        VkPipelineStageFlags2 srcStage = 0;
+        VkAccessFlags2 srcAccess = 0;
+        bool barrier = false;
+
+        if (usage.write || transition)
+        {
+            // readers already waited for the last write, so a later write only has to wait for them (write-after-read);
+            // without readers the last write has to be made available first (write-after-write)
+            srcStage = resource.readStage ? resource.readStage : resource.writeStage;
+            srcAccess = resource.readStage ? 0 : resource.writeAccess;
+            barrier = srcStage != 0 || transition;
+
+            if (usage.write)
+            {
+                resource.writeStage = usage.state.stage;
+                resource.writeAccess = usage.state.access;
+                resource.readStage = 0;
+                resource.readAccess = 0;
+            }
+            else
+            {
+                // later readers in other stages chain to the transition through this pass' stages
+                resource.writeStage = usage.state.stage;
+                resource.writeAccess = 0;
+                resource.readStage = usage.state.stage;
+                resource.readAccess = usage.state.access;
+            }
+        }
+        else
+        {
+            // read-after-read is free; read-after-write is needed once per stage and access that hasn't seen the write yet
+            bool visible = (usage.state.stage & ~resource.readStage) == 0 && (usage.state.access & ~resource.readAccess) == 0;
+
+            srcStage = resource.writeStage;
+            srcAccess = resource.writeAccess;
+            barrier = srcStage != 0 && !visible;
+
+            resource.readStage |= usage.state.stage;
+            resource.readAccess |= usage.state.access;
+        }
+
+        if (!barrier)
+            continue;
+
+        if (resource.isImage)
+            pass.imageBarriers.push_back(imageBarrier(resource.image, srcStage, srcAccess, oldLayout, usage.state.stage, usage.state.access, usage.state.layout, resource.aspectMask));
+        else
+            pass.bufferBarriers.push_back(bufferBarrier(resource.buffer, srcStage, srcAccess, usage.state.stage, usage.state.access));
+
+        if (resource.isImage)
+            resource.layout = usage.state.layout;
+    }
+}
+
+void RenderGraph::compile()
+{
+    cullPasses();
+
+    for (Pass& pass : m_passes)
+    {
+        pass.bufferBarriers.clear();
+        pass.imageBarriers.clear();
+
+        if (!pass.culled)
+            computeBarriers(pass);
+    }
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> RenderGraph::partition(uint32_t maxRanges) const
+{
+    assert(maxRanges > 0);
+
+    std::vector<uint32_t> live;
+    for (uint32_t i = 0; i < m_passes.size(); ++i)
+        if (!m_passes[i].culled)
+            live.push_back(i);
+
+    std::vector<std::pair<uint32_t, uint32_t>> result;
+
+    if (live.empty())
+        return result;
+
+    size_t rangeCount = std::min(size_t(maxRanges), live.size());
+
+    // culled passes record nothing, so they are attached to whichever range covers them
+    uint32_t first = 0;
+    for (size_t range = 0; range < rangeCount; ++range)
+    {
+        size_t lastLive = (range + 1) * live.size() / rangeCount - 1;
+        uint32_t end = range + 1 == rangeCount ? uint32_t(m_passes.size()) : live[lastLive] + 1;
+
+        result.push_back(std::make_pair(first, end));
+        first = end;
+    }
+
+    return result;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, uint32_t firstPass, uint32_t endPass)
+{
+    assert(firstPass <= endPass && endPass <= m_passes.size());
+
+    for (uint32_t i = firstPass; i < endPass; ++i)
+    {
+        Pass& pass = m_passes[i];
+
+        if (pass.culled)
+            continue;
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        if (!pass.bufferBarriers.empty() || !pass.imageBarriers.empty())
+            pipelineBarrier(commandBuffer, 0, pass.bufferBarriers.size(), pass.bufferBarriers.data(), pass.imageBarriers.size(), pass.imageBarriers.data());
+
+        if (pass.callback)
+            pass.callback(commandBuffer);
+
+        pass.recordTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+}
+
+size_t RenderGraph::getBarrierCount() const
+{
+    size_t result = 0;
+
+    for (const Pass& pass : m_passes)
+        result += pass.bufferBarriers.size() + pass.imageBarriers.size();
+
+    return result;
+}
+
+struct FlagName
+{
+    uint64_t bit;
+    const char* name;
+};
+
+static const FlagName kStageNames[] = {
+    { VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, "TOP_OF_PIPE" },
+    { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, "DRAW_INDIRECT" },
+    { VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, "VERTEX_SHADER" },
+    { VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT, "TASK_SHADER" },
+    { VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT, "MESH_SHADER" },
+    { VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, "FRAGMENT_SHADER" },
+    { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT, "EARLY_FRAGMENT_TESTS" },
+    { VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, "LATE_FRAGMENT_TESTS" },
+    { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, "COLOR_ATTACHMENT_OUTPUT" },
+    { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, "COMPUTE_SHADER" },
+    { VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, "TRANSFER" },
+    { VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, "BOTTOM_OF_PIPE" },
+    { VK_PIPELINE_STAGE_2_HOST_BIT, "HOST" },
+    { VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, "ALL_COMMANDS" },
+    { VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, "ACCELERATION_STRUCTURE_BUILD" },
+};
+
+static const FlagName kAccessNames[] = {
+    { VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, "INDIRECT_COMMAND_READ" },
+    { VK_ACCESS_2_SHADER_READ_BIT, "SHADER_READ" },
+    { VK_ACCESS_2_SHADER_WRITE_BIT, "SHADER_WRITE" },
+    { VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT, "COLOR_ATTACHMENT_READ" },
+    { VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, "COLOR_ATTACHMENT_WRITE" },
+    { VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, "DEPTH_STENCIL_ATTACHMENT_READ" },
+    { VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, "DEPTH_STENCIL_ATTACHMENT_WRITE" },
+    { VK_ACCESS_2_TRANSFER_READ_BIT, "TRANSFER_READ" },
+    { VK_ACCESS_2_TRANSFER_WRITE_BIT, "TRANSFER_WRITE" },
+    { VK_ACCESS_2_HOST_READ_BIT, "HOST_READ" },
+    { VK_ACCESS_2_HOST_WRITE_BIT, "HOST_WRITE" },
+    { VK_ACCESS_2_MEMORY_READ_BIT, "MEMORY_READ" },
+    { VK_ACCESS_2_MEMORY_WRITE_BIT, "MEMORY_WRITE" },
+    { VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR, "ACCELERATION_STRUCTURE_READ" },
+    { VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR, "ACCELERATION_STRUCTURE_WRITE" },
+};
+
+static std::string flagsToString(uint64_t flags, const FlagName* names, size_t count)
+{
+    if (flags == 0)
+        return "NONE";
+
+    std::string result;
+
+    for (size_t i = 0; i < count; ++i)
+        if (flags & names[i].bit)
+        {
+            result += result.empty() ? "" : "|";
+            result += names[i].name;
+            flags &= ~names[i].bit;
+        }
+
+    if (flags)
+    {
+        char unknown[32];
+        snprintf(unknown, sizeof(unknown), "%s0x%llx", result.empty() ? "" : "|", (unsigned long long)flags);
+        result += unknown;
+    }
+
+    return result;
+}
+
+static const char* layoutToString(VkImageLayout layout)
+{
+    switch (layout)
+    {
+    case VK_IMAGE_LAYOUT_UNDEFINED: return "UNDEFINED";
+    case VK_IMAGE_LAYOUT_GENERAL: return "GENERAL";
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: return "SHADER_READ_ONLY_OPTIMAL";
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return "TRANSFER_SRC_OPTIMAL";
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: return "TRANSFER_DST_OPTIMAL";
+    case VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL: return "ATTACHMENT_OPTIMAL";
+    case VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL: return "READ_ONLY_OPTIMAL";
+    case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: return "PRESENT_SRC";
+    default: return "OTHER";
+    }
+}
+
+void RenderGraph::dump(FILE* file) const
+{
+    size_t culled = 0;
+    for (const Pass& pass : m_passes)
+        culled += pass.culled;
+
+    fprintf(file, "Render graph: %d passes, %d culled, %d barriers\n", int(m_passes.size()), int(culled), int(getBarrierCount()));
+
+    for (size_t i = 0; i < m_passes.size(); ++i)
+    {
+        const Pass& pass = m_passes[i];
+
+        fprintf(file, "%2d %s%s\n", int(i), pass.name.c_str(), pass.culled ? " (culled)" : "");
+
+        for (const VkBufferMemoryBarrier2& barrier : pass.bufferBarriers)
+        {
+            const char* name = "?";
+            for (const Resource& resource : m_resources)
+                if (!resource.isImage && resource.buffer == barrier.buffer)
+                    name = resource.name.c_str();
+
+            fprintf(file, "     buffer %s: %s/%s -> %s/%s\n", name,
+                flagsToString(barrier.srcStageMask, kStageNames, COUNTOF(kStageNames)).c_str(), flagsToString(barrier.srcAccessMask, kAccessNames, COUNTOF(kAccessNames)).c_str(),
+                flagsToString(barrier.dstStageMask, kStageNames, COUNTOF(kStageNames)).c_str(), flagsToString(barrier.dstAccessMask, kAccessNames, COUNTOF(kAccessNames)).c_str());
+        }
+
+        for (const VkImageMemoryBarrier2& barrier : pass.imageBarriers)
+        {
+            const char* name = "?";
+            for (const Resource& resource : m_resources)
+                if (resource.isImage && resource.image == barrier.image)
+                    name = resource.name.c_str();
+
+            fprintf(file, "     image %s: %s/%s -> %s/%s, %s -> %s\n", name,
+                flagsToString(barrier.srcStageMask, kStageNames, COUNTOF(kStageNames)).c_str(), flagsToString(barrier.srcAccessMask, kAccessNames, COUNTOF(kAccessNames)).c_str(),
+                flagsToString(barrier.dstStageMask, kStageNames, COUNTOF(kStageNames)).c_str(), flagsToString(barrier.dstAccessMask, kAccessNames, COUNTOF(kAccessNames)).c_str(),
+                layoutToString(barrier.oldLayout), layoutToString(barrier.newLayout));
+        }
+    }
+}
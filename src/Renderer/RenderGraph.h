@@ -0,0 +1,192 @@
+#pragma once
+
+#include "niagara/common.h"
+
+#include <stdio.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+typedef uint32_t RenderGraphResource;
+
+/**
+ * Synchronization scope of a resource access: where it happens, what it does to memory and the image layout it needs
+ */
+struct RenderGraphState
+{
+    VkPipelineStageFlags2 stage;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+};
+
+/**
+ * Per-frame graph of passes that declare the buffers and images they read and write
+ * Compiling the graph culls passes whose results nobody consumes and computes the barriers
+ * and layout transitions each pass needs, merged into one vkCmdPipelineBarrier2 per pass
+ *
+ * Resources are identified by name and keep their state across frames, so the first pass
+ * of a frame synchronizes with the last access of the previous one
+ * Compiling doesn't touch the device, which lets the barrier list be dumped and checked without a GPU
+ */
+class RenderGraph
+{
+public:
+    typedef std::function<void(VkCommandBuffer)> PassCallback;
+
+    /**
+     * Removes all passes; resources and their states are kept for the next frame
+     */
+    void reset();
+
+    /**
+     * Declares a buffer used by this frame's passes
+     *
+     * @param name Stable name that identifies the resource across frames
+     * @param buffer Buffer handle; a different handle than last frame starts from an unknown state
+     * @param persistent Contents are consumed by later frames, so writers are never culled
+     * @return Resource handle for read and write declarations
+     */
+    RenderGraphResource importBuffer(const char* name, VkBuffer buffer, bool persistent = false);
+
+    /**
+     * Declares an image used by this frame's passes
+     *
+     * @param name Stable name that identifies the resource across frames
+     * @param image Image handle; a different handle than last frame starts from UNDEFINED layout
+     * @param aspectMask Aspect used in layout transitions
+     * @param persistent Contents are consumed by later frames, so writers are never culled
+     * @param initialState Overrides the tracked state, e.g. for swapchain images whose acquire wait happens at a specific stage
+     * @return Resource handle for read and write declarations
+     */
+    RenderGraphResource importImage(const char* name, VkImage image, VkImageAspectFlags aspectMask, bool persistent = false, const RenderGraphState* initialState = nullptr);
+
+    /**
+     * Marks a resource as consumed outside of the graph, e.g. by presentation
+     */
+    void markOutput(RenderGraphResource resource);
+
+    /**
+     * Adds a pass; passes execute in the order they are added
+     *
+     * @param name Name used in dumps
+     * @param callback Records the pass commands; may be empty when the graph is only compiled and dumped
+     * @return Pass index for read and write declarations
+     */
+    uint32_t addPass(const char* name, PassCallback callback);
+
+    /**
+     * Keeps a pass even if none of its writes are consumed, e.g. because it writes queries or presents
+     */
+    void setSideEffects(uint32_t pass);
+
+    /**
+     * Declares a read of a resource by a pass
+     *
+     * @param layout Layout the image must be in; ignored for buffers
+     */
+    void read(uint32_t pass, RenderGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+    /**
+     * Declares a write (or read-modify-write) of a resource by a pass
+     *
+     * @param layout Layout the image must be in; ignored for buffers
+     * @param discard Previous contents aren't needed, so images transition from UNDEFINED
+     */
+    void write(uint32_t pass, RenderGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED, bool discard = false);
+
+    /**
+     * Culls unused passes, computes barriers and advances resource states to the end of the frame
+     * The compiled graph must be executed, otherwise tracked states no longer match the GPU
+     */
+    void compile();
+
+    /**
+     * Splits the passes that survived culling into contiguous ranges of similar size
+     * Barriers belong to passes, so each range can be recorded into its own command buffer,
+     * in parallel, as long as the command buffers are submitted in range order
+     *
+     * @param maxRanges Upper bound on the number of ranges, e.g. the number of recording threads
+     * @return [first, end) pass index ranges in execution order
+     */
+    std::vector<std::pair<uint32_t, uint32_t>> partition(uint32_t maxRanges) const;
+
+    /**
+     * Records barriers and pass commands of a range of passes into the command buffer
+     * Different ranges may be recorded from different threads at the same time
+     *
+     * @param commandBuffer Command buffer to record into
+     * @param firstPass First pass of the range
+     * @param endPass One past the last pass of the range
+     */
+    void execute(VkCommandBuffer commandBuffer, uint32_t firstPass, uint32_t endPass);
+
+    /**
+     * Records barriers and pass commands of all passes into the command buffer
+     */
+    void execute(VkCommandBuffer commandBuffer) { execute(commandBuffer, 0, uint32_t(m_passes.size())); }
+
+    /**
+     * Prints passes, culled passes and the barriers recorded before each pass
+     */
+    void dump(FILE* file) const;
+
+    size_t getPassCount() const { return m_passes.size(); }
+    size_t getBarrierCount() const;
+
+    const char* getPassName(uint32_t pass) const { return m_passes[pass].name.c_str(); }
+    bool isPassCulled(uint32_t pass) const { return m_passes[pass].culled; }
+
+    /**
+     * Returns the CPU time spent recording a pass (barriers and callback) in the last execute, in milliseconds
+     */
+    double getPassRecordTime(uint32_t pass) const { return m_passes[pass].recordTime; }
+
+private:
+    struct Usage
+    {
+        RenderGraphResource resource;
+        RenderGraphState state;
+        bool write;
+        bool discard;
+    };
+
+    struct Resource
+    {
+        std::string name;
+        bool isImage;
+        VkBuffer buffer;
+        VkImage image;
+        VkImageAspectFlags aspectMask;
+        bool persistent;
+        bool output;
+
+        // last write that hasn't been made available yet and the reads that have been made visible since
+        VkPipelineStageFlags2 writeStage;
+        VkAccessFlags2 writeAccess;
+        VkPipelineStageFlags2 readStage;
+        VkAccessFlags2 readAccess;
+        VkImageLayout layout;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        PassCallback callback;
+        bool sideEffects;
+        bool culled;
+        double recordTime;
+        std::vector<Usage> usages;
+
+        std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+        std::vector<VkImageMemoryBarrier2> imageBarriers;
+    };
+
+    RenderGraphResource findResource(const char* name);
+    void addUsage(uint32_t pass, const Usage& usage);
+    void cullPasses();
+    void computeBarriers(Pass& pass);
+
+    std::vector<Resource> m_resources;
+    std::vector<Pass> m_passes;
+};
@@ -6,24 +6,71 @@
 #include "niagara/scene.h"
 #include "niagara/textures.h"
 #include "niagara/scenert.h"
+#include "../Utils/Profile.hpp"
+#include "../Utils/executable_path.hpp"
+#include "tmc/ex_cpu.hpp"
+#include "tmc/sync.hpp"
+#include <nlohmann/json.hpp>
+#include <math.h>
 #include <stdarg.h>
 #include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <future>
+
+// variants compiled during a run are recorded here on shutdown and compiled upfront on the next start; the list lives next
+// to the executable, so that runs from other working directories share it
+static const char* PIPELINE_VARIANTS_FILE = "pipeline_variants.txt";
+// mapped draw uploads are only used when per-slot copies take at most this share of a device local, host visible heap;
+// small BAR heaps are left to allocations that have to be mapped
+static const size_t MAPPED_DRAWS_HEAP_FRACTION = 8;
+
+// refitting keeps the TLAS topology of the last build, so bounds loosen as instances move; it is rebuilt after this many
+// refits, or once instances moved this many of their radii on average
+static const uint32_t TLAS_MAX_UPDATES = 240;
+static const double TLAS_MAX_DRIFT = 0.5;
+
+// angular radius of the sun in radians, as seen by Shadow_High; wider than the real sun for visibly soft shadows
+static const float SHADOW_SUN_RADIUS = 0.02f;
+
+// CPU occlusion culling rasterizes this many of the largest opaque draws of a scene into a buffer this many pixels wide,
+// as tall as the swapchain's aspect ratio asks for
+static const uint32_t CPU_OCCLUDER_COUNT = 256;
+static const uint32_t CPU_OCCLUSION_WIDTH = 256;
+
+// screen space error a LOD may have, relative to its distance; shared by raster and ray tracing LOD selection
+static float getLodTarget(uint32_t screenHeight)
+{
+    return 0.75f * 4.0f / float(screenHeight);
+}
+
 // #include "volk.h"
 
 
-Renderer::Renderer()
+Renderer::Renderer(tmc::ex_cpu* executor, uint32_t headlessWidth, uint32_t headlessHeight, uint32_t rayTracingLods)
+    : m_executor(executor)
+    , m_rayTracingLods(rayTracingLods)
 {
-    m_gfxDevice = initDevice();
+    m_gfxDevice = initDevice(headlessWidth, headlessHeight);
     m_gfxDevice.m_gbufferInfo.colorAttachmentCount = GBUFFER_COUNT;
 	m_gfxDevice.m_gbufferInfo.pColorAttachmentFormats = m_gbufferFormats;
 	m_gfxDevice.m_gbufferInfo.depthAttachmentFormat = m_gfxDevice.m_depthFormat;
     printf("Setting depth format to: %d\n", m_gfxDevice.m_depthFormat);
 
+	bool rcs = loadShaders(m_shaders, "", "shaders/");
+	assert(rcs);
+
+    m_textureSetLayout = createDescriptorArrayLayout(m_gfxDevice.m_device);
+    m_pipelines.m_pipelineCache = 0;
+
     createPrograms();
     createPipelines();
     createFramesData();
     vkGetDeviceQueue(m_gfxDevice.m_device, m_gfxDevice.m_familyIndex, 0, &m_queue);
 
+    m_profileContext = PROFILE_GPU_CONTEXT_CREATE(m_gfxDevice.m_physicalDevice, m_gfxDevice.m_device, m_queue, m_immCommandBuffer);
+
     // Initialize camera with default parameters
     m_camera = Camera(
         vec3(0.0f, 0.0f, 0.0f),             // position
@@ -40,63 +87,202 @@ Renderer::Renderer()
 
     createBuffer(m_buffers.m_scratch, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
+    // the last workgroup of every single pass reduction resets the counter, so it's only cleared once
+    uint32_t pyramidCounter = 0;
+    createBuffer(m_buffers.m_pyramidCounter, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, sizeof(pyramidCounter), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_timeline, m_buffers.m_pyramidCounter, m_buffers.m_scratch, &pyramidCounter, sizeof(pyramidCounter));
+
     loadGLTFScene("../../../Documents/github/niagara_bistro/bistrox.gltf");
+
+    m_simulation.init(m_camera, m_sunDirection, m_animations);
+    m_simulation.start();
+
+#ifdef SHADER_HOT_RELOAD
+    m_shaderReloader.start(SHADER_SOURCE_DIR, SHADER_OUTPUT_DIR, SHADER_COMPILER, SHADER_HEADER_FILES);
+#endif
 }
 
-void Renderer::createPrograms()
+void Renderer::createPrograms(const std::vector<const Shader*>& changed)
 {
-	bool rcs = loadShaders(m_shaders, "", "shaders/");
-	assert(rcs);
+    bool initial = !m_programs.m_drawcullProgram.layout;
 
-    m_textureSetLayout = createDescriptorArrayLayout(m_gfxDevice.m_device);
-    m_pipelines.m_pipelineCache = 0;
+    auto replace = [&](Program& program, VkPipelineBindPoint bindPoint, Shaders shaders, size_t pushConstantSize, VkDescriptorSetLayout arrayLayout = nullptr)
+    {
+        if (program.layout)
+        {
+            bool affected = false;
+            for (const Shader* shader : shaders)
+                affected |= std::find(changed.begin(), changed.end(), shader) != changed.end();
+
+            if (!affected)
+                return;
+        }
+
+        Program created = createProgram(m_gfxDevice.m_device, bindPoint, shaders, pushConstantSize, arrayLayout);
+
+        if (!created.layout)
+        {
+            if (!program.layout)
+            {
+                fprintf(stderr, "Error: %s program doesn't match its shaders\n", (*shaders.begin())->name.c_str());
+                std::exit(1);
+            }
+
+            // keep rendering with the previous program until the shader is fixed
+            printf("Warning: %s program doesn't match its shaders, keeping the previous version\n", (*shaders.begin())->name.c_str());
+            return;
+        }
+
+        if (program.layout)
+        {
+            // pipelines are recompiled lazily against the new program on next use
+            std::vector<VkPipeline> retired;
+            m_pipelines.m_variants.invalidate(program, retired);
+
+            // programs are only replaced between frames, so the last submit that could use them is the latest one
+            for (VkPipeline pipeline : retired)
+                m_retiredPipelines.push_back(std::make_pair(m_timeline.value, pipeline));
+
+            m_retiredPrograms.push_back(std::make_pair(m_timeline.value, program));
+        }
+
+        program = created;
+    };
 
-    m_programs.m_drawcullProgram = createProgram(m_gfxDevice.m_device, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["drawcull.comp"] }, sizeof(CullData));
-    m_programs.m_tasksubmitProgram = createProgram(m_gfxDevice.m_device, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["tasksubmit.comp"] }, 0);
-    m_programs.m_clustersubmitProgram = createProgram(m_gfxDevice.m_device, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["clustersubmit.comp"] }, 0);
-    m_programs.m_clustercullProgram = createProgram(m_gfxDevice.m_device, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["clustercull.comp"] }, sizeof(CullData));
-    m_programs.m_depthreduceProgram = createProgram(m_gfxDevice.m_device, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["depthreduce.comp"] }, sizeof(vec4));
-    m_programs.m_meshtaskProgram = createProgram(m_gfxDevice.m_device, VK_PIPELINE_BIND_POINT_GRAPHICS, { &m_shaders["meshlet.task"], &m_shaders["meshlet.mesh"], &m_shaders["mesh.frag"] }, sizeof(Globals), m_textureSetLayout);
-    m_programs.m_finalProgram = createProgram(m_gfxDevice.m_device, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["final.comp"] }, sizeof(ShadeData));
+    replace(m_programs.m_drawcullProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["drawcull.comp"] }, sizeof(CullData));
+    replace(m_programs.m_tasksubmitProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["tasksubmit.comp"] }, 0);
+    replace(m_programs.m_clustersubmitProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["clustersubmit.comp"] }, 0);
+    replace(m_programs.m_clustercullProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["clustercull.comp"] }, sizeof(CullData));
+    replace(m_programs.m_depthreduceProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["depthreduce.comp"] }, sizeof(vec4));
+    replace(m_programs.m_depthpyramidProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["depthpyramid.comp"] }, sizeof(PyramidData));
+    replace(m_programs.m_meshtaskProgram, VK_PIPELINE_BIND_POINT_GRAPHICS, { &m_shaders["meshlet.task"], &m_shaders["meshlet.mesh"], &m_shaders["mesh.frag"] }, sizeof(Globals), m_textureSetLayout);
+    replace(m_programs.m_clusterProgram, VK_PIPELINE_BIND_POINT_GRAPHICS, { &m_shaders["meshlet.mesh"], &m_shaders["mesh.frag"] }, sizeof(Globals), m_textureSetLayout);
+    replace(m_programs.m_finalProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["final.comp"] }, sizeof(ShadeData));
+    replace(m_programs.m_shadowProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["shadow.comp"] }, sizeof(ShadowData));
+    replace(m_programs.m_shadowfillProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["shadowfill.comp"] }, sizeof(vec4));
+    replace(m_programs.m_shadowblurProgram, VK_PIPELINE_BIND_POINT_COMPUTE, { &m_shaders["shadowblur.comp"] }, sizeof(vec4));
+
+    // hot reloads replace a few programs at a time, the layout count is only interesting at startup
+    if (initial)
+        printf("Programs use %d unique pipeline layouts\n", int(getLayoutCacheSize()));
 }
 
 void Renderer::createPipelines()
 {
-    auto replace = [&](VkPipeline& pipeline, VkPipeline newPipeline)
+    m_pipelines.m_variants.init(m_gfxDevice.m_device, m_pipelines.m_pipelineCache);
+
+    m_pipelines.m_variants.registerProgram("drawcull", m_programs.m_drawcullProgram);
+    m_pipelines.m_variants.registerProgram("tasksubmit", m_programs.m_tasksubmitProgram);
+    m_pipelines.m_variants.registerProgram("clustersubmit", m_programs.m_clustersubmitProgram);
+    m_pipelines.m_variants.registerProgram("clustercull", m_programs.m_clustercullProgram);
+    m_pipelines.m_variants.registerProgram("depthreduce", m_programs.m_depthreduceProgram);
+    m_pipelines.m_variants.registerProgram("depthpyramid", m_programs.m_depthpyramidProgram);
+    m_pipelines.m_variants.registerProgram("meshtask", m_programs.m_meshtaskProgram);
+    m_pipelines.m_variants.registerProgram("cluster", m_programs.m_clusterProgram);
+    m_pipelines.m_variants.registerProgram("final", m_programs.m_finalProgram);
+    m_pipelines.m_variants.registerProgram("shadow", m_programs.m_shadowProgram);
+    m_pipelines.m_variants.registerProgram("shadowfill", m_programs.m_shadowfillProgram);
+    m_pipelines.m_variants.registerProgram("shadowblur", m_programs.m_shadowblurProgram);
+
+    m_pipelines.m_variantsPath = getExecutableDirectory() + PIPELINE_VARIANTS_FILE;
+    m_pipelines.m_variants.prewarm(m_pipelines.m_variantsPath.c_str());
+}
+
+void Renderer::reloadShaders()
+{
+    std::vector<Shader> reloaded;
+    if (!m_shaderReloader.takeReloaded(reloaded))
+        return;
+
+    std::vector<const Shader*> changed;
+
+    for (Shader& shader : reloaded)
     {
-        if (pipeline)
-            vkDestroyPipeline(m_gfxDevice.m_device, pipeline, 0);
-        assert(newPipeline);
-        pipeline = newPipeline;
-        m_pipelines.m_pipelines.push_back(newPipeline);
-    };
+        auto it = std::find_if(m_shaders.shaders.begin(), m_shaders.shaders.end(), [&](const Shader& existing) { return existing.name == shader.name; });
+
+        // programs keep pointers into the shader set, so it can't grow at runtime
+        if (it == m_shaders.shaders.end())
+        {
+            printf("Warning: new shader %s will be loaded on restart\n", shader.name.c_str());
+            continue;
+        }
+
+        // bindings, push constants and specialization constants are fixed by the C++ side, so a changed interface needs a code change and a restart anyway
+        if (shader.pushConstantSize != it->pushConstantSize || shader.resourceMask != it->resourceMask || shader.specializationMask != it->specializationMask ||
+            memcmp(shader.resourceTypes, it->resourceTypes, sizeof(shader.resourceTypes)) != 0 ||
+            memcmp(shader.resourceCounts, it->resourceCounts, sizeof(shader.resourceCounts)) != 0)
+        {
+            printf("Warning: %s changed its bindings or push constants, restart to pick it up\n", shader.name.c_str());
+            continue;
+        }
+
+        *it = std::move(shader);
+        changed.push_back(&*it);
+    }
+
+    if (changed.empty())
+        return;
+
+    createPrograms(changed);
+
+    printf("Reloaded %d shaders\n", int(changed.size()));
+}
+
+void Renderer::releaseRetired(bool all)
+{
+    uint64_t completed = all ? ~0ull : getTimelineCompleted(m_gfxDevice.m_device, m_timeline);
+    auto expired = [&](uint64_t timelineValue) { return completed >= timelineValue; };
+
+    std::erase_if(m_retiredPipelines, [&](const std::pair<uint64_t, VkPipeline>& retired)
+    {
+        if (!expired(retired.first))
+            return false;
 
-    m_pipelines.m_pipelines.clear();
+        vkDestroyPipeline(m_gfxDevice.m_device, retired.second, 0);
+        return true;
+    });
 
-    replace(m_pipelines.m_taskcullPipeline, createComputePipeline(m_gfxDevice.m_device, m_pipelines.m_pipelineCache, m_programs.m_drawcullProgram, { /* LATE= */ false, /* TASK= */ true }));
-    replace(m_pipelines.m_taskculllatePipeline, createComputePipeline(m_gfxDevice.m_device, m_pipelines.m_pipelineCache, m_programs.m_drawcullProgram, { /* LATE= */ true, /* TASK= */ true }));
+    std::erase_if(m_retiredPrograms, [&](const std::pair<uint64_t, Program>& retired)
+    {
+        if (!expired(retired.first))
+            return false;
 
-    replace(m_pipelines.m_tasksubmitPipeline, createComputePipeline(m_gfxDevice.m_device, m_pipelines.m_pipelineCache, m_programs.m_tasksubmitProgram));
+        destroyProgram(m_gfxDevice.m_device, retired.second);
+        return true;
+    });
 
-    replace(m_pipelines.m_depthreducePipeline, createComputePipeline(m_gfxDevice.m_device, m_pipelines.m_pipelineCache, m_programs.m_depthreduceProgram));
+    std::erase_if(m_retiredBuffers, [&](const std::pair<uint64_t, Buffer>& retired)
+    {
+        if (!expired(retired.first))
+            return false;
 
-    replace(m_pipelines.m_meshtaskPipeline, createGraphicsPipeline(m_gfxDevice.m_device, m_pipelines.m_pipelineCache, m_gfxDevice.m_gbufferInfo, m_programs.m_meshtaskProgram, { /* LATE= */ false, /* TASK= */ true }));
-    replace(m_pipelines.m_meshtasklatePipeline, createGraphicsPipeline(m_gfxDevice.m_device, m_pipelines.m_pipelineCache, m_gfxDevice.m_gbufferInfo, m_programs.m_meshtaskProgram, { /* LATE= */ true, /* TASK= */ true }));
-    replace(m_pipelines.m_meshtaskpostPipeline, createGraphicsPipeline(m_gfxDevice.m_device, m_pipelines.m_pipelineCache, m_gfxDevice.m_gbufferInfo, m_programs.m_meshtaskProgram, { /* LATE= */ true, /* TASK= */ true, /* POST= */ 1 }));
+        destroyBuffer(retired.second, m_gfxDevice.m_device);
+        return true;
+    });
 
-    replace(m_pipelines.m_finalPipeline, createComputePipeline(m_gfxDevice.m_device, m_pipelines.m_pipelineCache, m_programs.m_finalProgram));
+    std::erase_if(m_retiredAccelerationStructures, [&](const std::pair<uint64_t, VkAccelerationStructureKHR>& retired)
+    {
+        if (!expired(retired.first))
+            return false;
 
+        vkDestroyAccelerationStructureKHR(m_gfxDevice.m_device, retired.second, 0);
+        return true;
+    });
 }
 
 void Renderer::createFramesData()
 {
-    m_queryPoolTimestamp = createQueryPool(m_gfxDevice.m_device, 128, VK_QUERY_TYPE_TIMESTAMP);
-	assert(m_queryPoolTimestamp);
+    m_gfxDevice.m_swapchainImageViews.resize(m_gfxDevice.m_swapchain.imageCount);
 
-	m_queryPoolPipeline = createQueryPool(m_gfxDevice.m_device, 4, VK_QUERY_TYPE_PIPELINE_STATISTICS);
-	assert(m_queryPoolPipeline);
+    // queries return values in bit order, readbackQueries depends on it
+    VkQueryPipelineStatisticFlags pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    m_pipelineStatisticCount = 3;
 
-    m_gfxDevice.m_swapchainImageViews.resize(m_gfxDevice.m_swapchain.imageCount);
+    if (m_gfxDevice.m_meshShaderQueries)
+    {
+        pipelineStatistics |= VK_QUERY_PIPELINE_STATISTIC_TASK_SHADER_INVOCATIONS_BIT_EXT | VK_QUERY_PIPELINE_STATISTIC_MESH_SHADER_INVOCATIONS_BIT_EXT;
+        m_pipelineStatisticCount = 5;
+    }
 
     for (int i = 0; i < FRAMES_COUNT; i++)
     {
@@ -112,18 +298,40 @@ void Renderer::createFramesData()
         m_frames[i].m_commandBuffer = 0;
         VK_CHECK(vkAllocateCommandBuffers(m_gfxDevice.m_device, &allocateInfo, &m_frames[i].m_commandBuffer));
 
+        for (uint32_t job = 0; job < MAX_RECORD_JOBS; ++job)
+        {
+            m_frames[i].m_recordPools[job] = createCommandPool(m_gfxDevice.m_device, m_gfxDevice.m_familyIndex);
+            assert(m_frames[i].m_recordPools[job]);
+
+            allocateInfo.commandPool = m_frames[i].m_recordPools[job];
+            VK_CHECK(vkAllocateCommandBuffers(m_gfxDevice.m_device, &allocateInfo, &m_frames[i].m_recordBuffers[job]));
+        }
+
+        m_frames[i].m_recordBufferCount = 0;
+
         m_frames[i].m_waitSemaphore = createSemaphore(m_gfxDevice.m_device); // acquireSemaphore
         assert(m_frames[i].m_waitSemaphore);
     
         m_frames[i].m_signalSemaphore = createSemaphore(m_gfxDevice.m_device); // releaseSemaphore
         assert(m_frames[i].m_signalSemaphore);
 
-        m_frames[i].m_renderFence = createFence(m_gfxDevice.m_device); // frameFence
-        assert(m_frames[i].m_renderFence);
-        // VK_CHECK(vkResetFences(m_gfxDevice.m_device, 1, &m_frames[i].m_renderFence));
+        m_frames[i].m_timelineValue = 0;
 
+        m_frames[i].m_pipelinePool = createQueryPool(m_gfxDevice.m_device, RENDER_PASS_COUNT, VK_QUERY_TYPE_PIPELINE_STATISTICS, pipelineStatistics);
+        assert(m_frames[i].m_pipelinePool);
+
+        createBuffer(m_frames[i].m_cullStatsReadback, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, RENDER_PASS_COUNT * sizeof(CullStats), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        m_frames[i].m_cullStatsCopied = false;
     }
 
+    // shaders only touch it when counting is enabled, but it's always bound
+    createBuffer(m_buffers.m_cullStats, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, RENDER_PASS_COUNT * sizeof(CullStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    m_timeline.semaphore = createTimelineSemaphore(m_gfxDevice.m_device);
+    assert(m_timeline.semaphore);
+
+    m_profiler.init(m_gfxDevice.m_device, m_gfxDevice.m_props.limits.timestampPeriod);
+
     m_immCommandPool = createCommandPool(m_gfxDevice.m_device, m_gfxDevice.m_familyIndex);
     VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
     allocateInfo.commandPool = m_immCommandPool;
@@ -144,17 +352,30 @@ void Renderer::createFramesData()
 
 bool Renderer::beginFrame()
 {
+    PROFILE_ZONE();
+
     m_currentFrameIndex = m_frameIndex % FRAMES_COUNT;
     m_lastFrameIndex = (m_frameIndex + FRAMES_COUNT - 1) % FRAMES_COUNT;
     
-    // printf("vkWaitForFences \n");
-    VK_CHECK(vkWaitForFences(m_gfxDevice.m_device, 1, &m_frames[m_currentFrameIndex].m_renderFence, VK_TRUE, ~0ull));
+    // the frame that last used this slot has to complete before its command pools are reset
+    waitTimeline(m_gfxDevice.m_device, m_timeline, m_frames[m_currentFrameIndex].m_timelineValue);
+
+    m_queryPoolPipeline = m_frames[m_currentFrameIndex].m_pipelinePool;
+
+    // while the tick loop is stopped, e.g. in lockstep benchmarks, the simulation is stepped here, on the render thread
+    if (!m_simulation.isRunning())
+        m_simulation.advance(Simulation::Clock::now());
+
+    applySimulation(m_simulation.acquire());
+
+    releaseRetired();
+    reloadShaders();
 
     m_frames[m_currentFrameIndex].m_frameTimeStamp = std::chrono::system_clock::now();
     
-    m_frames[m_currentFrameIndex].m_deltaTime = (std::chrono::duration_cast<std::chrono::milliseconds>(m_frames[m_lastFrameIndex].m_frameTimeStamp - m_frames[m_currentFrameIndex].m_frameTimeStamp)).count();
+    m_frames[m_currentFrameIndex].m_deltaTime = (std::chrono::duration_cast<std::chrono::milliseconds>(m_frames[m_currentFrameIndex].m_frameTimeStamp - m_frames[m_lastFrameIndex].m_frameTimeStamp)).count();
 
-    SwapchainStatus swapchainStatus = updateSwapchain(m_gfxDevice.m_swapchain, m_gfxDevice.m_physicalDevice, m_gfxDevice.m_device, m_gfxDevice.m_surface, m_gfxDevice.m_familyIndex, m_gfxDevice.m_window, m_gfxDevice.m_swapchainFormat);
+    SwapchainStatus swapchainStatus = m_gfxDevice.m_headless ? Swapchain_Ready : updateSwapchain(m_gfxDevice.m_swapchain, m_gfxDevice.m_physicalDevice, m_gfxDevice.m_device, m_gfxDevice.m_surface, m_gfxDevice.m_familyIndex, m_gfxDevice.m_window, m_gfxDevice.m_swapchainFormat);
 
     if (swapchainStatus == Swapchain_NotReady)
         return false;
@@ -210,65 +431,40 @@ bool Renderer::beginFrame()
         }
     }
 
-    VkResult acquireResult = vkAcquireNextImageKHR(m_gfxDevice.m_device, m_gfxDevice.m_swapchain.swapchain, ~0ull, m_frames[m_currentFrameIndex].m_waitSemaphore, VK_NULL_HANDLE, &m_imageIndex);
-    if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
-        return false; // attempting to render to an out-of-date swapchain would break semaphore synchronization
+    if (m_gfxDevice.m_headless)
+    {
+        // offscreen images are owned by frame slots, and the slot's previous frame has retired
+        m_imageIndex = uint32_t(m_currentFrameIndex);
+    }
+    else
+    {
+        VkResult acquireResult = vkAcquireNextImageKHR(m_gfxDevice.m_device, m_gfxDevice.m_swapchain.swapchain, ~0ull, m_frames[m_currentFrameIndex].m_waitSemaphore, VK_NULL_HANDLE, &m_imageIndex);
+        if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+            return false; // attempting to render to an out-of-date swapchain would break semaphore synchronization
+    }
 
-    // printf("vkResetFences \n");
-    VK_CHECK(vkResetFences(m_gfxDevice.m_device, 1, &m_frames[m_currentFrameIndex].m_renderFence));
-    
     VK_CHECK(vkResetCommandPool(m_gfxDevice.m_device, m_frames[m_currentFrameIndex].m_commandPool, 0));
 
+    for (uint32_t job = 0; job < MAX_RECORD_JOBS; ++job)
+        VK_CHECK(vkResetCommandPool(m_gfxDevice.m_device, m_frames[m_currentFrameIndex].m_recordPools[job], 0));
+
     VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
     VK_CHECK(vkBeginCommandBuffer(m_frames[m_currentFrameIndex].m_commandBuffer, &beginInfo));
 
-    vkCmdResetQueryPool(m_frames[m_currentFrameIndex].m_commandBuffer, m_queryPoolTimestamp, 0, 128);
-    vkCmdWriteTimestamp(m_frames[m_currentFrameIndex].m_commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, 0);
-
-    if (!m_buffers.m_drawVisibilityCleared)
-    {
-        // Use the new free function to clear buffers
-        clearBuffer(
-            m_frames[m_currentFrameIndex].m_commandBuffer,
-            m_buffers.m_drawVisibility.buffer,
-            sizeof(uint32_t) * m_draws.size(),
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
-        );
+    PROFILE_GPU_COLLECT(m_profileContext, m_frames[m_currentFrameIndex].m_commandBuffer);
 
-        m_buffers.m_drawVisibilityCleared = true;
-    }
+    // the slot's previous frame completed before the wait above, so its results are read back without stalling
+    m_profiler.beginFrame(m_gfxDevice.m_device, uint32_t(m_currentFrameIndex), m_frameIndex, m_frames[m_currentFrameIndex].m_commandBuffer);
 
-    if (!m_buffers.m_meshletVisibilityCleared)
-    {
-        // Use the new free function to clear buffers
-        clearBuffer(
-            m_frames[m_currentFrameIndex].m_commandBuffer,
-            m_buffers.m_meshletVisibility.buffer,
-            m_buffers.m_meshletVisibilityBytes,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT,
-            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
-        );
+    if (m_frames[m_currentFrameIndex].m_timelineValue)
+        readbackQueries();
 
-        m_buffers.m_meshletVisibilityCleared = true;
-    }
+    updateInstances(m_frames[m_currentFrameIndex].m_commandBuffer);
 
     // raytracing
-    uint32_t timestamp = 21;
-
-    vkCmdWriteTimestamp(m_frames[m_currentFrameIndex].m_commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 0);
-
-    if (m_tlasNeedsRebuild)
-    {
-        buildTLAS(m_gfxDevice.m_device, m_frames[m_currentFrameIndex].m_commandBuffer, m_buffers.m_tlas, m_buffers.m_tlasBuffer, m_buffers.m_tlasScratchBuffer, m_buffers.m_tlasInstanceBuffer, m_draws.size(), VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
-        m_tlasNeedsRebuild = false;
-    }
-
-    vkCmdWriteTimestamp(m_frames[m_currentFrameIndex].m_commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 1);
+    updateTLAS(m_frames[m_currentFrameIndex].m_commandBuffer);
 
 
     // Use the Camera class methods to get view and projection matrices
@@ -296,10 +492,10 @@ bool Renderer::beginFrame()
     m_cullData.frustum[3] = 1.0f / m_cullData.P11;  // top
     
     // Set other culling parameters
-    m_cullData.lodTarget = 0.75f * 4.0f / float(m_gfxDevice.m_swapchain.height);
+    m_cullData.lodTarget = getLodTarget(m_gfxDevice.m_swapchain.height);
     m_cullData.pyramidWidth = float(m_depthPyramidWidth);
     m_cullData.pyramidHeight = float(m_depthPyramidHeight);
-    m_cullData.drawCount = uint32_t(m_draws.size());
+    m_cullData.drawCount = m_instances.getDrawCount();
     
     // Enable culling features
     m_cullData.cullingEnabled = 1;
@@ -307,116 +503,77 @@ bool Renderer::beginFrame()
     m_cullData.occlusionEnabled = 1;
     m_cullData.clusterOcclusionEnabled = 1;
     m_cullData.clusterBackfaceEnabled = 1;
+    m_cullData.cpuOcclusionEnabled = m_cpuOcclusion;
+
+    if (m_cpuOcclusion)
+        cullOccludedDraws();
 
-    Globals m_globals = {};
+    m_globals = {};
     m_globals.projection = m_projection;
     m_globals.cullData = m_cullData;
     m_globals.screenWidth = float(m_gfxDevice.m_swapchain.width);
     m_globals.screenHeight = float(m_gfxDevice.m_swapchain.height);
 
-    // Use the new free function to create image barriers for render targets
-    VkImageMemoryBarrier2 renderBeginBarriers[GBUFFER_COUNT + 1];
-    
-    // Prepare color image array for the function
-    VkImage colorImages[GBUFFER_COUNT];
-    for (uint32_t i = 0; i < GBUFFER_COUNT; ++i)
-        colorImages[i] = m_gbufferTargets[i].image;
-    
-    createRenderTargetBarriers(m_depthTarget.image, colorImages, GBUFFER_COUNT, renderBeginBarriers);
-    
-    pipelineBarrier(m_frames[m_currentFrameIndex].m_commandBuffer, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, COUNTOF(renderBeginBarriers), renderBeginBarriers);
-
-    vkCmdResetQueryPool(m_frames[m_currentFrameIndex].m_commandBuffer, m_queryPoolPipeline, 0, 4);
+    vkCmdResetQueryPool(m_frames[m_currentFrameIndex].m_commandBuffer, m_queryPoolPipeline, 0, RENDER_PASS_COUNT);
 
     return true;
 }
 
-void Renderer::drawCull(VkPipeline pipeline, uint32_t timestamp, const char *phase, bool late, unsigned int postPass)
+void Renderer::drawCull(VkCommandBuffer commandBuffer, bool late, unsigned int postPass)
 {
-    uint32_t rasterizationStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_MESH_SHADER_BIT_EXT;
-
-    auto commandBuffer = m_frames[m_frameIndex % FRAMES_COUNT].m_commandBuffer;
+    CullData passData = m_cullData;
+    passData.clusterBackfaceEnabled = postPass == 0;
+    passData.postPass = postPass;
 
-    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 0);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_drawcullProgram, { /* LATE= */ late, /* TASK= */ true, /* STATS= */ m_cullStatsEnabled }));
 
-    VkBufferMemoryBarrier2 prefillBarrier = bufferBarrier(m_buffers.m_commandCount.buffer,
-        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
-    pipelineBarrier(commandBuffer, 0, 1, &prefillBarrier, 0, nullptr);
+    // the first cull doesn't read pyramid data, but the read in the shader is guarded by a push constant value (which could be specialization constant but isn't due to AMD bug)
+    DescriptorInfo pyramidDesc(m_samplers.m_depthSampler, m_depthPyramid.imageView, VK_IMAGE_LAYOUT_GENERAL);
+    DescriptorInfo descriptors[] = { getDrawBuffer().buffer, m_buffers.m_meshesh.buffer, m_buffers.m_taskCommands.buffer, m_buffers.m_commandCount.buffer, m_buffers.m_drawVisibility.buffer, pyramidDesc, m_buffers.m_cullStats.buffer, m_frames[m_currentFrameIndex].m_drawOcclusion.buffer };
 
-    // printf("vkCmdFillBuffer \n");
-    vkCmdFillBuffer(commandBuffer, m_buffers.m_commandCount.buffer, 0, 4, 0);
+    dispatch(commandBuffer, m_programs.m_drawcullProgram, m_instances.getDrawCount(), 1, passData, descriptors);
+}
 
-    // pyramid barrier is tricky: our frame sequence is cull -> render -> pyramid -> cull -> render
-    // the first cull (late=0) doesn't read pyramid data BUT the read in the shader is guarded by a push constant value (which could be specialization constant but isn't due to AMD bug)
-    // the second cull (late=1) does read pyramid data that was written in the pyramid stage
-    // as such, second cull needs to transition GENERAL->GENERAL with a COMPUTE->COMPUTE barrier, but the first cull needs to have a dummy transition because pyramid starts in UNDEFINED state on first frame
-    VkImageMemoryBarrier2 pyramidBarrier = imageBarrier(m_depthPyramid.image,
-        late ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0, late ? VK_ACCESS_SHADER_WRITE_BIT : 0, late ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+void Renderer::drawTaskSubmit(VkCommandBuffer commandBuffer)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_tasksubmitProgram));
 
-    VkBufferMemoryBarrier2 fillBarriers[] = {
-        bufferBarrier(m_buffers.m_taskCommands.buffer,
-            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | rasterizationStage, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT),
-        bufferBarrier(m_buffers.m_commandCount.buffer,
-            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT),
-    };
-    // printf("pipelineBarrier \n");
-    pipelineBarrier(commandBuffer, 0, COUNTOF(fillBarriers), fillBarriers, 1, &pyramidBarrier);
+    DescriptorInfo descriptors[] = { m_buffers.m_commandCount.buffer, m_buffers.m_taskCommands.buffer };
+    vkCmdPushDescriptorSetWithTemplate(commandBuffer, m_programs.m_tasksubmitProgram.updateTemplate, m_programs.m_tasksubmitProgram.layout, 0, descriptors);
 
-    {
-        CullData passData = m_cullData;
-        passData.clusterBackfaceEnabled = postPass == 0;
-        passData.postPass = postPass;
+    vkCmdDispatch(commandBuffer, 1, 1, 1);
+}
 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+void Renderer::drawClusterCull(VkCommandBuffer commandBuffer, bool late, unsigned int postPass)
+{
+    CullData passData = m_cullData;
+    passData.clusterBackfaceEnabled = postPass == 0;
+    passData.postPass = postPass;
 
-        DescriptorInfo pyramidDesc(m_samplers.m_depthSampler, m_depthPyramid.imageView, VK_IMAGE_LAYOUT_GENERAL);
-        DescriptorInfo descriptors[] = { m_buffers.m_draw.buffer, m_buffers.m_meshesh.buffer, m_buffers.m_taskCommands.buffer, m_buffers.m_commandCount.buffer, m_buffers.m_drawVisibility.buffer, pyramidDesc };
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_clustercullProgram, { /* LATE= */ late, /* STATS= */ m_cullStatsEnabled }));
 
-        // printf("dispatch %lu \n", m_draws.size());
-        dispatch(commandBuffer, m_programs.m_drawcullProgram, uint32_t(m_draws.size()), 1, passData, descriptors);
-        // printf("dispatch completed \n");
-    }
+    DescriptorInfo pyramidDesc(m_samplers.m_depthSampler, m_depthPyramid.imageView, VK_IMAGE_LAYOUT_GENERAL);
+    DescriptorInfo descriptors[] = { m_buffers.m_taskCommands.buffer, getDrawBuffer().buffer, m_buffers.m_meshlets.buffer, m_buffers.m_meshletVisibility.buffer, pyramidDesc, m_buffers.m_clusterIndices.buffer, m_buffers.m_clusterCount.buffer, m_buffers.m_cullStats.buffer };
+    vkCmdPushDescriptorSetWithTemplate(commandBuffer, m_programs.m_clustercullProgram.updateTemplate, m_programs.m_clustercullProgram.layout, 0, descriptors);
 
-    VkBufferMemoryBarrier2 syncBarrier = bufferBarrier(m_buffers.m_commandCount.buffer,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    vkCmdPushConstants(commandBuffer, m_programs.m_clustercullProgram.layout, m_programs.m_clustercullProgram.pushConstantStages, 0, sizeof(passData), &passData);
 
-    // printf("pipelineBarrier \n");
-    pipelineBarrier(commandBuffer, 0, 1, &syncBarrier, 0, nullptr);
+    // one workgroup per task command, laid out by drawTaskSubmit like the task shader dispatch
+    vkCmdDispatchIndirect(commandBuffer, m_buffers.m_commandCount.buffer, 4);
+}
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_tasksubmitPipeline);
+void Renderer::drawClusterSubmit(VkCommandBuffer commandBuffer)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_clustersubmitProgram));
 
-    DescriptorInfo descriptors[] = { m_buffers.m_commandCount.buffer, m_buffers.m_taskCommands.buffer };
-    vkCmdPushDescriptorSetWithTemplate(commandBuffer, m_programs.m_tasksubmitProgram.updateTemplate, m_programs.m_tasksubmitProgram.layout, 0, descriptors);
+    DescriptorInfo descriptors[] = { m_buffers.m_clusterCount.buffer, m_buffers.m_clusterIndices.buffer };
+    vkCmdPushDescriptorSetWithTemplate(commandBuffer, m_programs.m_clustersubmitProgram.updateTemplate, m_programs.m_clustersubmitProgram.layout, 0, descriptors);
 
-    // printf("vkCmdDispatch \n");
     vkCmdDispatch(commandBuffer, 1, 1, 1);
-
-    VkBufferMemoryBarrier2 cullBarriers[] = {
-        bufferBarrier(m_buffers.m_taskCommands.buffer,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
-            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | rasterizationStage, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT),
-        bufferBarrier(m_buffers.m_commandCount.buffer,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
-            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT),
-    };
-
-    // printf("pipelineBarrier \n");
-    pipelineBarrier(commandBuffer, 0, COUNTOF(cullBarriers), cullBarriers, 0, nullptr);
-
-    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 1);
 }
 
-void Renderer::drawRender(bool late, const VkClearColorValue &colorClear, const VkClearDepthStencilValue &depthClear, uint32_t query, uint32_t timestamp, const char *phase, unsigned int postPass)
+void Renderer::drawRender(VkCommandBuffer commandBuffer, bool late, const VkClearColorValue &colorClear, const VkClearDepthStencilValue &depthClear, uint32_t query, unsigned int postPass)
 {
-    auto commandBuffer = m_frames[m_frameIndex % FRAMES_COUNT].m_commandBuffer;
-
-    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 0);
-
     vkCmdBeginQuery(commandBuffer, m_queryPoolPipeline, query, 0);
 
     // Use the new free functions to create attachments
@@ -462,44 +619,35 @@ void Renderer::drawRender(bool late, const VkClearColorValue &colorClear, const
     Globals passGlobals = m_globals;
     passGlobals.cullData.postPass = postPass;
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, postPass >= 1 ? m_pipelines.m_meshtaskpostPipeline : late ? m_pipelines.m_meshtasklatePipeline
-                                                                                                                    : m_pipelines.m_meshtaskPipeline);
+    // the cluster path culled meshlets already, so mesh shader workgroups read the cluster list instead of a task payload
+    bool cluster = m_meshletCull == MeshletCull_Cluster;
+    const Program& program = cluster ? m_programs.m_clusterProgram : m_programs.m_meshtaskProgram;
 
+    // LATE and STATS are only declared by the task shader; the cluster program keeps LATE at 0 so the early and late passes share a pipeline
+    VkPipeline pipeline = cluster ? m_pipelines.m_variants.get(program, m_gfxDevice.m_gbufferInfo, { 0, /* TASK= */ false, /* POST= */ int(postPass >= 1) })
+                        : postPass >= 1 ? m_pipelines.m_variants.get(program, m_gfxDevice.m_gbufferInfo, { /* LATE= */ true, /* TASK= */ true, /* POST= */ 1, /* STATS= */ m_cullStatsEnabled })
+                                        : m_pipelines.m_variants.get(program, m_gfxDevice.m_gbufferInfo, { /* LATE= */ late, /* TASK= */ true, /* POST= */ 0, /* STATS= */ m_cullStatsEnabled });
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+    // binding 5 is meshlet visibility in the task shader and the cluster list in the mesh shader; only one of them is in the program
     DescriptorInfo pyramidDesc(m_samplers.m_depthSampler, m_depthPyramid.imageView, VK_IMAGE_LAYOUT_GENERAL);
-    DescriptorInfo descriptors[] = { m_buffers.m_taskCommands.buffer, m_buffers.m_draw.buffer, m_buffers.m_meshlets.buffer, m_buffers.m_meshletdata.buffer, m_buffers.m_vertices.buffer, m_buffers.m_meshletVisibility.buffer, pyramidDesc, m_samplers.m_textureSampler, m_buffers.m_materials.buffer };
-    vkCmdPushDescriptorSetWithTemplate(commandBuffer, m_programs.m_meshtaskProgram.updateTemplate, m_programs.m_meshtaskProgram.layout, 0, descriptors);
+    DescriptorInfo descriptors[] = { m_buffers.m_taskCommands.buffer, getDrawBuffer().buffer, m_buffers.m_meshlets.buffer, m_buffers.m_meshletdata.buffer, m_buffers.m_vertices.buffer, cluster ? m_buffers.m_clusterIndices.buffer : m_buffers.m_meshletVisibility.buffer, pyramidDesc, m_samplers.m_textureSampler, m_buffers.m_materials.buffer, m_buffers.m_cullStats.buffer };
+    vkCmdPushDescriptorSetWithTemplate(commandBuffer, program.updateTemplate, program.layout, 0, descriptors);
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_programs.m_meshtaskProgram.layout, 1, 1, &m_textureSet.second, 0, nullptr);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, program.layout, 1, 1, &m_textureSet.second, 0, nullptr);
 
-    vkCmdPushConstants(commandBuffer, m_programs.m_meshtaskProgram.layout, m_programs.m_meshtaskProgram.pushConstantStages, 0, sizeof(m_globals), &passGlobals);
-    vkCmdDrawMeshTasksIndirectEXT(commandBuffer, m_buffers.m_commandCount.buffer, 4, 1, 0);
+    vkCmdPushConstants(commandBuffer, program.layout, program.pushConstantStages, 0, sizeof(m_globals), &passGlobals);
+    vkCmdDrawMeshTasksIndirectEXT(commandBuffer, cluster ? m_buffers.m_clusterCount.buffer : m_buffers.m_commandCount.buffer, 4, 1, 0);
 
     vkCmdEndRendering(commandBuffer);
 
     vkCmdEndQuery(commandBuffer, m_queryPoolPipeline, query);
-
-    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 1);
 }
 
-void Renderer::drawPyramid(uint32_t timestamp)
+void Renderer::drawPyramid(VkCommandBuffer commandBuffer)
 {
-    auto commandBuffer = m_frames[m_frameIndex % FRAMES_COUNT].m_commandBuffer;
-
-    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 0);
-
-    VkImageMemoryBarrier2 depthBarriers[] = {
-        imageBarrier(m_depthTarget.image,
-            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            VK_IMAGE_ASPECT_DEPTH_BIT),
-        imageBarrier(m_depthPyramid.image,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL)
-    };
-
-    pipelineBarrier(commandBuffer, 0, 0, nullptr, COUNTOF(depthBarriers), depthBarriers);
-
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_depthreducePipeline);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_depthreduceProgram));
 
     for (uint32_t i = 0; i < m_depthPyramidLevels; ++i)
     {
@@ -521,321 +669,1454 @@ void Renderer::drawPyramid(uint32_t timestamp)
             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL,
             VK_IMAGE_ASPECT_COLOR_BIT, i, 1);
 
+        // mips depend on each other, which the graph can't express since it tracks the pyramid as a whole
         pipelineBarrier(commandBuffer, 0, 0, nullptr, 1, &reduceBarrier);
     }
-
-    VkImageMemoryBarrier2 depthWriteBarrier = imageBarrier(m_depthTarget.image,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-        VK_IMAGE_ASPECT_DEPTH_BIT);
-
-    pipelineBarrier(commandBuffer, 0, 0, nullptr, 1, &depthWriteBarrier);
-
-    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 1);
 }
 
-void Renderer::drawDebug()
-{
-}
-
-void Renderer::drawShadow()
+void Renderer::drawPyramidSinglePass(VkCommandBuffer commandBuffer)
 {
-    auto commandBuffer = m_frames[m_frameIndex % FRAMES_COUNT].m_commandBuffer;
+    assert(m_depthPyramidLevels <= PYRAMID_SINGLE_PASS_LEVELS);
 
-}
-
-void Renderer::draw()
-{
-    // at the beginning we are checking if resolution changed
-    // and should skip this cycle until swapchain is good.
-    // printf("beginFrame \n");
-    if (!beginFrame())
-    {
-        printf("Something wrong with beginFrame \n");
-        return;
-    }
-    
-    // Update camera based on keyboard input
-    float deltaTimeSeconds = m_frames[m_currentFrameIndex].m_deltaTime / 1000.0f;
-    m_camera.update(deltaTimeSeconds);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_depthpyramidProgram));
 
-    
-    // printf("drawCull \n");
-    drawCull(m_pipelines.m_taskcullPipeline, 2, "early cull", /* late= */ false);
-    // drawCull(m_pipelines.drawcullPipeline, 2, "early cull", /* late= */ false);
-    // printf("drawRender \n");
-    drawRender(/* late= */ false, m_colorClear, m_depthClear, 0, 4, "early render");
-    // printf("drawPyramid \n");
-    drawPyramid(6);
-    // printf("drawCull \n");
-    drawCull(m_pipelines.m_taskculllatePipeline, 8, "late cull", /* late= */ true);
-    // printf("drawRender \n");
-    drawRender(/* late= */ true, m_colorClear, m_depthClear, 1, 10, "late render");
-
-    if (m_meshPostPasses >> 1)
-    {
-        // post cull: frustum + occlusion cull & fill extra objects
-        // printf(" \n");
-        drawCull(m_pipelines.m_taskculllatePipeline , 12, "post cull", /* late= */ true, /* postPass= */ 1);
-
-        // post render: render extra objects
-        // printf(" \n");
-        drawRender(/* late= */ true, m_colorClear, m_depthClear, 2, 14, "post render", /* postPass= */ 1);
-    }
-
-
-    auto commandBuffer = m_frames[m_frameIndex % FRAMES_COUNT].m_commandBuffer;
-    VkImageMemoryBarrier2 blitBarriers[2 + GBUFFER_COUNT] = {
-        // note: even though the source image has previous state as undef, we need to specify COMPUTE_SHADER to synchronize with submitStageMask below
-        imageBarrier(m_gfxDevice.m_swapchain.images[m_imageIndex],
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL),
-        imageBarrier(m_depthTarget.image,
-            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            VK_IMAGE_ASPECT_DEPTH_BIT)
-    };
+    DescriptorInfo descriptors[2 + PYRAMID_SINGLE_PASS_LEVELS];
+    descriptors[0] = DescriptorInfo(m_samplers.m_depthSampler, m_depthTarget.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-    for (uint32_t i = 0; i < GBUFFER_COUNT; ++i)
-        blitBarriers[i + 2] = imageBarrier(m_gbufferTargets[i].image,
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // every mip binding needs a valid view; the shader doesn't write mips past the last one
+    for (uint32_t i = 0; i < PYRAMID_SINGLE_PASS_LEVELS; ++i)
+        descriptors[1 + i] = DescriptorInfo(m_depthPyramidMips[std::min(i, m_depthPyramidLevels - 1)], VK_IMAGE_LAYOUT_GENERAL);
 
-    pipelineBarrier(commandBuffer, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, COUNTOF(blitBarriers), blitBarriers);
+    descriptors[1 + PYRAMID_SINGLE_PASS_LEVELS] = m_buffers.m_pyramidCounter.buffer;
 
+    // every thread reduces 4x4 texels of mip 0, every workgroup 64x64
+    uint32_t threadsX = (m_depthPyramidWidth + 3) / 4;
+    uint32_t threadsY = (m_depthPyramidHeight + 3) / 4;
 
-    // printf("should be replaced by raytracing \n");
+    PyramidData pyramidData = {};
+    pyramidData.imageSize = vec2(m_depthPyramidWidth, m_depthPyramidHeight);
+    pyramidData.levelCount = m_depthPyramidLevels;
+    pyramidData.groupCount = getGroupCount(threadsX, m_programs.m_depthpyramidProgram.localSizeX) * getGroupCount(threadsY, m_programs.m_depthpyramidProgram.localSizeY);
 
-    // should be replaced by raytracing
-    {
+    dispatch(commandBuffer, m_programs.m_depthpyramidProgram, threadsX, threadsY, pyramidData, descriptors);
+}
 
-        VkImageMemoryBarrier2 dummyBarrier =
-            imageBarrier(m_shadowTarget.image,
-                0, 0, VK_IMAGE_LAYOUT_UNDEFINED,
-                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+void Renderer::drawDebug()
+{
+}
 
-        pipelineBarrier(commandBuffer, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 1, &dummyBarrier);
+void Renderer::drawShadow(VkCommandBuffer commandBuffer, bool checkerboard)
+{
+    bool high = m_shadowQuality == Shadow_High;
 
-        uint32_t timestamp = 16; // todo: we need an actual profiler
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 0);
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 1);
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 2);
-    }
+    // timed per quality as well, so runs with either report comparable times
+    GpuScope scope(m_profiler, commandBuffer, high ? "shadow hq" : "shadow lq");
 
-    {
-        uint32_t timestamp = 19;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_shadowProgram, { /* QUALITY= */ high }));
 
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 0);
+    DescriptorInfo descriptors[] = { { m_shadowTarget.imageView, VK_IMAGE_LAYOUT_GENERAL }, { m_samplers.m_readSampler, m_depthTarget.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }, { m_samplers.m_readSampler, m_gbufferTargets[1].imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }, m_buffers.m_tlas };
 
-        {
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_finalPipeline);
+    uint32_t width = m_gfxDevice.m_swapchain.width;
+    uint32_t height = m_gfxDevice.m_swapchain.height;
 
-            DescriptorInfo descriptors[] = { { m_gfxDevice.m_swapchainImageViews[m_imageIndex], VK_IMAGE_LAYOUT_GENERAL }, { m_samplers.m_readSampler, m_gbufferTargets[0].imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }, { m_samplers.m_readSampler, m_gbufferTargets[1].imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }, { m_samplers.m_readSampler, m_depthTarget.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }, { m_samplers.m_readSampler, m_shadowTarget.imageView, VK_IMAGE_LAYOUT_GENERAL } };
+    ShadowData shadowData = {};
+    shadowData.sunDirection = m_sunDirection;
+    shadowData.sunJitter = high ? SHADOW_SUN_RADIUS : 0.f;
+    shadowData.inverseViewProjection = inverse(m_projection * m_view);
+    shadowData.imageSize = vec2(float(width), float(height));
+    shadowData.checkerboard = checkerboard;
 
-            ShadeData shadeData = {};
-            shadeData.cameraPosition = m_camera.getPosition();
-            shadeData.sunDirection = m_sunDirection;
-            shadeData.shadowsEnabled = false;
-            shadeData.inverseViewProjection = inverse(m_projection * m_view);
-            shadeData.imageSize = vec2(float(m_gfxDevice.m_swapchain.width), float(m_gfxDevice.m_swapchain.height));
+    // in checkerboard mode every thread traces one pixel of a horizontal pair
+    dispatch(commandBuffer, m_programs.m_shadowProgram, checkerboard ? (width + 1) / 2 : width, height, shadowData, descriptors);
+}
 
-            dispatch(commandBuffer, m_programs.m_finalProgram, m_gfxDevice.m_swapchain.width, m_gfxDevice.m_swapchain.height, shadeData, descriptors);
-        }
+void Renderer::drawShadowFill(VkCommandBuffer commandBuffer)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_shadowfillProgram));
 
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, timestamp + 1);
-    }
+    DescriptorInfo descriptors[] = { { m_shadowTarget.imageView, VK_IMAGE_LAYOUT_GENERAL }, { m_samplers.m_readSampler, m_depthTarget.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL } };
 
-    // Import Global illumination here
-    // drawShadow();
+    uint32_t width = m_gfxDevice.m_swapchain.width;
+    uint32_t height = m_gfxDevice.m_swapchain.height;
 
-    // drawDebug();
+    vec4 fillData = vec4(float(width), float(height), 0, 0);
 
-    // printf("endFrame \n");
-    endFrame();
+    dispatch(commandBuffer, m_programs.m_shadowfillProgram, (width + 1) / 2, height, fillData, descriptors);
 }
 
-void Renderer::endFrame()
+void Renderer::drawShadowBlur(VkCommandBuffer commandBuffer, bool vertical)
 {
-    auto commandBuffer = m_frames[m_frameIndex % FRAMES_COUNT].m_commandBuffer;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_shadowblurProgram));
 
-    VkImageMemoryBarrier2 presentBarrier = imageBarrier(m_gfxDevice.m_swapchain.images[m_imageIndex],
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
-        0, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    const Image& source = vertical ? m_shadowblurTarget : m_shadowTarget;
+    const Image& target = vertical ? m_shadowTarget : m_shadowblurTarget;
 
-    pipelineBarrier(commandBuffer, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 1, &presentBarrier);
+    DescriptorInfo descriptors[] = { { target.imageView, VK_IMAGE_LAYOUT_GENERAL }, { m_samplers.m_readSampler, source.imageView, VK_IMAGE_LAYOUT_GENERAL }, { m_samplers.m_readSampler, m_depthTarget.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL } };
 
-    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, m_queryPoolTimestamp, 1);
+    uint32_t width = m_gfxDevice.m_swapchain.width;
+    uint32_t height = m_gfxDevice.m_swapchain.height;
 
-    VK_CHECK(vkEndCommandBuffer(commandBuffer));
+    vec4 blurData = vec4(float(width), float(height), vertical ? 0 : 1, vertical ? 1 : 0);
 
-    VkPipelineStageFlags submitStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-
-    VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &m_frames[m_currentFrameIndex].m_waitSemaphore;
-    submitInfo.pWaitDstStageMask = &submitStageMask;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &m_frames[m_currentFrameIndex].m_signalSemaphore;
+    dispatch(commandBuffer, m_programs.m_shadowblurProgram, width, height, blurData, descriptors);
+}
 
-    VK_CHECK_FORCE(vkQueueSubmit(m_queue, 1, &submitInfo, m_frames[m_currentFrameIndex].m_renderFence));
+void Renderer::drawFinal(VkCommandBuffer commandBuffer)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_variants.get(m_programs.m_finalProgram));
 
-    VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &m_frames[m_currentFrameIndex].m_signalSemaphore;
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = &m_gfxDevice.m_swapchain.swapchain;
-    presentInfo.pImageIndices = &m_imageIndex;
+    DescriptorInfo descriptors[] = { { m_gfxDevice.m_swapchainImageViews[m_imageIndex], VK_IMAGE_LAYOUT_GENERAL }, { m_samplers.m_readSampler, m_gbufferTargets[0].imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }, { m_samplers.m_readSampler, m_gbufferTargets[1].imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }, { m_samplers.m_readSampler, m_depthTarget.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }, { m_samplers.m_readSampler, m_shadowTarget.imageView, VK_IMAGE_LAYOUT_GENERAL } };
 
-    VK_CHECK_SWAPCHAIN(vkQueuePresentKHR(m_queue, &presentInfo));
+    ShadeData shadeData = {};
+    shadeData.cameraPosition = m_camera.getPosition();
+    shadeData.sunDirection = m_sunDirection;
+    shadeData.shadowsEnabled = m_shadowQuality != Shadow_Off;
+    shadeData.inverseViewProjection = inverse(m_projection * m_view);
+    shadeData.imageSize = vec2(float(m_gfxDevice.m_swapchain.width), float(m_gfxDevice.m_swapchain.height));
 
-    m_frameIndex++;
+    dispatch(commandBuffer, m_programs.m_finalProgram, m_gfxDevice.m_swapchain.width, m_gfxDevice.m_swapchain.height, shadeData, descriptors);
 }
 
-bool Renderer::loadGLTFScene(std::string filename)
+void declareFrameGraph(RenderGraph& graph, const FrameGraphSetup& setup, Renderer* renderer)
 {
-    // Use the existing loadScene function with our camera class directly
-    if (!loadScene(m_geometry, m_materials, m_draws, m_texturePaths, m_animations, m_camera, m_sunDirection, filename.c_str(), true, false))
+    const VkPipelineStageFlags2 rasterizationStage = VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT;
+
+    // mesh and geometry buffers are written once on load and aren't tracked
+    // draws are updated in place when spawned, despawned or moved and read by every later frame
+    RenderGraphResource draws = graph.importBuffer("draws", setup.draws, /* persistent= */ true);
+    RenderGraphResource taskCommands = graph.importBuffer("task commands", setup.taskCommands);
+    RenderGraphResource commandCount = graph.importBuffer("command count", setup.commandCount);
+    // visibility feeds the next frame's early passes
+    RenderGraphResource drawVisibility = graph.importBuffer("draw visibility", setup.drawVisibility, /* persistent= */ true);
+    RenderGraphResource meshletVisibility = graph.importBuffer("meshlet visibility", setup.meshletVisibility, /* persistent= */ true);
+    RenderGraphResource cullStats = graph.importBuffer("cull stats", setup.cullStats);
+    RenderGraphResource pyramidCounter = graph.importBuffer("pyramid counter", setup.pyramidCounter, /* persistent= */ true);
+
+    RenderGraphResource clusterIndices = 0, clusterCount = 0;
+    if (setup.clusterCull)
     {
-        printf("Error: scene %s failed to load\n", filename.c_str());
-        std::exit(1);
+        clusterIndices = graph.importBuffer("cluster indices", setup.clusterIndices);
+        clusterCount = graph.importBuffer("cluster count", setup.clusterCount);
     }
 
-	for (size_t i = 0; i < m_texturePaths.size(); ++i)
-	{
-		Image image;
-		if (!loadDDSImage(image, m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_gfxDevice.m_memoryProperties, m_buffers.m_scratch, m_texturePaths[i].c_str()))
-		{
-			printf("Error: image N: %ld %s failed to load\n", i, m_texturePaths[i].c_str());
-			return 1;
-		}
-
-		m_images.push_back(image);
-	}
-
-	// printf("Loaded %d textures (%.2f MB) in %.2f sec\n", int(m_images.size()), double(m_imageMemory) / 1e6, glfwGetTime() - imageTimer);
-
-	uint32_t descriptorCount = uint32_t(m_texturePaths.size() + 1);
-	m_textureSet = createDescriptorArray(m_gfxDevice.m_device, m_textureSetLayout, descriptorCount);
+    RenderGraphResource gbuffer[GBUFFER_COUNT];
+    for (uint32_t i = 0; i < GBUFFER_COUNT; ++i)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "gbuffer %d", int(i));
+        gbuffer[i] = graph.importImage(name, setup.gbuffer[i], VK_IMAGE_ASPECT_COLOR_BIT);
+    }
 
-	for (size_t i = 0; i < m_texturePaths.size(); ++i)
-	{
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.imageView = m_images[i].imageView;
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    RenderGraphResource depth = graph.importImage("depth", setup.depth, VK_IMAGE_ASPECT_DEPTH_BIT);
+    RenderGraphResource depthPyramid = graph.importImage("depth pyramid", setup.depthPyramid, VK_IMAGE_ASPECT_COLOR_BIT, /* persistent= */ true);
+    RenderGraphResource shadow = graph.importImage("shadow", setup.shadow, VK_IMAGE_ASPECT_COLOR_BIT);
+    RenderGraphResource shadowBlur = graph.importImage("shadow blur", setup.shadowBlur, VK_IMAGE_ASPECT_COLOR_BIT);
 
-		VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-		write.dstSet = m_textureSet.second;
-		write.dstBinding = 0;
-		write.dstArrayElement = uint32_t(i + 1);
-		write.descriptorCount = 1;
-		write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-		write.pImageInfo = &imageInfo;
+    // even though the swapchain image starts as undefined, the first barrier has to start at COMPUTE_SHADER to synchronize with the acquire wait in endFrame
+    RenderGraphState acquired = { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED };
+    RenderGraphResource swapchain = graph.importImage("swapchain", setup.swapchain, VK_IMAGE_ASPECT_COLOR_BIT, /* persistent= */ false, &acquired);
+    graph.markOutput(swapchain);
 
-		vkUpdateDescriptorSets(m_gfxDevice.m_device, 1, &write, 0, nullptr);
-	}
+    // without a renderer the graph is only compiled and dumped; otherwise every pass is timed under its name
+    auto addPass = [&](const char* name, RenderGraph::PassCallback callback)
+    {
+        if (!renderer)
+            return graph.addPass(name, nullptr);
 
-    printf("Geometry: VB %.2f MB, IB %.2f MB, meshlets %.2f MB\n",
-	    double(m_geometry.vertices.size() * sizeof(Vertex)) / 1e6,
-	    double(m_geometry.indices.size() * sizeof(uint32_t)) / 1e6,
-	    double(m_geometry.meshlets.size() * sizeof(Meshlet) + m_geometry.meshletdata.size() * sizeof(uint32_t)) / 1e6);
+        return graph.addPass(name, [renderer, name, callback = std::move(callback)](VkCommandBuffer commandBuffer)
+        {
+            PROFILE_ZONE_TRANSIENT(name);
+            PROFILE_GPU_ZONE_TRANSIENT(renderer->m_profileContext, commandBuffer, name);
+            GpuScope scope(renderer->m_profiler, commandBuffer, name);
+            callback(commandBuffer);
+        });
+    };
 
-    uint32_t meshletVisibilityCount = 0;
+    if (setup.clearVisibility || setup.clearSpawnedVisibility)
+    {
+        uint32_t pass = addPass("clear visibility", [=](VkCommandBuffer commandBuffer)
+        {
+            if (setup.clearVisibility)
+            {
+                vkCmdFillBuffer(commandBuffer, setup.drawVisibility, 0, setup.drawVisibilityBytes, 0);
+                vkCmdFillBuffer(commandBuffer, setup.meshletVisibility, 0, setup.meshletVisibilityBytes, 0);
+                return;
+            }
+
+            // spawned draws may reuse the slots and meshlet visibility bits of despawned ones
+            for (const InstanceManager::Range& range : renderer->m_instances.getSpawnedDraws())
+                vkCmdFillBuffer(commandBuffer, setup.drawVisibility, range.begin * sizeof(uint32_t), range.count * sizeof(uint32_t), 0);
+
+            for (const InstanceManager::Range& range : renderer->m_instances.getSpawnedMeshletWords())
+                vkCmdFillBuffer(commandBuffer, setup.meshletVisibility, range.begin * sizeof(uint32_t), range.count * sizeof(uint32_t), 0);
+        });
+
+        graph.write(pass, drawVisibility, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+        graph.write(pass, meshletVisibility, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    }
 
-    for (size_t i = 0; i < m_draws.size(); ++i)
+    if (setup.updateDraws)
     {
-        MeshDraw& draw = m_draws[i];
-        const Mesh& mesh = m_geometry.meshes[draw.meshIndex];
+        // staged draws were written by the host before submit, so only the copy into draws needs a barrier
+        uint32_t pass = addPass("update draws", [=](VkCommandBuffer commandBuffer)
+        {
+            const std::vector<VkBufferCopy>& copies = renderer->m_frames[renderer->m_currentFrameIndex].m_drawCopies;
+            vkCmdCopyBuffer(commandBuffer, setup.drawStaging, setup.draws, uint32_t(copies.size()), copies.data());
+        });
 
-        draw.meshletVisibilityOffset = meshletVisibilityCount;
+        graph.write(pass, draws, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    }
 
-        uint32_t meshletCount = 0;
-        for (uint32_t i = 0; i < mesh.lodCount; ++i)
-            meshletCount = std::max(meshletCount, mesh.lods[i].meshletCount);
+    if (setup.countCullStats)
+    {
+        uint32_t pass = addPass("clear cull stats", [=](VkCommandBuffer commandBuffer) { vkCmdFillBuffer(commandBuffer, setup.cullStats, 0, VK_WHOLE_SIZE, 0); });
 
-        meshletVisibilityCount += meshletCount;
-        m_meshPostPasses |= 1 << draw.postPass;
+        graph.write(pass, cullStats, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
     }
 
-    m_buffers.m_meshletVisibilityBytes = (meshletVisibilityCount + 31) / 32 * sizeof(uint32_t);
+    // names of the cluster passes, which only run with clusterCull
+    struct ClusterPassNames
+    {
+        const char* fill;
+        const char* cull;
+        const char* submit;
+    };
 
-    uint32_t raytracingBufferFlags = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    auto addCull = [&](const char* fillName, const char* cullName, const char* submitName, ClusterPassNames clusterNames, bool late, unsigned int postPass)
+    {
+        uint32_t fill = addPass(fillName, [=](VkCommandBuffer commandBuffer) { vkCmdFillBuffer(commandBuffer, setup.commandCount, 0, 4, 0); });
 
-    createBuffer(m_buffers.m_meshesh, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.meshes.size() * sizeof(Mesh), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBuffer(m_buffers.m_materials, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_materials.size() * sizeof(Material), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBuffer(m_buffers.m_vertices, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | raytracingBufferFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBuffer(m_buffers.m_indices, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | raytracingBufferFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBuffer(m_buffers.m_meshlets, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.meshlets.size() * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBuffer(m_buffers.m_meshletdata, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.meshletdata.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        graph.write(fill, commandCount, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
 
-    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_buffers.m_meshesh, m_buffers.m_scratch, m_geometry.meshes.data(), m_geometry.meshes.size() * sizeof(Mesh));
-    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_buffers.m_materials, m_buffers.m_scratch, m_materials.data(), m_materials.size() * sizeof(Material));
+        uint32_t cull = addPass(cullName, [=](VkCommandBuffer commandBuffer) { renderer->drawCull(commandBuffer, late, postPass); });
 
-    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_buffers.m_vertices, m_buffers.m_scratch, m_geometry.vertices.data(), m_geometry.vertices.size() * sizeof(Vertex));
-    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_buffers.m_indices, m_buffers.m_scratch, m_geometry.indices.data(), m_geometry.indices.size() * sizeof(uint32_t));
+        graph.read(cull, draws, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+        graph.read(cull, depthPyramid, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+        graph.write(cull, taskCommands, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT);
+        graph.write(cull, commandCount, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+        graph.write(cull, drawVisibility, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+        if (setup.countCullStats)
+            graph.write(cull, cullStats, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
 
-    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_buffers.m_meshlets, m_buffers.m_scratch, m_geometry.meshlets.data(), m_geometry.meshlets.size() * sizeof(Meshlet));
-    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_buffers.m_meshletdata, m_buffers.m_scratch, m_geometry.meshletdata.data(), m_geometry.meshletdata.size() * sizeof(uint32_t));
+        uint32_t submit = addPass(submitName, [=](VkCommandBuffer commandBuffer) { renderer->drawTaskSubmit(commandBuffer); });
 
-    createBuffer(m_buffers.m_draw, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_draws.size() * sizeof(MeshDraw), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    createBuffer(m_buffers.m_drawVisibility, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_draws.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBuffer(m_buffers.m_taskCommands, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, TASK_WGLIMIT * sizeof(MeshTaskCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBuffer(m_buffers.m_commandCount, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, 16, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        graph.write(submit, taskCommands, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+        graph.write(submit, commandCount, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
 
-    // TODO: there's a way to implement cluster visibility persistence *without* using bitwise storage at all, which may be beneficial on the balance, so we should try that.
-    // *if* we do that, we can drop meshletVisibilityOffset et al from everywhere
-    createBuffer(m_buffers.m_meshletVisibility, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_buffers.m_meshletVisibilityBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (!setup.clusterCull)
+            return;
 
-    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_buffers.m_draw, m_buffers.m_scratch, m_draws.data(), m_draws.size() * sizeof(MeshDraw));
+        uint32_t clusterFill = addPass(clusterNames.fill, [=](VkCommandBuffer commandBuffer) { vkCmdFillBuffer(commandBuffer, setup.clusterCount, 0, 4, 0); });
 
-    std::vector<VkDeviceSize> compactedSizes;
-    buildBLAS(m_gfxDevice.m_device, m_geometry.meshes, m_buffers.m_vertices, m_buffers.m_indices, m_blas, compactedSizes, m_buffers.m_blasBuffer, m_immCommandPool, m_immCommandBuffer, m_queue, m_gfxDevice.m_memoryProperties);
-    compactBLAS(m_gfxDevice.m_device, m_blas, compactedSizes, m_buffers.m_blasBuffer, m_immCommandPool, m_immCommandBuffer, m_queue, m_gfxDevice.m_memoryProperties);
+        graph.write(clusterFill, clusterCount, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
 
-    m_blasAddresses.resize(m_blas.size());
+        // dispatched indirectly with the task commands' workgroup count
+        uint32_t clusterCull = addPass(clusterNames.cull, [=](VkCommandBuffer commandBuffer) { renderer->drawClusterCull(commandBuffer, late, postPass); });
 
-    for (size_t i = 0; i < m_blas.size(); ++i)
-    {
-        VkAccelerationStructureDeviceAddressInfoKHR info = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
-        info.accelerationStructure = m_blas[i];
+        graph.read(clusterCull, draws, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+        graph.read(clusterCull, taskCommands, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+        graph.read(clusterCull, commandCount, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+        graph.read(clusterCull, depthPyramid, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+        graph.write(clusterCull, meshletVisibility, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+        graph.write(clusterCull, clusterIndices, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT);
+        graph.write(clusterCull, clusterCount, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+        if (setup.countCullStats)
+            graph.write(clusterCull, cullStats, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
 
-        m_blasAddresses[i] = vkGetAccelerationStructureDeviceAddressKHR(m_gfxDevice.m_device, &info);
-    }
+        uint32_t clusterSubmit = addPass(clusterNames.submit, [=](VkCommandBuffer commandBuffer) { renderer->drawClusterSubmit(commandBuffer); });
 
-    createBuffer(m_buffers.m_tlasInstanceBuffer, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, sizeof(VkAccelerationStructureInstanceKHR) * m_draws.size(), VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        graph.write(clusterSubmit, clusterIndices, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT);
+        graph.write(clusterSubmit, clusterCount, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+    };
 
-    for (size_t i = 0; i < m_draws.size(); ++i)
+    auto addRender = [&](const char* name, bool late, unsigned int postPass, uint32_t query)
     {
-        const MeshDraw& draw = m_draws[i];
-        assert(draw.meshIndex < m_blas.size());
+        uint32_t pass = addPass(name, [=](VkCommandBuffer commandBuffer) { renderer->drawRender(commandBuffer, late, renderer->m_colorClear, renderer->m_depthClear, query, postPass); });
 
-        VkAccelerationStructureInstanceKHR instance = {};
-        fillInstanceRT(instance, draw, uint32_t(i), m_blasAddresses[draw.meshIndex]);
-
-        memcpy(static_cast<VkAccelerationStructureInstanceKHR*>(m_buffers.m_tlasInstanceBuffer.data) + i, &instance, sizeof(VkAccelerationStructureInstanceKHR));
-    }
+        graph.read(pass, draws, rasterizationStage, VK_ACCESS_2_SHADER_READ_BIT);
 
-    m_buffers.m_tlas = createTLAS(m_gfxDevice.m_device, m_buffers.m_tlasBuffer, m_buffers.m_tlasScratchBuffer, m_buffers.m_tlasInstanceBuffer, m_draws.size(), m_gfxDevice.m_memoryProperties);
+        if (setup.clusterCull)
+        {
+            // meshlets were culled by the cluster passes; mesh shaders only look up task commands of listed clusters
+            graph.read(pass, taskCommands, VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT, VK_ACCESS_2_SHADER_READ_BIT);
+            graph.read(pass, clusterIndices, VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT, VK_ACCESS_2_SHADER_READ_BIT);
+            graph.read(pass, clusterCount, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+        }
+        else
+        {
+            graph.read(pass, taskCommands, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | rasterizationStage, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT);
+            graph.read(pass, commandCount, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+            graph.read(pass, depthPyramid, VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+            graph.write(pass, meshletVisibility, VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+            if (setup.countCullStats)
+                graph.write(pass, cullStats, VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+        }
+
+        // the early pass clears the targets, later passes load them
+        for (uint32_t i = 0; i < GBUFFER_COUNT; ++i)
+            graph.write(pass, gbuffer[i], VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                late ? VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT : VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL, /* discard= */ !late);
+
+        graph.write(pass, depth, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL, /* discard= */ !late);
+    };
+
+    addCull("early cull fill", "early cull", "early task submit", { "early cluster cull fill", "early cluster cull", "early cluster submit" }, /* late= */ false, /* postPass= */ 0);
+    addRender("early render", /* late= */ false, /* postPass= */ 0, 0);
+
+    // both reductions are timed under their own names as well, so alternating between them compares their GPU times
+    uint32_t pyramid = addPass("depth pyramid", [=](VkCommandBuffer commandBuffer)
+    {
+        if (setup.singlePassPyramid)
+        {
+            GpuScope scope(renderer->m_profiler, commandBuffer, "pyramid single pass");
+            renderer->drawPyramidSinglePass(commandBuffer);
+        }
+        else
+        {
+            GpuScope scope(renderer->m_profiler, commandBuffer, "pyramid per mip");
+            renderer->drawPyramid(commandBuffer);
+        }
+    });
+
+    graph.read(pyramid, depth, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    graph.write(pyramid, depthPyramid, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+    if (setup.singlePassPyramid)
+        graph.write(pyramid, pyramidCounter, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+
+    addCull("late cull fill", "late cull", "late task submit", { "late cluster cull fill", "late cluster cull", "late cluster submit" }, /* late= */ true, /* postPass= */ 0);
+    addRender("late render", /* late= */ true, /* postPass= */ 0, 1);
+
+    if (setup.postPass)
+    {
+        // post cull: frustum + occlusion cull & fill extra objects; post render: render extra objects
+        addCull("post cull fill", "post cull", "post task submit", { "post cluster cull fill", "post cluster cull", "post cluster submit" }, /* late= */ true, /* postPass= */ 1);
+        addRender("post render", /* late= */ true, /* postPass= */ 1, 2);
+    }
+
+    if (setup.countCullStats)
+    {
+        // the readback buffer belongs to the frame slot and is only read on the host once the frame completed
+        uint32_t pass = addPass("copy cull stats", [=](VkCommandBuffer commandBuffer)
+        {
+            VkBufferCopy region = { 0, 0, RENDER_PASS_COUNT * sizeof(CullStats) };
+            vkCmdCopyBuffer(commandBuffer, setup.cullStats, setup.cullStatsReadback, 1, &region);
+
+            VkBufferMemoryBarrier2 readbackBarrier = bufferBarrier(setup.cullStatsReadback, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+            pipelineBarrier(commandBuffer, 0, 1, &readbackBarrier, 0, nullptr);
+        });
+
+        graph.read(pass, cullStats, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+        graph.setSideEffects(pass);
+    }
+
+    if (setup.shadows)
+    {
+        uint32_t trace = addPass("shadow", [=](VkCommandBuffer commandBuffer) { renderer->drawShadow(commandBuffer, setup.shadowCheckerboard); });
+
+        graph.read(trace, depth, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        graph.read(trace, gbuffer[1], VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        // checkerboard tracing leaves gaps that the fill pass writes, so nothing of the previous frame is read either way
+        graph.write(trace, shadow, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, /* discard= */ true);
+
+        if (setup.shadowCheckerboard)
+        {
+            uint32_t fill = addPass("shadow fill", [=](VkCommandBuffer commandBuffer) { renderer->drawShadowFill(commandBuffer); });
+
+            graph.read(fill, depth, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            graph.write(fill, shadow, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+        }
+
+        uint32_t blurX = addPass("shadow blur x", [=](VkCommandBuffer commandBuffer) { renderer->drawShadowBlur(commandBuffer, /* vertical= */ false); });
+
+        graph.read(blurX, depth, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        graph.read(blurX, shadow, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+        graph.write(blurX, shadowBlur, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, /* discard= */ true);
+
+        uint32_t blurY = addPass("shadow blur y", [=](VkCommandBuffer commandBuffer) { renderer->drawShadowBlur(commandBuffer, /* vertical= */ true); });
+
+        graph.read(blurY, depth, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        graph.read(blurY, shadowBlur, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+        graph.write(blurY, shadow, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, /* discard= */ true);
+    }
+
+    uint32_t shade = addPass("final", [=](VkCommandBuffer commandBuffer) { renderer->drawFinal(commandBuffer); });
+
+    graph.write(shade, swapchain, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, /* discard= */ true);
+    for (uint32_t i = 0; i < GBUFFER_COUNT; ++i)
+        graph.read(shade, gbuffer[i], VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    graph.read(shade, depth, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    graph.read(shade, shadow, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+
+    // presentation waits on the submit semaphore, so the transition doesn't need a destination stage
+    uint32_t present = addPass("present", [=](VkCommandBuffer commandBuffer) { renderer->m_profiler.endFrame(commandBuffer); });
+
+    // offscreen images are left ready to be copied out
+    graph.read(present, swapchain, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, setup.offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    graph.setSideEffects(present);
+}
+
+template <typename T>
+static T placeholderHandle(uintptr_t value)
+{
+    return (T)value;
+}
+
+void dumpFrameGraph(int frames)
+{
+    // handles only identify resources in the dump; nothing is sent to a device
+    FrameGraphSetup setup = {};
+    setup.draws = placeholderHandle<VkBuffer>(5);
+    setup.drawStaging = placeholderHandle<VkBuffer>(9);
+    setup.taskCommands = placeholderHandle<VkBuffer>(1);
+    setup.commandCount = placeholderHandle<VkBuffer>(2);
+    setup.drawVisibility = placeholderHandle<VkBuffer>(3);
+    setup.meshletVisibility = placeholderHandle<VkBuffer>(4);
+    setup.drawVisibilityBytes = 1024;
+    setup.meshletVisibilityBytes = 1024;
+    setup.cullStats = placeholderHandle<VkBuffer>(6);
+    setup.cullStatsReadback = placeholderHandle<VkBuffer>(7);
+    setup.pyramidCounter = placeholderHandle<VkBuffer>(8);
+    setup.clusterIndices = placeholderHandle<VkBuffer>(10);
+    setup.clusterCount = placeholderHandle<VkBuffer>(11);
+
+    for (uint32_t i = 0; i < GBUFFER_COUNT; ++i)
+        setup.gbuffer[i] = placeholderHandle<VkImage>(16 + i);
+    setup.depth = placeholderHandle<VkImage>(32);
+    setup.depthPyramid = placeholderHandle<VkImage>(33);
+    setup.shadow = placeholderHandle<VkImage>(34);
+    setup.shadowBlur = placeholderHandle<VkImage>(35);
+    setup.postPass = true;
+    setup.shadows = true;
+    setup.shadowCheckerboard = true;
+    setup.updateDraws = true;
+    setup.countCullStats = true;
+
+    RenderGraph graph;
+
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        // alternate swapchain images like a real swapchain would
+        setup.swapchain = placeholderHandle<VkImage>(64 + frame % FRAMES_COUNT);
+        setup.clearVisibility = frame == 0;
+        setup.clearSpawnedVisibility = frame != 0;
+        setup.singlePassPyramid = frame % 2 == 1;
+        setup.clusterCull = frame % 2 == 1;
+
+        graph.reset();
+        declareFrameGraph(graph, setup, nullptr);
+        graph.compile();
+
+        printf("Frame %d\n", frame);
+        graph.dump(stdout);
+    }
+}
+
+void Renderer::draw()
+{
+    PROFILE_ZONE();
+
+    // at the beginning we are checking if resolution changed
+    // and should skip this cycle until swapchain is good.
+    if (!beginFrame())
+    {
+        printf("Something wrong with beginFrame \n");
+        return;
+    }
+
+    // the cluster list has room for CLUSTER_LIMIT clusters, so it's only allocated once the cluster path is selected
+    if (m_meshletCull == MeshletCull_Cluster && !m_buffers.m_clusterIndices.buffer)
+    {
+        createBuffer(m_buffers.m_clusterIndices, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, CLUSTER_LIMIT * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        createBuffer(m_buffers.m_clusterCount, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, 16, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+
+    FrameGraphSetup setup = {};
+    setup.draws = getDrawBuffer().buffer;
+    setup.drawStaging = m_frames[m_currentFrameIndex].m_drawStaging.buffer;
+    setup.taskCommands = m_buffers.m_taskCommands.buffer;
+    setup.commandCount = m_buffers.m_commandCount.buffer;
+    setup.drawVisibility = m_buffers.m_drawVisibility.buffer;
+    setup.meshletVisibility = m_buffers.m_meshletVisibility.buffer;
+    setup.drawVisibilityBytes = sizeof(uint32_t) * m_buffers.m_drawCapacity;
+    setup.meshletVisibilityBytes = m_buffers.m_meshletVisibilityBytes;
+    setup.cullStats = m_buffers.m_cullStats.buffer;
+    setup.cullStatsReadback = m_frames[m_currentFrameIndex].m_cullStatsReadback.buffer;
+    setup.pyramidCounter = m_buffers.m_pyramidCounter.buffer;
+    setup.clusterIndices = m_buffers.m_clusterIndices.buffer;
+    setup.clusterCount = m_buffers.m_clusterCount.buffer;
+
+    for (uint32_t i = 0; i < GBUFFER_COUNT; ++i)
+        setup.gbuffer[i] = m_gbufferTargets[i].image;
+    setup.depth = m_depthTarget.image;
+    setup.depthPyramid = m_depthPyramid.image;
+    setup.shadow = m_shadowTarget.image;
+    setup.shadowBlur = m_shadowblurTarget.image;
+    setup.swapchain = m_gfxDevice.m_swapchain.images[m_imageIndex];
+
+    setup.clearVisibility = !m_buffers.m_drawVisibilityCleared || !m_buffers.m_meshletVisibilityCleared;
+    setup.postPass = (m_meshPostPasses >> 1) != 0;
+    setup.clearSpawnedVisibility = !m_instances.getSpawnedDraws().empty();
+    setup.updateDraws = !m_frames[m_currentFrameIndex].m_drawCopies.empty();
+    setup.offscreen = m_gfxDevice.m_headless;
+    setup.countCullStats = m_cullStatsEnabled;
+    setup.clusterCull = m_meshletCull == MeshletCull_Cluster;
+    setup.shadows = m_shadowQuality != Shadow_Off;
+    setup.shadowCheckerboard = m_shadowCheckerboard;
+    setup.singlePassPyramid = m_depthPyramidLevels <= PYRAMID_SINGLE_PASS_LEVELS && (m_pyramidMode == Pyramid_SinglePass || (m_pyramidMode == Pyramid_Alternate && m_frameIndex % 2 == 1));
+
+    m_frames[m_currentFrameIndex].m_cullStatsCopied = m_cullStatsEnabled;
+    m_buffers.m_drawVisibilityCleared = true;
+    m_buffers.m_meshletVisibilityCleared = true;
+
+    m_frameGraph.reset();
+    declareFrameGraph(m_frameGraph, setup, this);
+    m_frameGraph.compile();
+
+    recordFrameGraph();
+
+    // Import Global illumination here
+
+    // drawDebug();
+
+    endFrame();
+
+    PROFILE_FRAME();
+}
+
+void Renderer::readbackQueries()
+{
+    const FrameData& frame = m_frames[m_currentFrameIndex];
+
+    // per query, one value per statistic in bit order followed by availability; passes that didn't run stay unavailable
+    uint64_t results[RENDER_PASS_COUNT][6] = {};
+    assert(m_pipelineStatisticCount < COUNTOF(results[0]));
+
+    VK_CHECK_QUERY(vkGetQueryPoolResults(m_gfxDevice.m_device, frame.m_pipelinePool, 0, RENDER_PASS_COUNT, sizeof(results), results, sizeof(results[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT));
+
+    m_gpuStats.frameIndex = m_profiler.getFrameIndex();
+    m_gpuStats.valid = m_profiler.getFrameTime() > 0;
+    m_gpuStats.frameTime = m_profiler.getFrameTime();
+    m_gpuStats.passTimes = m_profiler.getFrameResults();
+    m_gpuStats.triangles = 0;
+
+    for (uint32_t pass = 0; pass < RENDER_PASS_COUNT; ++pass)
+    {
+        const uint64_t* values = results[pass];
+
+        PipelineStats& stats = m_gpuStats.passStats[pass];
+        stats = {};
+        stats.valid = values[m_pipelineStatisticCount] != 0;
+
+        if (!stats.valid)
+            continue;
+
+        stats.clippingInvocations = values[0];
+        stats.clippingPrimitives = values[1];
+        stats.fragmentInvocations = values[2];
+
+        if (m_gfxDevice.m_meshShaderQueries)
+        {
+            stats.taskInvocations = values[3];
+            stats.meshInvocations = values[4];
+        }
+
+        m_gpuStats.triangles += stats.clippingInvocations;
+    }
+
+    if (m_pipelineStatsInterval && m_gpuStats.frameIndex % m_pipelineStatsInterval == 0)
+        printPipelineStats(m_gpuStats);
+
+    // passes that didn't run leave their entries cleared
+    m_gpuStats.cullStatsValid = frame.m_cullStatsCopied;
+    if (frame.m_cullStatsCopied)
+        memcpy(m_gpuStats.cullStats, frame.m_cullStatsReadback.data, sizeof(m_gpuStats.cullStats));
+    else
+        memset(m_gpuStats.cullStats, 0, sizeof(m_gpuStats.cullStats));
+
+    if (m_gpuStats.cullStatsValid && m_cullStatsInterval && m_gpuStats.frameIndex % m_cullStatsInterval == 0)
+    {
+        printCullStats(m_gpuStats);
+
+        if (!m_cullStatsPath.empty())
+            writeCullStatsJson(m_cullStatsPath.c_str(), m_gpuStats, m_cullData);
+    }
+}
+
+void printPipelineStats(const GpuFrameStats& stats)
+{
+    printf("Frame %llu pipeline statistics:\n", (unsigned long long)stats.frameIndex);
+    printf("  %-6s %12s %12s %12s %9s %12s %9s\n", "pass", "task", "mesh", "triangles", "culled", "fragments", "frag/tri");
+
+    for (uint32_t pass = 0; pass < RENDER_PASS_COUNT; ++pass)
+    {
+        const PipelineStats& passStats = stats.passStats[pass];
+        if (!passStats.valid)
+            continue;
+
+        // primitives rejected after the mesh shader are work that cluster culling could have skipped; clipping can also add primitives
+        double culled = passStats.clippingInvocations ? 100.0 * std::max(double(passStats.clippingInvocations) - double(passStats.clippingPrimitives), 0.0) / double(passStats.clippingInvocations) : 0.0;
+        double fragmentsPerTriangle = passStats.clippingPrimitives ? double(passStats.fragmentInvocations) / double(passStats.clippingPrimitives) : 0.0;
+
+        printf("  %-6s %12llu %12llu %12llu %8.1f%% %12llu %9.2f\n", RENDER_PASS_NAMES[pass],
+            (unsigned long long)passStats.taskInvocations, (unsigned long long)passStats.meshInvocations, (unsigned long long)passStats.clippingInvocations,
+            culled, (unsigned long long)passStats.fragmentInvocations, fragmentsPerTriangle);
+
+        // triangles that reach the rasterizer but never cover a pixel usually mean the pass was drawn with broken globals
+        if (passStats.clippingInvocations && (!passStats.clippingPrimitives || !passStats.fragmentInvocations))
+            printf("  warning: %s pass emitted %llu triangles but rasterized %llu with %llu fragments\n", RENDER_PASS_NAMES[pass],
+                (unsigned long long)passStats.clippingInvocations, (unsigned long long)passStats.clippingPrimitives, (unsigned long long)passStats.fragmentInvocations);
+    }
+
+    // late and post passes only draw what the early pass missed, so their share shows how well last frame's visibility predicted this one
+    uint64_t early = stats.passStats[0].clippingInvocations;
+    double lateShare = stats.triangles ? 100.0 * double(stats.triangles - early) / double(stats.triangles) : 0.0;
+
+    printf("  %.2fM triangles, %.1f%% drawn after the early pass\n", double(stats.triangles) * 1e-6, lateShare);
+}
+
+void printBlasLods(const std::vector<Mesh>& meshes, const std::vector<uint32_t>& blasLods, const std::vector<uint32_t>& blasTriangles, const std::vector<VkDeviceSize>& compactedSizes)
+{
+    VkDeviceSize lodSizes[COUNTOF(Mesh::lods)] = {};
+    uint64_t lodTriangles[COUNTOF(Mesh::lods)] = {};
+    uint64_t fullTriangles = 0;
+
+    for (size_t i = 0; i < blasLods.size(); ++i)
+    {
+        lodSizes[blasLods[i]] += compactedSizes[i];
+        lodTriangles[blasLods[i]] += blasTriangles[i];
+    }
+
+    for (const Mesh& mesh : meshes)
+        fullTriangles += mesh.lods[0].indexCount / 3;
+
+    for (uint32_t lod = 0; lod < COUNTOF(Mesh::lods); ++lod)
+        if (lodTriangles[lod])
+            printf("BLAS LOD %u: %.2f MB, %.3fM triangles\n", lod, double(lodSizes[lod]) / 1e6, double(lodTriangles[lod]) * 1e-6);
+
+    printf("BLAS LOD 0 of every mesh: %.3fM triangles\n", double(fullTriangles) * 1e-6);
+}
+
+void printCullStats(const GpuFrameStats& stats)
+{
+    if (!stats.cullStatsValid)
+        return;
+
+    printf("Frame %llu culling statistics:\n", (unsigned long long)stats.frameIndex);
+    printf("  %-6s %-8s %10s %10s %10s %10s %10s %10s %10s %12s\n", "pass", "stage", "tested", "history", "backface", "frustum", "occlusion", "drawn", "emitted", "triangles");
+
+    for (uint32_t pass = 0; pass < RENDER_PASS_COUNT; ++pass)
+    {
+        const CullStats& cs = stats.cullStats[pass];
+        if (cs.drawsTested == 0)
+            continue;
+
+        // draws aren't backface culled
+        printf("  %-6s %-8s %10u %10u %10s %10u %10u %10u %10u %12u\n", RENDER_PASS_NAMES[pass], "draws",
+            cs.drawsTested, cs.drawsHistoryCulled, "-", cs.drawsFrustumCulled, cs.drawsOcclusionCulled, cs.drawsAlreadyDrawn, cs.drawsEmitted, cs.drawTriangles);
+        printf("  %-6s %-8s %10u %10u %10u %10u %10u %10u %10u %12u\n", "", "meshlets",
+            cs.meshletsTested, cs.meshletsHistoryCulled, cs.meshletsBackfaceCulled, cs.meshletsFrustumCulled, cs.meshletsOcclusionCulled, cs.meshletsAlreadyDrawn, cs.meshletsEmitted, cs.meshletTriangles);
+
+        printf("  %-6s lods", "");
+        for (uint32_t lod = 0; lod < COUNTOF(cs.drawLods); ++lod)
+            printf(" %u", cs.drawLods[lod]);
+        printf("\n");
+
+        if (cs.drawsDropped)
+            printf("  %-6s %u draws dropped, task commands overflowed\n", "", cs.drawsDropped);
+    }
+}
+
+bool writeCullStatsJson(const char* path, const GpuFrameStats& stats, const CullData& cullData)
+{
+    nlohmann::json passes;
+
+    for (uint32_t pass = 0; pass < RENDER_PASS_COUNT; ++pass)
+    {
+        const CullStats& cs = stats.cullStats[pass];
+
+        nlohmann::json draws;
+        draws["tested"] = cs.drawsTested;
+        draws["historyCulled"] = cs.drawsHistoryCulled;
+        draws["frustumCulled"] = cs.drawsFrustumCulled;
+        draws["occlusionCulled"] = cs.drawsOcclusionCulled;
+        draws["alreadyDrawn"] = cs.drawsAlreadyDrawn;
+        draws["emitted"] = cs.drawsEmitted;
+        draws["dropped"] = cs.drawsDropped;
+        draws["meshlets"] = cs.drawMeshlets;
+        draws["triangles"] = cs.drawTriangles;
+        draws["lods"] = std::vector<uint32_t>(cs.drawLods, cs.drawLods + COUNTOF(cs.drawLods));
+
+        nlohmann::json meshlets;
+        meshlets["tested"] = cs.meshletsTested;
+        meshlets["historyCulled"] = cs.meshletsHistoryCulled;
+        meshlets["backfaceCulled"] = cs.meshletsBackfaceCulled;
+        meshlets["frustumCulled"] = cs.meshletsFrustumCulled;
+        meshlets["occlusionCulled"] = cs.meshletsOcclusionCulled;
+        meshlets["alreadyDrawn"] = cs.meshletsAlreadyDrawn;
+        meshlets["emitted"] = cs.meshletsEmitted;
+        meshlets["triangles"] = cs.meshletTriangles;
+
+        passes[RENDER_PASS_NAMES[pass]] = { { "draws", draws }, { "meshlets", meshlets } };
+    }
+
+    // settings the counts depend on; without TASK_CULL meshlets are only counted as tested and emitted
+    nlohmann::json settings;
+    settings["lodTarget"] = cullData.lodTarget;
+    settings["lodEnabled"] = cullData.lodEnabled != 0;
+    settings["cullingEnabled"] = cullData.cullingEnabled != 0;
+    settings["occlusionEnabled"] = cullData.occlusionEnabled != 0;
+    settings["clusterOcclusionEnabled"] = cullData.clusterOcclusionEnabled != 0;
+    settings["clusterBackfaceEnabled"] = cullData.clusterBackfaceEnabled != 0;
+    settings["cpuOcclusionEnabled"] = cullData.cpuOcclusionEnabled != 0;
+    settings["taskCull"] = TASK_CULL != 0;
+    settings["meshMaxVertices"] = MESH_MAXVTX;
+    settings["meshMaxTriangles"] = MESH_MAXTRI;
+
+    nlohmann::json document;
+    document["frame"] = stats.frameIndex;
+    document["valid"] = stats.cullStatsValid;
+    document["settings"] = settings;
+    document["passes"] = passes;
+
+    std::ofstream file(path);
+    if (!file)
+    {
+        printf("Error: can't write culling statistics to %s\n", path);
+        return false;
+    }
 
+    file << document.dump(2) << "\n";
     return true;
 }
 
-void Renderer::cleanup()
+void Renderer::applySimulation(const SimulationState& state)
 {
-    printf("Doing cleanup of resources created by renderer\n");
-    
-    // Make sure we finish all pending work before destroying resources
-    VK_CHECK(vkDeviceWaitIdle(m_gfxDevice.m_device));
-    
-    // Wait for all frames to complete
-    for (int i = 0; i < FRAMES_COUNT; i++)
+    m_camera = state.camera;
+    m_sunDirection = state.sunDirection;
+
+    m_animatedDraws.clear();
+
+    if (state.tick == m_simulationTick)
+        return;
+
+    m_simulationTick = state.tick;
+
+    for (const DrawTransform& transform : state.drawTransforms)
+    {
+        // animations keep running after their draws are despawned; until the slot is reused, there's nothing to move
+        if (!m_instances.isAlive(transform.drawIndex))
+            continue;
+
+        m_instances.setTransform(transform.drawIndex, transform.position, transform.scale, transform.orientation);
+
+        m_animatedDraws.push_back(transform.drawIndex);
+    }
+}
+
+void Renderer::cullOccludedDraws()
+{
+    PROFILE_ZONE();
+
+    const std::vector<MeshDraw>& draws = m_instances.getDraws();
+    const std::vector<uint32_t>& occluders = m_instances.getOccluders();
+
+    uint32_t width = CPU_OCCLUSION_WIDTH;
+    uint32_t height = std::min(std::max(width * m_gfxDevice.m_swapchain.height / m_gfxDevice.m_swapchain.width, 1u), uint32_t(OcclusionBuffer::MAX_SIZE));
+
+    // the buffer rounds its size up to whole tiles
+    if (m_occlusionBuffer.getWidth() != width || m_occlusionBuffer.getHeight() != (height + OcclusionBuffer::TILE_SIZE - 1) / OcclusionBuffer::TILE_SIZE * OcclusionBuffer::TILE_SIZE)
+        m_occlusionBuffer.init(width, height);
+
+    m_occluderMeshes.resize(m_geometry.meshes.size());
+
+    for (uint32_t drawIndex : occluders)
+    {
+        uint32_t meshIndex = draws[drawIndex].meshIndex;
+
+        if (m_occluderMeshes[meshIndex].indices.empty())
+            buildOccluderMesh(m_geometry, m_geometry.meshes[meshIndex], m_occluderMeshes[meshIndex]);
+    }
+
+    m_occlusionBuffer.render(m_cullData, draws, occluders, m_occluderMeshes, m_executor);
+
+    m_occlusionDraws.clear();
+    for (uint32_t i = 0; i < uint32_t(draws.size()); ++i)
+        if (draws[i].postPass != InstanceManager::FREE_SLOT)
+            m_occlusionDraws.push_back(i);
+
+    m_occlusionVisible.clear();
+    m_occlusionBuffer.filterDraws(draws, m_geometry.meshes, m_occlusionDraws, m_occlusionVisible, m_executor);
+
+    // built in cached memory and copied once, since the slot's buffer may be write combined
+    m_occlusionMask.assign((draws.size() + 31) / 32, 0);
+
+    for (uint32_t drawIndex : m_occlusionDraws)
+        m_occlusionMask[drawIndex / 32] |= 1u << (drawIndex % 32);
+
+    for (uint32_t drawIndex : m_occlusionVisible)
+        m_occlusionMask[drawIndex / 32] &= ~(1u << (drawIndex % 32));
+
+    memcpy(m_frames[m_currentFrameIndex].m_drawOcclusion.data, m_occlusionMask.data(), m_occlusionMask.size() * sizeof(uint32_t));
+}
+
+void Renderer::updateInstances(VkCommandBuffer commandBuffer)
+{
+    m_instances.flush();
+    m_meshPostPasses = m_instances.getPostPasses();
+
+    resizeInstanceBuffers(commandBuffer);
+    uploadDraws();
+
+    // refits can't activate or deactivate instances, and spawns may add instances
+    if (!m_instances.getSpawnedDraws().empty() || m_instances.getDespawnCount())
+        m_tlasNeedsRebuild = true;
+
+    const std::vector<InstanceManager::Range>& changed = m_instances.getChangedDraws();
+    m_tlasWrites.assign(changed.begin(), changed.end());
+
+    selectInstanceLods();
+
+    // instances referencing BLASes that were built or compacted are rewritten with their new address
+    m_blasChanges.clear();
+    if (m_blasBuilder.update(m_gfxDevice.m_device, commandBuffer, getTimelineCompleted(m_gfxDevice.m_device, m_timeline), m_timeline.value + 1, m_blasChanges))
+        m_tlasNeedsRebuild = true;
+
+    if (!m_blasChanges.empty())
+    {
+        std::vector<bool> blasChanged(m_blasBuilder.getCount());
+        for (uint32_t blas : m_blasChanges)
+            blasChanged[blas] = true;
+
+        const std::vector<MeshDraw>& draws = m_instances.getDraws();
+
+        for (uint32_t i = 0; i < uint32_t(draws.size()); ++i)
+            if (draws[i].postPass != InstanceManager::FREE_SLOT && blasChanged[m_instanceBlas[i]])
+                m_tlasWrites.push_back({ i, 1 });
+
+        if (m_blasBuilder.isCompacted() && m_rayTracingLods != 1)
+            printBlasLods(m_geometry.meshes, m_blasLods, m_blasTriangles, m_blasBuilder.getCompactedSizes());
+    }
+
+    InstanceManager::coalesceRanges(m_tlasWrites, InstanceManager::MAX_RANGE_GAP);
+
+    if (m_tlasWrites.empty())
+        return;
+
+    // earlier frames may still build the TLAS from the instances
+    VkBufferMemoryBarrier2 preBarrier = bufferBarrier(m_buffers.m_tlasInstanceBuffer.buffer,
+        VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+    pipelineBarrier(commandBuffer, 0, 1, &preBarrier, 0, nullptr);
+
+    // vkCmdUpdateBuffer writes at most 64 KB at a time
+    const uint32_t batchSize = 65536 / sizeof(VkAccelerationStructureInstanceKHR);
+    VkAccelerationStructureInstanceKHR instances[batchSize];
+
+    const std::vector<MeshDraw>& draws = m_instances.getDraws();
+
+    for (const InstanceManager::Range& range : m_tlasWrites)
+    {
+        for (uint32_t first = range.begin; first < range.begin + range.count; first += batchSize)
+        {
+            uint32_t count = std::min(batchSize, range.begin + range.count - first);
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                const MeshDraw& draw = draws[first + i];
+
+                // instances without an acceleration structure are inactive
+                instances[i] = {};
+                if (draw.postPass != InstanceManager::FREE_SLOT)
+                    fillInstanceRT(instances[i], draw, first + i, m_blasBuilder.getAddresses()[m_instanceBlas[first + i]]);
+
+                // a rebuild resets drift anyway, and slot counts only match the last build without spawns
+                if (!m_tlasNeedsRebuild)
+                {
+                    const vec4& sphere = m_tlasBuildSpheres[first + i];
+                    float radius = m_geometry.meshes[draw.meshIndex].radius * draw.scale;
+                    float drift = (length(draw.position - vec3(sphere)) + fabsf(radius - sphere.w)) / std::max(sphere.w, 1e-3f);
+
+                    m_tlasDrift += drift - m_tlasInstanceDrift[first + i];
+                    m_tlasInstanceDrift[first + i] = drift;
+                }
+            }
+
+            vkCmdUpdateBuffer(commandBuffer, m_buffers.m_tlasInstanceBuffer.buffer, first * sizeof(VkAccelerationStructureInstanceKHR), count * sizeof(VkAccelerationStructureInstanceKHR), instances);
+        }
+    }
+
+    VkBufferMemoryBarrier2 postBarrier = bufferBarrier(m_buffers.m_tlasInstanceBuffer.buffer,
+        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_SHADER_READ_BIT);
+
+    pipelineBarrier(commandBuffer, 0, 1, &postBarrier, 0, nullptr);
+
+    m_tlasNeedsUpdate = true;
+}
+
+void Renderer::selectInstanceLods()
+{
+    const std::vector<MeshDraw>& draws = m_instances.getDraws();
+
+    // spawned slots are rewritten with the changed draws, whatever BLAS they referenced before
+    m_instanceBlas.resize(draws.size());
+
+    // with one BLAS per mesh there is nothing to select, and only spawned draws need theirs
+    if (m_blasBuilder.getCount() == m_geometry.meshes.size())
+    {
+        for (const InstanceManager::Range& range : m_instances.getSpawnedDraws())
+            for (uint32_t i = range.begin; i < range.begin + range.count; ++i)
+                if (draws[i].postPass != InstanceManager::FREE_SLOT)
+                    m_instanceBlas[i] = m_meshBlas[draws[i].meshIndex];
+
+        return;
+    }
+
+    const std::vector<VkDeviceAddress>& addresses = m_blasBuilder.getAddresses();
+
+    vec3 cameraPosition = m_camera.getPosition();
+    float lodTarget = getLodTarget(m_gfxDevice.m_swapchain.height);
+
+    m_instanceTriangles = 0;
+    m_instanceFullTriangles = 0;
+
+    for (uint32_t i = 0; i < uint32_t(draws.size()); ++i)
+    {
+        const MeshDraw& draw = draws[i];
+        if (draw.postPass == InstanceManager::FREE_SLOT)
+            continue;
+
+        const Mesh& mesh = m_geometry.meshes[draw.meshIndex];
+        uint32_t blasBegin = m_meshBlas[draw.meshIndex];
+        uint32_t blasEnd = m_meshBlas[draw.meshIndex + 1];
+        uint32_t blas = blasBegin;
+
+        if (blasEnd - blasBegin > 1)
+        {
+            // same metric as drawcull.comp, so shadows of distant draws trace about the detail they are drawn with
+            vec3 center = draw.orientation * mesh.center * draw.scale + draw.position;
+            float distance = std::max(length(center - cameraPosition) - mesh.radius * draw.scale, 0.f);
+            float threshold = distance * lodTarget / draw.scale;
+
+            uint32_t lodIndex = 0;
+            for (uint32_t lod = 1; lod < mesh.lodCount; ++lod)
+                if (mesh.lods[lod].error < threshold)
+                    lodIndex = lod;
+
+            // BLASes that aren't built yet are skipped; a refit can't turn an active instance inactive
+            while (blas + 1 < blasEnd && m_blasLods[blas + 1] <= lodIndex && addresses[blas + 1])
+                blas++;
+        }
+
+        m_instanceTriangles += m_blasTriangles[blas];
+        m_instanceFullTriangles += mesh.lods[0].indexCount / 3;
+
+        if (m_instanceBlas[i] != blas)
+        {
+            m_instanceBlas[i] = blas;
+            m_tlasWrites.push_back({ i, 1 });
+        }
+    }
+
+    if (m_cullStatsInterval && m_frameIndex % m_cullStatsInterval == 0 && m_rayTracingLods != 1)
+        printf("Ray tracing LODs: instances reference %.3fM triangles, %.3fM at LOD 0\n", double(m_instanceTriangles) * 1e-6, double(m_instanceFullTriangles) * 1e-6);
+}
+
+void Renderer::updateTLAS(VkCommandBuffer commandBuffer)
+{
+    if (m_tlasUpdateCount >= TLAS_MAX_UPDATES || m_tlasDrift > TLAS_MAX_DRIFT * m_instances.getLiveDrawCount())
+        m_tlasNeedsRebuild = true;
+
+    if (!m_tlasNeedsRebuild && !m_tlasNeedsUpdate)
+        return;
+
+    bool rebuild = m_tlasNeedsRebuild;
+
+    PROFILE_GPU_ZONE_TRANSIENT(m_profileContext, commandBuffer, rebuild ? "tlas build" : "tlas update");
+    GpuScope scope(m_profiler, commandBuffer, rebuild ? "tlas build" : "tlas update");
+
+    // earlier frames may still trace rays against the TLAS or build it with the same scratch memory
+    VkBufferMemoryBarrier2 preBarriers[] = {
+        bufferBarrier(m_buffers.m_tlasBuffer.buffer,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, 0,
+            VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR),
+        bufferBarrier(m_buffers.m_tlasScratchBuffer.buffer,
+            VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+            VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR),
+    };
+
+    pipelineBarrier(commandBuffer, 0, COUNTOF(preBarriers), preBarriers, 0, nullptr);
+
+    buildTLAS(m_gfxDevice.m_device, commandBuffer, m_buffers.m_tlas, m_buffers.m_tlasBuffer, m_buffers.m_tlasScratchBuffer, m_buffers.m_tlasInstanceBuffer, m_instances.getDrawCount(),
+        rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR);
+
+    if (rebuild)
+    {
+        const std::vector<MeshDraw>& draws = m_instances.getDraws();
+
+        m_tlasBuildSpheres.resize(draws.size());
+        for (size_t i = 0; i < draws.size(); ++i)
+            m_tlasBuildSpheres[i] = vec4(draws[i].position, m_geometry.meshes[draws[i].meshIndex].radius * draws[i].scale);
+
+        m_tlasInstanceDrift.assign(draws.size(), 0.f);
+        m_tlasDrift = 0;
+        m_tlasUpdateCount = 0;
+    }
+    else
+    {
+        m_tlasUpdateCount++;
+    }
+
+    m_tlasNeedsRebuild = false;
+    m_tlasNeedsUpdate = false;
+}
+
+void Renderer::uploadDraws()
+{
+    FrameData& frame = m_frames[m_currentFrameIndex];
+
+    const std::vector<InstanceManager::Range>& changed = m_instances.getChangedDraws();
+    const std::vector<MeshDraw>& draws = m_instances.getDraws();
+
+    if (m_drawUpload == DrawUpload_Mapped)
+    {
+        // copies of other slots may still be read by frames in flight; they are patched when their slot comes around
+        for (FrameData& slot : m_frames)
+            slot.m_drawRanges.insert(slot.m_drawRanges.end(), changed.begin(), changed.end());
+
+        InstanceManager::coalesceRanges(frame.m_drawRanges, InstanceManager::MAX_RANGE_GAP);
+
+        for (const InstanceManager::Range& range : frame.m_drawRanges)
+            memcpy(static_cast<MeshDraw*>(frame.m_draws.data) + range.begin, &draws[range.begin], range.count * sizeof(MeshDraw));
+
+        frame.m_drawRanges.clear();
+        return;
+    }
+
+    frame.m_drawCopies.clear();
+
+    size_t size = 0;
+    for (const InstanceManager::Range& range : changed)
+        size += range.count * sizeof(MeshDraw);
+
+    if (size == 0)
+        return;
+
+    // the staging buffer only grows; the slot's previous frame, the last one to read it, has completed
+    if (frame.m_drawStaging.size < size)
+    {
+        if (frame.m_drawStaging.buffer)
+            destroyBuffer(frame.m_drawStaging, m_gfxDevice.m_device);
+
+        createBuffer(frame.m_drawStaging, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, std::max(size, frame.m_drawStaging.size * 2), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+
+    size_t offset = 0;
+
+    for (const InstanceManager::Range& range : changed)
+    {
+        VkBufferCopy region = { offset, range.begin * sizeof(MeshDraw), range.count * sizeof(MeshDraw) };
+        memcpy(static_cast<char*>(frame.m_drawStaging.data) + offset, &draws[range.begin], region.size);
+
+        frame.m_drawCopies.push_back(region);
+        offset += region.size;
+    }
+}
+
+const Buffer& Renderer::getDrawBuffer() const
+{
+    return m_drawUpload == DrawUpload_Mapped ? m_frames[m_currentFrameIndex].m_draws : m_buffers.m_draw;
+}
+
+void Renderer::resizeInstanceBuffers(VkCommandBuffer commandBuffer)
+{
+    uint32_t drawCapacity = m_instances.getDrawCapacity();
+    uint32_t meshletVisibilityBytes = m_instances.getMeshletVisibilityCapacity() * sizeof(uint32_t);
+
+    bool growDraws = m_buffers.m_drawCapacity != drawCapacity;
+    bool growMeshlets = m_buffers.m_meshletVisibilityBytes != meshletVisibilityBytes;
+
+    if (!growDraws && !growMeshlets)
+        return;
+
+    // nothing else is submitted before endFrame, so the frame's submit is the last one to use the old buffers
+    uint64_t retiredValue = m_timeline.value + 1;
+
+    std::vector<std::pair<Buffer, Buffer*>> grown; // old buffer and the member holding its replacement
+
+    auto grow = [&](Buffer& buffer, size_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags)
     {
-        if (m_frames[i].m_renderFence)
+        Buffer old = buffer;
+        createBuffer(buffer, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, size, usage, memoryFlags);
+
+        if (old.buffer)
+        {
+            assert(commandBuffer);
+            grown.push_back(std::make_pair(old, &buffer));
+        }
+    };
+
+    VkBufferUsageFlags storageUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VkBufferUsageFlags instanceUsage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    if (growDraws)
+    {
+        if (m_drawUpload == DrawUpload_Mapped)
+        {
+            // copies are rewritten from the CPU draws instead of copied on the GPU, when their slot is next used
+            for (FrameData& frame : m_frames)
+            {
+                if (frame.m_draws.buffer)
+                    m_retiredBuffers.push_back(std::make_pair(retiredValue, frame.m_draws));
+
+                createBuffer(frame.m_draws, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, drawCapacity * sizeof(MeshDraw), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible);
+
+                frame.m_drawRanges.clear();
+                frame.m_drawRanges.push_back({ 0, m_instances.getDrawCount() });
+            }
+        }
+        else
+        {
+            grow(m_buffers.m_draw, drawCapacity * sizeof(MeshDraw), storageUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        }
+
+        grow(m_buffers.m_drawVisibility, drawCapacity * sizeof(uint32_t), storageUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        grow(m_buffers.m_tlasInstanceBuffer, drawCapacity * sizeof(VkAccelerationStructureInstanceKHR), instanceUsage, hostVisible);
+
+        // occlusion masks are rewritten every frame they are read, so nothing is copied
+        for (FrameData& frame : m_frames)
         {
-            VK_CHECK(vkWaitForFences(m_gfxDevice.m_device, 1, &m_frames[i].m_renderFence, VK_TRUE, UINT64_MAX));
+            if (frame.m_drawOcclusion.buffer)
+                m_retiredBuffers.push_back(std::make_pair(retiredValue, frame.m_drawOcclusion));
+
+            createBuffer(frame.m_drawOcclusion, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, (drawCapacity + 31) / 32 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
         }
+
+        // the TLAS is sized for the instance count, so it's recreated and rebuilt from the copied instances
+        if (m_buffers.m_tlas)
+        {
+            m_retiredAccelerationStructures.push_back(std::make_pair(retiredValue, m_buffers.m_tlas));
+            m_retiredBuffers.push_back(std::make_pair(retiredValue, m_buffers.m_tlasBuffer));
+            m_retiredBuffers.push_back(std::make_pair(retiredValue, m_buffers.m_tlasScratchBuffer));
+        }
+
+        m_buffers.m_tlas = createTLAS(m_gfxDevice.m_device, m_buffers.m_tlasBuffer, m_buffers.m_tlasScratchBuffer, m_buffers.m_tlasInstanceBuffer, drawCapacity, m_gfxDevice.m_memoryProperties);
+        m_tlasNeedsRebuild = true;
+
+        m_buffers.m_drawCapacity = drawCapacity;
+    }
+
+    if (growMeshlets)
+    {
+        // TODO: there's a way to implement cluster visibility persistence *without* using bitwise storage at all, which may be beneficial on the balance, so we should try that.
+        // *if* we do that, we can drop meshletVisibilityOffset et al from everywhere
+        grow(m_buffers.m_meshletVisibility, meshletVisibilityBytes, storageUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        m_buffers.m_meshletVisibilityBytes = meshletVisibilityBytes;
+    }
+
+    if (grown.empty())
+        return;
+
+    printf("Instances: grew to %d draws, %d meshlet visibility words\n", int(drawCapacity), int(meshletVisibilityBytes / sizeof(uint32_t)));
+
+    // contents written by earlier frames are copied; slots past the old size are cleared when draws are spawned into them
+    std::vector<VkBufferMemoryBarrier2> barriers;
+
+    for (const std::pair<Buffer, Buffer*>& buffer : grown)
+        barriers.push_back(bufferBarrier(buffer.first.buffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT));
+
+    pipelineBarrier(commandBuffer, 0, barriers.size(), barriers.data(), 0, nullptr);
+    barriers.clear();
+
+    for (const std::pair<Buffer, Buffer*>& buffer : grown)
+    {
+        VkBufferCopy region = { 0, 0, buffer.first.size };
+        vkCmdCopyBuffer(commandBuffer, buffer.first.buffer, buffer.second->buffer, 1, &region);
+
+        barriers.push_back(bufferBarrier(buffer.second->buffer, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT));
+
+        m_retiredBuffers.push_back(std::make_pair(retiredValue, buffer.first));
+    }
+
+    pipelineBarrier(commandBuffer, 0, barriers.size(), barriers.data(), 0, nullptr);
+}
+
+void Renderer::recordFrameGraph()
+{
+    FrameData& frame = m_frames[m_currentFrameIndex];
+
+    // the prologue recorded by beginFrame is submitted first
+    VK_CHECK(vkEndCommandBuffer(frame.m_commandBuffer));
+
+    size_t workers = m_executor ? m_executor->thread_count() : 1;
+    uint32_t maxJobs = uint32_t(std::min(workers, size_t(MAX_RECORD_JOBS)));
+    std::vector<std::pair<uint32_t, uint32_t>> ranges = m_frameGraph.partition(std::max(maxJobs, 1u));
+
+    auto record = [&](size_t job)
+    {
+        PROFILE_ZONE_NAMED("record frame graph");
+
+        VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        VK_CHECK(vkBeginCommandBuffer(frame.m_recordBuffers[job], &beginInfo));
+        m_frameGraph.execute(frame.m_recordBuffers[job], ranges[job].first, ranges[job].second);
+        VK_CHECK(vkEndCommandBuffer(frame.m_recordBuffers[job]));
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::future<void>> jobs;
+    for (size_t job = 1; job < ranges.size(); ++job)
+        jobs.push_back(tmc::post_waitable(*m_executor, [&record, job]() { record(job); }, 0));
+
+    // the render thread records the first range instead of idling
+    if (!ranges.empty())
+        record(0);
+
+    for (std::future<void>& job : jobs)
+        job.wait();
+
+    m_recordCpuTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    frame.m_recordBufferCount = uint32_t(ranges.size());
+}
+
+void Renderer::endFrame()
+{
+    PROFILE_ZONE();
+
+    FrameData& frame = m_frames[m_currentFrameIndex];
+
+    // command buffers execute in array order, which keeps graph barriers valid across buffer boundaries
+    VkCommandBuffer commandBuffers[1 + MAX_RECORD_JOBS] = { frame.m_commandBuffer };
+    for (uint32_t job = 0; job < frame.m_recordBufferCount; ++job)
+        commandBuffers[1 + job] = frame.m_recordBuffers[job];
+
+    VkPipelineStageFlags submitStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    frame.m_timelineValue = ++m_timeline.value;
+
+    // the binary present semaphore ignores its value
+    VkSemaphore signalSemaphores[] = { frame.m_signalSemaphore, m_timeline.semaphore };
+    uint64_t signalValues[] = { 0, frame.m_timelineValue };
+
+    // headless frames have no acquire to wait for and nothing to present, so they only signal the timeline
+    uint32_t firstSignal = m_gfxDevice.m_headless ? 1 : 0;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+    timelineInfo.signalSemaphoreValueCount = 2 - firstSignal;
+    timelineInfo.pSignalSemaphoreValues = signalValues + firstSignal;
+
+    VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = m_gfxDevice.m_headless ? 0 : 1;
+    submitInfo.pWaitSemaphores = &m_frames[m_currentFrameIndex].m_waitSemaphore;
+    submitInfo.pWaitDstStageMask = &submitStageMask;
+    submitInfo.commandBufferCount = 1 + frame.m_recordBufferCount;
+    submitInfo.pCommandBuffers = commandBuffers;
+    submitInfo.signalSemaphoreCount = 2 - firstSignal;
+    submitInfo.pSignalSemaphores = signalSemaphores + firstSignal;
+
+    VK_CHECK_FORCE(vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE));
+
+    if (m_gfxDevice.m_headless)
+    {
+        m_frameIndex++;
+        return;
+    }
+
+    VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &m_frames[m_currentFrameIndex].m_signalSemaphore;
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &m_gfxDevice.m_swapchain.swapchain;
+    presentInfo.pImageIndices = &m_imageIndex;
+
+    VK_CHECK_SWAPCHAIN(vkQueuePresentKHR(m_queue, &presentInfo));
+
+    m_frameIndex++;
+}
+
+bool Renderer::loadGLTFScene(std::string filename)
+{
+    // Use the existing loadScene function with our camera class directly
+    std::vector<MeshDraw> draws;
+    if (!loadScene(m_geometry, m_materials, draws, m_texturePaths, m_animations, m_camera, m_sunDirection, filename.c_str(), true, false))
+    {
+        printf("Error: scene %s failed to load\n", filename.c_str());
+        std::exit(1);
+    }
+
+	for (size_t i = 0; i < m_texturePaths.size(); ++i)
+	{
+		Image image;
+		if (!loadDDSImage(image, m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_timeline, m_gfxDevice.m_memoryProperties, m_buffers.m_scratch, m_texturePaths[i].c_str()))
+		{
+			printf("Error: image N: %ld %s failed to load\n", i, m_texturePaths[i].c_str());
+			return 1;
+		}
+
+		m_images.push_back(image);
+	}
+
+	// printf("Loaded %d textures (%.2f MB) in %.2f sec\n", int(m_images.size()), double(m_imageMemory) / 1e6, glfwGetTime() - imageTimer);
+
+	uint32_t descriptorCount = uint32_t(m_texturePaths.size() + 1);
+	m_textureSet = createDescriptorArray(m_gfxDevice.m_device, m_textureSetLayout, descriptorCount);
+
+	for (size_t i = 0; i < m_texturePaths.size(); ++i)
+	{
+		VkDescriptorImageInfo imageInfo = {};
+		imageInfo.imageView = m_images[i].imageView;
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		write.dstSet = m_textureSet.second;
+		write.dstBinding = 0;
+		write.dstArrayElement = uint32_t(i + 1);
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		write.pImageInfo = &imageInfo;
+
+		vkUpdateDescriptorSets(m_gfxDevice.m_device, 1, &write, 0, nullptr);
+	}
+
+    printf("Geometry: VB %.2f MB, IB %.2f MB, meshlets %.2f MB\n",
+	    double(m_geometry.vertices.size() * sizeof(Vertex)) / 1e6,
+	    double(m_geometry.indices.size() * sizeof(uint32_t)) / 1e6,
+	    double(m_geometry.meshlets.size() * sizeof(Meshlet) + m_geometry.meshletdata.size() * sizeof(uint32_t)) / 1e6);
+
+    // assigns meshlet visibility ranges; buffers indexed by draw are sized by the manager's capacities, leaving room for spawns
+    m_instances.init(m_geometry.meshes, std::move(draws));
+    m_meshPostPasses = m_instances.getPostPasses();
+
+    // the largest opaque draws are the likeliest to hide others; alpha tested and blended draws have holes
+    std::vector<std::pair<float, uint32_t>> occluderSizes;
+    for (uint32_t i = 0; i < m_instances.getDrawCount(); ++i)
+    {
+        const MeshDraw& draw = m_instances.getDraws()[i];
+
+        if (draw.postPass == 0)
+            occluderSizes.push_back(std::make_pair(m_geometry.meshes[draw.meshIndex].radius * draw.scale, i));
+    }
+
+    size_t occluderCount = std::min(occluderSizes.size(), size_t(CPU_OCCLUDER_COUNT));
+    std::partial_sort(occluderSizes.begin(), occluderSizes.begin() + occluderCount, occluderSizes.end(), std::greater<std::pair<float, uint32_t>>());
+
+    for (size_t i = 0; i < occluderCount; ++i)
+        m_instances.setOccluder(occluderSizes[i].second, true);
+
+    uint32_t raytracingBufferFlags = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    createBuffer(m_buffers.m_meshesh, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.meshes.size() * sizeof(Mesh), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    createBuffer(m_buffers.m_materials, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_materials.size() * sizeof(Material), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    createBuffer(m_buffers.m_vertices, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | raytracingBufferFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    createBuffer(m_buffers.m_indices, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | raytracingBufferFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    createBuffer(m_buffers.m_meshlets, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.meshlets.size() * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    createBuffer(m_buffers.m_meshletdata, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.meshletdata.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_timeline, m_buffers.m_meshesh, m_buffers.m_scratch, m_geometry.meshes.data(), m_geometry.meshes.size() * sizeof(Mesh));
+    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_timeline, m_buffers.m_materials, m_buffers.m_scratch, m_materials.data(), m_materials.size() * sizeof(Material));
+
+    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_timeline, m_buffers.m_vertices, m_buffers.m_scratch, m_geometry.vertices.data(), m_geometry.vertices.size() * sizeof(Vertex));
+    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_timeline, m_buffers.m_indices, m_buffers.m_scratch, m_geometry.indices.data(), m_geometry.indices.size() * sizeof(uint32_t));
+
+    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_timeline, m_buffers.m_meshlets, m_buffers.m_scratch, m_geometry.meshlets.data(), m_geometry.meshlets.size() * sizeof(Meshlet));
+    uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_timeline, m_buffers.m_meshletdata, m_buffers.m_scratch, m_geometry.meshletdata.data(), m_geometry.meshletdata.size() * sizeof(uint32_t));
+
+    createBuffer(m_buffers.m_taskCommands, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, TASK_WGLIMIT * sizeof(MeshTaskCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    createBuffer(m_buffers.m_commandCount, m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, 16, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // every selected LOD a mesh has; when it has none of them, its coarsest LOD
+    std::vector<BlasLod> blasLods;
+    m_meshBlas.resize(m_geometry.meshes.size() + 1);
+
+    for (uint32_t i = 0; i < uint32_t(m_geometry.meshes.size()); ++i)
+    {
+        const Mesh& mesh = m_geometry.meshes[i];
+        m_meshBlas[i] = uint32_t(blasLods.size());
+
+        for (uint32_t lod = 0; lod < mesh.lodCount; ++lod)
+            if (m_rayTracingLods & (1 << lod))
+                blasLods.push_back({ i, lod });
+
+        if (m_meshBlas[i] == blasLods.size())
+            blasLods.push_back({ i, mesh.lodCount - 1 });
+    }
+
+    m_meshBlas.back() = uint32_t(blasLods.size());
+
+    m_blasLods.resize(blasLods.size());
+    m_blasTriangles.resize(blasLods.size());
+
+    for (size_t i = 0; i < blasLods.size(); ++i)
+    {
+        m_blasLods[i] = blasLods[i].lodIndex;
+        m_blasTriangles[i] = m_geometry.meshes[blasLods[i].meshIndex].lods[blasLods[i].lodIndex].indexCount / 3;
+    }
+
+    // built and compacted by the first frames, which trace nothing until then
+    m_blasBuilder.init(m_gfxDevice.m_device, m_gfxDevice.m_memoryProperties, m_geometry.meshes, blasLods, m_buffers.m_vertices, m_buffers.m_indices);
+
+    // per-slot copies need memory that is both device local and host visible, which isn't always there or large enough
+    m_drawUpload = DrawUpload_Staged;
+
+    VkMemoryPropertyFlags mappedFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    for (uint32_t i = 0; i < m_gfxDevice.m_memoryProperties.memoryTypeCount; ++i)
+    {
+        const VkMemoryType& memoryType = m_gfxDevice.m_memoryProperties.memoryTypes[i];
+
+        if ((memoryType.propertyFlags & mappedFlags) == mappedFlags && m_gfxDevice.m_memoryProperties.memoryHeaps[memoryType.heapIndex].size >= MAPPED_DRAWS_HEAP_FRACTION * FRAMES_COUNT * m_instances.getDrawCapacity() * sizeof(MeshDraw))
+            m_drawUpload = DrawUpload_Mapped;
+    }
+
+    printf("Draw uploads: %s\n", m_drawUpload == DrawUpload_Mapped ? "mapped per frame" : "staged");
+
+    // draws, visibility, TLAS instances and the TLAS itself
+    resizeInstanceBuffers(nullptr);
+
+    const std::vector<MeshDraw>& sceneDraws = m_instances.getDraws();
+
+    // mapped copies are written by the first frame of every slot
+    if (m_drawUpload == DrawUpload_Staged)
+        uploadBuffer(m_gfxDevice.m_device, m_immCommandPool, m_immCommandBuffer, m_queue, m_timeline, m_buffers.m_draw, m_buffers.m_scratch, sceneDraws.data(), sceneDraws.size() * sizeof(MeshDraw));
+
+    m_instanceBlas.clear();
+
+    for (size_t i = 0; i < sceneDraws.size(); ++i)
+    {
+        const MeshDraw& draw = sceneDraws[i];
+        assert(draw.meshIndex + 1 < m_meshBlas.size());
+
+        // the most detailed BLAS until the first frame selects LODs; instances are inactive until it is built
+        m_instanceBlas.push_back(m_meshBlas[draw.meshIndex]);
+
+        VkAccelerationStructureInstanceKHR instance = {};
+        fillInstanceRT(instance, draw, uint32_t(i), m_blasBuilder.getAddresses()[m_instanceBlas[i]]);
+
+        memcpy(static_cast<VkAccelerationStructureInstanceKHR*>(m_buffers.m_tlasInstanceBuffer.data) + i, &instance, sizeof(VkAccelerationStructureInstanceKHR));
     }
+
+    return true;
+}
+
+void Renderer::cleanup()
+{
+    printf("Doing cleanup of resources created by renderer\n");
+
+    m_simulation.stop();
+    m_shaderReloader.stop();
+    
+    // Make sure we finish all pending work before destroying resources; the idle wait also covers presentation
+    waitTimeline(m_gfxDevice.m_device, m_timeline, m_timeline.value);
+    VK_CHECK(vkDeviceWaitIdle(m_gfxDevice.m_device));
     
     // Destroy descriptor pool after commands are completed
     vkDestroyDescriptorPool(m_gfxDevice.m_device, m_textureSet.first, 0);
@@ -875,7 +2156,6 @@ void Renderer::cleanup()
     destroyBuffer(m_buffers.m_meshletdata, m_gfxDevice.m_device);
     destroyBuffer(m_buffers.m_meshletVisibility, m_gfxDevice.m_device);
     destroyBuffer(m_buffers.m_tlasBuffer, m_gfxDevice.m_device);
-    destroyBuffer(m_buffers.m_blasBuffer, m_gfxDevice.m_device);
     destroyBuffer(m_buffers.m_tlasScratchBuffer, m_gfxDevice.m_device);
     destroyBuffer(m_buffers.m_tlasInstanceBuffer, m_gfxDevice.m_device);
 	destroyBuffer(m_buffers.m_indices, m_gfxDevice.m_device);
@@ -883,13 +2163,15 @@ void Renderer::cleanup()
 	destroyBuffer(m_buffers.m_scratch, m_gfxDevice.m_device);
 
     vkDestroyAccelerationStructureKHR(m_gfxDevice.m_device, m_buffers.m_tlas, 0);
-    for (VkAccelerationStructureKHR as : m_blas)
-        vkDestroyAccelerationStructureKHR(m_gfxDevice.m_device, as, 0);
+    m_blasBuilder.destroy(m_gfxDevice.m_device);
 
     // Command pools should be destroyed after waiting for their command buffers to complete
     for (int i=0; i<FRAMES_COUNT; i++)
     {
         vkDestroyCommandPool(m_gfxDevice.m_device, m_frames[i].m_commandPool, 0);
+
+        for (uint32_t job = 0; job < MAX_RECORD_JOBS; ++job)
+            vkDestroyCommandPool(m_gfxDevice.m_device, m_frames[i].m_recordPools[job], 0);
     }
     
     // Destroy immediate command pool after use
@@ -897,13 +2179,35 @@ void Renderer::cleanup()
         vkDestroyCommandPool(m_gfxDevice.m_device, m_immCommandPool, 0);
     }
 
-	vkDestroyQueryPool(m_gfxDevice.m_device, m_queryPoolTimestamp, 0);
-	vkDestroyQueryPool(m_gfxDevice.m_device, m_queryPoolPipeline, 0);
+	for (int i = 0; i < FRAMES_COUNT; i++)
+	{
+		vkDestroyQueryPool(m_gfxDevice.m_device, m_frames[i].m_pipelinePool, 0);
+		destroyBuffer(m_frames[i].m_cullStatsReadback, m_gfxDevice.m_device);
+		destroyBuffer(m_frames[i].m_draws, m_gfxDevice.m_device);
+		destroyBuffer(m_frames[i].m_drawStaging, m_gfxDevice.m_device);
+		destroyBuffer(m_frames[i].m_drawOcclusion, m_gfxDevice.m_device);
+	}
+
+	destroyBuffer(m_buffers.m_cullStats, m_gfxDevice.m_device);
+	destroyBuffer(m_buffers.m_pyramidCounter, m_gfxDevice.m_device);
+	if (m_buffers.m_clusterIndices.buffer)
+	{
+		destroyBuffer(m_buffers.m_clusterIndices, m_gfxDevice.m_device);
+		destroyBuffer(m_buffers.m_clusterCount, m_gfxDevice.m_device);
+	}
 
-	destroySwapchain(m_gfxDevice.m_device, m_gfxDevice.m_swapchain);
+	m_profiler.destroy(m_gfxDevice.m_device);
+	PROFILE_GPU_CONTEXT_DESTROY(m_profileContext);
 
-	for (VkPipeline pipeline : m_pipelines.m_pipelines)
-		vkDestroyPipeline(m_gfxDevice.m_device, pipeline, 0);
+	if (m_gfxDevice.m_headless)
+		destroyOffscreenImages(m_gfxDevice);
+	else
+		destroySwapchain(m_gfxDevice.m_device, m_gfxDevice.m_swapchain);
+
+	m_pipelines.m_variants.save(m_pipelines.m_variantsPath.c_str());
+	m_pipelines.m_variants.destroy();
+
+	releaseRetired(/* all= */ true);
 
 	destroyProgram(m_gfxDevice.m_device, m_programs.m_debugtextProgram);
 	destroyProgram(m_gfxDevice.m_device, m_programs.m_drawcullProgram);
@@ -911,6 +2215,7 @@ void Renderer::cleanup()
 	destroyProgram(m_gfxDevice.m_device, m_programs.m_clustersubmitProgram);
 	destroyProgram(m_gfxDevice.m_device, m_programs.m_clustercullProgram);
 	destroyProgram(m_gfxDevice.m_device, m_programs.m_depthreduceProgram);
+	destroyProgram(m_gfxDevice.m_device, m_programs.m_depthpyramidProgram);
 	destroyProgram(m_gfxDevice.m_device, m_programs.m_meshProgram);
 
     destroyProgram(m_gfxDevice.m_device, m_programs.m_meshtaskProgram);
@@ -930,12 +2235,14 @@ void Renderer::cleanup()
 
     for (int i=0; i<FRAMES_COUNT; i++)
     {
-        vkDestroyFence(m_gfxDevice.m_device, m_frames[i].m_renderFence, 0);
         vkDestroySemaphore(m_gfxDevice.m_device, m_frames[i].m_signalSemaphore, 0);
         vkDestroySemaphore(m_gfxDevice.m_device, m_frames[i].m_waitSemaphore, 0);
     }
 
-	vkDestroySurfaceKHR(m_gfxDevice.m_instance, m_gfxDevice.m_surface, 0);
+	vkDestroySemaphore(m_gfxDevice.m_device, m_timeline.semaphore, 0);
+
+	if (m_gfxDevice.m_surface)
+		vkDestroySurfaceKHR(m_gfxDevice.m_instance, m_gfxDevice.m_surface, 0);
 
 	// Destroy debug callback before destroying the instance
 	if (m_gfxDevice.m_debugCallback) {
@@ -3,48 +3,92 @@
 #include "GfxDevice.h"
 #include "GfxTypes.h"
 #include "Camera.h"
+#include "ShaderReloader.h"
+#include "PipelineVariantCache.h"
+#include "RenderGraph.h"
+#include "Simulation.h"
+#include "GpuProfiler.h"
+#include "OcclusionBuffer.h"
+#include "InstanceManager.h"
+#include "BlasBuilder.h"
+#include "../Utils/Profile.hpp"
 #include "niagara/shaders.h"
 #include "niagara/resources.h"
 #include <chrono>
 
 static const size_t GBUFFER_COUNT = 2UL;
+// upper bound on command buffers the frame graph is split into for parallel recording
+static const uint32_t MAX_RECORD_JOBS = 4;
+// render passes bracketed by pipeline statistics queries, indexed by query; culling statistics use the same indices
+static const uint32_t RENDER_PASS_COUNT = 3;
+static const char* const RENDER_PASS_NAMES[RENDER_PASS_COUNT] = { "early", "late", "post" };
+// mips depthpyramid.comp can reduce in one dispatch; larger pyramids are always reduced per mip
+static const uint32_t PYRAMID_SINGLE_PASS_LEVELS = 13;
+
+// how the depth pyramid is reduced
+enum PyramidMode
+{
+	Pyramid_PerMip, // one dispatch per mip with a barrier in between
+	Pyramid_SinglePass, // one dispatch for all mips
+	Pyramid_Alternate, // switches every frame, to compare GPU times of both
+};
+
+// how draws changed on the CPU reach the GPU
+enum DrawUpload
+{
+	DrawUpload_Mapped, // every frame slot has its own host visible copy of the draws, patched in place when the slot is reused
+	DrawUpload_Staged, // one device local copy, patched with copies from the frame slot's staging buffer
+};
+
+// how meshlets of the draws that passed draw culling are culled and rendered
+enum MeshletCull
+{
+	MeshletCull_Task, // task shader workgroups cull meshlets and launch mesh shader workgroups for the visible ones
+	MeshletCull_Cluster, // a compute pass culls meshlets into a compacted cluster list, rendered by a mesh shader only dispatch
+};
+
+// ray traced sun shadows; alpha tested geometry casts shadows as if it was opaque
+enum ShadowQuality
+{
+	Shadow_Off,
+	Shadow_Low, // one ray to the center of the sun per pixel
+	Shadow_High, // several rays spread over the sun disk per pixel
+};
+
+namespace tmc { class ex_cpu; }
 
 struct FrameData {
     VkSemaphore m_waitSemaphore, m_signalSemaphore;
-    VkFence m_renderFence;
+    // per frame, so results can be read back once the slot comes around again without stalling later frames
+    VkQueryPool m_pipelinePool;
+    Buffer m_cullStatsReadback; // culling statistics of every render pass, copied at the end of the frame
+    bool m_cullStatsCopied; // whether the frame counted culling statistics
+    uint64_t m_timelineValue; // m_timeline value signaled once this frame's commands complete
 	std::chrono::_V2::system_clock::time_point m_frameTimeStamp;
-	int64_t m_deltaTime; // number of milliseconds
+	int64_t m_deltaTime; // milliseconds since the previous frame began
 
     VkCommandPool m_commandPool;
     VkCommandBuffer m_commandBuffer;
+
+    // one pool per recording job, so jobs running on different workers never share a pool
+    VkCommandPool m_recordPools[MAX_RECORD_JOBS];
+    VkCommandBuffer m_recordBuffers[MAX_RECORD_JOBS];
+    uint32_t m_recordBufferCount;
+
+    // DrawUpload_Mapped: the slot's copy of the draws, and draws changed since it was last patched
+    Buffer m_draws = {};
+    std::vector<InstanceManager::Range> m_drawRanges;
+    // DrawUpload_Staged: draws changed since the previous frame, copied to the draw buffer by the frame
+    Buffer m_drawStaging = {};
+    std::vector<VkBufferCopy> m_drawCopies;
+    // one bit per draw slot, set for draws CPU occlusion culling hid this frame; read by drawcull.comp
+    Buffer m_drawOcclusion = {};
 };
 
 struct Pipelines {
-	VkPipeline m_debugtextPipeline = 0;
-	VkPipeline m_drawcullPipeline = 0;
-	VkPipeline m_drawculllatePipeline = 0;
-	VkPipeline m_taskcullPipeline = 0;
-	VkPipeline m_taskculllatePipeline = 0;
-	VkPipeline m_tasksubmitPipeline = 0;
-	VkPipeline m_clustersubmitPipeline = 0;
-	VkPipeline m_clustercullPipeline = 0;
-	VkPipeline m_clusterculllatePipeline = 0;
-	VkPipeline m_depthreducePipeline = 0;
-	VkPipeline m_meshPipeline = 0;
-	VkPipeline m_meshpostPipeline = 0;
-	VkPipeline m_meshtaskPipeline = 0;
-	VkPipeline m_meshtasklatePipeline = 0;
-	VkPipeline m_meshtaskpostPipeline = 0;
-	VkPipeline m_clusterPipeline = 0;
-	VkPipeline m_clusterpostPipeline = 0;
-	VkPipeline m_blitPipeline = 0;
-	VkPipeline m_finalPipeline = 0;
-	VkPipeline m_shadowlqPipeline = 0;
-	VkPipeline m_shadowhqPipeline = 0;
-	VkPipeline m_shadowfillPipeline = 0;
-	VkPipeline m_shadowblurPipeline = 0;
-
-	std::vector<VkPipeline> m_pipelines;
+	// every (program, attachment formats, specialization constants) combination, compiled on first use
+	PipelineVariantCache m_variants;
+	std::string m_variantsPath; // variant list next to the executable
     VkPipelineCache m_pipelineCache = 0;
 };
 
@@ -55,6 +99,7 @@ struct Programs {
 	Program m_clustersubmitProgram = {};
 	Program m_clustercullProgram = {};
 	Program m_depthreduceProgram = {};
+	Program m_depthpyramidProgram = {};
 	Program m_meshProgram = {};
 	Program m_meshtaskProgram = {};
 	Program m_clusterProgram = {};
@@ -78,19 +123,88 @@ struct Buffers {
 	Buffer m_indices = {}; // ib
 	Buffer m_meshlets = {}; // mlb
 	Buffer m_meshletdata = {}; // mdb
-	Buffer m_draw = {}; // db
+	Buffer m_draw = {}; // db; DrawUpload_Staged only, mapped uploads read FrameData::m_draws
 	Buffer m_drawVisibility = {}; // dvb (also fixed capitalization)
 	Buffer m_taskCommands = {}; // dcb (also fixed capitalization)
 	Buffer m_commandCount = {}; // dccb (also fixed capitalization)
 	Buffer m_meshletVisibility = {}; // mvb (also fixed capitalization)
-	Buffer m_blasBuffer = {};
+	Buffer m_cullStats = {}; // csb
+	Buffer m_pyramidCounter = {}; // workgroups done in the single pass depth pyramid reduction
+	Buffer m_clusterIndices = {}; // cib; MeshletCull_Cluster only, created once it is first selected
+	Buffer m_clusterCount = {}; // ccb; cluster count followed by the mesh shader dispatch
 	Buffer m_tlasBuffer = {};
 	Buffer m_tlasScratchBuffer = {};
 	Buffer m_tlasInstanceBuffer = {};
 	VkAccelerationStructureKHR m_tlas = nullptr;
 	bool m_drawVisibilityCleared = false; // also fixed capitalization
 	bool m_meshletVisibilityCleared = false; // also fixed capitalization
-	uint32_t m_meshletVisibilityBytes;
+	uint32_t m_meshletVisibilityBytes = 0;
+	uint32_t m_drawCapacity = 0; // draws m_draw, m_drawVisibility, m_tlasInstanceBuffer and m_tlas have room for
+};
+
+/**
+ * Handles and settings the frame's render graph is declared from.
+ * Filled by the renderer every frame, or with placeholder handles to dump the graph without a device.
+ */
+struct FrameGraphSetup {
+	VkBuffer draws;
+	VkBuffer drawStaging; // changed draws to copy to draws, when uploads are staged
+	VkBuffer taskCommands;
+	VkBuffer commandCount;
+	VkBuffer drawVisibility;
+	VkBuffer meshletVisibility;
+	VkDeviceSize drawVisibilityBytes;
+	VkDeviceSize meshletVisibilityBytes;
+	VkBuffer cullStats;
+	VkBuffer cullStatsReadback; // host visible buffer the frame's culling statistics are copied to
+	VkBuffer pyramidCounter;
+	VkBuffer clusterIndices; // only used with clusterCull
+	VkBuffer clusterCount;
+
+	VkImage gbuffer[GBUFFER_COUNT];
+	VkImage depth;
+	VkImage depthPyramid;
+	VkImage shadow;
+	VkImage shadowBlur; // intermediate of the separable shadow blur
+	VkImage swapchain;
+
+	bool clearVisibility;
+	bool clearSpawnedVisibility; // clears visibility of draws spawned since the last frame, see InstanceManager
+	bool postPass;
+	bool updateDraws; // copies draws spawned, despawned or moved since the last frame from drawStaging
+	bool countCullStats; // cull and render passes count culling statistics
+	bool singlePassPyramid; // reduce the depth pyramid with drawPyramidSinglePass
+	bool clusterCull; // cull meshlets in compute passes and render them without task shaders, see MeshletCull
+	bool shadows; // trace, fill and blur sun shadows before shading
+	bool shadowCheckerboard; // trace every other pixel and fill in the rest
+	bool offscreen; // swapchain is a headless offscreen image that isn't presented
+};
+
+/**
+ * Pipeline statistics of one render pass, as counted by the driver.
+ */
+struct PipelineStats {
+	bool valid = false; // false when the pass didn't run
+	uint64_t taskInvocations = 0; // 0 when the device can't count task and mesh shader invocations
+	uint64_t meshInvocations = 0;
+	uint64_t clippingInvocations = 0; // primitives emitted by mesh shaders
+	uint64_t clippingPrimitives = 0; // primitives left after fixed function clipping and culling
+	uint64_t fragmentInvocations = 0;
+};
+
+/**
+ * GPU timings and counters of a completed frame.
+ * Read back when the frame's slot is reused, FRAMES_COUNT frames after it was submitted.
+ */
+struct GpuFrameStats {
+	uint64_t frameIndex = 0; // frame the results belong to
+	bool valid = false;
+	double frameTime = 0; // milliseconds between the first and the last command of the frame
+	std::vector<GpuProfiler::Result> passTimes; // frame graph passes in recording order
+	uint64_t triangles = 0; // primitives that reached clipping, summed over render passes
+	PipelineStats passStats[RENDER_PASS_COUNT];
+	bool cullStatsValid = false; // false unless the frame counted culling statistics
+	CullStats cullStats[RENDER_PASS_COUNT] = {};
 };
 
 struct Timestamps {
@@ -106,14 +220,20 @@ public:
     /**
      * Initializes the renderer with default settings.
      * Creates the graphics device, shaders, pipelines, and frame data.
+     * @param executor Worker pool used to record frame graph passes in parallel; nullptr records on the calling thread
+     * @param headlessWidth Renders into offscreen images of this width instead of a window when non-zero
+     * @param headlessHeight Offscreen image height
+     * @param rayTracingLods Bit mask of LODs to build BLASes for; TLAS instances reference one of them by distance
      */
-    Renderer();
+    explicit Renderer(tmc::ex_cpu* executor = nullptr, uint32_t headlessWidth = 0, uint32_t headlessHeight = 0, uint32_t rayTracingLods = 1);
+    tmc::ex_cpu* m_executor = nullptr;
     GfxDevice m_gfxDevice;
     FrameData m_frames[FRAMES_COUNT];
     VkDescriptorSetLayout m_textureSetLayout;
 	std::pair<VkDescriptorPool, VkDescriptorSet> m_textureSet;
-    VkQueryPool m_queryPoolTimestamp;
-    VkQueryPool m_queryPoolPipeline;
+    VkQueryPool m_queryPoolPipeline; // pool of the frame being recorded
+    GpuProfiler m_profiler; // times every frame graph pass
+    ProfileGpuContext m_profileContext = nullptr; // Tracy, only created when built with GAMEENGINE_PROFILE
 	VkQueue m_queue = 0;
 
     uint64_t m_frameIndex = 0;
@@ -134,7 +254,7 @@ public:
 
 	Geometry m_geometry;
 	std::vector<Material> m_materials;
-	std::vector<MeshDraw> m_draws;
+	InstanceManager m_instances; // draws of the scene; spawned and despawned at runtime
 	std::vector<Animation> m_animations;
 	std::vector<std::string> m_texturePaths;
 
@@ -152,37 +272,98 @@ public:
 	uint32_t m_depthPyramidWidth = 0;
 	uint32_t m_depthPyramidHeight = 0;
 	uint32_t m_depthPyramidLevels = 0;
+	PyramidMode m_pyramidMode = Pyramid_PerMip;
+	MeshletCull m_meshletCull = MeshletCull_Task; // may change between frames
+	ShadowQuality m_shadowQuality = Shadow_Low;
+	bool m_shadowCheckerboard = true; // traces half the shadow rays; the gaps are filled in from neighbours before the blur
+	bool m_cpuOcclusion = false; // rasterize occluders on the CPU every frame and skip the draws they hide in draw culling
+	DrawUpload m_drawUpload = DrawUpload_Mapped; // picked on load from the available memory types
+	uint32_t m_rayTracingLods = 1; // bit mask of LODs that get a BLAS; meshes with fewer LODs use their coarsest one instead
 	uint32_t m_meshPostPasses = 0;
 	uint32_t m_imageIndex = 0;
     VkClearColorValue m_colorClear = { 135.f / 255.f, 206.f / 255.f, 250.f / 255.f, 15.f / 255.f };
     VkClearDepthStencilValue m_depthClear = { 0.f, 0 };
-	uint64_t m_timestampResults[23] = {};
-	uint64_t m_pipelineResults[3] = {};
-	double m_frameGpuAvg = 0;
+	uint32_t m_pipelineStatisticCount = 0; // values per pipeline statistics query
+	uint32_t m_pipelineStatsInterval = 0; // frames between printed pipeline statistics, 0 disables
+	bool m_cullStatsEnabled = false; // count draws and meshlets rejected by every culling test; costs a few atomics per draw and meshlet
+	uint32_t m_cullStatsInterval = 0; // frames between printed culling statistics, 0 disables
+	std::string m_cullStatsPath; // rewritten with the printed culling statistics when not empty
+	GpuFrameStats m_gpuStats; // latest completed frame
 	double m_frameCpuAvg = 0;
 	size_t m_imageMemory = 0;
 
+    // single completion clock for frames, uploads and BLAS builds; CPU waits target the value of a specific submit
+    Timeline m_timeline = {};
+
     // immediate submit structures
-    VkFence m_immFence;
     VkCommandBuffer m_immCommandBuffer;
     VkCommandPool m_immCommandPool;
     
-	std::vector<VkAccelerationStructureKHR> m_blas;
-	std::vector<VkDeviceAddress> m_blasAddresses;
+	BlasBuilder m_blasBuilder; // BLASes of every mesh, built over the first frames
+	std::vector<uint32_t> m_blasChanges; // BLASes built or compacted this frame
+	std::vector<uint32_t> m_meshBlas; // first BLAS of every mesh, followed by the BLAS count
+	std::vector<uint32_t> m_blasLods; // LOD every BLAS was built from; increasing within a mesh
+	std::vector<uint32_t> m_blasTriangles; // triangles every BLAS was built from
+	std::vector<uint32_t> m_instanceBlas; // BLAS every TLAS instance references
+	std::vector<InstanceManager::Range> m_tlasWrites; // TLAS instances rewritten this frame
+	uint64_t m_instanceTriangles = 0; // triangles of the BLASes live instances reference
+	uint64_t m_instanceFullTriangles = 0; // same at LOD 0
 	VkAccelerationStructureKHR m_tlas = nullptr;
-	bool m_tlasNeedsRebuild = true;
+	bool m_tlasNeedsRebuild = true; // instances were added, removed or reallocated, or refits degraded the TLAS too much
+	bool m_tlasNeedsUpdate = false; // instances moved; refit in place
+	uint32_t m_tlasUpdateCount = 0; // refits since the last build
+	std::vector<vec4> m_tlasBuildSpheres; // position and radius of every instance when the TLAS was last built
+	std::vector<float> m_tlasInstanceDrift; // distance every instance moved or grew since, in radii at build time
+	double m_tlasDrift = 0; // sum of m_tlasInstanceDrift
+
+    // shader hot reload; replaced objects stay alive until m_timeline reaches the value of the last submit that used them
+    ShaderReloader m_shaderReloader;
+    std::vector<std::pair<uint64_t, VkPipeline>> m_retiredPipelines;
+    std::vector<std::pair<uint64_t, Program>> m_retiredPrograms;
+    // buffers and acceleration structures replaced when instance capacities grow
+    std::vector<std::pair<uint64_t, Buffer>> m_retiredBuffers;
+    std::vector<std::pair<uint64_t, VkAccelerationStructureKHR>> m_retiredAccelerationStructures;
+
+    // fixed-timestep camera and animation; the renderer only reads the latest published snapshot
+    Simulation m_simulation;
+    uint64_t m_simulationTick = ~0ull;
+    std::vector<uint32_t> m_animatedDraws; // draws the simulation moved since the last frame
+
+    // CPU occlusion culling; occluders are marked in m_instances, the largest opaque draws on load
+    OcclusionBuffer m_occlusionBuffer;
+    std::vector<OccluderMesh> m_occluderMeshes; // coarsest LOD of every mesh an occluder used, built on first use
+    std::vector<uint32_t> m_occlusionDraws; // live draws tested this frame
+    std::vector<uint32_t> m_occlusionVisible; // the ones the occluders don't hide
+    std::vector<uint32_t> m_occlusionMask; // bits of the tested draws that aren't visible, copied to the frame's mask
+
+    // rebuilt every frame; keeps resource states across frames to synchronize with the previous frame's accesses
+    RenderGraph m_frameGraph;
+    double m_recordCpuTime = 0; // wall time spent recording the frame graph, in milliseconds
 
     /**
      * Creates shader programs used in the renderer.
      * Initializes compute and graphics shader combinations.
+     * @param changed Shaders that were reloaded; when not empty, only programs using them are recreated
      */
-    void createPrograms();
+    void createPrograms(const std::vector<const Shader*>& changed = {});
     
     /**
-     * Creates rendering pipelines for all render passes.
-     * Sets up pipeline state and shader bindings.
+     * Registers programs with the pipeline variant cache and prewarms variants recorded by previous runs.
+     * Remaining variants are compiled on first use.
      */
     void createPipelines();
+
+    /**
+     * Picks up shaders recompiled by the hot reloader and swaps affected programs and pipelines.
+     * Must be called at a frame boundary, before any commands for the frame are recorded.
+     */
+    void reloadShaders();
+
+    /**
+     * Destroys replaced programs and pipelines once no in-flight frame can reference them.
+     * @param all Destroy everything regardless of frame index; requires the device to be idle
+     */
+    void releaseRetired(bool all = false);
     
     /**
      * Creates per-frame data structures for multi-buffered rendering.
@@ -197,33 +378,130 @@ public:
      */
 	bool beginFrame();
 	
+	/**
+     * Reads the pipeline statistics and culling statistics of the frame that last used the current frame slot
+     * and the pass timings the profiler read back for it into m_gpuStats.
+     * Must be called after m_profiler.beginFrame and before the slot's pipeline statistics pool is reset.
+     */
+	void readbackQueries();
+
+	/**
+     * Uploads changes m_instances collected since the last frame that can't wait for the frame graph:
+     * grows instance buffers when capacities changed and rewrites TLAS instances of changed draws.
+     * Draws and visibility are uploaded and cleared by frame graph passes.
+     * @param commandBuffer Frame prologue command buffer, submitted before the frame graph
+     */
+	void updateInstances(VkCommandBuffer commandBuffer);
+
+	/**
+     * Picks the BLAS every live TLAS instance references from the LOD the draw would be rasterized with: the coarsest
+     * BLAS that is at least as detailed, or the most detailed one. Instances whose BLAS changed are added to m_tlasWrites.
+     */
+	void selectInstanceLods();
+
+	/**
+     * Builds the TLAS from scratch when instances were added or removed or refits degraded it, refits it otherwise.
+     * @param commandBuffer Frame prologue command buffer, after updateInstances
+     */
+	void updateTLAS(VkCommandBuffer commandBuffer);
+
+	/**
+     * Writes draws changed since the frame slot was last used: in place into the slot's copy with DrawUpload_Mapped,
+     * into the slot's staging buffer for the frame graph to copy with DrawUpload_Staged.
+     * Either way the buffers written were last read by the slot's previous frame, which has completed.
+     */
+	void uploadDraws();
+
+	/**
+     * Returns the draw buffer shaders of the current frame read.
+     */
+	const Buffer& getDrawBuffer() const;
+
+	/**
+     * Reallocates buffers sized by draw and meshlet visibility capacity when m_instances outgrew them.
+     * Contents are copied to the new buffers and old buffers are retired until the frame completes.
+     * @param commandBuffer Command buffer to record copies into; nullptr when the buffers are created on load
+     */
+	void resizeInstanceBuffers(VkCommandBuffer commandBuffer);
+
+	/**
+     * Copies camera, sun and animated draw transforms from a simulation snapshot.
+     * Transforms are only re-uploaded when the snapshot is newer than the last one applied.
+     * @param state Latest snapshot published by the simulation
+     */
+	void applySimulation(const SimulationState& state);
+
+	/**
+     * Rasterizes the occluders for the frame's camera and marks the live draws they hide in the frame's occlusion mask.
+     * Splits the work across the executor's workers; only called when m_cpuOcclusion is set, after m_cullData is filled.
+     */
+	void cullOccludedDraws();
+
+	/**
+     * Records the compiled frame graph into the frame's record command buffers.
+     * Ranges of passes are recorded in parallel on the executor and submitted in order by endFrame.
+     */
+	void recordFrameGraph();
+
 	/**
      * Performs visibility culling for mesh draws.
-     * @param pipeline The culling pipeline to use
-     * @param timestamp Query index for performance timing
-     * @param phase Debug name for the culling phase
+     * Barriers around the pass are recorded by the render graph.
+     * @param commandBuffer Command buffer to record into
      * @param late Whether this is late culling (after main render)
      * @param postPass Post-processing pass index
      */
-	void drawCull(VkPipeline pipeline, uint32_t timestamp, const char* phase, bool late, unsigned int postPass = 0);
+	void drawCull(VkCommandBuffer commandBuffer, bool late, unsigned int postPass = 0);
+
+    /**
+     * Compacts culled draws into task shader workgroup commands.
+     * @param commandBuffer Command buffer to record into
+     */
+    void drawTaskSubmit(VkCommandBuffer commandBuffer);
+
+    /**
+     * Culls the meshlets of every task command into the cluster list; MeshletCull_Cluster only.
+     * @param commandBuffer Command buffer to record into
+     * @param late Whether this is late culling (after main render)
+     * @param postPass Post-processing pass index
+     */
+    void drawClusterCull(VkCommandBuffer commandBuffer, bool late, unsigned int postPass = 0);
+
+    /**
+     * Writes the mesh shader dispatch for the cluster list and pads it to whole dispatch rows.
+     * @param commandBuffer Command buffer to record into
+     */
+    void drawClusterSubmit(VkCommandBuffer commandBuffer);
     
     /**
      * Renders the scene with current visibility data.
+     * @param commandBuffer Command buffer to record into
      * @param late Whether this is late rendering (after main render)
      * @param colorClear Color value used for clearing color attachments
      * @param depthClear Depth value used for clearing depth attachment
      * @param query Query index for pipeline statistics
-     * @param timestamp Query index for performance timing
-     * @param phase Debug name for the render phase
      * @param postPass Post-processing pass index
      */
-    void drawRender(bool late, const VkClearColorValue& colorClear, const VkClearDepthStencilValue& depthClear, uint32_t query, uint32_t timestamp, const char* phase, unsigned int postPass = 0);
+    void drawRender(VkCommandBuffer commandBuffer, bool late, const VkClearColorValue& colorClear, const VkClearDepthStencilValue& depthClear, uint32_t query, unsigned int postPass = 0);
     
     /**
      * Generates mip chain for depth pyramid used in hierarchical Z-buffer.
-     * @param timestamp Query index for performance timing
+     * Barriers between mip levels are recorded here, the rest by the render graph.
+     * @param commandBuffer Command buffer to record into
+     */
+    void drawPyramid(VkCommandBuffer commandBuffer);
+
+    /**
+     * Generates the whole mip chain of the depth pyramid in one dispatch, without barriers between mips.
+     * Only supports pyramids of up to PYRAMID_SINGLE_PASS_LEVELS mips.
+     * @param commandBuffer Command buffer to record into
+     */
+    void drawPyramidSinglePass(VkCommandBuffer commandBuffer);
+
+    /**
+     * Shades the G-buffer into the swapchain image.
+     * @param commandBuffer Command buffer to record into
      */
-    void drawPyramid(uint32_t timestamp);
+    void drawFinal(VkCommandBuffer commandBuffer);
     
     /**
      * Renders debug visualization overlays.
@@ -232,10 +510,25 @@ public:
 	void drawDebug();
 	
 	/**
-     * Renders shadow maps for the scene.
-     * Handles shadow cascades and filtering.
+     * Traces sun shadows against the TLAS into the shadow target.
+     * @param commandBuffer Command buffer to record into
+     * @param checkerboard Only traces every other pixel; drawShadowFill fills in the rest
      */
-	void drawShadow();
+	void drawShadow(VkCommandBuffer commandBuffer, bool checkerboard);
+
+	/**
+     * Fills in the shadow target pixels a checkerboard drawShadow skipped from their traced neighbours.
+     * @param commandBuffer Command buffer to record into
+     */
+	void drawShadowFill(VkCommandBuffer commandBuffer);
+
+	/**
+     * Blurs the shadow target along one axis, ignoring neighbours at different depths.
+     * The horizontal pass writes the blur target and the vertical pass writes the shadow target back.
+     * @param commandBuffer Command buffer to record into
+     * @param vertical Blurs along y, from the blur target
+     */
+	void drawShadowBlur(VkCommandBuffer commandBuffer, bool vertical);
 	
 	/**
      * Main draw function that renders a complete frame.
@@ -267,4 +560,48 @@ public:
      * @return True if loading was successful, false otherwise
      */
 	bool loadGLTFScene(std::string filename);
-};
\ No newline at end of file
+};
+
+/**
+ * Declares the passes of a frame and the resources they access.
+ * @param graph Graph to add passes to; the caller resets, compiles and executes it
+ * @param setup Resource handles and frame settings
+ * @param renderer Renderer that records the passes, or nullptr to only declare them (for dumps)
+ */
+void declareFrameGraph(RenderGraph& graph, const FrameGraphSetup& setup, Renderer* renderer);
+
+/**
+ * Compiles the frame graph with placeholder handles and prints the computed barriers.
+ * Doesn't need a device, so barrier generation can be validated without a GPU.
+ * @param frames Number of consecutive frames to compile; later frames show steady state barriers
+ */
+void dumpFrameGraph(int frames);
+
+/**
+ * Prints per-pass pipeline statistics of a frame and how much work culling left to each pass.
+ * @param stats Statistics read back for the frame
+ */
+void printPipelineStats(const GpuFrameStats& stats);
+
+/**
+ * Prints compacted BLAS memory and triangles per LOD, next to the triangles of every mesh at LOD 0.
+ * @param blasLods LOD every BLAS was built from
+ * @param blasTriangles Triangles every BLAS was built from
+ * @param compactedSizes Compacted size of every BLAS
+ */
+void printBlasLods(const std::vector<Mesh>& meshes, const std::vector<uint32_t>& blasLods, const std::vector<uint32_t>& blasTriangles, const std::vector<VkDeviceSize>& compactedSizes);
+
+/**
+ * Prints how many draws and meshlets every culling test rejected in each pass of a frame.
+ * @param stats Statistics read back for the frame; only printed when cullStatsValid is set
+ */
+void printCullStats(const GpuFrameStats& stats);
+
+/**
+ * Writes the culling statistics of a frame as JSON, along with the settings they depend on.
+ * @param path Output file path
+ * @param stats Statistics read back for the frame
+ * @param cullData Culling settings of the frame
+ * @return False if the file can't be written
+ */
+bool writeCullStatsJson(const char* path, const GpuFrameStats& stats, const CullData& cullData);
@@ -0,0 +1,260 @@
+#include "ShaderReloader.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+ShaderReloader::~ShaderReloader()
+{
+    stop();
+}
+
+static bool endsWith(const std::string& str, const char* suffix)
+{
+    size_t length = strlen(suffix);
+    return str.size() >= length && str.compare(str.size() - length, length, suffix) == 0;
+}
+
+bool ShaderReloader::start(const char* sourcePath, const char* outputPath, const char* compiler, const char* headerFiles)
+{
+#ifdef __linux__
+    assert(!m_running);
+
+    m_sourcePath = sourcePath;
+    m_outputPath = outputPath;
+    m_compiler = compiler;
+
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify < 0)
+    {
+        fprintf(stderr, "Warning: shader hot reload disabled, inotify_init1 failed\n");
+        return false;
+    }
+
+    // editors either rewrite the file in place or save to a temporary and rename it over the original
+    m_watch = inotify_add_watch(m_inotify, sourcePath, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (m_watch < 0)
+    {
+        fprintf(stderr, "Warning: shader hot reload disabled, can't watch %s\n", sourcePath);
+        close(m_inotify);
+        m_inotify = -1;
+        return false;
+    }
+
+    // headers next to the sources are picked up by the directory watch above; others need a watch on their own directory,
+    // which also reports changes to unrelated files that are filtered out in watchLoop
+    for (const char* header = headerFiles; *header; )
+    {
+        const char* end = strchr(header, ',');
+        std::string path = end ? std::string(header, end) : std::string(header);
+        header = end ? end + 1 : header + path.size();
+
+        std::string::size_type pos = path.find_last_of("/\\");
+        if (path.empty() || pos == std::string::npos || path.compare(0, pos, m_sourcePath) == 0)
+            continue;
+
+        m_headers.push_back(path);
+
+        std::string directory = path.substr(0, pos);
+        bool watched = false;
+        for (auto& watch : m_headerWatches)
+            watched |= watch.second == directory;
+
+        if (watched)
+            continue;
+
+        int watch = inotify_add_watch(m_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (watch < 0)
+        {
+            fprintf(stderr, "Warning: can't watch %s, changes to %s won't recompile shaders\n", directory.c_str(), path.c_str());
+            continue;
+        }
+
+        m_headerWatches.push_back(std::make_pair(watch, directory));
+    }
+
+    m_running = true;
+    m_thread = std::thread(&ShaderReloader::watchLoop, this);
+
+    printf("Watching %s for shader changes\n", sourcePath);
+    return true;
+#else
+    (void)sourcePath;
+    (void)outputPath;
+    (void)compiler;
+    (void)headerFiles;
+    return false;
+#endif
+}
+
+void ShaderReloader::stop()
+{
+    if (!m_running)
+        return;
+
+    m_running = false;
+    m_thread.join();
+
+#ifdef __linux__
+    inotify_rm_watch(m_inotify, m_watch);
+    for (auto& watch : m_headerWatches)
+        inotify_rm_watch(m_inotify, watch.first);
+    close(m_inotify);
+    m_inotify = -1;
+    m_watch = -1;
+    m_headers.clear();
+    m_headerWatches.clear();
+#endif
+}
+
+bool ShaderReloader::takeReloaded(std::vector<Shader>& result)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_reloaded.empty())
+        return false;
+
+    result = std::move(m_reloaded);
+    m_reloaded.clear();
+    return true;
+}
+
+void ShaderReloader::watchLoop()
+{
+#ifdef __linux__
+    alignas(inotify_event) char buffer[4096];
+
+    while (m_running)
+    {
+        pollfd pfd = { m_inotify, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        // a single save generates a burst of events; wait for it to settle and coalesce by file name
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        std::vector<std::string> changed;
+        bool headerChanged = false;
+
+        ssize_t length;
+        while ((length = read(m_inotify, buffer, sizeof(buffer))) > 0)
+        {
+            for (char* ptr = buffer; ptr < buffer + length;)
+            {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+
+                if (event->len == 0)
+                    continue;
+
+                std::string name = event->name;
+
+                if (event->wd != m_watch)
+                {
+                    for (auto& watch : m_headerWatches)
+                        if (watch.first == event->wd)
+                            headerChanged |= std::find(m_headers.begin(), m_headers.end(), watch.second + "/" + name) != m_headers.end();
+
+                    continue;
+                }
+
+                if (std::find(changed.begin(), changed.end(), name) == changed.end())
+                    changed.push_back(name);
+            }
+        }
+
+        for (const std::string& name : changed)
+            headerChanged |= endsWith(name, ".h");
+
+        // we don't track includes, so a header change conservatively rebuilds every shader
+        if (headerChanged)
+            compileAll();
+        else
+            for (const std::string& name : changed)
+                if (endsWith(name, ".glsl"))
+                    compileShader(name);
+    }
+#endif
+}
+
+void ShaderReloader::compileShader(const std::string& sourceName)
+{
+#ifdef __linux__
+    // drawcull.comp.glsl -> drawcull.comp, matching the names loadShaders assigns
+    std::string name = sourceName.substr(0, sourceName.size() - strlen(".glsl"));
+    std::string outputPath = m_outputPath + "/" + name + ".spv";
+
+    std::string command = "\"" + m_compiler + "\" -V --target-env vulkan1.3 \"" + m_sourcePath + "/" + sourceName + "\" -o \"" + outputPath + "\" 2>&1";
+
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe)
+    {
+        fprintf(stderr, "Error: can't run %s\n", m_compiler.c_str());
+        return;
+    }
+
+    std::string log;
+    char line[512];
+    while (fgets(line, sizeof(line), pipe))
+        log += line;
+
+    if (pclose(pipe) != 0)
+    {
+        // keep using the previous module; the compiler output is all the user needs to fix the error
+        fprintf(stderr, "Error: failed to compile %s, keeping previous version\n%s", sourceName.c_str(), log.c_str());
+        return;
+    }
+
+    Shader shader = {};
+    if (!loadShader(shader, outputPath.c_str()))
+    {
+        fprintf(stderr, "Warning: %s is not a valid SPIRV module\n", outputPath.c_str());
+        return;
+    }
+
+    shader.name = name;
+
+    printf("Recompiled %s\n", sourceName.c_str());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (Shader& reloaded : m_reloaded)
+        if (reloaded.name == shader.name)
+        {
+            reloaded = std::move(shader);
+            return;
+        }
+
+    m_reloaded.push_back(std::move(shader));
+#else
+    (void)sourceName;
+#endif
+}
+
+void ShaderReloader::compileAll()
+{
+#ifdef __linux__
+    DIR* dir = opendir(m_sourcePath.c_str());
+    if (!dir)
+        return;
+
+    std::vector<std::string> sources;
+    while (dirent* de = readdir(dir))
+        if (endsWith(de->d_name, ".glsl"))
+            sources.push_back(de->d_name);
+
+    closedir(dir);
+
+    for (const std::string& source : sources)
+        compileShader(source);
+#endif
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "niagara/common.h"
+#include "niagara/shaders.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Watches the GLSL source directory and the headers shaders include, and recompiles changed shaders in the background
+ * Recompiled modules are parsed on the worker thread and handed over to the render thread,
+ * which swaps programs and pipelines at a frame boundary
+ */
+class ShaderReloader
+{
+public:
+    ShaderReloader() = default;
+    ~ShaderReloader();
+
+    ShaderReloader(const ShaderReloader&) = delete;
+    ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+    /**
+     * Starts watching the shader sources and spawns the compile thread
+     *
+     * @param sourcePath Directory with *.glsl sources and shared headers
+     * @param outputPath Directory where compiled *.spv modules are written
+     * @param compiler Path to glslangValidator
+     * @param headerFiles Comma separated paths of headers outside sourcePath that shaders include, e.g. niagara/config.h
+     * @return True if the watcher is running, false if hot reload is unavailable
+     */
+    bool start(const char* sourcePath, const char* outputPath, const char* compiler, const char* headerFiles = "");
+
+    /**
+     * Stops the compile thread and releases the watch handles
+     */
+    void stop();
+
+    /**
+     * Moves shaders recompiled since the last call into the result
+     * Called from the render thread once per frame
+     *
+     * @param result Receives recompiled shaders, named like ShaderSet entries
+     * @return True if at least one shader was recompiled
+     */
+    bool takeReloaded(std::vector<Shader>& result);
+
+private:
+    void watchLoop();
+    void compileShader(const std::string& sourceName);
+    void compileAll();
+
+    std::string m_sourcePath;
+    std::string m_outputPath;
+    std::string m_compiler;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running = false;
+    int m_inotify = -1;
+    int m_watch = -1;
+
+    // shaders are rebuilt when one of these headers changes; their directories are watched as well
+    std::vector<std::string> m_headers;
+    std::vector<std::pair<int, std::string>> m_headerWatches;
+
+    std::mutex m_mutex;
+    std::vector<Shader> m_reloaded;
+};
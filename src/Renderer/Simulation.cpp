@@ -0,0 +1,150 @@
+#include "Simulation.h"
+
+#include <glm/common.hpp>
+
+#include <math.h>
+
+Simulation::~Simulation()
+{
+    stop();
+}
+
+void Simulation::init(const Camera& camera, const vec3& sunDirection, const std::vector<Animation>& animations)
+{
+    assert(!m_running);
+
+    m_camera = camera;
+    m_sunDirection = sunDirection;
+    m_animations = animations;
+    m_tick = 0;
+    m_nextTick = Clock::now();
+
+    publish();
+}
+
+void Simulation::start()
+{
+    assert(!m_running);
+
+    m_running = true;
+    m_nextTick = Clock::now();
+    m_thread = std::thread(&Simulation::tickLoop, this);
+}
+
+void Simulation::stop()
+{
+    if (!m_running)
+        return;
+
+    m_running = false;
+    m_thread.join();
+}
+
+void Simulation::tickLoop()
+{
+    while (m_running)
+    {
+        advance(Clock::now());
+
+        // sleeping here would stall an executor worker, which is why the loop has a thread of its own
+        std::this_thread::sleep_until(m_nextTick);
+    }
+}
+
+void Simulation::setCameraPath(const CameraPath& path)
+{
+    assert(!m_running);
+
+    m_cameraPath = path;
+}
+
+void Simulation::setLockstep(bool lockstep)
+{
+    assert(!m_running);
+
+    m_lockstep = lockstep;
+}
+
+uint32_t Simulation::advance(Clock::time_point now)
+{
+    if (m_lockstep)
+    {
+        step();
+        publish();
+        return 1;
+    }
+
+    const auto tickDuration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(TICK_SECONDS));
+
+    uint32_t ticks = 0;
+    while (m_nextTick <= now && ticks < MAX_CATCHUP_TICKS)
+    {
+        step();
+        m_nextTick += tickDuration;
+        ticks++;
+    }
+
+    if (m_nextTick <= now)
+        m_nextTick = now + tickDuration;
+
+    if (ticks)
+        publish();
+
+    return ticks;
+}
+
+void Simulation::step()
+{
+    m_tick++;
+
+    if (m_cameraPath.empty())
+        m_camera.update(float(TICK_SECONDS));
+    else
+        m_cameraPath.apply(m_camera, double(m_tick) * TICK_SECONDS);
+}
+
+void Simulation::publish()
+{
+    SimulationState& state = m_states.write();
+
+    state.tick = m_tick;
+    state.time = double(m_tick) * TICK_SECONDS;
+    state.camera = m_camera;
+    state.sunDirection = m_sunDirection;
+
+    // animations are sampled at publish time only, intermediate ticks never reach the renderer
+    state.drawTransforms.clear();
+
+    for (const Animation& animation : m_animations)
+    {
+        double index = (state.time - animation.startTime) / animation.period;
+        if (index < 0 || animation.keyframes.empty())
+            continue;
+
+        index = fmod(index, double(animation.keyframes.size()));
+
+        size_t index0 = size_t(index) % animation.keyframes.size();
+        size_t index1 = (index0 + 1) % animation.keyframes.size();
+        float t = float(index - floor(index));
+
+        const Keyframe& k0 = animation.keyframes[index0];
+        const Keyframe& k1 = animation.keyframes[index1];
+
+        DrawTransform transform = {};
+        transform.drawIndex = animation.drawIndex;
+        transform.position = glm::mix(k0.translation, k1.translation, t);
+        transform.scale = glm::mix(k0.scale, k1.scale, t);
+        transform.orientation = glm::slerp(k0.rotation, k1.rotation, t);
+
+        state.drawTransforms.push_back(transform);
+    }
+
+    m_states.publish();
+}
+
+const SimulationState& Simulation::acquire()
+{
+    m_states.consume();
+
+    return m_states.read();
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "Camera.h"
+#include "CameraPath.h"
+#include "GfxTypes.h"
+#include "../Utils/TripleBuffer.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/**
+ * Placement of an animated draw at a simulation tick
+ */
+struct DrawTransform
+{
+    uint32_t drawIndex;
+    vec3 position;
+    float scale;
+    quat orientation;
+};
+
+/**
+ * Immutable snapshot of the simulated world published once per tick
+ */
+struct SimulationState
+{
+    uint64_t tick;
+    double time; // simulated seconds since start
+    Camera camera;
+    vec3 sunDirection;
+    std::vector<DrawTransform> drawTransforms;
+};
+
+/**
+ * Advances camera and animations at a fixed rate, independently of rendering
+ * Runs on a dedicated thread, which sleeps between ticks, and publishes a snapshot after every tick,
+ * so a slow frame delays neither the simulation nor the next frame's view of it
+ */
+class Simulation
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr double TICK_SECONDS = 1.0 / 60.0;
+    // ticks simulated at most per advance; after longer stalls simulated time falls behind instead of spiraling
+    static constexpr uint32_t MAX_CATCHUP_TICKS = 8;
+
+    Simulation() = default;
+    ~Simulation();
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    /**
+     * Sets the initial world state and publishes it as tick 0
+     *
+     * @param camera Camera placement loaded with the scene
+     * @param sunDirection Normalized direction towards the sun
+     * @param animations Keyframed draw animations loaded with the scene
+     */
+    void init(const Camera& camera, const vec3& sunDirection, const std::vector<Animation>& animations);
+
+    /**
+     * Starts the tick loop on its own thread; executor workers are left to frame work
+     */
+    void start();
+
+    /**
+     * Stops the tick loop and joins its thread
+     */
+    void stop();
+
+    bool isRunning() const { return m_running; }
+
+    /**
+     * Drives the camera along a recorded path instead of from input; must be called while stopped
+     */
+    void setCameraPath(const CameraPath& path);
+
+    /**
+     * In lockstep, every advance() runs exactly one tick regardless of wall time, which makes
+     * frame N always show simulated time N * TICK_SECONDS; used by benchmarks
+     */
+    void setLockstep(bool lockstep);
+
+    /**
+     * Runs all ticks due by the given time and publishes the last one
+     * Called by the tick loop, or by the render thread while the loop is stopped
+     *
+     * @return Number of ticks simulated
+     */
+    uint32_t advance(Clock::time_point now);
+
+    /**
+     * Picks up the latest published snapshot; called by the render thread once per frame
+     *
+     * @return Latest snapshot, stays valid until the next call
+     */
+    const SimulationState& acquire();
+
+private:
+    void tickLoop();
+    void step();
+    void publish();
+
+    TripleBuffer<SimulationState> m_states;
+
+    std::atomic<bool> m_running = false;
+    std::thread m_thread;
+
+    // owned by whichever thread calls advance()
+    Camera m_camera;
+    vec3 m_sunDirection = vec3(0, 0, 1);
+    std::vector<Animation> m_animations;
+    CameraPath m_cameraPath;
+    bool m_lockstep = false;
+    uint64_t m_tick = 0;
+    Clock::time_point m_nextTick;
+};
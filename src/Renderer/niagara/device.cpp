@@ -39,7 +39,7 @@ static bool isLayerSupported(const char* name)
 	return false;
 }
 
-VkInstance createInstance()
+VkInstance createInstance(bool headless)
 {
 	if (volkGetInstanceVersion() < API_VERSION)
 	{
@@ -82,28 +82,35 @@ VkInstance createInstance()
 #endif
 #endif
 
-	const char* extensions[] = {
-		VK_KHR_SURFACE_EXTENSION_NAME,
+	std::vector<const char*> extensions;
+
+	// headless instances render offscreen and don't need window system integration
+	if (!headless)
+	{
+		extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #ifdef VK_USE_PLATFORM_WIN32_KHR
-		VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
+		extensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #endif
 #ifdef VK_USE_PLATFORM_XLIB_KHR
-		VK_KHR_XLIB_SURFACE_EXTENSION_NAME,
+		extensions.push_back(VK_KHR_XLIB_SURFACE_EXTENSION_NAME);
 #endif
 #ifdef VK_USE_PLATFORM_WAYLAND_KHR
-		VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME,
+		extensions.push_back(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
 #endif
 #ifdef VK_USE_PLATFORM_METAL_EXT
-		VK_EXT_METAL_SURFACE_EXTENSION_NAME,
-		VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME,
+		extensions.push_back(VK_EXT_METAL_SURFACE_EXTENSION_NAME);
+#endif
+	}
+
+#ifdef VK_USE_PLATFORM_METAL_EXT
+	extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
 #endif
 #ifndef NDEBUG
-		VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
+	extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 #endif
-	};
 
-	createInfo.ppEnabledExtensionNames = extensions;
-	createInfo.enabledExtensionCount = sizeof(extensions) / sizeof(extensions[0]);
+	createInfo.ppEnabledExtensionNames = extensions.data();
+	createInfo.enabledExtensionCount = uint32_t(extensions.size());
 
 #ifdef VK_USE_PLATFORM_METAL_EXT
 	createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
@@ -186,7 +193,7 @@ static bool supportsPresentation(VkPhysicalDevice physicalDevice, uint32_t famil
 #endif
 }
 
-VkPhysicalDevice pickPhysicalDevice(VkPhysicalDevice* physicalDevices, uint32_t physicalDeviceCount)
+VkPhysicalDevice pickPhysicalDevice(VkPhysicalDevice* physicalDevices, uint32_t physicalDeviceCount, bool headless)
 {
 	VkPhysicalDevice preferred = 0;
 	VkPhysicalDevice fallback = 0;
@@ -198,7 +205,8 @@ VkPhysicalDevice pickPhysicalDevice(VkPhysicalDevice* physicalDevices, uint32_t
 		VkPhysicalDeviceProperties props;
 		vkGetPhysicalDeviceProperties(physicalDevices[i], &props);
 
-		if (props.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU)
+		// software rasterizers like lavapipe are only good enough for headless runs
+		if (props.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU && !headless)
 			continue;
 
 		printf("GPU%d: %s (Vulkan 1.%d)\n", i, props.deviceName, VK_VERSION_MINOR(props.apiVersion));
@@ -207,7 +215,7 @@ VkPhysicalDevice pickPhysicalDevice(VkPhysicalDevice* physicalDevices, uint32_t
 		if (familyIndex == VK_QUEUE_FAMILY_IGNORED)
 			continue;
 
-		if (!supportsPresentation(physicalDevices[i], familyIndex))
+		if (!headless && !supportsPresentation(physicalDevices[i], familyIndex))
 			continue;
 
 		if (props.apiVersion < API_VERSION)
@@ -262,7 +270,7 @@ static bool isExtensionSupported(VkPhysicalDevice physicalDevice, const char* ex
     return false;
 }
 
-VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint32_t familyIndex, bool meshShadingSupported, bool raytracingSupported)
+VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint32_t familyIndex, bool meshShadingSupported, bool raytracingSupported, bool headless, bool meshShaderQueries)
 {
 	float queuePriorities[] = { 1.0f };
 
@@ -272,10 +280,12 @@ VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint
 	queueInfo.pQueuePriorities = queuePriorities;
 
 	std::vector<const char*> extensions = {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 		VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
 	};
 
+	if (!headless)
+		extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
 	// Check if push descriptor is supported
 	bool pushDescriptorSupported = isExtensionSupported(physicalDevice, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
 
@@ -340,6 +350,7 @@ VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint
 	features12.shaderInt8 = true;
 	features12.samplerFilterMinmax = true;
 	features12.scalarBlockLayout = true;
+	features12.timelineSemaphore = true;
 
 	if (raytracingSupported)
 		features12.bufferDeviceAddress = true;
@@ -366,6 +377,7 @@ VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint
 	VkPhysicalDeviceMeshShaderFeaturesEXT featuresMesh = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
 	featuresMesh.taskShader = true;
 	featuresMesh.meshShader = true;
+	featuresMesh.meshShaderQueries = meshShaderQueries;
 
 	// This will only be used if raytracingSupported=true (see below)
 	VkPhysicalDeviceRayQueryFeaturesKHR featuresRayQueries = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR };
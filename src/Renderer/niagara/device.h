@@ -1,9 +1,9 @@
 #pragma once
 
-VkInstance createInstance();
+VkInstance createInstance(bool headless = false);
 VkDebugReportCallbackEXT registerDebugCallback(VkInstance instance);
 
 uint32_t getGraphicsFamilyIndex(VkPhysicalDevice physicalDevice);
-VkPhysicalDevice pickPhysicalDevice(VkPhysicalDevice* physicalDevices, uint32_t physicalDeviceCount);
+VkPhysicalDevice pickPhysicalDevice(VkPhysicalDevice* physicalDevices, uint32_t physicalDeviceCount, bool headless = false);
 
-VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint32_t familyIndex, bool meshShadingSupported, bool raytracingSupported);
+VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint32_t familyIndex, bool meshShadingSupported, bool raytracingSupported, bool headless = false, bool meshShaderQueries = false);
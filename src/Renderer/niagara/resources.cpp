@@ -125,9 +125,9 @@ void createBuffer(Buffer& result, VkDevice device, const VkPhysicalDeviceMemoryP
 	result.size = size;
 }
 
-void uploadBuffer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, const Buffer& buffer, const Buffer& scratch, const void* data, size_t size)
+void uploadBuffer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, Timeline& timeline, const Buffer& buffer, const Buffer& scratch, const void* data, size_t size)
 {
-	// TODO: this function is submitting a command buffer and waiting for device idle for each buffer upload; this is obviously suboptimal and we'd need to batch this later
+	// TODO: this function is submitting a command buffer and waiting for it to complete for each buffer upload; this is obviously suboptimal and we'd need to batch this later
 	assert(size > 0);
 	assert(scratch.data);
 	assert(scratch.size >= size);
@@ -145,13 +145,46 @@ void uploadBuffer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer co
 
 	VK_CHECK(vkEndCommandBuffer(commandBuffer));
 
+	// scratch and the command pool are reused by the next upload, but frames already in flight keep running
+	waitTimeline(device, timeline, submitTimeline(queue, timeline, commandBuffer));
+}
+
+uint64_t submitTimeline(VkQueue queue, Timeline& timeline, VkCommandBuffer commandBuffer)
+{
+	uint64_t signalValue = ++timeline.value;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &signalValue;
+
 	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.pNext = &timelineInfo;
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &timeline.semaphore;
 
 	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 
-	VK_CHECK(vkDeviceWaitIdle(device));
+	return signalValue;
+}
+
+void waitTimeline(VkDevice device, const Timeline& timeline, uint64_t value)
+{
+	VkSemaphoreWaitInfo waitInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timeline.semaphore;
+	waitInfo.pValues = &value;
+
+	VK_CHECK(vkWaitSemaphores(device, &waitInfo, ~0ull));
+}
+
+uint64_t getTimelineCompleted(VkDevice device, const Timeline& timeline)
+{
+	uint64_t value = 0;
+	VK_CHECK(vkGetSemaphoreCounterValue(device, timeline.semaphore, &value));
+
+	return value;
 }
 
 void destroyBuffer(const Buffer& buffer, VkDevice device)
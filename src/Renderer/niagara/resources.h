@@ -15,6 +15,12 @@ struct Image
 	VkDeviceMemory memory;
 };
 
+struct Timeline
+{
+	VkSemaphore semaphore;
+	uint64_t value; // value signaled by the most recent submit
+};
+
 VkImageMemoryBarrier2 imageBarrier(VkImage image, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkImageLayout oldLayout, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask, VkImageLayout newLayout, VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, uint32_t baseMipLevel = 0, uint32_t levelCount = VK_REMAINING_MIP_LEVELS);
 VkBufferMemoryBarrier2 bufferBarrier(VkBuffer buffer, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask);
 
@@ -24,9 +30,13 @@ void stageBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 stageMask
 void stageBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 srcStageMask, VkPipelineStageFlags2 dstStageMask);
 
 void createBuffer(Buffer& result, VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, size_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags);
-void uploadBuffer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, const Buffer& buffer, const Buffer& scratch, const void* data, size_t size);
+void uploadBuffer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, Timeline& timeline, const Buffer& buffer, const Buffer& scratch, const void* data, size_t size);
 void destroyBuffer(const Buffer& buffer, VkDevice device);
 
+uint64_t submitTimeline(VkQueue queue, Timeline& timeline, VkCommandBuffer commandBuffer);
+void waitTimeline(VkDevice device, const Timeline& timeline, uint64_t value);
+uint64_t getTimelineCompleted(VkDevice device, const Timeline& timeline);
+
 VkDeviceAddress getBufferAddress(const Buffer& buffer, VkDevice device);
 
 VkImageView createImageView(VkDevice device, VkImage image, VkFormat format, uint32_t mipLevel, uint32_t levelCount);
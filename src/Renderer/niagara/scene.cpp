@@ -1,6 +1,7 @@
 #include "common.h"
 #include "scene.h"
 #include "config.h"
+#include "../../Utils/Profile.hpp"
 
 // #include <fast_obj.h>
 #include <cgltf.h>
@@ -81,6 +82,8 @@ static size_t appendMeshlets(Geometry& result, const std::vector<vec3>& vertices
 
 static void appendMesh(Geometry& result, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool buildMeshlets, bool fast = false)
 {
+	PROFILE_ZONE();
+
 	std::vector<uint32_t> remap(vertices.size());
 	size_t uniqueVertices = meshopt_generateVertexRemap(remap.data(), indices.data(), indices.size(), vertices.data(), vertices.size(), sizeof(Vertex));
 
@@ -297,6 +300,8 @@ static void loadVertices(std::vector<Vertex>& vertices, const cgltf_primitive& p
 
 bool loadScene(Geometry& geometry, std::vector<Material>& materials, std::vector<MeshDraw>& draws, std::vector<std::string>& texturePaths, std::vector<Animation>& animations, Camera& camera, vec3& sunDirection, const char* path, bool buildMeshlets, bool fast)
 {
+	PROFILE_ZONE();
+
 	clock_t timer = clock();
 
 	cgltf_options options = {};
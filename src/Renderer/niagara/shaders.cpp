@@ -11,6 +11,8 @@
 #include <dirent.h>
 #endif
 
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -33,6 +35,16 @@ struct Id
 	uint32_t binding;
 	uint32_t set;
 	uint32_t constant;
+	uint32_t arrayStride;
+	const uint32_t* insn; // type declaration, for types that need more than typeId to compute sizes
+};
+
+struct MemberDecoration
+{
+	uint32_t structId;
+	uint32_t member;
+	uint32_t decoration;
+	uint32_t value;
 };
 
 static VkShaderStageFlagBits getShaderStage(SpvExecutionModel executionModel)
@@ -78,6 +90,56 @@ static VkDescriptorType getDescriptorType(SpvOp op)
 	}
 }
 
+static uint32_t getMemberDecoration(const std::vector<MemberDecoration>& members, uint32_t structId, uint32_t member, uint32_t decoration)
+{
+	for (const MemberDecoration& md : members)
+		if (md.structId == structId && md.member == member && md.decoration == decoration)
+			return md.value;
+
+	return ~0u;
+}
+
+// Size of a type in an explicitly laid out block (push constants, buffers), following Offset/ArrayStride/MatrixStride decorations
+static uint32_t getTypeSize(const std::vector<Id>& ids, const std::vector<MemberDecoration>& members, uint32_t typeId, uint32_t matrixStride = ~0u)
+{
+	const Id& type = ids[typeId];
+
+	switch (type.opcode)
+	{
+	case SpvOpTypeInt:
+	case SpvOpTypeFloat:
+		return type.insn[2] / 8;
+	case SpvOpTypeVector:
+		return type.insn[3] * getTypeSize(ids, members, type.insn[2]);
+	case SpvOpTypeMatrix:
+		return type.insn[3] * (matrixStride != ~0u ? matrixStride : getTypeSize(ids, members, type.insn[2]));
+	case SpvOpTypeArray:
+	{
+		uint32_t length = ids[type.insn[3]].constant;
+		return length * (type.arrayStride ? type.arrayStride : getTypeSize(ids, members, type.insn[2]));
+	}
+	case SpvOpTypeStruct:
+	{
+		uint32_t wordCount = type.insn[0] >> 16;
+		uint32_t size = 0;
+
+		for (uint32_t i = 0; i < wordCount - 2; ++i)
+		{
+			uint32_t offset = getMemberDecoration(members, typeId, i, SpvDecorationOffset);
+			assert(offset != ~0u);
+
+			uint32_t memberStride = getMemberDecoration(members, typeId, i, SpvDecorationMatrixStride);
+			size = std::max(size, offset + getTypeSize(ids, members, type.insn[2 + i], memberStride));
+		}
+
+		return size;
+	}
+	default:
+		assert(!"Unsupported type in block");
+		return 0;
+	}
+}
+
 static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 {
 	assert(code[0] == SpvMagicNumber);
@@ -85,6 +147,7 @@ static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 	uint32_t idBound = code[3];
 
 	std::vector<Id> ids(idBound);
+	std::vector<MemberDecoration> members;
 
 	int localSizeIdX = -1;
 	int localSizeIdY = -1;
@@ -154,6 +217,27 @@ static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 				assert(wordCount == 4);
 				ids[id].binding = insn[3];
 				break;
+			case SpvDecorationArrayStride:
+				assert(wordCount == 4);
+				ids[id].arrayStride = insn[3];
+				break;
+			case SpvDecorationSpecId:
+				assert(wordCount == 4);
+				assert(insn[3] < 32);
+				shader.specializationMask |= 1 << insn[3];
+				break;
+			}
+		}
+		break;
+		case SpvOpMemberDecorate:
+		{
+			assert(wordCount >= 4);
+
+			// only layout decorations are needed to compute push constant block sizes
+			if (insn[3] == SpvDecorationOffset || insn[3] == SpvDecorationMatrixStride)
+			{
+				assert(wordCount == 5);
+				members.push_back({ insn[1], insn[2], insn[3], insn[4] });
 			}
 		}
 		break;
@@ -162,6 +246,12 @@ static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 		case SpvOpTypeSampler:
 		case SpvOpTypeSampledImage:
 		case SpvOpTypeAccelerationStructureKHR:
+		case SpvOpTypeInt:
+		case SpvOpTypeFloat:
+		case SpvOpTypeVector:
+		case SpvOpTypeMatrix:
+		case SpvOpTypeArray:
+		case SpvOpTypeRuntimeArray:
 		{
 			assert(wordCount >= 2);
 
@@ -170,6 +260,7 @@ static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 
 			assert(ids[id].opcode == 0);
 			ids[id].opcode = opcode;
+			ids[id].insn = insn;
 		}
 		break;
 		case SpvOpTypePointer:
@@ -225,12 +316,25 @@ static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 			assert(id.binding < 32);
 			assert(ids[id.typeId].opcode == SpvOpTypePointer);
 
-			uint32_t typeKind = ids[ids[id.typeId].typeId].opcode;
+			uint32_t typeId = ids[id.typeId].typeId;
+			uint32_t resourceCount = 1;
+
+			// arrays of descriptors, e.g. `uniform image2D mips[8]`
+			if (ids[typeId].opcode == SpvOpTypeArray)
+			{
+				resourceCount = ids[ids[typeId].insn[3]].constant;
+				typeId = ids[typeId].insn[2];
+			}
+
+			assert(ids[typeId].opcode != SpvOpTypeRuntimeArray);
+
+			uint32_t typeKind = ids[typeId].opcode;
 			VkDescriptorType resourceType = getDescriptorType(SpvOp(typeKind));
 
 			assert((shader.resourceMask & (1 << id.binding)) == 0 || shader.resourceTypes[id.binding] == resourceType);
 
 			shader.resourceTypes[id.binding] = resourceType;
+			shader.resourceCounts[id.binding] = resourceCount;
 			shader.resourceMask |= 1 << id.binding;
 		}
 
@@ -241,7 +345,10 @@ static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 
 		if (id.opcode == SpvOpVariable && id.storageClass == SpvStorageClassPushConstant)
 		{
+			assert(ids[id.typeId].opcode == SpvOpTypePointer);
+
 			shader.usesPushConstants = true;
+			shader.pushConstantSize = getTypeSize(ids, members, ids[id.typeId].typeId);
 		}
 	}
 
@@ -392,6 +499,63 @@ static VkDescriptorUpdateTemplate createUpdateTemplate(VkDevice device, VkPipeli
 	return updateTemplate;
 }
 
+// Programs that reflect to the same bindings and push constant range share their layout objects
+// This keeps driver object count down and makes such programs layout compatible, so push descriptors and constants survive pipeline switches
+struct LayoutKey
+{
+	VkPipelineBindPoint bindPoint;
+	uint32_t resourceMask;
+	VkDescriptorType resourceTypes[32];
+	VkShaderStageFlags resourceStages[32];
+	VkShaderStageFlags pushConstantStages;
+	uint32_t pushConstantSize;
+	VkDescriptorSetLayout arrayLayout;
+};
+
+struct LayoutCacheEntry
+{
+	LayoutKey key;
+	uint64_t hash;
+	uint32_t refCount;
+
+	VkDescriptorSetLayout setLayout;
+	VkPipelineLayout layout;
+	VkDescriptorUpdateTemplate updateTemplate;
+	uint32_t pushDescriptorCount;
+};
+
+static std::vector<LayoutCacheEntry> gLayoutCache;
+
+static void fillLayoutKey(LayoutKey& key, VkPipelineBindPoint bindPoint, Shaders shaders, VkShaderStageFlags pushConstantStages, size_t pushConstantSize, VkDescriptorSetLayout arrayLayout)
+{
+	// the key is hashed and compared bytewise, so unused bindings and padding must be zero
+	memset(&key, 0, sizeof(key));
+
+	key.bindPoint = bindPoint;
+	key.resourceMask = gatherResources(shaders, key.resourceTypes);
+
+	for (const Shader* shader : shaders)
+		for (uint32_t i = 0; i < 32; ++i)
+			if (shader->resourceMask & (1 << i))
+				key.resourceStages[i] |= shader->stage;
+
+	key.pushConstantStages = pushConstantSize ? pushConstantStages : 0;
+	key.pushConstantSize = uint32_t(pushConstantSize);
+	key.arrayLayout = arrayLayout;
+}
+
+static uint64_t hashLayoutKey(const LayoutKey& key)
+{
+	// FNV-1a
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(&key);
+	uint64_t hash = 14695981039346656037ull;
+
+	for (size_t i = 0; i < sizeof(key); ++i)
+		hash = (hash ^ data[i]) * 1099511628211ull;
+
+	return hash;
+}
+
 bool loadShader(Shader& shader, const char* path)
 {
 	FILE* file = fopen(path, "rb");
@@ -495,6 +659,37 @@ bool loadShaders(ShaderSet& shaders, const char* base, const char* path)
 	return true;
 }
 
+void benchmarkReflection(const ShaderSet& shaders, int iterations)
+{
+	double total = 0;
+	size_t totalSize = 0;
+
+	for (const Shader& shader : shaders.shaders)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (int i = 0; i < iterations; ++i)
+		{
+			Shader scratch = {};
+			parseShader(scratch, reinterpret_cast<const uint32_t*>(shader.spirv.data()), uint32_t(shader.spirv.size() / 4));
+		}
+
+		double time = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+
+		int bindings = 0;
+		for (uint32_t i = 0; i < 32; ++i)
+			bindings += (shader.resourceMask >> i) & 1;
+
+		printf("%-24s %7.1f KB %8.2f us push %3d bytes, %2d bindings, spec mask %x\n",
+		    shader.name.c_str(), double(shader.spirv.size()) / 1024, time, int(shader.pushConstantSize), bindings, shader.specializationMask);
+
+		total += time;
+		totalSize += shader.spirv.size();
+	}
+
+	printf("Reflected %d shaders (%.1f KB) in %.2f us\n", int(shaders.shaders.size()), double(totalSize) / 1024, total);
+}
+
 const Shader& ShaderSet::operator[](const char* name) const
 {
 	for (const Shader& shader : shaders)
@@ -505,24 +700,53 @@ const Shader& ShaderSet::operator[](const char* name) const
 	abort();
 }
 
-static VkSpecializationInfo fillSpecializationInfo(std::vector<VkSpecializationMapEntry>& entries, const Constants& constants)
+static bool validateConstants(const Program& program, size_t constantCount)
+{
+	uint32_t specializationMask = 0;
+	for (size_t i = 0; i < program.shaderCount; ++i)
+		specializationMask |= program.shaders[i]->specializationMask;
+
+	// constants are positional, so gaps are fine (e.g. a mesh-only program ignoring LATE), but constants past the last declared id are a mismatch
+	uint32_t declaredCount = 0;
+	for (uint32_t i = 0; i < 32; ++i)
+		if (specializationMask & (1 << i))
+			declaredCount = i + 1;
+
+	if (constantCount > declaredCount)
+	{
+		fprintf(stderr, "Error: %s declares %d specialization constants, pipeline provides %d\n", program.shaders[0]->name.c_str(), int(declaredCount), int(constantCount));
+		return false;
+	}
+
+	return true;
+}
+
+static VkSpecializationInfo fillSpecializationInfo(std::vector<VkSpecializationMapEntry>& entries, const int* constants, size_t constantCount)
 {
-	for (size_t i = 0; i < constants.size(); ++i)
+	for (size_t i = 0; i < constantCount; ++i)
 		entries.push_back({ uint32_t(i), uint32_t(i * 4), 4 });
 
 	VkSpecializationInfo result = {};
 	result.mapEntryCount = uint32_t(entries.size());
 	result.pMapEntries = entries.data();
-	result.dataSize = constants.size() * sizeof(int);
-	result.pData = constants.begin();
+	result.dataSize = constantCount * sizeof(int);
+	result.pData = constants;
 
 	return result;
 }
 
 VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, const VkPipelineRenderingCreateInfo& renderingInfo, const Program& program, Constants constants)
 {
+	return createGraphicsPipeline(device, pipelineCache, renderingInfo, program, constants.begin(), constants.size());
+}
+
+VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, const VkPipelineRenderingCreateInfo& renderingInfo, const Program& program, const int* constants, size_t constantCount)
+{
+	if (!validateConstants(program, constantCount))
+		return 0;
+
 	std::vector<VkSpecializationMapEntry> specializationEntries;
-	VkSpecializationInfo specializationInfo = fillSpecializationInfo(specializationEntries, constants);
+	VkSpecializationInfo specializationInfo = fillSpecializationInfo(specializationEntries, constants, constantCount);
 
 	VkGraphicsPipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
 
@@ -604,8 +828,17 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
 }
 
 VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, const Program& program, Constants constants)
+{
+	return createComputePipeline(device, pipelineCache, program, constants.begin(), constants.size());
+}
+
+VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, const Program& program, const int* constants, size_t constantCount)
 {
 	assert(program.shaderCount == 1);
+
+	if (!validateConstants(program, constantCount))
+		return 0;
+
 	const Shader& shader = *program.shaders[0];
 
 	assert(shader.stage == VK_SHADER_STAGE_COMPUTE_BIT);
@@ -613,7 +846,7 @@ VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache,
 	VkComputePipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
 
 	std::vector<VkSpecializationMapEntry> specializationEntries;
-	VkSpecializationInfo specializationInfo = fillSpecializationInfo(specializationEntries, constants);
+	VkSpecializationInfo specializationInfo = fillSpecializationInfo(specializationEntries, constants, constantCount);
 
 	VkShaderModuleCreateInfo module = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
 	module.codeSize = shader.spirv.size(); // note: this needs to be a number of bytes!
@@ -634,8 +867,45 @@ VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache,
 	return pipeline;
 }
 
+static bool validateProgram(Shaders shaders, size_t pushConstantSize)
+{
+	bool valid = true;
+	bool usesPushConstants = false;
+
+	for (const Shader* shader : shaders)
+	{
+		usesPushConstants |= shader->usesPushConstants;
+
+		// C++ push constant structs are alignas(16), so they can have up to 15 bytes of tail padding that the block doesn't
+		if (shader->usesPushConstants && (shader->pushConstantSize > pushConstantSize || pushConstantSize - shader->pushConstantSize >= 16))
+		{
+			fprintf(stderr, "Error: %s declares %d bytes of push constants, program provides %d\n", shader->name.c_str(), int(shader->pushConstantSize), int(pushConstantSize));
+			valid = false;
+		}
+
+		for (uint32_t i = 0; i < 32; ++i)
+			if ((shader->resourceMask & (1 << i)) && shader->resourceCounts[i] != 1)
+			{
+				// update templates reserve one DescriptorInfo per binding
+				fprintf(stderr, "Error: %s binding %d is an array of %d descriptors, push descriptors only support one per binding\n", shader->name.c_str(), int(i), int(shader->resourceCounts[i]));
+				valid = false;
+			}
+	}
+
+	if (pushConstantSize && !usesPushConstants)
+	{
+		fprintf(stderr, "Error: program provides %d bytes of push constants, but no shader declares them\n", int(pushConstantSize));
+		valid = false;
+	}
+
+	return valid;
+}
+
 Program createProgram(VkDevice device, VkPipelineBindPoint bindPoint, Shaders shaders, size_t pushConstantSize, VkDescriptorSetLayout arrayLayout)
 {
+	if (!validateProgram(shaders, pushConstantSize))
+		return Program();
+
 	VkShaderStageFlags pushConstantStages = 0;
 	for (const Shader* shader : shaders)
 		if (shader->usesPushConstants)
@@ -651,14 +921,40 @@ Program createProgram(VkDevice device, VkPipelineBindPoint bindPoint, Shaders sh
 
 	program.bindPoint = bindPoint;
 
-	program.setLayout = createSetLayout(device, shaders);
-	assert(program.setLayout);
+	LayoutKey key;
+	fillLayoutKey(key, bindPoint, shaders, pushConstantStages, pushConstantSize, arrayLayout);
+	uint64_t hash = hashLayoutKey(key);
+
+	LayoutCacheEntry* entry = nullptr;
+	for (LayoutCacheEntry& existing : gLayoutCache)
+		if (existing.hash == hash && memcmp(&existing.key, &key, sizeof(key)) == 0)
+			entry = &existing;
+
+	if (!entry)
+	{
+		LayoutCacheEntry created = {};
+		created.key = key;
+		created.hash = hash;
+
+		created.setLayout = createSetLayout(device, shaders);
+		assert(created.setLayout);
+
+		created.layout = createPipelineLayout(device, created.setLayout, arrayLayout, pushConstantStages, pushConstantSize);
+		assert(created.layout);
 
-	program.layout = createPipelineLayout(device, program.setLayout, arrayLayout, pushConstantStages, pushConstantSize);
-	assert(program.layout);
+		created.updateTemplate = createUpdateTemplate(device, bindPoint, created.layout, shaders, &created.pushDescriptorCount);
+		assert(created.updateTemplate);
+
+		gLayoutCache.push_back(created);
+		entry = &gLayoutCache.back();
+	}
 
-	program.updateTemplate = createUpdateTemplate(device, bindPoint, program.layout, shaders, &program.pushDescriptorCount);
-	assert(program.updateTemplate);
+	entry->refCount++;
+
+	program.setLayout = entry->setLayout;
+	program.layout = entry->layout;
+	program.updateTemplate = entry->updateTemplate;
+	program.pushDescriptorCount = entry->pushDescriptorCount;
 
 	program.pushConstantStages = pushConstantStages;
 	program.pushConstantSize = uint32_t(pushConstantSize);
@@ -683,9 +979,33 @@ Program createProgram(VkDevice device, VkPipelineBindPoint bindPoint, Shaders sh
 
 void destroyProgram(VkDevice device, const Program& program)
 {
-	vkDestroyDescriptorUpdateTemplate(device, program.updateTemplate, 0);
-	vkDestroyPipelineLayout(device, program.layout, 0);
-	vkDestroyDescriptorSetLayout(device, program.setLayout, 0);
+	if (!program.layout)
+		return;
+
+	for (size_t i = 0; i < gLayoutCache.size(); ++i)
+	{
+		LayoutCacheEntry& entry = gLayoutCache[i];
+		if (entry.layout != program.layout)
+			continue;
+
+		assert(entry.refCount > 0);
+		if (--entry.refCount > 0)
+			return;
+
+		vkDestroyDescriptorUpdateTemplate(device, entry.updateTemplate, 0);
+		vkDestroyPipelineLayout(device, entry.layout, 0);
+		vkDestroyDescriptorSetLayout(device, entry.setLayout, 0);
+
+		gLayoutCache.erase(gLayoutCache.begin() + i);
+		return;
+	}
+
+	assert(!"destroyProgram: program layout is not in the layout cache");
+}
+
+size_t getLayoutCacheSize()
+{
+	return gLayoutCache.size();
 }
 
 VkDescriptorSetLayout createDescriptorArrayLayout(VkDevice device)
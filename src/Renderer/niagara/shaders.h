@@ -10,8 +10,12 @@ struct Shader
 	VkShaderStageFlagBits stage;
 
 	VkDescriptorType resourceTypes[32];
+	uint32_t resourceCounts[32];
 	uint32_t resourceMask;
 
+	uint32_t pushConstantSize;
+	uint32_t specializationMask;
+
 	uint32_t localSizeX;
 	uint32_t localSizeY;
 	uint32_t localSizeZ;
@@ -50,15 +54,25 @@ bool loadShader(Shader& shader, const char* path);
 bool loadShader(Shader& shader, const char* base, const char* path);
 bool loadShaders(ShaderSet& shaders, const char* base, const char* path);
 
+// Reparses every shader in the set and prints per-shader reflection times
+void benchmarkReflection(const ShaderSet& shaders, int iterations);
+
 using Shaders = std::initializer_list<const Shader*>;
 using Constants = std::initializer_list<int>;
 
+// Pipeline creation returns a null pipeline and prints why when the constants don't match the program's specialization constants
 VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, const VkPipelineRenderingCreateInfo& renderingInfo, const Program& program, Constants constants = {});
 VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, const Program& program, Constants constants = {});
 
+VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, const VkPipelineRenderingCreateInfo& renderingInfo, const Program& program, const int* constants, size_t constantCount);
+VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, const Program& program, const int* constants, size_t constantCount);
+
+// Returns a program with a null layout and prints why when the shaders don't fit the push constant size or binding model
 Program createProgram(VkDevice device, VkPipelineBindPoint bindPoint, Shaders shaders, size_t pushConstantSize, VkDescriptorSetLayout arrayLayout = nullptr);
 void destroyProgram(VkDevice device, const Program& program);
 
+size_t getLayoutCacheSize();
+
 VkDescriptorSetLayout createDescriptorArrayLayout(VkDevice device);
 std::pair<VkDescriptorPool, VkDescriptorSet> createDescriptorArray(VkDevice device, VkDescriptorSetLayout layout, uint32_t descriptorCount);
 
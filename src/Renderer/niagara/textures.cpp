@@ -2,6 +2,7 @@
 #include "textures.h"
 
 #include "resources.h"
+#include "../../Utils/Profile.hpp"
 
 #include <stdio.h>
 
@@ -136,8 +137,10 @@ static size_t getImageSizeBC(unsigned int width, unsigned int height, unsigned i
 	return result;
 }
 
-bool loadDDSImage(Image& image, VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, const VkPhysicalDeviceMemoryProperties& memoryProperties, const Buffer& scratch, const char* path)
+bool loadDDSImage(Image& image, VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, Timeline& timeline, const VkPhysicalDeviceMemoryProperties& memoryProperties, const Buffer& scratch, const char* path)
 {
+	PROFILE_ZONE();
+
 	FILE* file = fopen(path, "rb");
 	if (!file)
 	{
@@ -264,13 +267,7 @@ bool loadDDSImage(Image& image, VkDevice device, VkCommandPool commandPool, VkCo
 
 	VK_CHECK(vkEndCommandBuffer(commandBuffer));
 
-	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
-
-	VK_CHECK(vkDeviceWaitIdle(device));
+	waitTimeline(device, timeline, submitTimeline(queue, timeline, commandBuffer));
 
 	return true;
 }
@@ -2,5 +2,6 @@
 
 struct Image;
 struct Buffer;
+struct Timeline;
 
-bool loadDDSImage(Image& image, VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, const VkPhysicalDeviceMemoryProperties& memoryProperties, const Buffer& scratch, const char* path);
+bool loadDDSImage(Image& image, VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, Timeline& timeline, const VkPhysicalDeviceMemoryProperties& memoryProperties, const Buffer& scratch, const char* path);
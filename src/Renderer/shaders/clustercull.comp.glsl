@@ -9,6 +9,7 @@
 #include "math.h"
 
 layout (constant_id = 0) const bool LATE = false;
+layout (constant_id = 1) const bool STATS = false;
 
 #define CULL TASK_CULL
 
@@ -51,6 +52,12 @@ layout(binding = 6) buffer ClusterCount
 	uint clusterCount;
 };
 
+// one entry per pass: early, late, post
+layout(binding = 7) buffer CullStatsBuffer
+{
+	CullStats cullStats[];
+};
+
 void main()
 {
 	// we convert 2D index to 1D index using a fixed *64 factor, see tasksubmit.comp.glsl
@@ -66,6 +73,8 @@ void main()
 	uint mi = mgi + command.taskOffset;
 	uint mvi = mgi + command.meshletVisibilityOffset;
 
+	uint statsPass = LATE ? 1 + min(cullData.postPass, 1) : 0;
+
 #if CULL
 	vec3 center = rotateQuat(meshlets[mi].center, meshDraw.orientation) * meshDraw.scale + meshDraw.position;
 	center = (cullData.view * vec4(center, 1)).xyz;
@@ -95,8 +104,13 @@ void main()
 			skip = true;
 	}
 
+	bool historyVisible = visible;
+
 	// backface cone culling
 	visible = visible && (cullData.clusterBackfaceEnabled == 0 || !coneCull(center, radius, cone_axis, cone_cutoff, vec3(0, 0, 0)));
+
+	bool backfaceVisible = visible;
+
 	// the left/top/right/bottom plane culling utilizes frustum symmetry to cull against two planes at the same time
 	visible = visible && center.z * cullData.frustum[1] - abs(center.x) * cullData.frustum[0] > -radius;
 	visible = visible && center.z * cullData.frustum[3] - abs(center.y) * cullData.frustum[2] > -radius;
@@ -104,6 +118,8 @@ void main()
 	// note: because we use an infinite projection matrix, this may cull meshlets that belong to a mesh that straddles the "far" plane; we could optionally remove the far check to be conservative
 	visible = visible && center.z + radius > cullData.znear && center.z - radius < cullData.zfar;
 
+	bool frustumVisible = visible;
+
 	if (LATE && cullData.clusterOcclusionEnabled == 1 && visible)
 	{
 		vec4 aabb;
@@ -137,6 +153,29 @@ void main()
 		if (index < CLUSTER_LIMIT)
 			clusterIndices[index] = commandId | (mgi << 24);
 	}
+
+	// same accounting as meshlet.task.glsl, so both paths report comparable statistics
+	if (STATS && valid)
+	{
+		atomicAdd(cullStats[statsPass].meshletsTested, 1);
+
+		// every meshlet is counted by the first test that rejected it
+		if (!historyVisible)
+			atomicAdd(cullStats[statsPass].meshletsHistoryCulled, 1);
+		else if (!backfaceVisible)
+			atomicAdd(cullStats[statsPass].meshletsBackfaceCulled, 1);
+		else if (!frustumVisible)
+			atomicAdd(cullStats[statsPass].meshletsFrustumCulled, 1);
+		else if (!visible)
+			atomicAdd(cullStats[statsPass].meshletsOcclusionCulled, 1);
+		else if (skip)
+			atomicAdd(cullStats[statsPass].meshletsAlreadyDrawn, 1);
+		else
+		{
+			atomicAdd(cullStats[statsPass].meshletsEmitted, 1);
+			atomicAdd(cullStats[statsPass].meshletTriangles, uint(meshlets[mi].triangleCount));
+		}
+	}
 #else
 	if (mgi < taskCount)
 	{
@@ -144,6 +183,13 @@ void main()
 
 		if (index < CLUSTER_LIMIT)
 			clusterIndices[index] = commandId | (mgi << 24);
+
+		if (STATS)
+		{
+			atomicAdd(cullStats[statsPass].meshletsTested, 1);
+			atomicAdd(cullStats[statsPass].meshletsEmitted, 1);
+			atomicAdd(cullStats[statsPass].meshletTriangles, uint(meshlets[mi].triangleCount));
+		}
 	}
 #endif
 }
@@ -0,0 +1,159 @@
+#version 450
+
+// Reduces the whole depth pyramid in one dispatch, see depthreduce.comp.glsl for the per mip version
+// Every workgroup reduces a 64x64 tile of mip 0 down to a single texel of mip 6 in shared memory; the last
+// workgroup to finish, found with a global atomic counter, then reduces mip 6 down to the last mip.
+// This covers 13 mips, i.e. pyramids up to 4096x4096
+
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+
+layout(push_constant) uniform block
+{
+	vec2 imageSize;
+	uint levelCount;
+	uint groupCount;
+};
+
+layout(binding = 0) uniform sampler2D depthImage;
+
+// mips past the end of the pyramid are bound to its last mip and never written
+layout(binding = 1, r32f) uniform writeonly image2D mip0;
+layout(binding = 2, r32f) uniform writeonly image2D mip1;
+layout(binding = 3, r32f) uniform writeonly image2D mip2;
+layout(binding = 4, r32f) uniform writeonly image2D mip3;
+layout(binding = 5, r32f) uniform writeonly image2D mip4;
+layout(binding = 6, r32f) uniform writeonly image2D mip5;
+layout(binding = 7, r32f) uniform coherent image2D mip6;
+layout(binding = 8, r32f) uniform writeonly image2D mip7;
+layout(binding = 9, r32f) uniform writeonly image2D mip8;
+layout(binding = 10, r32f) uniform writeonly image2D mip9;
+layout(binding = 11, r32f) uniform writeonly image2D mip10;
+layout(binding = 12, r32f) uniform writeonly image2D mip11;
+layout(binding = 13, r32f) uniform writeonly image2D mip12;
+
+// incremented by every workgroup, reset by the last one
+layout(binding = 14) coherent buffer Counter
+{
+	uint counter;
+};
+
+shared float tile[16][16];
+shared bool lastGroup;
+
+ivec2 levelSize(uint level)
+{
+	return max(ivec2(imageSize) >> int(level), ivec2(1));
+}
+
+void storeMip(uint level, ivec2 pos, float depth)
+{
+	if (level >= levelCount || any(greaterThanEqual(pos, levelSize(level))))
+		return;
+
+	switch (level)
+	{
+	case 0: imageStore(mip0, pos, vec4(depth)); break;
+	case 1: imageStore(mip1, pos, vec4(depth)); break;
+	case 2: imageStore(mip2, pos, vec4(depth)); break;
+	case 3: imageStore(mip3, pos, vec4(depth)); break;
+	case 4: imageStore(mip4, pos, vec4(depth)); break;
+	case 5: imageStore(mip5, pos, vec4(depth)); break;
+	case 6: imageStore(mip6, pos, vec4(depth)); break;
+	case 7: imageStore(mip7, pos, vec4(depth)); break;
+	case 8: imageStore(mip8, pos, vec4(depth)); break;
+	case 9: imageStore(mip9, pos, vec4(depth)); break;
+	case 10: imageStore(mip10, pos, vec4(depth)); break;
+	case 11: imageStore(mip11, pos, vec4(depth)); break;
+	case 12: imageStore(mip12, pos, vec4(depth)); break;
+	}
+}
+
+// texels past the edge of a mip repeat the edge like a clamped sampler would, so they never change the minimum
+float loadMip(uint level, ivec2 pos)
+{
+	pos = min(pos, levelSize(level) - 1);
+
+	// Sampler is set up to do min reduction, so this computes the minimum depth of a 2x2 texel quad
+	if (level == 0)
+		return texture(depthImage, (vec2(pos) + vec2(0.5)) / imageSize).x;
+	else
+		return imageLoad(mip6, pos).x;
+}
+
+// reduces the 64x64 tile of level starting at origin into levels level+1 to level+6; level 0 is also written
+void reduceTile(uint level, ivec2 origin)
+{
+	ivec2 local = ivec2(gl_LocalInvocationID.xy);
+	float depth2 = 1;
+
+	// every thread reduces 4x4 texels of level to 2x2 texels of level+1 and a single texel of level+2
+	for (int y = 0; y < 2; ++y)
+		for (int x = 0; x < 2; ++x)
+		{
+			ivec2 pos1 = local * 2 + ivec2(x, y);
+			float depth1 = 1;
+
+			for (int yy = 0; yy < 2; ++yy)
+				for (int xx = 0; xx < 2; ++xx)
+				{
+					ivec2 pos = origin + pos1 * 2 + ivec2(xx, yy);
+					float depth = loadMip(level, pos);
+
+					if (level == 0)
+						storeMip(0, pos, depth);
+
+					depth1 = min(depth1, depth);
+				}
+
+			storeMip(level + 1, (origin >> 1) + pos1, depth1);
+			depth2 = min(depth2, depth1);
+		}
+
+	storeMip(level + 2, (origin >> 2) + local, depth2);
+
+	tile[local.y][local.x] = depth2;
+	barrier();
+
+	for (uint i = 3; i <= 6; ++i)
+	{
+		int size = 16 >> (i - 2);
+		bool active = local.x < size && local.y < size;
+		float depth = 0;
+
+		if (active)
+		{
+			depth = min(min(tile[local.y * 2][local.x * 2], tile[local.y * 2][local.x * 2 + 1]), min(tile[local.y * 2 + 1][local.x * 2], tile[local.y * 2 + 1][local.x * 2 + 1]));
+			storeMip(level + i, (origin >> i) + local, depth);
+		}
+
+		barrier(); // all reads of tile
+		if (active)
+			tile[local.y][local.x] = depth;
+		barrier(); // all writes of tile
+	}
+}
+
+void main()
+{
+	reduceTile(0, ivec2(gl_WorkGroupID.xy) * 64);
+
+	if (levelCount <= 7)
+		return;
+
+	// the thread that wrote this group's mip 6 texel makes it visible before counting the group as done
+	if (gl_LocalInvocationIndex == 0)
+	{
+		memoryBarrierImage();
+		lastGroup = atomicAdd(counter, 1) == groupCount - 1;
+	}
+
+	barrier(); // for lastGroup
+
+	if (!lastGroup)
+		return;
+
+	if (gl_LocalInvocationIndex == 0)
+		counter = 0;
+
+	reduceTile(6, ivec2(0));
+}
@@ -9,6 +9,7 @@
 
 layout (constant_id = 0) const bool LATE = false;
 layout (constant_id = 1) const bool TASK = true;
+layout (constant_id = 2) const bool STATS = false;
 
 layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
 
@@ -49,6 +50,18 @@ layout(binding = 4) buffer DrawVisibility
 
 layout(binding = 5) uniform sampler2D depthPyramid;
 
+// one entry per pass: early, late, post
+layout(binding = 6) buffer CullStatsBuffer
+{
+	CullStats cullStats[];
+};
+
+// one bit per draw, set for draws the CPU occlusion buffer hid this frame
+layout(binding = 7) readonly buffer CpuOcclusion
+{
+	uint cpuOcclusion[];
+};
+
 void main()
 {
 	uint di = gl_GlobalInvocationID.x;
@@ -61,9 +74,18 @@ void main()
 	if (drawData.postPass != cullData.postPass)
 		return;
 
+	uint statsPass = LATE ? 1 + min(cullData.postPass, 1) : 0;
+
+	if (STATS)
+		atomicAdd(cullStats[statsPass].drawsTested, 1);
+
 	// TODO: when occlusion culling is off, can we make sure everything is processed with LATE=false?
 	if (!LATE && drawVisibility[di] == 0)
+	{
+		if (STATS)
+			atomicAdd(cullStats[statsPass].drawsHistoryCulled, 1);
 		return;
+	}
 
 	uint meshIndex = drawData.meshIndex;
 	Mesh mesh = meshes[meshIndex];
@@ -81,6 +103,14 @@ void main()
 
 	visible = visible || cullData.cullingEnabled == 0;
 
+	if (STATS && !visible)
+		atomicAdd(cullStats[statsPass].drawsFrustumCulled, 1);
+
+	bool frustumVisible = visible;
+
+	if (visible && cullData.cpuOcclusionEnabled == 1)
+		visible = (cpuOcclusion[di >> 5] & (1u << (di & 31))) == 0;
+
 	if (LATE && visible && cullData.occlusionEnabled == 1)
 	{
 		vec4 aabb;
@@ -102,6 +132,9 @@ void main()
 		}
 	}
 
+	if (STATS && frustumVisible && !visible)
+		atomicAdd(cullStats[statsPass].drawsOcclusionCulled, 1);
+
 	// when meshlet occlusion culling is enabled, we actually *do* need to append the draw command if vis[]==1 in LATE pass,
 	// so that we can correctly render now-visible previously-invisible meshlets. we also pass drawvis[] along to task shader
 	// so that it can *reject* clusters that we *did* draw in the first pass
@@ -121,6 +154,14 @@ void main()
 
 		MeshLod lod = meshes[meshIndex].lods[lodIndex];
 
+		if (STATS)
+		{
+			atomicAdd(cullStats[statsPass].drawsEmitted, 1);
+			atomicAdd(cullStats[statsPass].drawMeshlets, lod.meshletCount);
+			atomicAdd(cullStats[statsPass].drawTriangles, lod.indexCount / 3);
+			atomicAdd(cullStats[statsPass].drawLods[lodIndex], 1);
+		}
+
 		if (TASK)
 		{
 			uint taskGroups = (lod.meshletCount + TASK_WGSIZE - 1) / TASK_WGSIZE;
@@ -141,6 +182,10 @@ void main()
 					taskCommands[dci + i].meshletVisibilityOffset = meshletVisibilityOffset + i * TASK_WGSIZE;
 				}
 			}
+			else if (STATS)
+			{
+				atomicAdd(cullStats[statsPass].drawsDropped, 1);
+			}
 		}
 		else
 		{
@@ -154,6 +199,10 @@ void main()
 			drawCommands[dci].firstInstance = 0;
 		}
 	}
+	else if (STATS && visible)
+	{
+		atomicAdd(cullStats[statsPass].drawsAlreadyDrawn, 1);
+	}
 
 	if (LATE)
 		drawVisibility[di] = visible ? 1 : 0;
@@ -39,6 +39,7 @@ struct CullData
 	int occlusionEnabled;
 	int clusterOcclusionEnabled;
 	int clusterBackfaceEnabled;
+	int cpuOcclusionEnabled;           // skip draws marked in the CPU occlusion mask, see OcclusionBuffer
 
 	uint postPass;
 };
@@ -120,3 +121,28 @@ struct MeshTaskPayload
 {
 	uint clusterIndices[TASK_WGSIZE];
 };
+
+struct CullStats
+{
+	// draw culling; draws of the pass that reached the tests
+	uint drawsTested;
+	uint drawsHistoryCulled;   // early pass: not visible last frame, left to the late pass
+	uint drawsFrustumCulled;
+	uint drawsOcclusionCulled;
+	uint drawsAlreadyDrawn;    // late pass: still visible, but rendered by the early pass
+	uint drawsEmitted;
+	uint drawsDropped;         // emitted, but dropped because task commands overflowed
+	uint drawMeshlets;         // meshlets in the selected LODs of emitted draws
+	uint drawTriangles;        // triangles in the selected LODs of emitted draws
+	uint drawLods[8];          // emitted draws per selected LOD
+
+	// meshlet culling in task shader; meshlets of emitted draws
+	uint meshletsTested;
+	uint meshletsHistoryCulled;
+	uint meshletsBackfaceCulled;
+	uint meshletsFrustumCulled;
+	uint meshletsOcclusionCulled;
+	uint meshletsAlreadyDrawn;
+	uint meshletsEmitted;
+	uint meshletTriangles;     // triangles in emitted meshlets
+};
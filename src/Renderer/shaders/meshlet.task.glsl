@@ -10,6 +10,7 @@
 #include "math.h"
 
 layout (constant_id = 0) const bool LATE = false;
+layout (constant_id = 3) const bool STATS = false;
 
 #define CULL TASK_CULL
 
@@ -42,6 +43,12 @@ layout(binding = 5) buffer MeshletVisibility
 
 layout(binding = 6) uniform sampler2D depthPyramid;
 
+// one entry per pass: early, late, post
+layout(binding = 9) buffer CullStatsBuffer
+{
+	CullStats cullStats[];
+};
+
 taskPayloadSharedEXT MeshTaskPayload payload;
 
 #if CULL
@@ -63,6 +70,8 @@ void main()
 	uint mi = mgi + command.taskOffset;
 	uint mvi = mgi + command.meshletVisibilityOffset;
 
+	uint statsPass = LATE ? 1 + min(globals.cullData.postPass, 1) : 0;
+
 #if CULL
 	sharedCount = 0;
 	barrier(); // for sharedCount
@@ -97,8 +106,13 @@ void main()
 			skip = true;
 	}
 
+	bool historyVisible = visible;
+
 	// backface cone culling
 	visible = visible && (cullData.clusterBackfaceEnabled == 0 || !coneCull(center, radius, cone_axis, cone_cutoff, vec3(0, 0, 0)));
+
+	bool backfaceVisible = visible;
+
 	// the left/top/right/bottom plane culling utilizes frustum symmetry to cull against two planes at the same time
 	visible = visible && center.z * cullData.frustum[1] - abs(center.x) * cullData.frustum[0] > -radius;
 	visible = visible && center.z * cullData.frustum[3] - abs(center.y) * cullData.frustum[2] > -radius;
@@ -106,6 +120,8 @@ void main()
 	// note: because we use an infinite projection matrix, this may cull meshlets that belong to a mesh that straddles the "far" plane; we could optionally remove the far check to be conservative
 	visible = visible && center.z + radius > cullData.znear && center.z - radius < cullData.zfar;
 
+	bool frustumVisible = visible;
+
 	if (LATE && cullData.clusterOcclusionEnabled == 1 && visible)
 	{
 		vec4 aabb;
@@ -139,11 +155,40 @@ void main()
 		payload.clusterIndices[index] = commandId | (mgi << 24);
 	}
 
+	if (STATS && valid)
+	{
+		atomicAdd(cullStats[statsPass].meshletsTested, 1);
+
+		// every meshlet is counted by the first test that rejected it
+		if (!historyVisible)
+			atomicAdd(cullStats[statsPass].meshletsHistoryCulled, 1);
+		else if (!backfaceVisible)
+			atomicAdd(cullStats[statsPass].meshletsBackfaceCulled, 1);
+		else if (!frustumVisible)
+			atomicAdd(cullStats[statsPass].meshletsFrustumCulled, 1);
+		else if (!visible)
+			atomicAdd(cullStats[statsPass].meshletsOcclusionCulled, 1);
+		else if (skip)
+			atomicAdd(cullStats[statsPass].meshletsAlreadyDrawn, 1);
+		else
+		{
+			atomicAdd(cullStats[statsPass].meshletsEmitted, 1);
+			atomicAdd(cullStats[statsPass].meshletTriangles, uint(meshlets[mi].triangleCount));
+		}
+	}
+
 	barrier(); // for sharedCount
 	EmitMeshTasksEXT(sharedCount, 1, 1);
 #else
 	payload.clusterIndices[gl_LocalInvocationID.x] = commandId | (mgi << 24);
 
+	if (STATS && mgi < taskCount)
+	{
+		atomicAdd(cullStats[statsPass].meshletsTested, 1);
+		atomicAdd(cullStats[statsPass].meshletsEmitted, 1);
+		atomicAdd(cullStats[statsPass].meshletTriangles, uint(meshlets[mi].triangleCount));
+	}
+
 	EmitMeshTasksEXT(taskCount, 1, 1);
 #endif
 }
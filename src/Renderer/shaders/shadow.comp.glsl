@@ -0,0 +1,115 @@
+#version 460
+
+#extension GL_EXT_ray_query: require
+#extension GL_GOOGLE_include_directive: require
+
+#include "math.h"
+
+// 0: one ray to the center of the sun; 1: rays spread over the sun disk
+layout (constant_id = 0) const int QUALITY = 0;
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+struct ShadowData
+{
+	vec3 sunDirection;
+	float sunJitter;
+
+	mat4 inverseViewProjection;
+
+	vec2 imageSize;
+	uint checkerboard;
+};
+
+layout(push_constant) uniform block
+{
+	ShadowData shadowData;
+};
+
+layout(binding = 0, r8) uniform writeonly image2D outImage;
+
+layout(binding = 1) uniform sampler2D depthImage;
+layout(binding = 2) uniform sampler2D gbufferImage1;
+
+layout(binding = 3) uniform accelerationStructureEXT tlas;
+
+const int HQ_RAYS = 4;
+
+bool shadowTrace(vec3 origin, vec3 dir)
+{
+	// only the presence of a hit matters, so the first one found ends the traversal
+	rayQueryEXT rq;
+	rayQueryInitializeEXT(rq, tlas, gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT, 0xff, origin, 1e-3, dir, 1e3);
+	rayQueryProceedEXT(rq);
+
+	return rayQueryGetIntersectionTypeEXT(rq, true) != gl_RayQueryCommittedIntersectionNoneEXT;
+}
+
+void main()
+{
+	uvec2 pos = gl_GlobalInvocationID.xy;
+
+	// checkerboard traces every other pixel of a row, shifted by one on odd rows; shadowfill.comp fills in the rest
+	if (shadowData.checkerboard != 0)
+		pos.x = pos.x * 2 + (pos.y & 1);
+
+	if (pos.x >= uint(shadowData.imageSize.x) || pos.y >= uint(shadowData.imageSize.y))
+		return;
+
+	vec2 uv = (vec2(pos) + 0.5) / shadowData.imageSize;
+
+	float depth = texelFetch(depthImage, ivec2(pos), 0).r;
+
+	// nothing was rendered here
+	if (depth == 0)
+	{
+		imageStore(outImage, ivec2(pos), vec4(1));
+		return;
+	}
+
+	vec3 normal = decodeOct(texelFetch(gbufferImage1, ivec2(pos), 0).rg * 2 - 1);
+
+	// surfaces facing away from the sun aren't lit either way
+	if (dot(normal, shadowData.sunDirection) <= 0)
+	{
+		imageStore(outImage, ivec2(pos), vec4(0));
+		return;
+	}
+
+	vec4 clip = vec4(uv.x * 2 - 1, 1 - uv.y * 2, depth, 1);
+	vec4 wposh = shadowData.inverseViewProjection * clip;
+	vec3 wpos = wposh.xyz / wposh.w;
+
+	// reconstructed positions get less precise with distance; w is the reciprocal of view depth
+	float viewDepth = 1 / wposh.w;
+	vec3 origin = wpos + normal * (1e-2 + viewDepth * 1e-3);
+
+	float shadow = 0;
+
+	if (QUALITY == 0)
+	{
+		shadow = shadowTrace(origin, shadowData.sunDirection) ? 0 : 1;
+	}
+	else
+	{
+		vec3 tangent = normalize(cross(shadowData.sunDirection, abs(shadowData.sunDirection.y) < 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0)));
+		vec3 bitangent = cross(shadowData.sunDirection, tangent);
+
+		// spiral over the sun disk, rotated per pixel so that the blur averages different samples
+		float rotation = gradientNoise(vec2(pos)) * 6.2831853;
+
+		for (int i = 0; i < HQ_RAYS; ++i)
+		{
+			float radius = sqrt((float(i) + 0.5) / float(HQ_RAYS)) * shadowData.sunJitter;
+			float angle = float(i) * 2.3999632 + rotation;
+
+			vec3 dir = normalize(shadowData.sunDirection + (tangent * cos(angle) + bitangent * sin(angle)) * radius);
+
+			shadow += shadowTrace(origin, dir) ? 0 : 1;
+		}
+
+		shadow /= float(HQ_RAYS);
+	}
+
+	imageStore(outImage, ivec2(pos), vec4(shadow));
+}
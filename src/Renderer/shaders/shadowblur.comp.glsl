@@ -0,0 +1,56 @@
+#version 450
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(push_constant) uniform block
+{
+	vec4 blurData; // image size, blur direction
+};
+
+layout(binding = 0, r8) uniform writeonly image2D outImage;
+
+layout(binding = 1) uniform sampler2D shadowImage;
+layout(binding = 2) uniform sampler2D depthImage;
+
+const int KERNEL_RADIUS = 4;
+
+void main()
+{
+	uvec2 pos = gl_GlobalInvocationID.xy;
+
+	ivec2 size = ivec2(blurData.xy);
+	ivec2 direction = ivec2(blurData.zw);
+
+	if (pos.x >= size.x || pos.y >= size.y)
+		return;
+
+	float depth = texelFetch(depthImage, ivec2(pos), 0).r;
+
+	if (depth == 0)
+	{
+		imageStore(outImage, ivec2(pos), vec4(1));
+		return;
+	}
+
+	float shadow = 0;
+	float weight = 0;
+
+	// separable gaussian that ignores samples from other surfaces, so shadows don't bleed across depth discontinuities
+	for (int i = -KERNEL_RADIUS; i <= KERNEL_RADIUS; ++i)
+	{
+		ivec2 sp = clamp(ivec2(pos) + direction * i, ivec2(0), size - 1);
+
+		float sampleShadow = texelFetch(shadowImage, sp, 0).r;
+		float sampleDepth = texelFetch(depthImage, sp, 0).r;
+
+		// depth is znear / z, so the relative difference matches the relative difference of view depths
+		float depthWeight = max(1 - abs(sampleDepth - depth) / (depth * 0.05), 0);
+		float gaussWeight = exp2(-float(i * i) / float(KERNEL_RADIUS * KERNEL_RADIUS));
+
+		shadow += sampleShadow * depthWeight * gaussWeight;
+		weight += depthWeight * gaussWeight;
+	}
+
+	// the center sample always has full weight
+	imageStore(outImage, ivec2(pos), vec4(shadow / weight));
+}
@@ -0,0 +1,65 @@
+#version 450
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(push_constant) uniform block
+{
+	vec4 fillData; // image size, unused
+};
+
+layout(binding = 0, r8) uniform image2D shadowImage;
+
+layout(binding = 1) uniform sampler2D depthImage;
+
+void main()
+{
+	uvec2 pos = gl_GlobalInvocationID.xy;
+
+	// pixels shadow.comp skipped in checkerboard mode; their horizontal and vertical neighbours were traced
+	pos.x = pos.x * 2 + ((pos.y + 1) & 1);
+
+	ivec2 size = ivec2(fillData.xy);
+
+	if (pos.x >= size.x || pos.y >= size.y)
+		return;
+
+	float depth = texelFetch(depthImage, ivec2(pos), 0).r;
+
+	if (depth == 0)
+	{
+		imageStore(shadowImage, ivec2(pos), vec4(1));
+		return;
+	}
+
+	const ivec2 offsets[4] = ivec2[](ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1));
+
+	float shadow = 0;
+	float weight = 0;
+	float fallback = 0;
+	int count = 0;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		ivec2 sp = ivec2(pos) + offsets[i];
+
+		// pixels on the border have fewer neighbours
+		if (sp.x < 0 || sp.y < 0 || sp.x >= size.x || sp.y >= size.y)
+			continue;
+
+		float sampleShadow = imageLoad(shadowImage, sp).r;
+		float sampleDepth = texelFetch(depthImage, sp, 0).r;
+
+		// depth is znear / z, so the relative difference matches the relative difference of view depths
+		float sampleWeight = max(1 - abs(sampleDepth - depth) / (depth * 0.05), 0);
+
+		shadow += sampleShadow * sampleWeight;
+		weight += sampleWeight;
+		fallback += sampleShadow;
+		count++;
+	}
+
+	// thin features may have no neighbour on the same surface
+	shadow = weight > 1e-3 ? shadow / weight : fallback / max(count, 1);
+
+	imageStore(shadowImage, ivec2(pos), vec4(shadow));
+}
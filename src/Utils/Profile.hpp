@@ -0,0 +1,51 @@
+#pragma once
+/// Tracy instrumentation macros. Enabled by the GAMEENGINE_PROFILE CMake option; otherwise every macro
+/// expands to nothing and Tracy headers aren't included.
+
+#if GAMEENGINE_PROFILE
+
+#include <volk.h>
+
+#include <tracy/Tracy.hpp>
+#include <tracy/TracyVulkan.hpp>
+
+#include <string.h>
+
+/// GPU timing context of a queue, see PROFILE_GPU_CONTEXT_CREATE
+typedef TracyVkCtx ProfileGpuContext;
+
+/// Times the enclosing scope on the CPU under the function name.
+#define PROFILE_ZONE() ZoneScoped
+/// Times the enclosing scope on the CPU under a string literal.
+#define PROFILE_ZONE_NAMED(name) ZoneScopedN(name)
+/// Times the enclosing scope on the CPU under a name only known at runtime.
+#define PROFILE_ZONE_TRANSIENT(name) ZoneTransientN(___tracy_transient_zone, name, true)
+/// Marks the end of a frame.
+#define PROFILE_FRAME() FrameMark
+/// Names the calling thread; the name is copied.
+#define PROFILE_THREAD_NAME(name) tracy::SetThreadName(name)
+
+/// Creates a GPU context; submits to the queue and waits, so only call it during initialization.
+#define PROFILE_GPU_CONTEXT_CREATE(physicalDevice, device, queue, commandBuffer) TracyVkContext(physicalDevice, device, queue, commandBuffer)
+#define PROFILE_GPU_CONTEXT_DESTROY(context) TracyVkDestroy(context)
+/// Records the readback of completed GPU zones; must be recorded outside of rendering once per frame.
+#define PROFILE_GPU_COLLECT(context, commandBuffer) TracyVkCollect(context, commandBuffer)
+/// Times the commands recorded into commandBuffer in the enclosing scope under a name only known at runtime.
+#define PROFILE_GPU_ZONE_TRANSIENT(context, commandBuffer, name) TracyVkZoneTransient(context, ___tracy_gpu_zone, commandBuffer, name, true)
+
+#else
+
+typedef void* ProfileGpuContext;
+
+#define PROFILE_ZONE()
+#define PROFILE_ZONE_NAMED(name)
+#define PROFILE_ZONE_TRANSIENT(name)
+#define PROFILE_FRAME()
+#define PROFILE_THREAD_NAME(name)
+
+#define PROFILE_GPU_CONTEXT_CREATE(physicalDevice, device, queue, commandBuffer) nullptr
+#define PROFILE_GPU_CONTEXT_DESTROY(context)
+#define PROFILE_GPU_COLLECT(context, commandBuffer)
+#define PROFILE_GPU_ZONE_TRANSIENT(context, commandBuffer, name)
+
+#endif
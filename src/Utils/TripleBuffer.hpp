@@ -0,0 +1,58 @@
+#pragma once
+/// Lock-free single producer / single consumer triple buffer for handing snapshots between threads.
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Three slots shared by one writer and one reader. The writer fills its private slot and publishes it
+ * by swapping it with the shared middle slot; the reader swaps the middle slot with its own when a new one
+ * was published. Neither side ever waits for the other, and the reader always sees the latest complete value.
+ * @tparam T Snapshot type; slots are reused, so large members keep their allocations between publishes
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    /**
+     * Gets the slot owned by the writer. Only valid on the writer thread until the next publish().
+     * @return Slot to fill with the next snapshot
+     */
+    T& write() { return m_slots[m_writeIndex]; }
+
+    /**
+     * Makes the writer slot the latest snapshot and hands the writer a free slot.
+     * The new writer slot holds a stale snapshot that has to be overwritten.
+     */
+    void publish() {
+        uint32_t previous = m_middle.exchange(m_writeIndex | kFreshBit, std::memory_order_acq_rel);
+        m_writeIndex = previous & kIndexMask;
+    }
+
+    /**
+     * Takes the latest published snapshot, if there is one the reader hasn't seen yet.
+     * @return True if read() now returns a newer snapshot
+     */
+    bool consume() {
+        if (!(m_middle.load(std::memory_order_relaxed) & kFreshBit))
+            return false;
+
+        uint32_t previous = m_middle.exchange(m_readIndex, std::memory_order_acq_rel);
+        m_readIndex = previous & kIndexMask;
+        return true;
+    }
+
+    /**
+     * Gets the slot owned by the reader. Only valid on the reader thread until the next consume().
+     * @return Latest consumed snapshot
+     */
+    const T& read() const { return m_slots[m_readIndex]; }
+
+private:
+    static constexpr uint32_t kIndexMask = 3;
+    static constexpr uint32_t kFreshBit = 4;
+
+    T m_slots[3] = {};
+    uint32_t m_writeIndex = 0;
+    uint32_t m_readIndex = 1;
+    std::atomic<uint32_t> m_middle = 2;
+};
@@ -0,0 +1,47 @@
+#pragma once
+/// Minimal command line helpers for the engine's developer modes (benchmarks, dumps).
+
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * Checks whether a flag is present on the command line.
+ * @param argc Number of command line arguments
+ * @param argv Array of command line argument strings
+ * @param name Flag to look for, e.g. "--headless"
+ * @return True if the flag was passed
+ */
+inline bool hasArg(int argc, const char* const* argv, const char* name) {
+    for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[i], name) == 0)
+            return true;
+    return false;
+}
+
+/**
+ * Gets the value following a flag, e.g. "--frames 100".
+ * @param argc Number of command line arguments
+ * @param argv Array of command line argument strings
+ * @param name Flag to look for
+ * @param fallback Value returned when the flag or its value is missing
+ * @return Flag value or fallback
+ */
+inline const char* getArg(int argc, const char* const* argv, const char* name, const char* fallback = nullptr) {
+    for (int i = 1; i + 1 < argc; ++i)
+        if (std::strcmp(argv[i], name) == 0)
+            return argv[i + 1];
+    return fallback;
+}
+
+/**
+ * Gets the integer value following a flag.
+ * @param argc Number of command line arguments
+ * @param argv Array of command line argument strings
+ * @param name Flag to look for
+ * @param fallback Value returned when the flag or its value is missing
+ * @return Flag value or fallback
+ */
+inline int getArgInt(int argc, const char* const* argv, const char* name, int fallback) {
+    const char* value = getArg(argc, argv, name);
+    return value ? std::atoi(value) : fallback;
+}
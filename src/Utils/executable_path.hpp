@@ -0,0 +1,43 @@
+#pragma once
+/// Locates files that live next to the executable, independent of the working directory.
+
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach-o/dyld.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * Gets the directory containing the running executable.
+ * @return Directory with a trailing separator, or an empty string (the working directory) if it can't be determined
+ */
+inline std::string getExecutableDirectory() {
+    char path[4096];
+
+#ifdef _WIN32
+    DWORD length = GetModuleFileNameA(nullptr, path, sizeof(path));
+    if (length == 0 || length == sizeof(path))
+        return std::string();
+#elif defined(__APPLE__)
+    uint32_t size = sizeof(path);
+    if (_NSGetExecutablePath(path, &size) != 0)
+        return std::string();
+    size_t length = std::strlen(path);
+#else
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path));
+    if (length <= 0 || size_t(length) == sizeof(path))
+        return std::string();
+#endif
+
+    std::string result(path, size_t(length));
+    std::string::size_type pos = result.find_last_of("/\\");
+    return pos == std::string::npos ? std::string() : result.substr(0, pos + 1);
+}
@@ -0,0 +1,29 @@
+#pragma once
+/// Fork-join helper for splitting CPU work of a frame across the executor's workers.
+
+#include "tmc/ex_cpu.hpp"
+#include "tmc/sync.hpp"
+
+#include <cstdint>
+#include <future>
+#include <vector>
+
+/**
+ * Runs jobs 1..jobCount-1 on the executor and job 0 on the calling thread, then waits for all of them.
+ * Jobs must not wait for other jobs, so that blocked workers can't starve the executor.
+ * @param executor Executor running the other jobs; may be null when jobCount is 1
+ * @param jobCount Number of jobs
+ * @param job Callable taking the job index
+ */
+template <typename Job>
+inline void runJobs(tmc::ex_cpu* executor, uint32_t jobCount, const Job& job) {
+    std::vector<std::future<void>> futures;
+    for (uint32_t i = 1; i < jobCount; ++i)
+        futures.push_back(tmc::post_waitable(*executor, [&job, i]() { job(i); }, 0));
+
+    if (jobCount)
+        job(0);
+
+    for (std::future<void>& future : futures)
+        future.wait();
+}
@@ -3,6 +3,7 @@
 /// that demonstrate switching tasks between executors.
 
 #include "tmc/ex_cpu.hpp"
+#include "Profile.hpp"
 
 #include <sstream>
 #include <string>
@@ -22,17 +23,20 @@ inline thread_local size_t threadId{};
 inline void hookInitExCpuThreadName(tmc::ex_cpu& Executor) {
     Executor.set_thread_init_hook([](size_t Slot) {
         this_thread::threadName = std::string("cpu thread ") + std::to_string(Slot);
+        PROFILE_THREAD_NAME(this_thread::threadName.c_str());
     });
 }
 
 /**
  * Sets up thread ID initialization hook for CPU executor threads.
+ * Also names the thread in profiler captures.
  * This must be called before calling init() on the executor.
  * @param Executor The CPU executor to set up the hook for
  */
 inline void hookInitExCpuThreadId(tmc::ex_cpu& Executor) {
     Executor.set_thread_init_hook([](size_t Slot) {
         this_thread::threadId = Slot;
+        PROFILE_THREAD_NAME((std::string("cpu thread ") + std::to_string(Slot)).c_str());
     });
 }
 
@@ -1,8 +1,14 @@
 #define TMC_IMPL
 
+#include "Renderer/Benchmark.h"
+#include "Renderer/CpuCull.h"
+#include "Renderer/DrawBvh.h"
+#include "Renderer/InstanceManager.h"
+#include "Renderer/OcclusionBuffer.h"
 #include "Renderer/Renderer.h"
 #include "tmc/ex_cpu.hpp"
 #include "Utils/thread_name.hpp"
+#include "Utils/command_line.hpp"
 
 #ifdef WIN32
 /**
@@ -28,18 +34,195 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 int main(int __argc, const char** __argv)
 #endif
 {
+    // developer modes that don't need a window or a device
+    if (hasArg(__argc, __argv, "--bench-reflection"))
+    {
+        ShaderSet shaders;
+        if (!loadShaders(shaders, "", "shaders/"))
+            return 1;
+
+        benchmarkReflection(shaders, getArgInt(__argc, __argv, "--iterations", 1000));
+        return 0;
+    }
+
+    if (hasArg(__argc, __argv, "--dump-render-graph"))
+    {
+        dumpFrameGraph(getArgInt(__argc, __argv, "--frames", 2));
+        return 0;
+    }
+
+    // --bench-instances spawns, despawns and moves --spawns N of --draws N draws every frame, 5000 of 100k by default
+    if (hasArg(__argc, __argv, "--bench-instances"))
+        return benchmarkInstances(uint32_t(getArgInt(__argc, __argv, "--draws", 0)), uint32_t(getArgInt(__argc, __argv, "--spawns", 0)), getArgInt(__argc, __argv, "--iterations", 100)) ? 0 : 1;
+
+    PROFILE_THREAD_NAME("render thread");
+
     tmc::ex_cpu executor;
     hookInitExCpuThreadId(executor);
     executor.init();
 
-    Renderer renderer;
+    // --bench-cull culls synthetic scenes on the CPU with every SIMD kernel; --draws N replaces the default 100k and 1M draws
+    if (hasArg(__argc, __argv, "--bench-cull"))
+        return benchmarkCpuCull(uint32_t(getArgInt(__argc, __argv, "--draws", 0)), executor, getArgInt(__argc, __argv, "--iterations", 20)) ? 0 : 1;
+
+    // --bench-occlusion rasterizes synthetic occluders on the CPU and tests --draws N draws against them, 100k by default
+    if (hasArg(__argc, __argv, "--bench-occlusion"))
+        return benchmarkOcclusion(uint32_t(getArgInt(__argc, __argv, "--draws", 0)), executor, getArgInt(__argc, __argv, "--iterations", 20)) ? 0 : 1;
+
+    // --bench-bvh checks draw BVH queries against brute force before and after refits, on --draws N draws or a few sizes up to 100k
+    if (hasArg(__argc, __argv, "--bench-bvh"))
+        return benchmarkDrawBvh(uint32_t(getArgInt(__argc, __argv, "--draws", 0)), executor, getArgInt(__argc, __argv, "--iterations", 20)) ? 0 : 1;
+
+    // --headless WxH renders a fixed number of frames offscreen, e.g. on a software Vulkan implementation in CI
+    unsigned int headlessWidth = 0, headlessHeight = 0;
+    if (const char* headless = getArg(__argc, __argv, "--headless"))
+    {
+        if (sscanf(headless, "%ux%u", &headlessWidth, &headlessHeight) != 2 || headlessWidth == 0 || headlessHeight == 0)
+        {
+            printf("Error: expected --headless WIDTHxHEIGHT, got %s\n", headless);
+            return 1;
+        }
+    }
+
+    // --rt-lods 0,2,4 builds BLASes for these LODs and lets distant TLAS instances reference the coarser ones;
+    // without 0, meshes are traced at their most detailed listed LOD at best. --cull-stats N also prints the savings
+    uint32_t rayTracingLods = 1;
+    if (const char* lods = getArg(__argc, __argv, "--rt-lods"))
+    {
+        rayTracingLods = 0;
+
+        for (const char* lod = lods; ; )
+        {
+            char* end = nullptr;
+            unsigned long index = strtoul(lod, &end, 10);
+
+            if (end == lod || index >= 8 || (*end && *end != ','))
+            {
+                printf("Error: expected --rt-lods with comma separated LOD indices below 8, got %s\n", lods);
+                return 1;
+            }
+
+            rayTracingLods |= 1u << index;
+
+            if (!*end)
+                break;
+
+            lod = end + 1;
+        }
+    }
+
+    Renderer renderer(&executor, headlessWidth, headlessHeight, rayTracingLods);
 
-    while (!shouldQuit(renderer.m_gfxDevice))
+    // --pipeline-stats N prints per-pass pipeline statistics every N frames
+    renderer.m_pipelineStatsInterval = uint32_t(getArgInt(__argc, __argv, "--pipeline-stats", 0));
+
+    // --cull-stats N counts draws and meshlets rejected by every culling test and prints them every N frames;
+    // --cull-stats-json path.json also rewrites the file with them, every 300 frames unless --cull-stats is given
+    renderer.m_cullStatsInterval = uint32_t(getArgInt(__argc, __argv, "--cull-stats", 0));
+    if (const char* cullStatsPath = getArg(__argc, __argv, "--cull-stats-json"))
+    {
+        renderer.m_cullStatsPath = cullStatsPath;
+        if (!renderer.m_cullStatsInterval)
+            renderer.m_cullStatsInterval = 300;
+    }
+    renderer.m_cullStatsEnabled = renderer.m_cullStatsInterval != 0;
+
+    // --pyramid single reduces the depth pyramid in one dispatch; alternate switches every frame, so that
+    // --gpu-profile or --benchmark report "pyramid per mip" and "pyramid single pass" times side by side
+    if (const char* pyramid = getArg(__argc, __argv, "--pyramid"))
+    {
+        if (strcmp(pyramid, "mip") == 0)
+            renderer.m_pyramidMode = Pyramid_PerMip;
+        else if (strcmp(pyramid, "single") == 0)
+            renderer.m_pyramidMode = Pyramid_SinglePass;
+        else if (strcmp(pyramid, "alternate") == 0)
+            renderer.m_pyramidMode = Pyramid_Alternate;
+        else
+        {
+            printf("Error: expected --pyramid mip|single|alternate, got %s\n", pyramid);
+            return 1;
+        }
+    }
+
+    // --meshlet-cull cluster culls meshlets in compute passes and renders them without task shaders instead of the
+    // default task; --gpu-profile and --benchmark report the cluster passes under their own names
+    if (const char* meshletCull = getArg(__argc, __argv, "--meshlet-cull"))
+    {
+        if (strcmp(meshletCull, "task") == 0)
+            renderer.m_meshletCull = MeshletCull_Task;
+        else if (strcmp(meshletCull, "cluster") == 0)
+            renderer.m_meshletCull = MeshletCull_Cluster;
+        else
+        {
+            printf("Error: expected --meshlet-cull task|cluster, got %s\n", meshletCull);
+            return 1;
+        }
+    }
+
+    // --cpu-occlusion rasterizes the largest opaque draws on worker threads every frame and skips the draws they hide
+    // before GPU culling; --cull-stats counts those as occlusion culled
+    renderer.m_cpuOcclusion = hasArg(__argc, __argv, "--cpu-occlusion");
+
+    // --shadows off|low|high picks the ray traced sun shadow quality; low traces a checkerboard of pixels and fills in
+    // the rest, which --shadow-checkerboard 0|1 overrides. --gpu-profile reports "shadow lq" or "shadow hq" separately
+    if (const char* shadows = getArg(__argc, __argv, "--shadows"))
+    {
+        if (strcmp(shadows, "off") == 0)
+            renderer.m_shadowQuality = Shadow_Off;
+        else if (strcmp(shadows, "low") == 0)
+            renderer.m_shadowQuality = Shadow_Low;
+        else if (strcmp(shadows, "high") == 0)
+            renderer.m_shadowQuality = Shadow_High;
+        else
+        {
+            printf("Error: expected --shadows off|low|high, got %s\n", shadows);
+            return 1;
+        }
+
+        renderer.m_shadowCheckerboard = renderer.m_shadowQuality == Shadow_Low;
+    }
+    renderer.m_shadowCheckerboard = getArgInt(__argc, __argv, "--shadow-checkerboard", renderer.m_shadowCheckerboard) != 0;
+
+    // --gpu-profile path.json rewrites the per-pass GPU timing table every --gpu-profile-interval frames
+    if (const char* profilePath = getArg(__argc, __argv, "--gpu-profile"))
+        renderer.m_profiler.setDump(profilePath, uint32_t(getArgInt(__argc, __argv, "--gpu-profile-interval", 300)));
+
+    int result = 0;
+
+    // --benchmark path.json plays a recorded camera path for --frames frames and reports frame time statistics
+    if (const char* cameraPath = getArg(__argc, __argv, "--benchmark"))
+    {
+        Benchmark benchmark;
+        if (benchmark.run(renderer, cameraPath, getArgInt(__argc, __argv, "--frames", 1000)))
+        {
+            benchmark.print();
+
+            if (const char* csv = getArg(__argc, __argv, "--csv"))
+                result |= !benchmark.writeCsv(csv);
+            if (const char* json = getArg(__argc, __argv, "--json"))
+                result |= !benchmark.writeJson(json);
+        }
+        else
+        {
+            result = 1;
+        }
+    }
+    else if (renderer.m_gfxDevice.m_headless)
+    {
+        int frames = getArgInt(__argc, __argv, "--frames", 100);
+
+        for (int frame = 0; frame < frames; ++frame)
+            renderer.draw();
+    }
+    else
     {
-        renderer.draw();
+        while (!shouldQuit(renderer.m_gfxDevice))
+        {
+            renderer.draw();
+        }
     }
 
     renderer.cleanup();
     
-    return 0;
+    return result;
 }
\ No newline at end of file